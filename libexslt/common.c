@@ -2,6 +2,7 @@
 #include "libexslt/libexslt.h"
 
 #include <libxml/tree.h>
+#include <libxml/hash.h>
 #include <libxml/xpath.h>
 #include <libxml/xpathInternals.h>
 
@@ -102,6 +103,151 @@ exsltObjectTypeFunction (xmlXPathParserContextPtr ctxt, int nargs) {
     valuePush(ctxt, ret);
 }
 
+/**
+ * exsltGroupBy:
+ * @ctxt:  an XPath parser context
+ * @nodes:  a node-set
+ * @comp:  the expression computing the key of a node
+ *
+ * Keeps the first node of @nodes for each string value of @comp
+ * evaluated with that node as context node.
+ *
+ * Returns the first node of each group, @nodes itself if it is empty,
+ * or NULL in case of error.
+ */
+static xmlNodeSetPtr
+exsltGroupBy(xmlXPathParserContextPtr ctxt, xmlNodeSetPtr nodes,
+             xmlXPathCompExprPtr comp) {
+    xmlXPathContextPtr xpctxt = ctxt->context;
+    xmlNodeSetPtr ret;
+    xmlHashTablePtr groups;
+    xmlXPathObjectPtr obj;
+    xmlNodePtr oldNode, cur;
+    xmlDocPtr oldDoc;
+    int oldContextSize, oldProximityPosition;
+    int i, res;
+    xmlChar *key;
+
+    if (xmlXPathNodeSetIsEmpty(nodes))
+        return(nodes);
+
+    ret = xmlXPathNodeSetCreate(NULL);
+    if (ret == NULL)
+        return(NULL);
+    groups = xmlHashCreate(nodes->nodeNr);
+    if (groups == NULL) {
+        xmlXPathFreeNodeSet(ret);
+        return(NULL);
+    }
+
+    oldDoc = xpctxt->doc;
+    oldNode = xpctxt->node;
+    oldContextSize = xpctxt->contextSize;
+    oldProximityPosition = xpctxt->proximityPosition;
+
+    for (i = 0; i < nodes->nodeNr; i++) {
+        cur = nodes->nodeTab[i];
+        xpctxt->node = cur;
+        if (cur->type == XML_NAMESPACE_DECL)
+            cur = (xmlNodePtr) ((xmlNsPtr) cur)->next;
+        xpctxt->doc = (cur != NULL) ? cur->doc : oldDoc;
+        xpctxt->contextSize = nodes->nodeNr;
+        xpctxt->proximityPosition = i + 1;
+        obj = xmlXPathCompiledEval(comp, xpctxt);
+        if (obj == NULL) {
+            xmlXPathFreeNodeSet(ret);
+            ret = NULL;
+            break;
+        }
+        key = xmlXPathCastToString(obj);
+        xmlXPathFreeObject(obj);
+        if (key == NULL) {
+            xmlXPathFreeNodeSet(ret);
+            ret = NULL;
+            break;
+        }
+        /* Only the first node of a group is added. */
+        res = 0;
+        if (xmlHashLookup(groups, key) == NULL) {
+            res = xmlHashAddEntry(groups, key, nodes->nodeTab[i]);
+            if (res == 0)
+                res = xmlXPathNodeSetAddUnique(ret, nodes->nodeTab[i]);
+        }
+        xmlFree(key);
+        if (res < 0) {
+            xmlXPathFreeNodeSet(ret);
+            ret = NULL;
+            break;
+        }
+    }
+
+    xpctxt->doc = oldDoc;
+    xpctxt->node = oldNode;
+    xpctxt->contextSize = oldContextSize;
+    xpctxt->proximityPosition = oldProximityPosition;
+    xmlHashFree(groups, NULL);
+    return(ret);
+}
+
+/**
+ * exsltGroupByFunction:
+ * @ctxt:  an XPath parser context
+ * @nargs:  the number of arguments
+ *
+ * Implements exsl:group-by(node-set, string): returns the first node of
+ * each group of nodes with the same string value of the expression given
+ * as second argument, evaluated with each node as context node. The
+ * nodes are grouped in one pass over a hash table.
+ */
+static void
+exsltGroupByFunction (xmlXPathParserContextPtr ctxt, int nargs) {
+    xmlXPathObjectPtr obj;
+    xmlXPathCompExprPtr comp;
+    xmlNodeSetPtr ns, ret;
+    xmlChar *expr;
+    int boolval = 0;
+    void *user = NULL;
+
+    if (nargs != 2) {
+	xmlXPathSetArityError(ctxt);
+	return;
+    }
+
+    expr = xmlXPathPopString(ctxt);
+    if (xmlXPathCheckError(ctxt))
+        return;
+    comp = xmlXPathCtxtCompile(ctxt->context, expr);
+    xmlFree(expr);
+    if (comp == NULL) {
+        xmlXPathSetError(ctxt, XPATH_EXPR_ERROR);
+        return;
+    }
+
+    if (ctxt->value != NULL) {
+        boolval = ctxt->value->boolval;
+	user = ctxt->value->user;
+	ctxt->value->boolval = 0;
+	ctxt->value->user = NULL;
+    }
+    ns = xmlXPathPopNodeSet(ctxt);
+    if (xmlXPathCheckError(ctxt)) {
+        xmlXPathFreeCompExpr(comp);
+	return;
+    }
+
+    ret = exsltGroupBy(ctxt, ns, comp);
+    xmlXPathFreeCompExpr(comp);
+
+    if (ret != ns)
+	xmlXPathFreeNodeSet(ns);
+
+    obj = xmlXPathWrapNodeSet(ret);
+    if (obj != NULL) {
+        obj->user = user;
+        obj->boolval = boolval;
+    }
+    valuePush(ctxt, obj);
+}
 
 /**
  * exsltCommonRegister:
@@ -117,6 +263,9 @@ exsltCommonRegister (void) {
     xsltRegisterExtModuleFunction((const xmlChar *) "object-type",
 				  EXSLT_COMMON_NAMESPACE,
 				  exsltObjectTypeFunction);
+    xsltRegisterExtModuleFunction((const xmlChar *) "group-by",
+				  EXSLT_COMMON_NAMESPACE,
+				  exsltGroupByFunction);
     xsltRegisterExtModuleElement((const xmlChar *) "document",
 				 EXSLT_COMMON_NAMESPACE,
 				 xsltDocumentComp,
@@ -23,9 +23,13 @@
 #define IN_LIBEXSLT
 #include "libexslt/libexslt.h"
 
+#include <stdio.h>
+#include <string.h>
+
 #include <libxml/tree.h>
 #include <libxml/xpath.h>
 #include <libxml/xpathInternals.h>
+#include <libxml/hash.h>
 
 #include <libxslt/xsltutils.h>
 #include <libxslt/xsltInternals.h>
@@ -33,6 +37,254 @@
 
 #include "exslt.h"
 
+/*
+ * Maximum number of compiled expressions kept per transformation.
+ */
+#define EXSLT_DYN_CACHE_MAX 512
+
+/*
+ * A compiled expression of the cache. The function calls of an
+ * expression are bound to the namespaces in scope at its first
+ * evaluation, so the expression string is keyed together with a hash
+ * of the namespace bindings of the calling instruction.
+ */
+typedef struct _exsltDynCompExpr exsltDynCompExpr;
+struct _exsltDynCompExpr {
+    exsltDynCompExpr *prev;	/* more recently used */
+    exsltDynCompExpr *next;	/* less recently used */
+    xmlChar *str;		/* the expression */
+    xmlChar nsKey[24];		/* the namespace context */
+    xmlXPathCompExprPtr comp;
+    int busy;			/* number of running evaluations */
+    int cached;			/* owned by the cache */
+};
+
+typedef struct _exsltDynData exsltDynData;
+struct _exsltDynData {
+    xmlHashTablePtr exprs;	/* exsltDynCompExpr by string and nsKey */
+    exsltDynCompExpr *first;	/* most recently used */
+    exsltDynCompExpr *last;	/* least recently used */
+    int nbExprs;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+};
+
+/**
+ * exsltDynInit:
+ * @ctxt: an XSLT transformation context
+ * @URI: the namespace URI for the extension
+ *
+ * Initializes the EXSLT - Dynamic module for a transformation.
+ *
+ * Returns the data for this transformation
+ */
+static void *
+exsltDynInit (xsltTransformContextPtr ctxt ATTRIBUTE_UNUSED,
+	      const xmlChar *URI ATTRIBUTE_UNUSED) {
+    exsltDynData *ret;
+
+    ret = (exsltDynData *) xmlMalloc(sizeof(exsltDynData));
+    if (ret == NULL) {
+	xsltGenericError(xsltGenericErrorContext,
+			 "exsltDynInit: not enough memory\n");
+	return(NULL);
+    }
+    memset(ret, 0, sizeof(exsltDynData));
+    ret->exprs = xmlHashCreate(0);
+    if (ret->exprs == NULL) {
+	xmlFree(ret);
+	return(NULL);
+    }
+    return(ret);
+}
+
+static void
+exsltDynFreeCompExpr(void *payload, const xmlChar *name ATTRIBUTE_UNUSED) {
+    exsltDynCompExpr *expr = (exsltDynCompExpr *) payload;
+
+    xmlXPathFreeCompExpr(expr->comp);
+    if (expr->str != NULL)
+	xmlFree(expr->str);
+    xmlFree(expr);
+}
+
+/**
+ * exsltDynShutdown:
+ * @ctxt: an XSLT transformation context
+ * @URI: the namespace URI for the extension
+ * @data: the module data to free up
+ *
+ * Shutdown the EXSLT - Dynamic module
+ */
+static void
+exsltDynShutdown (xsltTransformContextPtr ctxt ATTRIBUTE_UNUSED,
+		  const xmlChar *URI ATTRIBUTE_UNUSED,
+		  void *vdata) {
+    exsltDynData *data = (exsltDynData *) vdata;
+
+    if (data == NULL)
+	return;
+    if ((data->hits != 0) || (data->misses != 0))
+	xsltGenericDebug(xsltGenericDebugContext,
+			 "exsltDynShutdown: expression cache: %lu hits, "
+			 "%lu misses, %lu evictions\n",
+			 data->hits, data->misses, data->evictions);
+    xmlHashFree(data->exprs, exsltDynFreeCompExpr);
+    xmlFree(data);
+}
+
+/**
+ * exsltDynUnlink:
+ * @data:  the module data
+ * @expr:  an expression of the cache
+ *
+ * Removes @expr from the list of expressions in use order.
+ */
+static void
+exsltDynUnlink(exsltDynData *data, exsltDynCompExpr *expr) {
+    if (expr->prev != NULL)
+	expr->prev->next = expr->next;
+    else
+	data->first = expr->next;
+    if (expr->next != NULL)
+	expr->next->prev = expr->prev;
+    else
+	data->last = expr->prev;
+    expr->prev = expr->next = NULL;
+}
+
+/**
+ * exsltDynNsKey:
+ * @ctxt:  an XPath context
+ * @key:  a buffer of 24 bytes receiving the key
+ *
+ * Computes a key identifying the namespace bindings in scope.
+ */
+static void
+exsltDynNsKey(xmlXPathContextPtr ctxt, xmlChar *key) {
+    unsigned long long h = 14695981039346656037ULL;
+    const xmlChar *cur;
+    int i;
+
+    for (i = 0; (ctxt->namespaces != NULL) && (i < ctxt->nsNr); i++) {
+	xmlNsPtr ns = ctxt->namespaces[i];
+
+	for (cur = ns->prefix; (cur != NULL) && (*cur != 0); cur++)
+	    h = (h ^ *cur) * 1099511628211ULL;
+	h = (h ^ 1) * 1099511628211ULL;
+	for (cur = ns->href; (cur != NULL) && (*cur != 0); cur++)
+	    h = (h ^ *cur) * 1099511628211ULL;
+	h = (h ^ 2) * 1099511628211ULL;
+    }
+    snprintf((char *) key, 24, "%016llx:%d", h, ctxt->nsNr & 0xFFFF);
+}
+
+/**
+ * exsltDynCompile:
+ * @ctxt:  an XPath parser context
+ * @str:  the expression
+ *
+ * Compiles @str in the context of the calling instruction, reusing the
+ * result of a previous compilation if possible. The returned
+ * expression must be released with exsltDynRelease().
+ *
+ * Returns the compiled expression or NULL in case of error.
+ */
+static exsltDynCompExpr *
+exsltDynCompile(xmlXPathParserContextPtr ctxt, const xmlChar *str) {
+    xsltTransformContextPtr tctxt = xsltXPathGetTransformContext(ctxt);
+    exsltDynData *data = NULL;
+    exsltDynCompExpr *expr, *victim;
+    xmlChar nsKey[24];
+
+    if (tctxt != NULL)
+	data = (exsltDynData *) xsltGetExtData(tctxt,
+					       EXSLT_DYNAMIC_NAMESPACE);
+    exsltDynNsKey(ctxt->context, nsKey);
+
+    if (data != NULL) {
+	expr = (exsltDynCompExpr *) xmlHashLookup2(data->exprs, str, nsKey);
+	/*
+	 * An expression evaluating itself is compiled again, so that
+	 * runaway recursion is still reported while parsing it.
+	 */
+	if ((expr != NULL) && (expr->busy == 0)) {
+	    data->hits++;
+	    if (expr != data->first) {
+		exsltDynUnlink(data, expr);
+		expr->next = data->first;
+		data->first->prev = expr;
+		data->first = expr;
+	    }
+	    expr->busy++;
+	    return(expr);
+	}
+	data->misses++;
+    }
+
+    expr = (exsltDynCompExpr *) xmlMalloc(sizeof(exsltDynCompExpr));
+    if (expr == NULL)
+	return(NULL);
+    memset(expr, 0, sizeof(exsltDynCompExpr));
+    expr->comp = xmlXPathCtxtCompile(ctxt->context, str);
+    if (expr->comp == NULL) {
+	xmlFree(expr);
+	return(NULL);
+    }
+    expr->busy = 1;
+    if ((data == NULL) ||
+        (xmlHashLookup2(data->exprs, str, nsKey) != NULL))
+	return(expr);
+
+    /*
+     * Evict the least recently used expressions which aren't running.
+     */
+    victim = data->last;
+    while ((data->nbExprs >= EXSLT_DYN_CACHE_MAX) && (victim != NULL)) {
+	exsltDynCompExpr *prev = victim->prev;
+
+	if (victim->busy == 0) {
+	    exsltDynUnlink(data, victim);
+	    xmlHashRemoveEntry2(data->exprs, victim->str, victim->nsKey,
+				exsltDynFreeCompExpr);
+	    data->nbExprs--;
+	    data->evictions++;
+	}
+	victim = prev;
+    }
+
+    memcpy(expr->nsKey, nsKey, sizeof(nsKey));
+    expr->str = xmlStrdup(str);
+    if ((expr->str == NULL) ||
+        (xmlHashAddEntry2(data->exprs, str, expr->nsKey, expr) < 0))
+	return(expr);
+    expr->cached = 1;
+    expr->next = data->first;
+    if (data->first != NULL)
+	data->first->prev = expr;
+    else
+	data->last = expr;
+    data->first = expr;
+    data->nbExprs++;
+    return(expr);
+}
+
+/**
+ * exsltDynRelease:
+ * @expr:  an expression returned by exsltDynCompile()
+ *
+ * Signals the end of an evaluation of @expr.
+ */
+static void
+exsltDynRelease(exsltDynCompExpr *expr) {
+    if (expr == NULL)
+	return;
+    expr->busy--;
+    if ((expr->busy == 0) && (!expr->cached))
+	exsltDynFreeCompExpr(expr, NULL);
+}
+
 /**
  * exsltDynEvaluateFunction:
  * @ctxt:  an XPath parser context
@@ -47,6 +299,7 @@ static void
 exsltDynEvaluateFunction(xmlXPathParserContextPtr ctxt, int nargs) {
 	xmlChar *str = NULL;
 	xmlXPathObjectPtr ret = NULL;
+	exsltDynCompExpr *expr;
 
 	if (ctxt == NULL)
 		return;
@@ -70,7 +323,11 @@ exsltDynEvaluateFunction(xmlXPathParserContextPtr ctxt, int nargs) {
          */
         ctxt->context->depth += 5;
 #endif
-	ret = xmlXPathEval(str,ctxt->context);
+	expr = exsltDynCompile(ctxt, str);
+	if (expr != NULL) {
+		ret = xmlXPathCompiledEval(expr->comp, ctxt->context);
+		exsltDynRelease(expr);
+	}
 #if LIBXML_VERSION >= 20911
         ctxt->context->depth -= 5;
 #endif
@@ -101,6 +358,7 @@ exsltDynMapFunction(xmlXPathParserContextPtr ctxt, int nargs)
     xmlChar *str = NULL;
     xmlNodeSetPtr nodeset = NULL;
     xsltTransformContextPtr tctxt;
+    exsltDynCompExpr *expr = NULL;
     xmlXPathCompExprPtr comp = NULL;
     xmlXPathObjectPtr ret = NULL;
     xmlDocPtr oldDoc, container = NULL;
@@ -137,8 +395,9 @@ exsltDynMapFunction(xmlXPathParserContextPtr ctxt, int nargs)
     }
 
     if (str == NULL || !xmlStrlen(str) ||
-        !(comp = xmlXPathCtxtCompile(tctxt->xpathCtxt, str)))
+        !(expr = exsltDynCompile(ctxt, str)))
         goto cleanup;
+    comp = expr->comp;
 
     oldDoc = ctxt->context->doc;
     oldNode = ctxt->context->node;
@@ -267,8 +526,8 @@ exsltDynMapFunction(xmlXPathParserContextPtr ctxt, int nargs)
 
   cleanup:
     /* restore the xpath context */
-    if (comp != NULL)
-        xmlXPathFreeCompExpr(comp);
+    if (expr != NULL)
+        exsltDynRelease(expr);
     if (nodeset != NULL)
         xmlXPathFreeNodeSet(nodeset);
     if (str != NULL)
@@ -286,6 +545,9 @@ exsltDynMapFunction(xmlXPathParserContextPtr ctxt, int nargs)
 
 void
 exsltDynRegister (void) {
+    xsltRegisterExtModule (EXSLT_DYNAMIC_NAMESPACE,
+			   exsltDynInit,
+			   exsltDynShutdown);
     xsltRegisterExtModuleFunction ((const xmlChar *) "evaluate",
 				   EXSLT_DYNAMIC_NAMESPACE,
 				   exsltDynEvaluateFunction);
@@ -1,6 +1,7 @@
 #define IN_LIBEXSLT
 #include "libexslt/libexslt.h"
 
+#include <stdio.h>
 #include <string.h>
 
 #include <libxml/tree.h>
@@ -15,6 +16,7 @@
 #include <libxslt/extensions.h>
 #include <libxslt/transform.h>
 #include <libxslt/imports.h>
+#include <libxslt/extra.h>
 
 #include "exslt.h"
 
@@ -22,14 +24,29 @@ typedef struct _exsltFuncFunctionData exsltFuncFunctionData;
 struct _exsltFuncFunctionData {
     int nargs;			/* number of arguments to the function */
     xmlNodePtr content;		/* the func:fuction template content */
+    int memoize;		/* libxslt:memoize="yes": the result only
+				   depends on the arguments */
 };
 
+/*
+ * Maximum number of results kept by the memoization cache of a
+ * transformation before it is flushed.
+ */
+#define EXSLT_FUNC_MEMO_MAX 4096
+
 typedef struct _exsltFuncData exsltFuncData;
 struct _exsltFuncData {
     xmlHashTablePtr funcs;	/* pointer to the stylesheet module data */
     xmlXPathObjectPtr result;	/* returned by func:result */
     xsltStackElemPtr ctxtVar;   /* context variable */
     int error;			/* did an error occur? */
+    const xmlChar *lastURI;	/* the last function called */
+    const xmlChar *lastName;
+    exsltFuncFunctionData *lastFunc;
+    xmlHashTablePtr memo;	/* results of memoized functions */
+    int memoNr;			/* number of entries in memo */
+    unsigned long memoHits;
+    unsigned long memoMisses;
 };
 
 typedef struct _exsltFuncResultPreComp exsltFuncResultPreComp;
@@ -171,6 +188,78 @@ exsltFuncInit (xsltTransformContextPtr ctxt, const xmlChar *URI) {
     return(ret);
 }
 
+static void
+exsltFuncFreeMemoEntry(void *payload, const xmlChar *name ATTRIBUTE_UNUSED) {
+    xmlXPathFreeObject((xmlXPathObjectPtr) payload);
+}
+
+/**
+ * exsltFuncMemoKey:
+ * @ctxt:  an XPath parser context
+ * @nargs:  the number of arguments on the value stack
+ *
+ * Builds the key identifying the arguments of a call in the
+ * memoization cache.
+ *
+ * Returns the key or NULL if an argument isn't a string, a number or
+ *         a boolean.
+ */
+static xmlChar *
+exsltFuncMemoKey(xmlXPathParserContextPtr ctxt, int nargs) {
+    static const char hex[] = "0123456789abcdef";
+    xmlXPathObjectPtr obj;
+    xmlChar *ret, *cur;
+    size_t len = 1;
+    int i, j;
+
+    if (ctxt->valueNr < nargs)
+        return(NULL);
+    for (i = ctxt->valueNr - nargs; i < ctxt->valueNr; i++) {
+        obj = ctxt->valueTab[i];
+        switch (obj->type) {
+            case XPATH_STRING:
+                len += 12 + xmlStrlen(obj->stringval);
+                break;
+            case XPATH_NUMBER:
+                len += 1 + 2 * sizeof(double);
+                break;
+            case XPATH_BOOLEAN:
+                len += 2;
+                break;
+            default:
+                return(NULL);
+        }
+    }
+
+    ret = cur = (xmlChar *) xmlMalloc(len);
+    if (ret == NULL)
+        return(NULL);
+    for (i = ctxt->valueNr - nargs; i < ctxt->valueNr; i++) {
+        obj = ctxt->valueTab[i];
+        if (obj->type == XPATH_STRING) {
+            int slen = xmlStrlen(obj->stringval);
+
+            cur += snprintf((char *) cur, 12, "s%d:", slen);
+            memcpy(cur, obj->stringval, slen);
+            cur += slen;
+        } else if (obj->type == XPATH_NUMBER) {
+            unsigned char bits[sizeof(double)];
+
+            memcpy(bits, &obj->floatval, sizeof(double));
+            *cur++ = 'n';
+            for (j = 0; j < (int) sizeof(double); j++) {
+                *cur++ = hex[bits[j] >> 4];
+                *cur++ = hex[bits[j] & 15];
+            }
+        } else {
+            *cur++ = 'b';
+            *cur++ = obj->boolval ? '1' : '0';
+        }
+    }
+    *cur = 0;
+    return(ret);
+}
+
 /**
  * exsltFuncShutdown:
  * @ctxt: an XSLT transformation context
@@ -189,6 +278,12 @@ exsltFuncShutdown (xsltTransformContextPtr ctxt ATTRIBUTE_UNUSED,
     if (data != NULL) {
         if (data->result != NULL)
             xmlXPathFreeObject(data->result);
+        if ((data->memoHits != 0) || (data->memoMisses != 0))
+            xsltGenericDebug(xsltGenericDebugContext,
+                             "exsltFuncShutdown: memoized calls: %lu hits, "
+                             "%lu misses\n", data->memoHits, data->memoMisses);
+        if (data->memo != NULL)
+            xmlHashFree(data->memo, exsltFuncFreeMemoEntry);
         xmlFree(data);
     }
 }
@@ -295,6 +390,7 @@ exsltFuncFunctionFunction (xmlXPathParserContextPtr ctxt, int nargs) {
     xsltTransformContextPtr tctxt = xsltXPathGetTransformContext(ctxt);
     int i;
     xmlXPathObjectPtr *args = NULL;
+    xmlChar *memoKey = NULL;
 
     /*
      * retrieve func:function template
@@ -304,9 +400,20 @@ exsltFuncFunctionFunction (xmlXPathParserContextPtr ctxt, int nargs) {
     oldResult = data->result;
     data->result = NULL;
 
-    func = (exsltFuncFunctionData*) xmlHashLookup2 (data->funcs,
-						    ctxt->context->functionURI,
-						    ctxt->context->function);
+    if ((data->lastFunc != NULL) &&
+        (xmlStrEqual(ctxt->context->function, data->lastName)) &&
+        (xmlStrEqual(ctxt->context->functionURI, data->lastURI))) {
+        func = data->lastFunc;
+    } else {
+        func = (exsltFuncFunctionData*) xmlHashLookup2 (data->funcs,
+                                                ctxt->context->functionURI,
+                                                ctxt->context->function);
+        if (func != NULL) {
+            data->lastFunc = func;
+            data->lastName = ctxt->context->function;
+            data->lastURI = ctxt->context->functionURI;
+        }
+    }
     if (func == NULL) {
         /* Should never happen */
         xsltGenericError(xsltGenericErrorContext,
@@ -338,6 +445,28 @@ exsltFuncFunctionFunction (xmlXPathParserContextPtr ctxt, int nargs) {
 	return;
     }
 
+    /*
+     * Memoized functions: look up the result for the same arguments.
+     */
+    if (func->memoize) {
+        memoKey = exsltFuncMemoKey(ctxt, nargs);
+        if ((memoKey != NULL) && (data->memo != NULL)) {
+            ret = (xmlXPathObjectPtr) xmlHashLookup3(data->memo, memoKey,
+                    ctxt->context->function, ctxt->context->functionURI);
+            if (ret != NULL) {
+                data->memoHits++;
+                data->result = oldResult;
+                for (i = 0; i < nargs; i++)
+                    xmlXPathFreeObject(valuePop(ctxt));
+                xmlFree(memoKey);
+                valuePush(ctxt, xmlXPathObjectCopy(ret));
+                return;
+            }
+        }
+        if (memoKey != NULL)
+            data->memoMisses++;
+    }
+
     /*
     * When a function is called recursively during evaluation of its
     * arguments, the recursion check in xsltApplySequenceConstructor
@@ -480,9 +609,30 @@ exsltFuncFunctionFunction (xmlXPathParserContextPtr ctxt, int nargs) {
         xmlXPathFreeObject(ret);
 	goto error;
     }
+    if ((memoKey != NULL) && (tctxt->state == XSLT_STATE_OK) &&
+        ((ret->type == XPATH_STRING) || (ret->type == XPATH_NUMBER) ||
+         (ret->type == XPATH_BOOLEAN))) {
+        xmlXPathObjectPtr copy;
+
+        if ((data->memo != NULL) && (data->memoNr >= EXSLT_FUNC_MEMO_MAX)) {
+            xmlHashFree(data->memo, exsltFuncFreeMemoEntry);
+            data->memo = NULL;
+            data->memoNr = 0;
+        }
+        if (data->memo == NULL)
+            data->memo = xmlHashCreate(0);
+        copy = xmlXPathObjectCopy(ret);
+        if ((data->memo == NULL) || (copy == NULL) ||
+            (xmlHashAddEntry3(data->memo, memoKey, ctxt->context->function,
+                              ctxt->context->functionURI, copy) < 0))
+            xmlXPathFreeObject(copy);
+        else
+            data->memoNr++;
+    }
     valuePush(ctxt, ret);
 
 error:
+    xmlFree(memoKey);
     xmlFree(args);
     xmlFreeNode(fake);
     tctxt->depth--;
@@ -535,6 +685,22 @@ exsltFuncFunctionComp (xsltStylesheetPtr style, xmlNodePtr inst) {
         xmlFree(name);
         return;
     }
+    {
+	xmlChar *memoize;
+
+	memoize = xmlGetNsProp(inst, (const xmlChar *) "memoize",
+			       XSLT_LIBXSLT_NAMESPACE);
+	if (memoize != NULL) {
+	    if (xmlStrEqual(memoize, (const xmlChar *) "yes"))
+		func->memoize = 1;
+	    else if (!xmlStrEqual(memoize, (const xmlChar *) "no")) {
+		xsltTransformError(NULL, style, inst,
+		    "func:function: libxslt:memoize must be 'yes' or 'no'\n");
+		style->errors++;
+	    }
+	    xmlFree(memoize);
+	}
+    }
     func->content = inst->children;
     while (IS_XSLT_ELEM(func->content) &&
 	   IS_XSLT_NAME(func->content, "param")) {
@@ -11,6 +11,397 @@
 
 #include "exslt.h"
 
+#include <string.h>
+
+/*
+ * Above this product of the sizes of the arguments, set:difference
+ * and set:intersection use a hash of the nodes of the second argument
+ * instead of scanning it for every node of the first one.
+ */
+#define EXSLT_SETS_LINEAR_MAX 4096
+
+/*
+ * An open addressing hash table of nodes or strings.
+ */
+typedef struct _exsltSetsHash exsltSetsHash;
+struct _exsltSetsHash {
+    size_t mask;
+    const void **keys;
+    unsigned int *hashes;
+    xmlChar **owned;		/* strings to free with the table */
+    int nbOwned;
+    int maxOwned;
+};
+
+static int
+exsltSetsHashInit(exsltSetsHash *hash, int count) {
+    size_t size = 16;
+
+    memset(hash, 0, sizeof(exsltSetsHash));
+    while (size < 2 * (size_t) count)
+        size *= 2;
+    hash->mask = size - 1;
+    hash->keys = (const void **) xmlMalloc(size * sizeof(void *));
+    hash->hashes = (unsigned int *) xmlMalloc(size * sizeof(unsigned int));
+    if ((hash->keys == NULL) || (hash->hashes == NULL)) {
+        xmlFree(hash->keys);
+        xmlFree(hash->hashes);
+        return(-1);
+    }
+    memset(hash->keys, 0, size * sizeof(void *));
+    return(0);
+}
+
+static void
+exsltSetsHashCleanup(exsltSetsHash *hash) {
+    int i;
+
+    for (i = 0; i < hash->nbOwned; i++)
+        xmlFree(hash->owned[i]);
+    xmlFree(hash->owned);
+    xmlFree(hash->keys);
+    xmlFree(hash->hashes);
+}
+
+static unsigned int
+exsltSetsHashString(const xmlChar *str) {
+    unsigned int h = 2166136261u;
+
+    while (*str != 0)
+        h = (h ^ *str++) * 16777619u;
+    return(h);
+}
+
+/*
+ * Namespace nodes are copies, they are identified by their parent
+ * element and their prefix like xmlXPathNodeSetContains() does.
+ */
+static unsigned int
+exsltSetsHashNode(xmlNodePtr node) {
+    size_t h = (size_t) node;
+
+    if ((node->type == XML_NAMESPACE_DECL) &&
+        (((xmlNsPtr) node)->next != NULL)) {
+        xmlNsPtr ns = (xmlNsPtr) node;
+
+        h = (size_t) ns->next;
+        if (ns->prefix != NULL)
+            h ^= exsltSetsHashString(ns->prefix);
+    }
+    return((unsigned int) ((h >> 4) * 2654435761u));
+}
+
+static int
+exsltSetsNodeEqual(xmlNodePtr node1, xmlNodePtr node2) {
+    xmlNsPtr ns1, ns2;
+
+    if (node1 == node2)
+        return(1);
+    if ((node1->type != XML_NAMESPACE_DECL) ||
+        (node2->type != XML_NAMESPACE_DECL))
+        return(0);
+    ns1 = (xmlNsPtr) node1;
+    ns2 = (xmlNsPtr) node2;
+    return((ns1->next != NULL) && (ns2->next == ns1->next) &&
+           (xmlStrEqual(ns1->prefix, ns2->prefix)));
+}
+
+/**
+ * exsltSetsHashNodes:
+ * @hash:  the table to fill
+ * @nodes:  a node-set
+ *
+ * Initializes @hash with the nodes of @nodes.
+ *
+ * Returns 0 in case of success, -1 otherwise.
+ */
+static int
+exsltSetsHashNodes(exsltSetsHash *hash, xmlNodeSetPtr nodes) {
+    unsigned int h;
+    size_t i;
+    int j;
+
+    if (exsltSetsHashInit(hash, nodes->nodeNr) < 0)
+        return(-1);
+    for (j = 0; j < nodes->nodeNr; j++) {
+        h = exsltSetsHashNode(nodes->nodeTab[j]);
+        for (i = h & hash->mask; hash->keys[i] != NULL;
+             i = (i + 1) & hash->mask) {
+            if ((hash->hashes[i] == h) &&
+                (exsltSetsNodeEqual((xmlNodePtr) hash->keys[i],
+                                    nodes->nodeTab[j])))
+                break;
+        }
+        hash->keys[i] = nodes->nodeTab[j];
+        hash->hashes[i] = h;
+    }
+    return(0);
+}
+
+static int
+exsltSetsHashContains(exsltSetsHash *hash, xmlNodePtr node) {
+    unsigned int h = exsltSetsHashNode(node);
+    size_t i;
+
+    for (i = h & hash->mask; hash->keys[i] != NULL;
+         i = (i + 1) & hash->mask) {
+        if ((hash->hashes[i] == h) &&
+            (exsltSetsNodeEqual((xmlNodePtr) hash->keys[i], node)))
+            return(1);
+    }
+    return(0);
+}
+
+/**
+ * exsltSetsHashAddString:
+ * @hash:  a table of strings
+ * @str:  the string to add
+ * @owned:  whether @str must be freed with the table
+ *
+ * Adds @str to @hash unless an equal string is already there. An owned
+ * string which isn't added is freed.
+ *
+ * Returns 1 if @str was added, 0 if it was already there, -1 in case
+ * of error.
+ */
+static int
+exsltSetsHashAddString(exsltSetsHash *hash, xmlChar *str, int owned) {
+    unsigned int h = exsltSetsHashString(str);
+    size_t i;
+
+    for (i = h & hash->mask; hash->keys[i] != NULL;
+         i = (i + 1) & hash->mask) {
+        if ((hash->hashes[i] == h) &&
+            (xmlStrEqual((const xmlChar *) hash->keys[i], str))) {
+            if (owned)
+                xmlFree(str);
+            return(0);
+        }
+    }
+    if (owned) {
+        if (hash->nbOwned >= hash->maxOwned) {
+            int size = hash->maxOwned ? 2 * hash->maxOwned : 16;
+            xmlChar **tmp;
+
+            tmp = (xmlChar **) xmlRealloc(hash->owned,
+                                          size * sizeof(xmlChar *));
+            if (tmp == NULL) {
+                xmlFree(str);
+                return(-1);
+            }
+            hash->owned = tmp;
+            hash->maxOwned = size;
+        }
+        hash->owned[hash->nbOwned++] = str;
+    }
+    hash->keys[i] = str;
+    hash->hashes[i] = h;
+    return(1);
+}
+
+/**
+ * exsltSetsStringValue:
+ * @node:  a node
+ * @owned:  set to 1 if the result must be freed
+ *
+ * Returns the string value of @node, without copying it when the node
+ * holds it as is.
+ */
+static xmlChar *
+exsltSetsStringValue(xmlNodePtr node, int *owned) {
+    xmlNodePtr text = NULL;
+
+    switch (node->type) {
+        case XML_TEXT_NODE:
+        case XML_CDATA_SECTION_NODE:
+        case XML_COMMENT_NODE:
+        case XML_PI_NODE:
+            text = node;
+            break;
+        case XML_ELEMENT_NODE:
+        case XML_ATTRIBUTE_NODE:
+            if ((node->children != NULL) &&
+                (node->children->next == NULL) &&
+                ((node->children->type == XML_TEXT_NODE) ||
+                 (node->children->type == XML_CDATA_SECTION_NODE)))
+                text = node->children;
+            break;
+        default:
+            break;
+    }
+    if ((text != NULL) && (text->content != NULL)) {
+        *owned = 0;
+        return(text->content);
+    }
+    *owned = 1;
+    return(xmlXPathCastNodeToString(node));
+}
+
+/**
+ * exsltSetsDifference:
+ * @nodes1:  a node-set
+ * @nodes2:  a node-set
+ *
+ * Same as xmlXPathDifference() in linear time for large node-sets.
+ *
+ * Returns the nodes of @nodes1 which aren't in @nodes2, @nodes1 if
+ * @nodes2 is empty, or NULL in case of error.
+ */
+static xmlNodeSetPtr
+exsltSetsDifference(xmlNodeSetPtr nodes1, xmlNodeSetPtr nodes2) {
+    xmlNodeSetPtr ret;
+    exsltSetsHash hash;
+    int i;
+
+    if ((nodes1 == NULL) || (nodes2 == NULL) ||
+        ((size_t) nodes1->nodeNr * nodes2->nodeNr <= EXSLT_SETS_LINEAR_MAX))
+        return(xmlXPathDifference(nodes1, nodes2));
+
+    ret = xmlXPathNodeSetCreate(NULL);
+    if (ret == NULL)
+        return(NULL);
+    if (exsltSetsHashNodes(&hash, nodes2) < 0) {
+        xmlXPathFreeNodeSet(ret);
+        return(NULL);
+    }
+    for (i = 0; i < nodes1->nodeNr; i++) {
+        if ((!exsltSetsHashContains(&hash, nodes1->nodeTab[i])) &&
+            (xmlXPathNodeSetAddUnique(ret, nodes1->nodeTab[i]) < 0)) {
+            xmlXPathFreeNodeSet(ret);
+            ret = NULL;
+            break;
+        }
+    }
+    exsltSetsHashCleanup(&hash);
+    return(ret);
+}
+
+/**
+ * exsltSetsIntersection:
+ * @nodes1:  a node-set
+ * @nodes2:  a node-set
+ *
+ * Same as xmlXPathIntersection() in linear time for large node-sets.
+ *
+ * Returns the nodes of @nodes1 which are also in @nodes2 or NULL in
+ * case of error.
+ */
+static xmlNodeSetPtr
+exsltSetsIntersection(xmlNodeSetPtr nodes1, xmlNodeSetPtr nodes2) {
+    xmlNodeSetPtr ret;
+    exsltSetsHash hash;
+    int i;
+
+    if ((nodes1 == NULL) || (nodes2 == NULL) ||
+        ((size_t) nodes1->nodeNr * nodes2->nodeNr <= EXSLT_SETS_LINEAR_MAX))
+        return(xmlXPathIntersection(nodes1, nodes2));
+
+    ret = xmlXPathNodeSetCreate(NULL);
+    if (ret == NULL)
+        return(NULL);
+    if (exsltSetsHashNodes(&hash, nodes2) < 0) {
+        xmlXPathFreeNodeSet(ret);
+        return(NULL);
+    }
+    for (i = 0; i < nodes1->nodeNr; i++) {
+        if ((exsltSetsHashContains(&hash, nodes1->nodeTab[i])) &&
+            (xmlXPathNodeSetAddUnique(ret, nodes1->nodeTab[i]) < 0)) {
+            xmlXPathFreeNodeSet(ret);
+            ret = NULL;
+            break;
+        }
+    }
+    exsltSetsHashCleanup(&hash);
+    return(ret);
+}
+
+/**
+ * exsltSetsDistinct:
+ * @ctxt:  an XPath parser context
+ * @nodes:  a node-set
+ * @comp:  the expression computing the key of a node or NULL
+ *
+ * Same as xmlXPathDistinctSorted() if @comp is NULL, otherwise keeps
+ * the first node of @nodes for each string value of @comp evaluated
+ * with that node as context node.
+ *
+ * Returns the distinct nodes of @nodes, @nodes itself if it is empty,
+ * or NULL in case of error.
+ */
+static xmlNodeSetPtr
+exsltSetsDistinct(xmlXPathParserContextPtr ctxt, xmlNodeSetPtr nodes,
+                  xmlXPathCompExprPtr comp) {
+    xmlXPathContextPtr xpctxt = ctxt->context;
+    xmlNodeSetPtr ret;
+    exsltSetsHash hash;
+    xmlNodePtr oldNode, cur;
+    xmlDocPtr oldDoc;
+    int oldContextSize, oldProximityPosition;
+    int i, owned, added;
+    xmlChar *key;
+
+    if (xmlXPathNodeSetIsEmpty(nodes))
+        return(nodes);
+
+    ret = xmlXPathNodeSetCreate(NULL);
+    if (ret == NULL)
+        return(NULL);
+    if (exsltSetsHashInit(&hash, nodes->nodeNr) < 0) {
+        xmlXPathFreeNodeSet(ret);
+        return(NULL);
+    }
+
+    oldDoc = xpctxt->doc;
+    oldNode = xpctxt->node;
+    oldContextSize = xpctxt->contextSize;
+    oldProximityPosition = xpctxt->proximityPosition;
+
+    for (i = 0; i < nodes->nodeNr; i++) {
+        cur = nodes->nodeTab[i];
+        if (comp == NULL) {
+            key = exsltSetsStringValue(cur, &owned);
+        } else {
+            xmlXPathObjectPtr obj;
+
+            xpctxt->node = cur;
+            if (cur->type == XML_NAMESPACE_DECL)
+                cur = (xmlNodePtr) ((xmlNsPtr) cur)->next;
+            xpctxt->doc = (cur != NULL) ? cur->doc : oldDoc;
+            xpctxt->contextSize = nodes->nodeNr;
+            xpctxt->proximityPosition = i + 1;
+            obj = xmlXPathCompiledEval(comp, xpctxt);
+            if (obj == NULL) {
+                xmlXPathFreeNodeSet(ret);
+                ret = NULL;
+                break;
+            }
+            key = xmlXPathCastToString(obj);
+            xmlXPathFreeObject(obj);
+            owned = 1;
+        }
+        if (key == NULL) {
+            xmlXPathFreeNodeSet(ret);
+            ret = NULL;
+            break;
+        }
+        added = exsltSetsHashAddString(&hash, key, owned);
+        if ((added < 0) ||
+            ((added > 0) &&
+             (xmlXPathNodeSetAddUnique(ret, nodes->nodeTab[i]) < 0))) {
+            xmlXPathFreeNodeSet(ret);
+            ret = NULL;
+            break;
+        }
+    }
+
+    xpctxt->doc = oldDoc;
+    xpctxt->node = oldNode;
+    xpctxt->contextSize = oldContextSize;
+    xpctxt->proximityPosition = oldProximityPosition;
+    exsltSetsHashCleanup(&hash);
+    return(ret);
+}
+
 /**
  * exsltSetsDifferenceFunction:
  * @ctxt:  an XPath parser context
@@ -37,7 +428,7 @@ exsltSetsDifferenceFunction (xmlXPathParserContextPtr ctxt, int nargs) {
 	return;
     }
 
-    ret = xmlXPathDifference(arg1, arg2);
+    ret = exsltSetsDifference(arg1, arg2);
 
     if (ret != arg1)
 	xmlXPathFreeNodeSet(arg1);
@@ -72,7 +463,7 @@ exsltSetsIntersectionFunction (xmlXPathParserContextPtr ctxt, int nargs) {
 	return;
     }
 
-    ret = xmlXPathIntersection(arg1, arg2);
+    ret = exsltSetsIntersection(arg1, arg2);
 
     xmlXPathFreeNodeSet(arg1);
     xmlXPathFreeNodeSet(arg2);
@@ -85,20 +476,36 @@ exsltSetsIntersectionFunction (xmlXPathParserContextPtr ctxt, int nargs) {
  * @ctxt:  an XPath parser context
  * @nargs:  the number of arguments
  *
- * Wraps #xmlXPathDistinct for use by the XPath processor
+ * Implements set:distinct(). The optional second argument is an
+ * expression computing the string compared instead of the string
+ * value of each node.
  */
 static void
 exsltSetsDistinctFunction (xmlXPathParserContextPtr ctxt, int nargs) {
     xmlXPathObjectPtr obj;
+    xmlXPathCompExprPtr comp = NULL;
     xmlNodeSetPtr ns, ret;
+    xmlChar *expr;
     int boolval = 0;
     void *user = NULL;
 
-    if (nargs != 1) {
+    if ((nargs < 1) || (nargs > 2)) {
 	xmlXPathSetArityError(ctxt);
 	return;
     }
 
+    if (nargs == 2) {
+        expr = xmlXPathPopString(ctxt);
+        if (xmlXPathCheckError(ctxt))
+            return;
+        comp = xmlXPathCtxtCompile(ctxt->context, expr);
+        xmlFree(expr);
+        if (comp == NULL) {
+            xmlXPathSetError(ctxt, XPATH_EXPR_ERROR);
+            return;
+        }
+    }
+
     if (ctxt->value != NULL) {
         boolval = ctxt->value->boolval;
 	user = ctxt->value->user;
@@ -106,11 +513,14 @@ exsltSetsDistinctFunction (xmlXPathParserContextPtr ctxt, int nargs) {
 	ctxt->value->user = NULL;
     }
     ns = xmlXPathPopNodeSet(ctxt);
-    if (xmlXPathCheckError(ctxt))
+    if (xmlXPathCheckError(ctxt)) {
+        xmlXPathFreeCompExpr(comp);
 	return;
+    }
 
     /* !!! must be sorted !!! */
-    ret = xmlXPathDistinctSorted(ns);
+    ret = exsltSetsDistinct(ctxt, ns, comp);
+    xmlXPathFreeCompExpr(comp);
 
     if (ret != ns)
 	xmlXPathFreeNodeSet(ns);
@@ -1,6 +1,8 @@
 #define IN_LIBEXSLT
 #include "libexslt/libexslt.h"
 
+#include <string.h>
+
 #include <libxml/tree.h>
 #include <libxml/xpath.h>
 #include <libxml/xpathInternals.h>
@@ -11,9 +13,135 @@
 #include <libxslt/xsltutils.h>
 #include <libxslt/xsltInternals.h>
 #include <libxslt/extensions.h>
+#include <libxslt/variables.h>
 
 #include "exslt.h"
 
+/*
+ * Tokens up to this length are stored in the dictionary of the
+ * transformation, so that repeated tokens share their text.
+ */
+#define EXSLT_STR_TOKEN_DICT_MAX 32
+
+/**
+ * exsltStrAddToken:
+ * @container:  the result tree fragment holding the tokens
+ * @name:  the name of the token elements
+ * @token:  the start of the token
+ * @len:  the length of the token in bytes
+ * @set:  the node-set receiving the token
+ *
+ * Appends a token element containing the @len first bytes of @token
+ * to @container and @set. If the container uses a dictionary, @name
+ * must come from it.
+ */
+static void
+exsltStrAddToken(xmlDocPtr container, const xmlChar *name,
+		 const xmlChar *token, int len, xmlNodeSetPtr set) {
+    xmlNodePtr node, text;
+
+    if (container->dict != NULL)
+	node = xmlNewDocNodeEatName(container, NULL, (xmlChar *) name, NULL);
+    else
+	node = xmlNewDocRawNode(container, NULL, name, NULL);
+    if (node == NULL)
+	return;
+    if ((container->dict != NULL) && (len <= EXSLT_STR_TOKEN_DICT_MAX)) {
+	text = xmlNewDocTextLen(container, NULL, 0);
+	if (text != NULL) {
+	    text->content = (xmlChar *) xmlDictLookup(container->dict,
+						      token, len);
+	    if (text->content == NULL) {
+		xmlFreeNode(text);
+		text = NULL;
+	    }
+	}
+    } else {
+	text = xmlNewDocTextLen(container, token, len);
+    }
+    if (text == NULL) {
+	xmlFreeNode(node);
+	return;
+    }
+    xmlAddChild(node, text);
+    xmlAddChild((xmlNodePtr) container, node);
+    xmlXPathNodeSetAddUnique(set, node);
+}
+
+/**
+ * exsltStrTokenize:
+ * @container:  the result tree fragment holding the tokens
+ * @name:  the name of the token elements
+ * @str:  the string to tokenize
+ * @delimiters:  the delimiter characters
+ * @set:  the node-set receiving the tokens
+ *
+ * Splits @str at every character of @delimiters, or into single
+ * characters if @delimiters is empty.
+ */
+static void
+exsltStrTokenize(xmlDocPtr container, const xmlChar *name,
+		 const xmlChar *str, const xmlChar *delimiters,
+		 xmlNodeSetPtr set) {
+    const xmlChar *cur, *token, *delimiter, *end;
+    unsigned char table[256];
+    int clen;
+
+    if (*delimiters == 0) {
+	for (cur = str; *cur != 0; cur += clen) {
+	    clen = xmlUTF8Strsize(cur, 1);
+	    exsltStrAddToken(container, name, cur, clen, set);
+	}
+	return;
+    }
+
+    memset(table, 0, sizeof(table));
+    for (delimiter = delimiters; *delimiter != 0; delimiter++) {
+	if (*delimiter >= 0x80)
+	    break;
+	table[*delimiter] = 1;
+    }
+
+    if (*delimiter == 0) {
+	/*
+	 * ASCII delimiters never match inside a multi-byte character,
+	 * the string can be scanned byte by byte.
+	 */
+	end = str + xmlStrlen(str);
+	for (token = str; token < end; token = cur + 1) {
+	    if (delimiters[1] == 0) {
+		cur = memchr(token, delimiters[0], end - token);
+		if (cur == NULL)
+		    cur = end;
+	    } else {
+		for (cur = token; (cur < end) && (!table[*cur]); cur++)
+		    ;
+	    }
+	    /* discard empty tokens */
+	    if (cur != token)
+		exsltStrAddToken(container, name, token, cur - token, set);
+	}
+	return;
+    }
+
+    for (cur = str, token = str; *cur != 0; cur += clen) {
+	clen = xmlUTF8Strsize(cur, 1);
+	for (delimiter = delimiters; *delimiter != 0;
+	     delimiter += xmlUTF8Strsize(delimiter, 1)) {
+	    if (!xmlUTF8Charcmp(cur, delimiter)) {
+		/* discard empty tokens */
+		if (cur != token)
+		    exsltStrAddToken(container, name, token, cur - token,
+				     set);
+		token = cur + clen;
+		break;
+	    }
+	}
+    }
+    if (token != cur)
+	exsltStrAddToken(container, name, token, cur - token, set);
+}
+
 /**
  * exsltStrTokenizeFunction:
  * @ctxt: an XPath parser context
@@ -26,12 +154,10 @@ static void
 exsltStrTokenizeFunction(xmlXPathParserContextPtr ctxt, int nargs)
 {
     xsltTransformContextPtr tctxt;
-    xmlChar *str, *delimiters, *cur;
-    const xmlChar *token, *delimiter;
-    xmlNodePtr node;
+    xmlChar *str, *delimiters;
+    const xmlChar *name;
     xmlDocPtr container;
     xmlXPathObjectPtr ret = NULL;
-    int clen;
 
     if ((nargs < 1) || (nargs > 2)) {
         xmlXPathSetArityError(ctxt);
@@ -66,45 +192,13 @@ exsltStrTokenizeFunction(xmlXPathParserContextPtr ctxt, int nargs)
     if (container != NULL) {
         xsltRegisterLocalRVT(tctxt, container);
         ret = xmlXPathNewNodeSet(NULL);
-        if (ret != NULL) {
-            for (cur = str, token = str; *cur != 0; cur += clen) {
-	        clen = xmlUTF8Strsize(cur, 1);
-		if (*delimiters == 0) {	/* empty string case */
-		    xmlChar ctmp;
-		    ctmp = *(cur+clen);
-		    *(cur+clen) = 0;
-                    node = xmlNewDocRawNode(container, NULL,
-                                       (const xmlChar *) "token", cur);
-		    xmlAddChild((xmlNodePtr) container, node);
-		    xmlXPathNodeSetAddUnique(ret->nodesetval, node);
-                    *(cur+clen) = ctmp; /* restore the changed byte */
-                    token = cur + clen;
-                } else for (delimiter = delimiters; *delimiter != 0;
-				delimiter += xmlUTF8Strsize(delimiter, 1)) {
-                    if (!xmlUTF8Charcmp(cur, delimiter)) {
-                        if (cur == token) {
-                            /* discard empty tokens */
-                            token = cur + clen;
-                            break;
-                        }
-                        *cur = 0;	/* terminate the token */
-                        node = xmlNewDocRawNode(container, NULL,
-                                           (const xmlChar *) "token", token);
-			xmlAddChild((xmlNodePtr) container, node);
-			xmlXPathNodeSetAddUnique(ret->nodesetval, node);
-                        *cur = *delimiter; /* restore the changed byte */
-                        token = cur + clen;
-                        break;
-                    }
-                }
-            }
-            if (token != cur) {
-		node = xmlNewDocRawNode(container, NULL,
-				    (const xmlChar *) "token", token);
-                xmlAddChild((xmlNodePtr) container, node);
-	        xmlXPathNodeSetAddUnique(ret->nodesetval, node);
-            }
-        }
+        if (container->dict != NULL)
+            name = xmlDictLookup(container->dict, BAD_CAST "token", 5);
+        else
+            name = BAD_CAST "token";
+        if ((ret != NULL) && (name != NULL))
+            exsltStrTokenize(container, name, str, delimiters,
+                             ret->nodesetval);
     }
 
 fail:
@@ -118,6 +212,69 @@ fail:
         valuePush(ctxt, xmlXPathNewNodeSet(NULL));
 }
 
+/**
+ * exsltStrSplit:
+ * @container:  the result tree fragment holding the tokens
+ * @name:  the name of the token elements
+ * @str:  the string to split
+ * @delimiter:  the delimiter, matched without regard to ASCII case
+ * @set:  the node-set receiving the tokens
+ *
+ * Splits @str at every occurrence of @delimiter, or into single bytes
+ * if @delimiter is empty.
+ */
+static void
+exsltStrSplit(xmlDocPtr container, const xmlChar *name,
+	      const xmlChar *str, const xmlChar *delimiter,
+	      xmlNodeSetPtr set) {
+    const xmlChar *cur, *token, *end;
+    int delimiterLength = xmlStrlen(delimiter);
+    int first;
+
+    end = str + xmlStrlen(str);
+    if (delimiterLength == 0) {
+	for (cur = str; cur < end; cur++)
+	    exsltStrAddToken(container, name, cur, 1, set);
+	return;
+    }
+
+    /*
+     * xmlStrncasecmp() folds the bytes 'A' to '[' onto 'a' to '{',
+     * the other bytes only match themselves.
+     */
+    first = delimiter[0] | 0x20;
+    if ((first < 'a') || (first > '{'))
+	first = 0;
+    for (cur = str, token = str; cur < end; ) {
+	/*
+	 * Look for the first byte of the delimiter, only the folded
+	 * bytes need a case-insensitive scan.
+	 */
+	if (first == 0) {
+	    cur = memchr(cur, delimiter[0], end - cur);
+	    if (cur == NULL)
+		break;
+	} else {
+	    while ((cur < end) && ((*cur | 0x20) != first))
+		cur++;
+	    if (cur == end)
+		break;
+	}
+	if ((end - cur < delimiterLength) ||
+	    (xmlStrncasecmp(cur, delimiter, delimiterLength))) {
+	    cur++;
+	    continue;
+	}
+	/* discard empty tokens */
+	if (cur != token)
+	    exsltStrAddToken(container, name, token, cur - token, set);
+	cur += delimiterLength;
+	token = cur;
+    }
+    if (token != end)
+	exsltStrAddToken(container, name, token, end - token, set);
+}
+
 /**
  * exsltStrSplitFunction:
  * @ctxt: an XPath parser context
@@ -129,12 +286,10 @@ fail:
 static void
 exsltStrSplitFunction(xmlXPathParserContextPtr ctxt, int nargs) {
     xsltTransformContextPtr tctxt;
-    xmlChar *str, *delimiter, *cur;
-    const xmlChar *token;
-    xmlNodePtr node;
+    xmlChar *str, *delimiter;
+    const xmlChar *name;
     xmlDocPtr container;
     xmlXPathObjectPtr ret = NULL;
-    int delimiterLength;
 
     if ((nargs < 1) || (nargs > 2)) {
         xmlXPathSetArityError(ctxt);
@@ -150,7 +305,6 @@ exsltStrSplitFunction(xmlXPathParserContextPtr ctxt, int nargs) {
     }
     if (delimiter == NULL)
         return;
-    delimiterLength = xmlStrlen (delimiter);
 
     str = xmlXPathPopString(ctxt);
     if (xmlXPathCheckError(ctxt) || (str == NULL)) {
@@ -173,44 +327,13 @@ exsltStrSplitFunction(xmlXPathParserContextPtr ctxt, int nargs) {
     if (container != NULL) {
         xsltRegisterLocalRVT(tctxt, container);
         ret = xmlXPathNewNodeSet(NULL);
-        if (ret != NULL) {
-            for (cur = str, token = str; *cur != 0; cur++) {
-		if (delimiterLength == 0) {
-		    if (cur != token) {
-			xmlChar tmp = *cur;
-			*cur = 0;
-                        node = xmlNewDocRawNode(container, NULL,
-                                           (const xmlChar *) "token", token);
-			xmlAddChild((xmlNodePtr) container, node);
-			xmlXPathNodeSetAddUnique(ret->nodesetval, node);
-			*cur = tmp;
-			token++;
-		    }
-		}
-		else if (!xmlStrncasecmp(cur, delimiter, delimiterLength)) {
-		    if (cur == token) {
-			/* discard empty tokens */
-			cur = cur + delimiterLength - 1;
-			token = cur + 1;
-			continue;
-		    }
-		    *cur = 0;
-		    node = xmlNewDocRawNode(container, NULL,
-				       (const xmlChar *) "token", token);
-		    xmlAddChild((xmlNodePtr) container, node);
-		    xmlXPathNodeSetAddUnique(ret->nodesetval, node);
-		    *cur = *delimiter;
-		    cur = cur + delimiterLength - 1;
-		    token = cur + 1;
-                }
-            }
-	    if (token != cur) {
-		node = xmlNewDocRawNode(container, NULL,
-				   (const xmlChar *) "token", token);
-		xmlAddChild((xmlNodePtr) container, node);
-		xmlXPathNodeSetAddUnique(ret->nodesetval, node);
-	    }
-        }
+        if (container->dict != NULL)
+            name = xmlDictLookup(container->dict, BAD_CAST "token", 5);
+        else
+            name = BAD_CAST "token";
+        if ((ret != NULL) && (name != NULL))
+            exsltStrSplit(container, name, str, delimiter,
+                          ret->nodesetval);
     }
 
 fail:
@@ -585,6 +708,391 @@ exsltStrReturnString(xmlXPathParserContextPtr ctxt, const xmlChar *str,
     return(0);
 }
 
+/*
+ * Maximum number of search and replace tables kept per transformation.
+ */
+#define EXSLT_STR_REPLACE_CACHE_MAX 16
+
+/*
+ * The search and replace strings of a str:replace() call, with a trie
+ * of the search strings finding the longest match at a position in
+ * one pass over the input. Tables built from node-sets which live as
+ * long as the transformation are kept in a cache keyed on the nodes.
+ */
+typedef struct _exsltStrReplaceMap exsltStrReplaceMap;
+struct _exsltStrReplaceMap {
+    exsltStrReplaceMap *next;
+    xmlNodePtr *searchNodes;	/* the search nodes if cached */
+    xmlNodePtr *replaceNodes;	/* the replace nodes if cached */
+    int nbReplaceNodes;
+    int n;			/* the number of search strings */
+    xmlChar **search;
+    xmlChar **replace;
+    int *slen;
+    int *rlen;
+    int empty;			/* the empty search string or -1 */
+    int nbStates;
+    int *match;			/* search string ending at a state or -1 */
+    size_t mask;
+    size_t *keys;		/* transitions as (state << 8 | byte) + 1 */
+    int *targets;
+};
+
+typedef struct _exsltStrData exsltStrData;
+struct _exsltStrData {
+    exsltStrReplaceMap *replaceMaps;	/* most recently used first */
+};
+
+static void
+exsltStrFreeReplaceMap(exsltStrReplaceMap *map) {
+    int i;
+
+    if (map == NULL)
+        return;
+    if ((map->search != NULL) && (map->replace != NULL)) {
+        for (i = 0; i < map->n; i++) {
+            if (map->search[i] != NULL)
+                xmlFree(map->search[i]);
+            if (map->replace[i] != NULL)
+                xmlFree(map->replace[i]);
+        }
+    }
+    if (map->search != NULL)
+        xmlFree(map->search);
+    if (map->replace != NULL)
+        xmlFree(map->replace);
+    if (map->slen != NULL)
+        xmlFree(map->slen);
+    if (map->rlen != NULL)
+        xmlFree(map->rlen);
+    if (map->match != NULL)
+        xmlFree(map->match);
+    if (map->keys != NULL)
+        xmlFree(map->keys);
+    if (map->targets != NULL)
+        xmlFree(map->targets);
+    if (map->searchNodes != NULL)
+        xmlFree(map->searchNodes);
+    if (map->replaceNodes != NULL)
+        xmlFree(map->replaceNodes);
+    xmlFree(map);
+}
+
+/**
+ * exsltStrInit:
+ * @ctxt: an XSLT transformation context
+ * @URI: the namespace URI for the extension
+ *
+ * Initializes the EXSLT - Strings module for a transformation.
+ *
+ * Returns the data for this transformation
+ */
+static void *
+exsltStrInit (xsltTransformContextPtr ctxt ATTRIBUTE_UNUSED,
+              const xmlChar *URI ATTRIBUTE_UNUSED) {
+    exsltStrData *ret;
+
+    ret = (exsltStrData *) xmlMalloc(sizeof(exsltStrData));
+    if (ret == NULL) {
+        xsltGenericError(xsltGenericErrorContext,
+                         "exsltStrInit: not enough memory\n");
+        return(NULL);
+    }
+    memset(ret, 0, sizeof(exsltStrData));
+    return(ret);
+}
+
+/**
+ * exsltStrShutdown:
+ * @ctxt: an XSLT transformation context
+ * @URI: the namespace URI for the extension
+ * @vdata: the module data to free up
+ *
+ * Shutdown the EXSLT - Strings module
+ */
+static void
+exsltStrShutdown (xsltTransformContextPtr ctxt ATTRIBUTE_UNUSED,
+                  const xmlChar *URI ATTRIBUTE_UNUSED,
+                  void *vdata) {
+    exsltStrData *data = (exsltStrData *) vdata;
+    exsltStrReplaceMap *map;
+
+    if (data == NULL)
+        return;
+    while (data->replaceMaps != NULL) {
+        map = data->replaceMaps;
+        data->replaceMaps = map->next;
+        exsltStrFreeReplaceMap(map);
+    }
+    xmlFree(data);
+}
+
+/**
+ * exsltStrReplaceState:
+ * @map:  a search and replace table
+ * @state:  a state of the trie
+ * @c:  the next byte
+ *
+ * Returns the state reached from @state with @c or -1.
+ */
+static int
+exsltStrReplaceState(exsltStrReplaceMap *map, int state, xmlChar c) {
+    size_t key = (((size_t) state << 8) | c) + 1;
+    size_t i = (key * 2654435761u) & map->mask;
+
+    while (map->keys[i] != 0) {
+        if (map->keys[i] == key)
+            return(map->targets[i]);
+        i = (i + 1) & map->mask;
+    }
+    return(-1);
+}
+
+/**
+ * exsltStrReplaceBuildTrie:
+ * @map:  a search and replace table
+ *
+ * Builds the trie of the search strings of @map. Among search strings
+ * which are equal, the first one wins.
+ *
+ * Returns 0 in case of success, -1 otherwise.
+ */
+static int
+exsltStrReplaceBuildTrie(exsltStrReplaceMap *map) {
+    size_t total = 0, size = 16, key, h;
+    int i, j, state, next;
+
+    for (i = 0; i < map->n; i++)
+        total += map->slen[i];
+    while (size < 2 * total + 2)
+        size *= 2;
+    map->mask = size - 1;
+    map->keys = (size_t *) xmlMalloc(size * sizeof(size_t));
+    map->targets = (int *) xmlMalloc(size * sizeof(int));
+    map->match = (int *) xmlMalloc((total + 1) * sizeof(int));
+    if ((map->keys == NULL) || (map->targets == NULL) ||
+        (map->match == NULL))
+        return(-1);
+    memset(map->keys, 0, size * sizeof(size_t));
+    map->match[0] = -1;
+    map->nbStates = 1;
+
+    for (i = 0; i < map->n; i++) {
+        if (map->slen[i] == 0)
+            continue;
+        state = 0;
+        for (j = 0; j < map->slen[i]; j++) {
+            next = exsltStrReplaceState(map, state, map->search[i][j]);
+            if (next < 0) {
+                next = map->nbStates++;
+                map->match[next] = -1;
+                key = (((size_t) state << 8) | map->search[i][j]) + 1;
+                h = (key * 2654435761u) & map->mask;
+                while (map->keys[h] != 0)
+                    h = (h + 1) & map->mask;
+                map->keys[h] = key;
+                map->targets[h] = next;
+            }
+            state = next;
+        }
+        if (map->match[state] < 0)
+            map->match[state] = i;
+    }
+    return(0);
+}
+
+/**
+ * exsltStrNewReplaceMap:
+ * @ctxt: an XPath parser context
+ * @search_set:  the search node-set or NULL
+ * @search_str:  the search string if @search_set is NULL
+ * @replace_set:  the replace node-set or NULL
+ * @replace_str:  the replace string if @replace_set is NULL
+ * @n:  the number of search strings
+ *
+ * Returns a new search and replace table or NULL in case of error.
+ */
+static exsltStrReplaceMap *
+exsltStrNewReplaceMap(xmlXPathParserContextPtr ctxt,
+                      xmlNodeSetPtr search_set, const xmlChar *search_str,
+                      xmlNodeSetPtr replace_set, const xmlChar *replace_str,
+                      int n) {
+    exsltStrReplaceMap *map;
+    int i;
+
+    map = (exsltStrReplaceMap *) xmlMalloc(sizeof(exsltStrReplaceMap));
+    if (map == NULL)
+        goto error;
+    memset(map, 0, sizeof(exsltStrReplaceMap));
+    map->search = (xmlChar **) xmlMalloc(n * sizeof(xmlChar *));
+    map->replace = (xmlChar **) xmlMalloc(n * sizeof(xmlChar *));
+    map->slen = (int *) xmlMalloc(n * sizeof(int));
+    map->rlen = (int *) xmlMalloc(n * sizeof(int));
+    if ((map->search == NULL) || (map->replace == NULL) ||
+        (map->slen == NULL) || (map->rlen == NULL))
+        goto error;
+    memset(map->search, 0, n * sizeof(xmlChar *));
+    memset(map->replace, 0, n * sizeof(xmlChar *));
+    map->n = n;
+
+    map->empty = -1;
+    for (i = 0; i < n; i++) {
+        if (search_set != NULL)
+            map->search[i] = xmlXPathCastNodeToString(search_set->nodeTab[i]);
+        else
+            map->search[i] = xmlStrdup(search_str);
+        if (map->search[i] == NULL)
+            goto error;
+
+        map->slen[i] = xmlStrlen(map->search[i]);
+        if (map->empty < 0 && map->slen[i] == 0)
+            map->empty = i;
+
+        if (replace_set != NULL) {
+            if (i < replace_set->nodeNr) {
+                map->replace[i] =
+                    xmlXPathCastNodeToString(replace_set->nodeTab[i]);
+                if (map->replace[i] == NULL)
+                    goto error;
+            }
+        }
+        else if ((i == 0) && (replace_str != NULL)) {
+            map->replace[i] = xmlStrdup(replace_str);
+            if (map->replace[i] == NULL)
+                goto error;
+        }
+
+        if (map->replace[i] == NULL)
+            map->rlen[i] = 0;
+        else
+            map->rlen[i] = xmlStrlen(map->replace[i]);
+    }
+
+    if (map->empty >= 0 && map->rlen[map->empty] == 0)
+        map->empty = -1;
+
+    if (exsltStrReplaceBuildTrie(map) < 0)
+        goto error;
+    return(map);
+
+error:
+    exsltStrFreeReplaceMap(map);
+    xmlXPathSetError(ctxt, XPATH_MEMORY_ERROR);
+    return(NULL);
+}
+
+/**
+ * exsltStrStableNodeSet:
+ * @set:  a node-set
+ *
+ * Checks whether the nodes of @set stay unchanged until the end of the
+ * transformation, so that their identity can key a cache.
+ *
+ * Returns 1 if so, 0 otherwise.
+ */
+static int
+exsltStrStableNodeSet(xmlNodeSetPtr set) {
+    xmlDocPtr doc;
+    int i;
+
+    for (i = 0; i < set->nodeNr; i++) {
+        /* namespace nodes are copies owned by the node-set */
+        if (set->nodeTab[i]->type == XML_NAMESPACE_DECL)
+            return(0);
+        doc = set->nodeTab[i]->doc;
+        if ((doc == NULL) ||
+            ((XSLT_IS_RES_TREE_FRAG(doc)) &&
+             (doc->compression != XSLT_RVT_GLOBAL)))
+            return(0);
+    }
+    return(1);
+}
+
+/**
+ * exsltStrGetReplaceMap:
+ * @ctxt: an XPath parser context
+ * @search_set:  the search node-set or NULL
+ * @search_str:  the search string if @search_set is NULL
+ * @replace_set:  the replace node-set or NULL
+ * @replace_str:  the replace string if @replace_set is NULL
+ * @n:  the number of search strings
+ * @cached:  set to 1 if the returned table is owned by the cache
+ *
+ * Returns the search and replace table for the arguments of a
+ * str:replace() call or NULL in case of error.
+ */
+static exsltStrReplaceMap *
+exsltStrGetReplaceMap(xmlXPathParserContextPtr ctxt,
+                      xmlNodeSetPtr search_set, const xmlChar *search_str,
+                      xmlNodeSetPtr replace_set, const xmlChar *replace_str,
+                      int n, int *cached) {
+    xsltTransformContextPtr tctxt;
+    exsltStrData *data = NULL;
+    exsltStrReplaceMap *map, *prev;
+    int nbReplaceNodes, count;
+
+    *cached = 0;
+    if ((search_set == NULL) || (replace_set == NULL) ||
+        (!exsltStrStableNodeSet(search_set)) ||
+        (!exsltStrStableNodeSet(replace_set)))
+        return(exsltStrNewReplaceMap(ctxt, search_set, search_str,
+                                     replace_set, replace_str, n));
+
+    tctxt = xsltXPathGetTransformContext(ctxt);
+    if (tctxt != NULL)
+        data = (exsltStrData *) xsltGetExtData(tctxt,
+                                               EXSLT_STRINGS_NAMESPACE);
+    if (data == NULL)
+        return(exsltStrNewReplaceMap(ctxt, search_set, search_str,
+                                     replace_set, replace_str, n));
+
+    /* only the replace nodes paired with a search node matter */
+    nbReplaceNodes = replace_set->nodeNr < n ? replace_set->nodeNr : n;
+    for (map = data->replaceMaps, prev = NULL, count = 0; map != NULL;
+         prev = map, map = map->next, count++) {
+        if ((map->n == n) &&
+            (map->nbReplaceNodes == nbReplaceNodes) &&
+            (memcmp(map->searchNodes, search_set->nodeTab,
+                    n * sizeof(xmlNodePtr)) == 0) &&
+            ((nbReplaceNodes == 0) ||
+             (memcmp(map->replaceNodes, replace_set->nodeTab,
+                     nbReplaceNodes * sizeof(xmlNodePtr)) == 0))) {
+            if (prev != NULL) {
+                prev->next = map->next;
+                map->next = data->replaceMaps;
+                data->replaceMaps = map;
+            }
+            *cached = 1;
+            return(map);
+        }
+        if ((count == EXSLT_STR_REPLACE_CACHE_MAX - 1) &&
+            (map->next != NULL)) {
+            /* drop the least recently used table */
+            exsltStrFreeReplaceMap(map->next);
+            map->next = NULL;
+        }
+    }
+
+    map = exsltStrNewReplaceMap(ctxt, search_set, search_str,
+                                replace_set, replace_str, n);
+    if (map == NULL)
+        return(NULL);
+    map->searchNodes = (xmlNodePtr *) xmlMalloc(n * sizeof(xmlNodePtr));
+    map->replaceNodes = (xmlNodePtr *)
+        xmlMalloc((nbReplaceNodes + 1) * sizeof(xmlNodePtr));
+    if ((map->searchNodes == NULL) || (map->replaceNodes == NULL))
+        return(map);
+    memcpy(map->searchNodes, search_set->nodeTab, n * sizeof(xmlNodePtr));
+    if (nbReplaceNodes > 0)
+        memcpy(map->replaceNodes, replace_set->nodeTab,
+               nbReplaceNodes * sizeof(xmlNodePtr));
+    map->nbReplaceNodes = nbReplaceNodes;
+    map->next = data->replaceMaps;
+    data->replaceMaps = map;
+    *cached = 1;
+    return(map);
+}
+
 /**
  * exsltStrReplaceFunction:
  * @ctxt: an XPath parser context
@@ -595,12 +1103,11 @@ exsltStrReturnString(xmlXPathParserContextPtr ctxt, const xmlChar *str,
  */
 static void
 exsltStrReplaceFunction (xmlXPathParserContextPtr ctxt, int nargs) {
-    int i, i_empty, n, slen0, rlen0, *slen, *rlen;
-    void *mem = NULL;
+    int n, cached = 0;
     const xmlChar *src, *start;
     xmlChar *string, *search_str = NULL, *replace_str = NULL;
-    xmlChar **search, **replace;
     xmlNodeSetPtr search_set = NULL, replace_set = NULL;
+    exsltStrReplaceMap *map;
     xmlBufferPtr buf;
 
     if (nargs  != 3) {
@@ -645,69 +1152,12 @@ exsltStrReplaceFunction (xmlXPathParserContextPtr ctxt, int nargs) {
         goto done_empty_search;
     }
 
-    /* allocate memory for string pointer and length arrays */
-
-    if (n == 1) {
-        search = &search_str;
-        replace = &replace_str;
-        slen = &slen0;
-        rlen = &rlen0;
-    }
-    else {
-        mem = xmlMalloc(2 * n * (sizeof(const xmlChar *) + sizeof(int)));
-        if (mem == NULL) {
-            xmlXPathSetError(ctxt, XPATH_MEMORY_ERROR);
-            goto fail_malloc;
-        }
-        search = (xmlChar **) mem;
-        replace = search + n;
-        slen = (int *) (replace + n);
-        rlen = slen + n;
-    }
-
     /* process arguments */
 
-    i_empty = -1;
-
-    for (i=0; i<n; ++i) {
-        if (search_set != NULL) {
-            search[i] = xmlXPathCastNodeToString(search_set->nodeTab[i]);
-            if (search[i] == NULL) {
-                n = i;
-                goto fail_process_args;
-            }
-        }
-
-        slen[i] = xmlStrlen(search[i]);
-        if (i_empty < 0 && slen[i] == 0)
-            i_empty = i;
-
-        if (replace_set != NULL) {
-            if (i < replace_set->nodeNr) {
-                replace[i] = xmlXPathCastNodeToString(replace_set->nodeTab[i]);
-                if (replace[i] == NULL) {
-                    n = i + 1;
-                    goto fail_process_args;
-                }
-            }
-            else
-                replace[i] = NULL;
-        }
-        else {
-            if (i == 0)
-                replace[i] = replace_str;
-            else
-                replace[i] = NULL;
-        }
-
-        if (replace[i] == NULL)
-            rlen[i] = 0;
-        else
-            rlen[i] = xmlStrlen(replace[i]);
-    }
-
-    if (i_empty >= 0 && rlen[i_empty] == 0)
-        i_empty = -1;
+    map = exsltStrGetReplaceMap(ctxt, search_set, search_str,
+                                replace_set, replace_str, n, &cached);
+    if (map == NULL)
+        goto fail_map;
 
     /* replace operation */
 
@@ -721,22 +1171,25 @@ exsltStrReplaceFunction (xmlXPathParserContextPtr ctxt, int nargs) {
     start = string;
 
     while (*src != 0) {
-        int max_len = 0, i_match = 0;
-
-        for (i=0; i<n; ++i) {
-            if (*src == search[i][0] &&
-                slen[i] > max_len &&
-                xmlStrncmp(src, search[i], slen[i]) == 0)
-            {
-                i_match = i;
-                max_len = slen[i];
+        const xmlChar *cur;
+        int state, max_len = 0, i_match = -1;
+
+        /* find the longest search string at src */
+        for (cur = src, state = 0; *cur != 0; cur++) {
+            state = exsltStrReplaceState(map, state, *cur);
+            if (state < 0)
+                break;
+            if (map->match[state] >= 0) {
+                i_match = map->match[state];
+                max_len = cur + 1 - src;
             }
         }
 
-        if (max_len == 0) {
-            if (i_empty >= 0 && start < src) {
+        if (i_match < 0) {
+            if (map->empty >= 0 && start < src) {
                 if (xmlBufferAdd(buf, start, src - start) ||
-                    xmlBufferAdd(buf, replace[i_empty], rlen[i_empty]))
+                    xmlBufferAdd(buf, map->replace[map->empty],
+                                 map->rlen[map->empty]))
                 {
                     xmlXPathSetError(ctxt, XPATH_MEMORY_ERROR);
                     goto fail_buffer_add;
@@ -749,14 +1202,15 @@ exsltStrReplaceFunction (xmlXPathParserContextPtr ctxt, int nargs) {
         else {
             if ((start < src &&
                  xmlBufferAdd(buf, start, src - start)) ||
-                (rlen[i_match] &&
-                 xmlBufferAdd(buf, replace[i_match], rlen[i_match])))
+                (map->rlen[i_match] &&
+                 xmlBufferAdd(buf, map->replace[i_match],
+                              map->rlen[i_match])))
             {
                 xmlXPathSetError(ctxt, XPATH_MEMORY_ERROR);
                 goto fail_buffer_add;
             }
 
-            src += slen[i_match];
+            src += max_len;
             start = src;
         }
     }
@@ -776,22 +1230,10 @@ fail_buffer_add:
     xmlBufferFree(buf);
 
 fail_buffer:
-fail_process_args:
-    if (search_set != NULL) {
-        for (i=0; i<n; ++i)
-            xmlFree(search[i]);
-    }
-    if (replace_set != NULL) {
-        for (i=0; i<n; ++i) {
-            if (replace[i] != NULL)
-                xmlFree(replace[i]);
-        }
-    }
-
-    if (mem != NULL)
-        xmlFree(mem);
+    if (!cached)
+        exsltStrFreeReplaceMap(map);
 
-fail_malloc:
+fail_map:
 done_empty_search:
     xmlFree(string);
 
@@ -819,6 +1261,9 @@ fail_replace:
 
 void
 exsltStrRegister (void) {
+    xsltRegisterExtModule (EXSLT_STRINGS_NAMESPACE,
+                           exsltStrInit,
+                           exsltStrShutdown);
     xsltRegisterExtModuleFunction ((const xmlChar *) "tokenize",
 				   EXSLT_STRINGS_NAMESPACE,
 				   exsltStrTokenizeFunction);
@@ -29,6 +29,7 @@
 #include "imports.h"
 #include "transform.h"
 #include "preproc.h"
+#include "xsltprivate.h"
 
 #define WITH_XSLT_DEBUG_ATTRIBUTES
 #ifdef WITH_XSLT_DEBUG
@@ -90,6 +91,35 @@ struct _xsltAttrSetContext {
     int error;
 };
 
+/*
+ * An xsl:attribute of a flattened use-attribute-sets list. The name and
+ * namespace are pre-computed if they are static.
+ */
+typedef struct _xsltUseAttrStep xsltUseAttrStep;
+typedef xsltUseAttrStep *xsltUseAttrStepPtr;
+struct _xsltUseAttrStep {
+    xmlNodePtr inst;		/* the xsl:attribute element */
+    int folded;			/* the following fields are set */
+    const xmlChar *name;
+    const xmlChar *prefix;
+    const xmlChar *nsName;
+};
+
+/*
+ * The use-attribute-sets of an instruction or of a literal result
+ * element, resolved after the attribute sets.
+ */
+typedef struct _xsltUseAttrSets xsltUseAttrSets;
+typedef xsltUseAttrSets *xsltUseAttrSetsPtr;
+struct _xsltUseAttrSets {
+    struct _xsltUseAttrSets *next; /* in the list of the stylesheet */
+    xmlNodePtr inst;		/* the node holding the QNames */
+    const xmlChar *names;	/* the QNames */
+    int resolved;		/* the steps are available */
+    int nbSteps;
+    xsltUseAttrStepPtr steps;
+};
+
 static void
 xsltResolveAttrSet(xsltAttrSetPtr set, xsltStylesheetPtr topStyle,
                    xsltStylesheetPtr style, const xmlChar *name,
@@ -691,11 +721,162 @@ xsltResolveSASCallback(void *payload, void *data,
     }
 }
 
+/**
+ * xsltCompileUseAttributeSets:
+ * @style:  the XSLT stylesheet
+ * @inst:  the instruction or the xsl:use-attribute-sets attribute of
+ *         a literal result element
+ * @names:  the QNames of the attribute sets
+ *
+ * Registers a use of attribute sets, which will be flattened into the
+ * list of xsl:attribute instructions to apply once all the attribute
+ * sets are known, see xsltResolveStylesheetAttributeSet().
+ *
+ * Returns an opaque pointer for xsltApplyUseAttributeSets() or NULL
+ *         in case of error.
+ */
+void *
+xsltCompileUseAttributeSets(xsltStylesheetPtr style, xmlNodePtr inst,
+                            const xmlChar *names) {
+    xsltUseAttrSetsPtr use;
+
+    if ((style == NULL) || (inst == NULL) || (names == NULL))
+        return(NULL);
+    use = (xsltUseAttrSetsPtr) xmlMalloc(sizeof(xsltUseAttrSets));
+    if (use == NULL) {
+        xsltGenericError(xsltGenericErrorContext,
+		"xsltCompileUseAttributeSets : malloc failed\n");
+	return(NULL);
+    }
+    memset(use, 0, sizeof(xsltUseAttrSets));
+    use->inst = inst;
+    use->names = xmlDictLookup(style->dict, names, -1);
+    use->next = (xsltUseAttrSetsPtr) XSLT_STYLE_PRIV(style)->useAttrSets;
+    XSLT_STYLE_PRIV(style)->useAttrSets = use;
+    return(use);
+}
+
+/**
+ * xsltFoldUseAttrStep:
+ * @style:  the XSLT stylesheet
+ * @step:  an xsl:attribute of a flattened list
+ *
+ * Pre-computes the name and namespace of the attribute if they are
+ * static. The checks reporting errors are left to xsltAttribute().
+ */
+static void
+xsltFoldUseAttrStep(xsltStylesheetPtr style, xsltUseAttrStepPtr step) {
+    xsltStylePreCompPtr comp = (xsltStylePreCompPtr) step->inst->psvi;
+    const xmlChar *name, *prefix = NULL, *nsName = NULL;
+
+    if ((comp == NULL) || (!comp->has_name) || (comp->name == NULL))
+        return;
+    name = xsltSplitQName(style->dict, comp->name, &prefix);
+    if (name == NULL)
+        return;
+    if (comp->has_ns) {
+        if (comp->ns == NULL)
+            return;
+        if (comp->ns[0] != 0)
+            nsName = comp->ns;
+        if (xmlStrEqual(nsName, BAD_CAST "http://www.w3.org/2000/xmlns/"))
+            return;
+        if (xmlStrEqual(nsName, XML_XML_NAMESPACE))
+            prefix = BAD_CAST "xml";
+        else if (xmlStrEqual(prefix, BAD_CAST "xml"))
+            prefix = NULL;
+    } else if (prefix != NULL) {
+        xmlNsPtr ns = xmlSearchNs(step->inst->doc, step->inst, prefix);
+
+        if (ns == NULL)
+            return;
+        nsName = ns->href;
+    }
+    step->name = name;
+    step->prefix = prefix;
+    step->nsName = nsName;
+    step->folded = 1;
+}
+
+/**
+ * xsltResolveUseAttributeSets:
+ * @style:  the principal XSLT stylesheet
+ * @use:  a use of attribute sets
+ *
+ * Flattens the attribute sets referenced by @use into the list of
+ * their xsl:attribute instructions. Lists which would report an error
+ * are left unresolved and processed by xsltApplyAttributeSet().
+ */
+static void
+xsltResolveUseAttributeSets(xsltStylesheetPtr style, xsltUseAttrSetsPtr use) {
+    const xmlChar *curstr, *endstr, *qname, *ncname, *prefix, *nsUri;
+    xsltUseAttrStepPtr tmp;
+    xsltAttrSetPtr set;
+    xsltAttrElemPtr cur;
+    xmlNsPtr ns;
+    int max = 0;
+
+    curstr = use->names;
+    while (*curstr != 0) {
+        while (IS_BLANK(*curstr))
+            curstr++;
+        if (*curstr == 0)
+            break;
+        endstr = curstr;
+        while ((*endstr != 0) && (!IS_BLANK(*endstr)))
+            endstr++;
+        qname = xmlDictLookup(style->dict, curstr, endstr - curstr);
+        curstr = endstr;
+        if ((qname == NULL) || (xmlValidateQName(qname, 0)))
+            goto error;
+
+        ncname = xsltSplitQName(style->dict, qname, &prefix);
+        nsUri = NULL;
+        if (prefix != NULL) {
+            ns = xmlSearchNs(use->inst->doc, use->inst, prefix);
+            if (ns == NULL)
+                goto error;
+            nsUri = ns->href;
+        }
+        if (style->attributeSets == NULL)
+            continue;
+        set = xmlHashLookup2(style->attributeSets, ncname, nsUri);
+        if (set == NULL)
+            continue;
+
+        for (cur = set->attrs; cur != NULL; cur = cur->next) {
+            if (cur->attr == NULL)
+                continue;
+            if (use->nbSteps >= max) {
+                max = max ? max * 2 : 8;
+                tmp = (xsltUseAttrStepPtr) xmlRealloc(use->steps,
+                        max * sizeof(xsltUseAttrStep));
+                if (tmp == NULL)
+                    goto error;
+                use->steps = tmp;
+            }
+            tmp = &use->steps[use->nbSteps++];
+            memset(tmp, 0, sizeof(xsltUseAttrStep));
+            tmp->inst = cur->attr;
+            xsltFoldUseAttrStep(style, tmp);
+        }
+    }
+    use->resolved = 1;
+    return;
+
+error:
+    if (use->steps != NULL)
+        xmlFree(use->steps);
+    use->steps = NULL;
+    use->nbSteps = 0;
+}
+
 /**
  * xsltResolveStylesheetAttributeSet:
  * @style:  the XSLT stylesheet
  *
- * resolve the references between attribute sets.
+ * resolve the references between attribute sets, then flatten the uses
+ * registered by xsltCompileUseAttributeSets().
  */
 void
 xsltResolveStylesheetAttributeSet(xsltStylesheetPtr style) {
@@ -733,71 +914,37 @@ xsltResolveStylesheetAttributeSet(xsltStylesheetPtr style) {
 	}
 	cur = xsltNextImport(cur);
     }
+
+    /*
+    * Flatten the uses of attribute sets.
+    */
+    for (cur = style; cur != NULL; cur = xsltNextImport(cur)) {
+        xsltUseAttrSetsPtr use;
+
+        for (use = (xsltUseAttrSetsPtr) XSLT_STYLE_PRIV(cur)->useAttrSets;
+             use != NULL; use = use->next)
+            xsltResolveUseAttributeSets(style, use);
+    }
 }
 
 /**
- * xsltAttribute:
+ * xsltAttributeTarget:
  * @ctxt:  a XSLT process context
- * @contextNode:  the current node in the source tree
  * @inst:  the xsl:attribute element
- * @castedComp:  precomputed information
  *
- * Process the xslt attribute node on the source node
+ * Returns the element receiving the attribute created by @inst or NULL
+ *         if the attribute must not be added.
  */
-void
-xsltAttribute(xsltTransformContextPtr ctxt,
-	      xmlNodePtr contextNode,
-              xmlNodePtr inst,
-	      xsltElemPreCompPtr castedComp)
-{
-#ifdef XSLT_REFACTORED
-    xsltStyleItemAttributePtr comp =
-	(xsltStyleItemAttributePtr) castedComp;
-#else
-    xsltStylePreCompPtr comp = (xsltStylePreCompPtr) castedComp;
-#endif
+static xmlNodePtr
+xsltAttributeTarget(xsltTransformContextPtr ctxt, xmlNodePtr inst) {
     xmlNodePtr targetElem;
-    xmlChar *prop = NULL;
-    const xmlChar *name = NULL, *prefix = NULL, *nsName = NULL;
-    xmlChar *value = NULL;
-    xmlNsPtr ns = NULL;
-    xmlAttrPtr attr;
-
-    if ((ctxt == NULL) || (contextNode == NULL) || (inst == NULL) ||
-        (inst->type != XML_ELEMENT_NODE) )
-        return;
-
-    /*
-    * A comp->has_name == 0 indicates that we need to skip this instruction,
-    * since it was evaluated to be invalid already during compilation.
-    */
-    if (!comp->has_name)
-        return;
-    /*
-    * BIG NOTE: This previously used xsltGetSpecialNamespace() and
-    *  xsltGetNamespace(), but since both are not appropriate, we
-    *  will process namespace lookup here to avoid adding yet another
-    *  ns-lookup function to namespaces.c.
-    */
-    /*
-    * SPEC XSLT 1.0: Error cases:
-    * - Creating nodes other than text nodes during the instantiation of
-    *   the content of the xsl:attribute element; implementations may
-    *   either signal the error or ignore the offending nodes."
-    */
 
-    if (comp == NULL) {
-        xsltTransformError(ctxt, NULL, inst,
-	    "Internal error in xsltAttribute(): "
-	    "The XSLT 'attribute' instruction was not compiled.\n");
-        return;
-    }
     /*
     * TODO: Shouldn't ctxt->insert == NULL be treated as an internal error?
     *   So report an internal error?
     */
     if (ctxt->insert == NULL)
-        return;
+        return(NULL);
     /*
     * SPEC XSLT 1.0:
     *  "Adding an attribute to a node that is not an element;
@@ -808,7 +955,7 @@ xsltAttribute(xsltTransformContextPtr ctxt,
     */
     targetElem = ctxt->insert;
     if (targetElem->type != XML_ELEMENT_NODE)
-	return;
+	return(NULL);
 
     /*
     * SPEC XSLT 1.0:
@@ -829,129 +976,31 @@ xsltAttribute(xsltTransformContextPtr ctxt,
 	    "xsl:attribute: Cannot add attributes to an "
 	    "element if children have been already added "
 	    "to the element.\n");
-        return;
+        return(NULL);
     }
+    return(targetElem);
+}
 
-    /*
-    * Process the name
-    * ----------------
-    */
-
-#ifdef WITH_DEBUGGER
-    if (ctxt->debugStatus != XSLT_DEBUG_NONE)
-        xslHandleDebugger(inst, contextNode, NULL, ctxt);
-#endif
-
-    if (comp->name == NULL) {
-	/* TODO: fix attr acquisition wrt to the XSLT namespace */
-        prop = xsltEvalAttrValueTemplate(ctxt, inst,
-	    (const xmlChar *) "name", XSLT_NAMESPACE);
-        if (prop == NULL) {
-            xsltTransformError(ctxt, NULL, inst,
-		"xsl:attribute: The attribute 'name' is missing.\n");
-            goto error;
-        }
-	if (xmlValidateQName(prop, 0)) {
-	    xsltTransformError(ctxt, NULL, inst,
-		"xsl:attribute: The effective name '%s' is not a "
-		"valid QName.\n", prop);
-	    /* we fall through to catch any further errors, if possible */
-	}
-
-	/*
-	* Reject a name of "xmlns".
-	*/
-	if (xmlStrEqual(prop, BAD_CAST "xmlns")) {
-            xsltTransformError(ctxt, NULL, inst,
-                "xsl:attribute: The effective name 'xmlns' is not allowed.\n");
-	    xmlFree(prop);
-	    goto error;
-	}
-
-	name = xsltSplitQName(ctxt->dict, prop, &prefix);
-	xmlFree(prop);
-    } else {
-	/*
-	* The "name" value was static.
-	*/
-#ifdef XSLT_REFACTORED
-	prefix = comp->nsPrefix;
-	name = comp->name;
-#else
-	name = xsltSplitQName(ctxt->dict, comp->name, &prefix);
-#endif
-    }
-
-    /*
-    * Process namespace semantics
-    * ---------------------------
-    *
-    * Evaluate the namespace name.
-    */
-    if (comp->has_ns) {
-	/*
-	* The "namespace" attribute was existent.
-	*/
-	if (comp->ns != NULL) {
-	    /*
-	    * No AVT; just plain text for the namespace name.
-	    */
-	    if (comp->ns[0] != 0)
-		nsName = comp->ns;
-	} else {
-	    xmlChar *tmpNsName;
-	    /*
-	    * Eval the AVT.
-	    */
-	    /* TODO: check attr acquisition wrt to the XSLT namespace */
-	    tmpNsName = xsltEvalAttrValueTemplate(ctxt, inst,
-		(const xmlChar *) "namespace", XSLT_NAMESPACE);
-	    /*
-	    * This fixes bug #302020: The AVT might also evaluate to the
-	    * empty string; this means that the empty string also indicates
-	    * "no namespace".
-	    * SPEC XSLT 1.0:
-	    *  "If the string is empty, then the expanded-name of the
-	    *  attribute has a null namespace URI."
-	    */
-	    if ((tmpNsName != NULL) && (tmpNsName[0] != 0))
-		nsName = xmlDictLookup(ctxt->dict, BAD_CAST tmpNsName, -1);
-	    xmlFree(tmpNsName);
-	}
-
-        if (xmlStrEqual(nsName, BAD_CAST "http://www.w3.org/2000/xmlns/")) {
-            xsltTransformError(ctxt, NULL, inst,
-                "xsl:attribute: Namespace http://www.w3.org/2000/xmlns/ "
-                "forbidden.\n");
-            goto error;
-        }
-        if (xmlStrEqual(nsName, XML_XML_NAMESPACE)) {
-            prefix = BAD_CAST "xml";
-        } else if (xmlStrEqual(prefix, BAD_CAST "xml")) {
-            prefix = NULL;
-        }
-    } else if (prefix != NULL) {
-	/*
-	* SPEC XSLT 1.0:
-	*  "If the namespace attribute is not present, then the QName is
-	*  expanded into an expanded-name using the namespace declarations
-	*  in effect for the xsl:attribute element, *not* including any
-	*  default namespace declaration."
-	*/
-	ns = xmlSearchNs(inst->doc, inst, prefix);
-	if (ns == NULL) {
-	    /*
-	    * Note that this is treated as an error now (checked with
-	    *  Saxon, Xalan-J and MSXML).
-	    */
-	    xsltTransformError(ctxt, NULL, inst,
-		"xsl:attribute: The QName '%s:%s' has no "
-		"namespace binding in scope in the stylesheet; "
-		"this is an error, since the namespace was not "
-		"specified by the instruction itself.\n", prefix, name);
-	} else
-	    nsName = ns->href;
-    }
+/**
+ * xsltAttributeCreate:
+ * @ctxt:  a XSLT process context
+ * @contextNode:  the current node in the source tree
+ * @inst:  the xsl:attribute element
+ * @targetElem:  the element receiving the attribute
+ * @name:  the local name of the attribute
+ * @prefix:  the prefix of the attribute name or NULL
+ * @nsName:  the namespace name of the attribute or NULL
+ *
+ * Adds the attribute to @targetElem and instantiates its value.
+ */
+static void
+xsltAttributeCreate(xsltTransformContextPtr ctxt, xmlNodePtr contextNode,
+                    xmlNodePtr inst, xmlNodePtr targetElem,
+                    const xmlChar *name, const xmlChar *prefix,
+                    const xmlChar *nsName) {
+    xmlChar *value = NULL;
+    xmlNsPtr ns;
+    xmlAttrPtr attr;
 
     /*
     * Find/create a matching ns-decl in the result tree.
@@ -1102,6 +1151,193 @@ error:
     return;
 }
 
+/**
+ * xsltAttribute:
+ * @ctxt:  a XSLT process context
+ * @contextNode:  the current node in the source tree
+ * @inst:  the xsl:attribute element
+ * @castedComp:  precomputed information
+ *
+ * Process the xslt attribute node on the source node
+ */
+void
+xsltAttribute(xsltTransformContextPtr ctxt,
+	      xmlNodePtr contextNode,
+              xmlNodePtr inst,
+	      xsltElemPreCompPtr castedComp)
+{
+#ifdef XSLT_REFACTORED
+    xsltStyleItemAttributePtr comp =
+	(xsltStyleItemAttributePtr) castedComp;
+#else
+    xsltStylePreCompPtr comp = (xsltStylePreCompPtr) castedComp;
+#endif
+    xmlNodePtr targetElem;
+    xmlChar *prop = NULL;
+    const xmlChar *name = NULL, *prefix = NULL, *nsName = NULL;
+    xmlNsPtr ns = NULL;
+
+    if ((ctxt == NULL) || (contextNode == NULL) || (inst == NULL) ||
+        (inst->type != XML_ELEMENT_NODE) )
+        return;
+
+    /*
+    * A comp->has_name == 0 indicates that we need to skip this instruction,
+    * since it was evaluated to be invalid already during compilation.
+    */
+    if (!comp->has_name)
+        return;
+    /*
+    * BIG NOTE: This previously used xsltGetSpecialNamespace() and
+    *  xsltGetNamespace(), but since both are not appropriate, we
+    *  will process namespace lookup here to avoid adding yet another
+    *  ns-lookup function to namespaces.c.
+    */
+    /*
+    * SPEC XSLT 1.0: Error cases:
+    * - Creating nodes other than text nodes during the instantiation of
+    *   the content of the xsl:attribute element; implementations may
+    *   either signal the error or ignore the offending nodes."
+    */
+
+    if (comp == NULL) {
+        xsltTransformError(ctxt, NULL, inst,
+	    "Internal error in xsltAttribute(): "
+	    "The XSLT 'attribute' instruction was not compiled.\n");
+        return;
+    }
+    targetElem = xsltAttributeTarget(ctxt, inst);
+    if (targetElem == NULL)
+        return;
+
+    /*
+    * Process the name
+    * ----------------
+    */
+
+#ifdef WITH_DEBUGGER
+    if (ctxt->debugStatus != XSLT_DEBUG_NONE)
+        xslHandleDebugger(inst, contextNode, NULL, ctxt);
+#endif
+
+    if (comp->name == NULL) {
+	/* TODO: fix attr acquisition wrt to the XSLT namespace */
+        prop = xsltEvalAttrValueTemplate(ctxt, inst,
+	    (const xmlChar *) "name", XSLT_NAMESPACE);
+        if (prop == NULL) {
+            xsltTransformError(ctxt, NULL, inst,
+		"xsl:attribute: The attribute 'name' is missing.\n");
+            goto error;
+        }
+	if (xmlValidateQName(prop, 0)) {
+	    xsltTransformError(ctxt, NULL, inst,
+		"xsl:attribute: The effective name '%s' is not a "
+		"valid QName.\n", prop);
+	    /* we fall through to catch any further errors, if possible */
+	}
+
+	/*
+	* Reject a name of "xmlns".
+	*/
+	if (xmlStrEqual(prop, BAD_CAST "xmlns")) {
+            xsltTransformError(ctxt, NULL, inst,
+                "xsl:attribute: The effective name 'xmlns' is not allowed.\n");
+	    xmlFree(prop);
+	    goto error;
+	}
+
+	name = xsltSplitQName(ctxt->dict, prop, &prefix);
+	xmlFree(prop);
+    } else {
+	/*
+	* The "name" value was static.
+	*/
+#ifdef XSLT_REFACTORED
+	prefix = comp->nsPrefix;
+	name = comp->name;
+#else
+	name = xsltSplitQName(ctxt->dict, comp->name, &prefix);
+#endif
+    }
+
+    /*
+    * Process namespace semantics
+    * ---------------------------
+    *
+    * Evaluate the namespace name.
+    */
+    if (comp->has_ns) {
+	/*
+	* The "namespace" attribute was existent.
+	*/
+	if (comp->ns != NULL) {
+	    /*
+	    * No AVT; just plain text for the namespace name.
+	    */
+	    if (comp->ns[0] != 0)
+		nsName = comp->ns;
+	} else {
+	    xmlChar *tmpNsName;
+	    /*
+	    * Eval the AVT.
+	    */
+	    /* TODO: check attr acquisition wrt to the XSLT namespace */
+	    tmpNsName = xsltEvalAttrValueTemplate(ctxt, inst,
+		(const xmlChar *) "namespace", XSLT_NAMESPACE);
+	    /*
+	    * This fixes bug #302020: The AVT might also evaluate to the
+	    * empty string; this means that the empty string also indicates
+	    * "no namespace".
+	    * SPEC XSLT 1.0:
+	    *  "If the string is empty, then the expanded-name of the
+	    *  attribute has a null namespace URI."
+	    */
+	    if ((tmpNsName != NULL) && (tmpNsName[0] != 0))
+		nsName = xmlDictLookup(ctxt->dict, BAD_CAST tmpNsName, -1);
+	    xmlFree(tmpNsName);
+	}
+
+        if (xmlStrEqual(nsName, BAD_CAST "http://www.w3.org/2000/xmlns/")) {
+            xsltTransformError(ctxt, NULL, inst,
+                "xsl:attribute: Namespace http://www.w3.org/2000/xmlns/ "
+                "forbidden.\n");
+            goto error;
+        }
+        if (xmlStrEqual(nsName, XML_XML_NAMESPACE)) {
+            prefix = BAD_CAST "xml";
+        } else if (xmlStrEqual(prefix, BAD_CAST "xml")) {
+            prefix = NULL;
+        }
+    } else if (prefix != NULL) {
+	/*
+	* SPEC XSLT 1.0:
+	*  "If the namespace attribute is not present, then the QName is
+	*  expanded into an expanded-name using the namespace declarations
+	*  in effect for the xsl:attribute element, *not* including any
+	*  default namespace declaration."
+	*/
+	ns = xmlSearchNs(inst->doc, inst, prefix);
+	if (ns == NULL) {
+	    /*
+	    * Note that this is treated as an error now (checked with
+	    *  Saxon, Xalan-J and MSXML).
+	    */
+	    xsltTransformError(ctxt, NULL, inst,
+		"xsl:attribute: The QName '%s:%s' has no "
+		"namespace binding in scope in the stylesheet; "
+		"this is an error, since the namespace was not "
+		"specified by the instruction itself.\n", prefix, name);
+	} else
+	    nsName = ns->href;
+    }
+
+    xsltAttributeCreate(ctxt, contextNode, inst, targetElem, name, prefix,
+                        nsName);
+
+error:
+    return;
+}
+
 /**
  * xsltApplyAttributeSet:
  * @ctxt:  the XSLT stylesheet
@@ -1221,6 +1457,50 @@ xsltApplyAttributeSet(xsltTransformContextPtr ctxt, xmlNodePtr node,
     }
 }
 
+/**
+ * xsltApplyUseAttributeSets:
+ * @ctxt:  the XSLT transformation context
+ * @node:  the node in the source tree.
+ * @use:  the value returned by xsltCompileUseAttributeSets()
+ *
+ * Apply the xsl:use-attribute-sets of an instruction or of a literal
+ * result element, running the flattened list of xsl:attribute
+ * instructions if available.
+ */
+void
+xsltApplyUseAttributeSets(xsltTransformContextPtr ctxt, xmlNodePtr node,
+                          void *use)
+{
+    xsltUseAttrSetsPtr comp = (xsltUseAttrSetsPtr) use;
+    xsltUseAttrStepPtr step;
+    xmlNodePtr targetElem;
+    int i;
+
+    if ((ctxt == NULL) || (comp == NULL))
+        return;
+    if ((!comp->resolved)
+#ifdef WITH_DEBUGGER
+        || (ctxt->debugStatus != XSLT_DEBUG_NONE)
+#endif
+       ) {
+        xsltApplyAttributeSet(ctxt, node, comp->inst, comp->names);
+        return;
+    }
+
+    for (i = 0, step = comp->steps; i < comp->nbSteps; i++, step++) {
+        if (!step->folded) {
+            xsltAttribute(ctxt, node, step->inst, step->inst->psvi);
+            continue;
+        }
+        if ((node == NULL) || (step->inst->type != XML_ELEMENT_NODE))
+            continue;
+        targetElem = xsltAttributeTarget(ctxt, step->inst);
+        if (targetElem != NULL)
+            xsltAttributeCreate(ctxt, node, step->inst, targetElem,
+                                step->name, step->prefix, step->nsName);
+    }
+}
+
 static void
 xsltFreeAttributeSetsEntry(void *payload,
                            const xmlChar *name ATTRIBUTE_UNUSED) {
@@ -1235,8 +1515,19 @@ xsltFreeAttributeSetsEntry(void *payload,
  */
 void
 xsltFreeAttributeSetsHashes(xsltStylesheetPtr style) {
+    xsltUseAttrSetsPtr use, next;
+
     if (style->attributeSets != NULL)
 	xmlHashFree((xmlHashTablePtr) style->attributeSets,
 		    xsltFreeAttributeSetsEntry);
     style->attributeSets = NULL;
+
+    for (use = (xsltUseAttrSetsPtr) XSLT_STYLE_PRIV(style)->useAttrSets;
+         use != NULL; use = next) {
+        next = use->next;
+        if (use->steps != NULL)
+            xmlFree(use->steps);
+        xmlFree(use);
+    }
+    XSLT_STYLE_PRIV(style)->useAttrSets = NULL;
 }
@@ -16,16 +16,20 @@
 #define IN_LIBXSLT
 #include "libxslt.h"
 
+#include <limits.h>
 #include <string.h>
 
 #include <libxml/xmlmemory.h>
 #include <libxml/tree.h>
 #include <libxml/xpath.h>
 #include <libxml/xpathInternals.h>
+#include <libxml/parserInternals.h>
 #include "xslt.h"
 #include "xsltutils.h"
 #include "xsltInternals.h"
 #include "templates.h"
+#include "variables.h"
+#include "xsltprivate.h"
 
 #ifdef WITH_XSLT_DEBUG
 #define WITH_XSLT_DEBUG_AVT
@@ -33,27 +37,42 @@
 
 #define MAX_AVT_SEG 10
 
+/*
+ * Values up to this length which don't depend on the context are
+ * interned in the dictionary of the result rather than allocated.
+ */
+#define XSLT_AVT_DICT_MAX 64
+
+typedef struct _xsltAVTSegment xsltAVTSegment;
+typedef xsltAVTSegment *xsltAVTSegmentPtr;
+struct _xsltAVTSegment {
+    /*
+     * Either a literal string or an expression
+     */
+    const xmlChar *str;		/* the literal, in the stylesheet dictionary */
+    int len;			/* the length of @str */
+    xmlXPathCompExprPtr comp;	/* the compiled expression */
+    const xmlChar *expr;	/* its source, in the stylesheet dictionary */
+    int hoist;			/* context-independent: 1 + its index in
+				   the cache of the transformation, see
+				   xsltHoistAVT() */
+};
+
 typedef struct _xsltAttrVT xsltAttrVT;
 typedef xsltAttrVT *xsltAttrVTPtr;
 struct _xsltAttrVT {
     struct _xsltAttrVT *next; /* next xsltAttrVT */
     int nb_seg;		/* Number of segments */
     int max_seg;	/* max capacity before re-alloc needed */
-    int strstart;	/* is the start a string */
     /*
      * the namespaces in scope
      */
     xmlNsPtr *nsList;
     int nsNr;
     /*
-     * the content is an alternate of string and xmlXPathCompExprPtr
+     * the content, consecutive literals are merged
      */
-#if __STDC_VERSION__ >= 199901L
-    /* Using a C99 flexible array member avoids false positives under UBSan */
-    void *segments[];
-#else
-    void *segments[1];
-#endif
+    xsltAVTSegmentPtr segments;
 };
 
 /**
@@ -67,25 +86,17 @@ struct _xsltAttrVT {
 static xsltAttrVTPtr
 xsltNewAttrVT(xsltStylesheetPtr style) {
     xsltAttrVTPtr cur;
-    size_t size = sizeof(xsltAttrVT) + MAX_AVT_SEG * sizeof(void*);
 
-    cur = (xsltAttrVTPtr) xmlMalloc(size);
+    cur = (xsltAttrVTPtr) xmlMalloc(sizeof(xsltAttrVT));
     if (cur == NULL) {
 	xsltTransformError(NULL, style, NULL,
 		"xsltNewAttrVTPtr : malloc failed\n");
 	if (style != NULL) style->errors++;
 	return(NULL);
     }
-    memset(cur, 0, size);
+    memset(cur, 0, sizeof(xsltAttrVT));
 
-    cur->nb_seg = 0;
-    cur->max_seg = MAX_AVT_SEG;
-    cur->strstart = 0;
     cur->next = style->attVTs;
-    /*
-     * Note: this pointer may be changed by a re-alloc within xsltCompileAttr,
-     * so that code may change the stylesheet pointer also!
-     */
     style->attVTs = (xsltAttrVTPtr) cur;
 
     return(cur);
@@ -103,19 +114,11 @@ xsltFreeAttrVT(xsltAttrVTPtr avt) {
 
     if (avt == NULL) return;
 
-    if (avt->strstart == 1) {
-	for (i = 0;i < avt->nb_seg; i += 2)
-	    if (avt->segments[i] != NULL)
-		xmlFree((xmlChar *) avt->segments[i]);
-	for (i = 1;i < avt->nb_seg; i += 2)
-	    xmlXPathFreeCompExpr((xmlXPathCompExprPtr) avt->segments[i]);
-    } else {
-	for (i = 0;i < avt->nb_seg; i += 2)
-	    xmlXPathFreeCompExpr((xmlXPathCompExprPtr) avt->segments[i]);
-	for (i = 1;i < avt->nb_seg; i += 2)
-	    if (avt->segments[i] != NULL)
-		xmlFree((xmlChar *) avt->segments[i]);
-    }
+    for (i = 0;i < avt->nb_seg; i++)
+	if (avt->segments[i].comp != NULL)
+	    xmlXPathFreeCompExpr(avt->segments[i].comp);
+    if (avt->segments != NULL)
+        xmlFree(avt->segments);
     if (avt->nsList != NULL)
         xmlFree(avt->nsList);
     xmlFree(avt);
@@ -137,31 +140,73 @@ xsltFreeAVTList(void *avt) {
 	cur = next;
     }
 }
+
 /**
- * xsltSetAttrVTsegment:
- * @ avt: pointer to an xsltAttrVT structure
- * @ val: the value to be set to the next available segment
- *
- * Within xsltCompileAttr there are several places where a value
- * needs to be added to the 'segments' array within the xsltAttrVT
- * structure, and at each place the allocated size may have to be
- * re-allocated.  This routine takes care of that situation.
+ * xsltAddAVTSegment:
+ * @avt: pointer to an xsltAttrVT structure
  *
- * Returns the avt pointer, which may have been changed by a re-alloc
+ * Returns a new zeroed segment at the end of @avt or NULL in case of
+ *         error.
  */
-static xsltAttrVTPtr
-xsltSetAttrVTsegment(xsltAttrVTPtr avt, void *val) {
+static xsltAVTSegmentPtr
+xsltAddAVTSegment(xsltAttrVTPtr avt) {
+    xsltAVTSegmentPtr seg;
+
     if (avt->nb_seg >= avt->max_seg) {
-        size_t size = sizeof(xsltAttrVT) +
-                      (avt->max_seg + MAX_AVT_SEG) * sizeof(void *);
-	avt = (xsltAttrVTPtr) xmlRealloc(avt, size);
-	if (avt == NULL)
-	    return NULL;
-	memset(&avt->segments[avt->nb_seg], 0, MAX_AVT_SEG*sizeof(void *));
-	avt->max_seg += MAX_AVT_SEG;
+        int max = avt->max_seg + MAX_AVT_SEG;
+
+	seg = (xsltAVTSegmentPtr) xmlRealloc(avt->segments,
+                                             max * sizeof(xsltAVTSegment));
+	if (seg == NULL)
+	    return(NULL);
+	avt->segments = seg;
+	avt->max_seg = max;
     }
-    avt->segments[avt->nb_seg++] = val;
-    return avt;
+    seg = &avt->segments[avt->nb_seg++];
+    memset(seg, 0, sizeof(xsltAVTSegment));
+    return(seg);
+}
+
+/**
+ * xsltAVTConstant:
+ * @expr:  the expression of an AVT segment
+ *
+ * Folds string and number literals.
+ *
+ * Returns the string value of @expr if it is a literal, NULL otherwise.
+ */
+static xmlChar *
+xsltAVTConstant(const xmlChar *expr) {
+    const xmlChar *start, *end;
+    int digits = 0, dot = 0;
+
+    while (IS_BLANK_CH(*expr))
+        expr++;
+    end = expr + xmlStrlen(expr);
+    while ((end > expr) && (IS_BLANK_CH(end[-1])))
+        end--;
+    if (end == expr)
+        return(NULL);
+
+    if ((*expr == '"') || (*expr == '\'')) {
+        start = expr + 1;
+        if ((end - expr < 2) || (end[-1] != *expr) ||
+            (memchr(start, *expr, end - 1 - start) != NULL))
+            return(NULL);
+        return(xmlStrndup(start, end - 1 - start));
+    }
+
+    for (start = expr; start < end; start++) {
+        if ((*start >= '0') && (*start <= '9'))
+            digits++;
+        else if ((*start == '.') && (!dot))
+            dot = 1;
+        else
+            return(NULL);
+    }
+    if (digits == 0)
+        return(NULL);
+    return(xmlXPathCastNumberToString(xmlXPathStringEvalNumber(expr)));
 }
 
 /**
@@ -179,9 +224,11 @@ xsltCompileAttr(xsltStylesheetPtr style, xmlAttrPtr attr) {
     const xmlChar *cur;
     xmlChar *ret = NULL;
     xmlChar *expr = NULL;
+    xmlChar *cst;
     xmlXPathCompExprPtr comp = NULL;
-    xsltAttrVTPtr avt, tmp;
-    int i = 0, lastavt = 0;
+    xsltAttrVTPtr avt;
+    xsltAVTSegmentPtr seg;
+    int i = 0;
 
     if ((style == NULL) || (attr == NULL) || (attr->children == NULL))
         return;
@@ -223,6 +270,10 @@ xsltCompileAttr(xsltStylesheetPtr style, xmlAttrPtr attr) {
     }
     avt->nsNr = i;
 
+    /*
+    * Literal text, including the folded constant expressions, is
+    * accumulated in ret until the next expression.
+    */
     cur = str;
     while (*cur != 0) {
 	if (*cur == '{') {
@@ -239,17 +290,9 @@ xsltCompileAttr(xsltStylesheetPtr style, xmlAttrPtr attr) {
 		str = cur;
 		continue;
 	    }
-	    if ((ret != NULL) || (cur - str > 0)) {
+	    if (cur - str > 0)
 		ret = xmlStrncat(ret, str, cur - str);
-		str = cur;
-		if (avt->nb_seg == 0)
-		    avt->strstart = 1;
-		if ((tmp = xsltSetAttrVTsegment(avt, (void *) ret)) == NULL)
-		    goto error;
-                avt = tmp;
-		ret = NULL;
-		lastavt = 0;
-	    }
+	    str = cur;
 
 	    cur++;
 	    while ((*cur != 0) && (*cur != '}')) {
@@ -278,6 +321,11 @@ xsltCompileAttr(xsltStylesheetPtr style, xmlAttrPtr attr) {
 		*/
 	        XSLT_TODO
 		goto error;
+	    }
+	    cst = xsltAVTConstant(expr);
+	    if (cst != NULL) {
+		ret = xmlStrcat(ret, cst);
+		xmlFree(cst);
 	    } else {
 		comp = xsltXPathCompile(style, expr);
 		if (comp == NULL) {
@@ -287,27 +335,26 @@ xsltCompileAttr(xsltStylesheetPtr style, xmlAttrPtr attr) {
 		    style->errors++;
 		    goto error;
 		}
-		if (avt->nb_seg == 0)
-		    avt->strstart = 0;
-		if (lastavt == 1) {
-		    if ((tmp = xsltSetAttrVTsegment(avt, NULL)) == NULL) {
-                        xsltTransformError(NULL, style, attr->parent,
-                                           "out of memory\n");
-		        goto error;
-                    }
-                    avt = tmp;
+		if (ret != NULL) {
+		    seg = xsltAddAVTSegment(avt);
+		    if (seg == NULL)
+			goto oom;
+		    seg->len = xmlStrlen(ret);
+		    seg->str = xmlDictLookup(style->dict, ret, seg->len);
+		    if (seg->str == NULL)
+			goto oom;
+		    xmlFree(ret);
+		    ret = NULL;
 		}
-		if ((tmp = xsltSetAttrVTsegment(avt, (void *) comp)) == NULL) {
-                    xsltTransformError(NULL, style, attr->parent,
-                                       "out of memory\n");
-		    goto error;
-                }
-                avt = tmp;
-		lastavt = 1;
-		xmlFree(expr);
-		expr = NULL;
-                comp = NULL;
+		seg = xsltAddAVTSegment(avt);
+		if (seg == NULL)
+		    goto oom;
+		seg->comp = comp;
+		comp = NULL;
+		seg->expr = xmlDictLookup(style->dict, expr, -1);
 	    }
+	    xmlFree(expr);
+	    expr = NULL;
 	    cur++;
 	    str = cur;
 	} else if (*cur == '}') {
@@ -326,33 +373,24 @@ xsltCompileAttr(xsltStylesheetPtr style, xmlAttrPtr attr) {
 	} else
 	    cur++;
     }
-    if ((ret != NULL) || (cur - str > 0)) {
+    if (cur - str > 0)
 	ret = xmlStrncat(ret, str, cur - str);
-	str = cur;
-	if (avt->nb_seg == 0)
-	    avt->strstart = 1;
-	if ((tmp = xsltSetAttrVTsegment(avt, (void *) ret)) == NULL)
-	    goto error;
-        avt = tmp;
-	ret = NULL;
+    if (ret != NULL) {
+	seg = xsltAddAVTSegment(avt);
+	if (seg == NULL)
+	    goto oom;
+	seg->len = xmlStrlen(ret);
+	seg->str = xmlDictLookup(style->dict, ret, seg->len);
+	if (seg->str == NULL)
+	    goto oom;
     }
+    goto error;
 
+oom:
+    xsltTransformError(NULL, style, attr->parent,
+                       "xsltCompileAttr: malloc problem\n");
+    style->errors++;
 error:
-    if (avt == NULL) {
-        xsltTransformError(NULL, style, attr->parent,
-		"xsltCompileAttr: malloc problem\n");
-    } else {
-        if (attr->psvi != avt) {  /* may have changed from realloc */
-            attr->psvi = avt;
-	    /*
-	     * This is a "hack", but I can't see any clean method of
-	     * doing it.  If a re-alloc has taken place, then the pointer
-	     * for this AVT may have changed.  style->attVTs was set by
-	     * xsltNewAttrVT, so it needs to be re-set to the new value!
-	     */
-	    style->attVTs = avt;
-	}
-    }
     if (ret != NULL)
 	xmlFree(ret);
     if (expr != NULL)
@@ -361,45 +399,208 @@ error:
         xmlXPathFreeCompExpr(comp);
 }
 
+/**
+ * xsltHoistAVT:
+ * @style:  the XSLT stylesheet
+ * @avt:  the precompiled attribute value template info
+ * @contextFree:  tells whether an expression doesn't depend on the context
+ * @data:  the first argument of @contextFree
+ *
+ * Assigns an index in the per-transformation cache of values to the
+ * expressions of @avt which evaluate to the same string anywhere in a
+ * transformation, like references to global variables.
+ */
+void
+xsltHoistAVT(xsltStylesheetPtr style, void *avt,
+             int (*contextFree) (void *data, const xmlChar *expr),
+             void *data) {
+#ifdef XSLT_REFACTORED
+    (void) style;
+    (void) avt;
+    (void) contextFree;
+    (void) data;
+#else
+    xsltAttrVTPtr cur = (xsltAttrVTPtr) avt;
+    int i;
+
+    if ((style == NULL) || (cur == NULL) || (contextFree == NULL))
+        return;
+    for (i = 0; i < cur->nb_seg; i++) {
+        xsltAVTSegmentPtr seg = &cur->segments[i];
+
+        if ((seg->comp == NULL) || (seg->expr == NULL) || (seg->hoist > 0))
+            continue;
+        if (contextFree(data, seg->expr))
+            seg->hoist = ++XSLT_STYLE_PRIV(style->principal)->hoistNr;
+    }
+#endif
+}
+
+/**
+ * xsltEvalAVTSegment:
+ * @ctxt: the XSLT transformation context
+ * @avt: the precompiled attribute value template info
+ * @seg: an expression segment of @avt
+ * @owned: set to the value if it must be freed
+ *
+ * Returns the string value of @seg or NULL in case of error.
+ */
+static const xmlChar *
+xsltEvalAVTSegment(xsltTransformContextPtr ctxt, xsltAttrVTPtr avt,
+                   xsltAVTSegmentPtr seg, xmlChar **owned) {
+    xmlChar *val;
+#ifndef XSLT_REFACTORED
+    xsltTransformContextPrivPtr priv = XSLT_CTXT_PRIV(ctxt);
+#endif
+
+    *owned = NULL;
+#ifndef XSLT_REFACTORED
+    if ((seg->hoist > 0) && (seg->hoist <= priv->hoistMax) &&
+        (priv->hoistTab[seg->hoist - 1] != NULL)) {
+        priv->hoistReuses++;
+        return(priv->hoistTab[seg->hoist - 1]->stringval);
+    }
+#endif
+
+    val = xsltEvalXPathStringNs(ctxt, seg->comp, avt->nsNr, avt->nsList);
+    if (val == NULL)
+        return(NULL);
+
+#ifndef XSLT_REFACTORED
+    if (seg->hoist > 0) {
+        xmlXPathObjectPtr obj = xmlXPathWrapString(val);
+
+        if (obj == NULL) {
+            xmlFree(val);
+            return(NULL);
+        }
+        xsltHoistedStoreIndex(ctxt, seg->hoist, obj);
+        obj->stringval = NULL;
+        xmlXPathFreeObject(obj);
+    }
+#endif
+    *owned = val;
+    return(val);
+}
 
 /**
- * xsltEvalAVT:
+ * xsltEvalAVTDict:
  * @ctxt: the XSLT transformation context
  * @avt: the prevompiled attribute value template info
  * @node: the node hosting the attribute
+ * @dict: the dictionary of the document receiving the value or NULL
  *
- * Process the given AVT, and return the new string value.
+ * Process the given AVT like xsltEvalAVT(). The string values of the
+ * segments are copied once into a buffer of the final size. A short
+ * value made only of literals and context-independent expressions is
+ * interned in @dict instead, since it is the same on each evaluation.
  *
- * Returns the computed string value or NULL, must be deallocated by the
- *         caller.
+ * Returns the computed string value or NULL, owned by @dict if it is
+ *         one of its strings, otherwise by the caller.
  */
 xmlChar *
-xsltEvalAVT(xsltTransformContextPtr ctxt, void *avt, xmlNodePtr node) {
-    xmlChar *ret = NULL, *tmp;
-    xmlXPathCompExprPtr comp;
+xsltEvalAVTDict(xsltTransformContextPtr ctxt, void *avt, xmlNodePtr node,
+                xmlDictPtr dict) {
     xsltAttrVTPtr cur = (xsltAttrVTPtr) avt;
+    const xmlChar *vals[MAX_AVT_SEG], **values = vals;
+    xmlChar *own[MAX_AVT_SEG], **owned = own;
+    int lens[MAX_AVT_SEG], *lengths = lens;
+    xmlChar small[XSLT_AVT_DICT_MAX + 1];
+    xmlChar *ret = NULL;
+    size_t total = 0;
+    int varying = 0;
     int i;
-    int str;
 
     if ((ctxt == NULL) || (avt == NULL) || (node == NULL))
         return(NULL);
-    str = cur->strstart;
-    for (i = 0;i < cur->nb_seg;i++) {
-        if (str) {
-	    ret = xmlStrcat(ret, (const xmlChar *) cur->segments[i]);
-	} else {
-	    comp = (xmlXPathCompExprPtr) cur->segments[i];
-	    tmp = xsltEvalXPathStringNs(ctxt, comp, cur->nsNr, cur->nsList);
-	    if (tmp != NULL) {
-	        if (ret != NULL) {
-		    ret = xmlStrcat(ret, tmp);
-		    xmlFree(tmp);
-		} else {
-		    ret = tmp;
-		}
-	    }
-	}
-	str = !str;
+    if (cur->nb_seg == 0)
+        return(NULL);
+
+    if (cur->nb_seg > MAX_AVT_SEG) {
+        values = (const xmlChar **) xmlMalloc(cur->nb_seg * sizeof(*values));
+        owned = (xmlChar **) xmlMalloc(cur->nb_seg * sizeof(*owned));
+        lengths = (int *) xmlMalloc(cur->nb_seg * sizeof(*lengths));
+        if ((values == NULL) || (owned == NULL) || (lengths == NULL)) {
+            xsltTransformError(ctxt, NULL, node,
+                "xsltEvalAVT: malloc failed\n");
+            goto done;
+        }
+    }
+
+    /*
+    * Evaluate all the expressions first, they may evaluate other AVTs.
+    */
+    for (i = 0; i < cur->nb_seg; i++) {
+        xsltAVTSegmentPtr seg = &cur->segments[i];
+
+        if (seg->comp == NULL) {
+            values[i] = seg->str;
+            lengths[i] = seg->len;
+            owned[i] = NULL;
+        } else {
+            values[i] = xsltEvalAVTSegment(ctxt, cur, seg, &owned[i]);
+            if (seg->hoist <= 0)
+                varying = 1;
+            lengths[i] = (values[i] != NULL) ? xmlStrlen(values[i]) : 0;
+        }
+        total += lengths[i];
+    }
+    if (total > XSLT_AVT_DICT_MAX)
+        dict = NULL;
+
+    if ((cur->nb_seg == 1) && (owned[0] != NULL) &&
+        ((dict == NULL) || (varying))) {
+        ret = owned[0];
+        owned[0] = NULL;
+    } else if ((dict != NULL) && (! varying)) {
+        total = 0;
+        for (i = 0; i < cur->nb_seg; i++) {
+            if (lengths[i] > 0)
+                memcpy(small + total, values[i], lengths[i]);
+            total += lengths[i];
+        }
+        ret = (xmlChar *) xmlDictLookup(dict, small, total);
+    } else if (total < INT_MAX) {
+        ret = (xmlChar *) xmlMalloc(total + 1);
+        if (ret != NULL) {
+            total = 0;
+            for (i = 0; i < cur->nb_seg; i++) {
+                if (lengths[i] > 0)
+                    memcpy(ret + total, values[i], lengths[i]);
+                total += lengths[i];
+            }
+            ret[total] = 0;
+        }
+    }
+    if (ret == NULL)
+        xsltTransformError(ctxt, NULL, node, "xsltEvalAVT: malloc failed\n");
+
+    for (i = 0; i < cur->nb_seg; i++) {
+        if (owned[i] != NULL)
+            xmlFree(owned[i]);
+    }
+
+done:
+    if (values != vals) {
+        xmlFree((xmlChar **) values);
+        xmlFree(owned);
+        xmlFree(lengths);
     }
     return(ret);
 }
+
+/**
+ * xsltEvalAVT:
+ * @ctxt: the XSLT transformation context
+ * @avt: the prevompiled attribute value template info
+ * @node: the node hosting the attribute
+ *
+ * Process the given AVT, and return the new string value.
+ *
+ * Returns the computed string value or NULL, must be deallocated by the
+ *         caller.
+ */
+xmlChar *
+xsltEvalAVT(xsltTransformContextPtr ctxt, void *avt, xmlNodePtr node) {
+    return(xsltEvalAVTDict(ctxt, avt, node, NULL));
+}
@@ -40,6 +40,8 @@
 #include "xsltutils.h"
 #include "imports.h"
 #include "extensions.h"
+#include "threadpool.h"
+#include "xsltprivate.h"
 
 #include <stdlib.h>             /* for _MAX_PATH & getenv */
 #ifdef _WIN32
@@ -2329,6 +2331,8 @@ xsltCleanupGlobals(void)
 
     xmlFreeMutex(xsltExtMutex);
     xsltExtMutex = NULL;
+    xsltCleanupThreadPool();
+    xsltCleanupStepThreads();
     xsltFreeLocales();
     xsltUninit();
 }
@@ -34,6 +34,8 @@
 #include "numbersInternals.h"
 #include "keys.h"
 #include "documents.h"
+#include "extra.h"
+#include "xsltprivate.h"
 
 #ifdef WITH_XSLT_DEBUG
 #define WITH_XSLT_DEBUG_FUNCTION
@@ -345,6 +347,137 @@ error:
         xmlXPathFreeObject(obj2);
 }
 
+/**
+ * xsltKeyLookup:
+ * @ctxt:  the XPath Parser context
+ * @qname:  the name of the key
+ * @value:  the key value
+ *
+ * Looks up @value in the key @qname of the document of the context
+ * node, computing the key if needed.
+ *
+ * Returns the nodes of the key table or NULL, the caller must not
+ * free or modify them.
+ */
+static xmlNodeSetPtr
+xsltKeyLookup(xmlXPathParserContextPtr ctxt, const xmlChar *qname,
+	      const xmlChar *value) {
+    xmlNodeSetPtr nodelist = NULL;
+    xmlChar *key = NULL;
+    const xmlChar *keyURI;
+    xsltTransformContextPtr tctxt;
+    xmlChar *prefix;
+    xmlXPathContextPtr xpctxt = ctxt->context;
+    xmlNodePtr tmpNode = NULL;
+    xsltDocumentPtr oldDocInfo;
+
+    tctxt = xsltXPathGetTransformContext(ctxt);
+
+    oldDocInfo = tctxt->document;
+
+    if (xpctxt->node == NULL) {
+	xsltTransformError(tctxt, NULL, tctxt->inst,
+	    "Internal error in xsltKeyFunction(): "
+	    "The context node is not set on the XPath context.\n");
+	XSLT_SET_STATE(tctxt, XSLT_STATE_STOPPED);
+	goto error;
+    }
+    /*
+     * Get the associated namespace URI if qualified name
+     */
+    key = xmlSplitQName2(qname, &prefix);
+    if (key == NULL) {
+	key = xmlStrdup(qname);
+	keyURI = NULL;
+	if (prefix != NULL)
+	    xmlFree(prefix);
+    } else {
+	if (prefix != NULL) {
+	    keyURI = xmlXPathNsLookup(xpctxt, prefix);
+	    if (keyURI == NULL) {
+		xsltTransformError(tctxt, NULL, tctxt->inst,
+		    "key() : prefix %s is not bound\n", prefix);
+		/*
+		* TODO: Shouldn't we stop here?
+		*/
+	    }
+	    xmlFree(prefix);
+	} else {
+	    keyURI = NULL;
+	}
+    }
+
+    /*
+    * We need to ensure that ctxt->document is available for
+    * xsltGetKey().
+    * First find the relevant doc, which is the context node's
+    * owner doc; using context->doc is not safe, since
+    * the doc could have been acquired via the document() function,
+    * or the doc might be a Result Tree Fragment.
+    * FUTURE INFO: In XSLT 2.0 the key() function takes an additional
+    * argument indicating the doc to use.
+    */
+    if (xpctxt->node->type == XML_NAMESPACE_DECL) {
+	/*
+	* REVISIT: This is a libxml hack! Check xpath.c for details.
+	* The XPath module sets the owner element of a ns-node on
+	* the ns->next field.
+	*/
+	if ((((xmlNsPtr) xpctxt->node)->next != NULL) &&
+	    (((xmlNsPtr) xpctxt->node)->next->type == XML_ELEMENT_NODE))
+	{
+	    tmpNode = (xmlNodePtr) ((xmlNsPtr) xpctxt->node)->next;
+	}
+    } else
+	tmpNode = xpctxt->node;
+
+    if ((tmpNode == NULL) || (tmpNode->doc == NULL)) {
+	xsltTransformError(tctxt, NULL, tctxt->inst,
+	    "Internal error in xsltKeyFunction(): "
+	    "Couldn't get the doc of the XPath context node.\n");
+	goto error;
+    }
+
+    if ((tctxt->document == NULL) ||
+	(tctxt->document->doc != tmpNode->doc))
+    {
+	if (tmpNode->doc->name && (tmpNode->doc->name[0] == ' ')) {
+	    /*
+	    * This is a Result Tree Fragment.
+	    */
+	    if (tmpNode->doc->_private == NULL) {
+		tmpNode->doc->_private = xsltNewDocument(tctxt, tmpNode->doc);
+		if (tmpNode->doc->_private == NULL)
+		    goto error;
+	    }
+	    tctxt->document = (xsltDocumentPtr) tmpNode->doc->_private;
+	} else {
+	    /*
+	    * May be the initial source doc or a doc acquired via the
+	    * document() function.
+	    */
+	    tctxt->document = xsltFindDocument(tctxt, tmpNode->doc);
+	}
+	if (tctxt->document == NULL) {
+	    xsltTransformError(tctxt, NULL, tctxt->inst,
+		"Internal error in xsltKeyFunction(): "
+		"Could not get the document info of a context doc.\n");
+	    XSLT_SET_STATE(tctxt, XSLT_STATE_STOPPED);
+	    goto error;
+	}
+    }
+    /*
+    * Get/compute the key value.
+    */
+    nodelist = xsltGetKey(tctxt, key, keyURI, value);
+
+error:
+    tctxt->document = oldDocInfo;
+    if (key != NULL)
+	xmlFree(key);
+    return(nodelist);
+}
+
 /**
  * xsltKeyFunction:
  * @ctxt:  the XPath Parser context
@@ -412,51 +545,10 @@ xsltKeyFunction(xmlXPathParserContextPtr ctxt, int nargs){
 	valuePush(ctxt, ret);
     } else {
 	xmlNodeSetPtr nodelist = NULL;
-	xmlChar *key = NULL, *value;
-	const xmlChar *keyURI;
 	xsltTransformContextPtr tctxt;
-	xmlChar *qname, *prefix;
-	xmlXPathContextPtr xpctxt = ctxt->context;
-	xmlNodePtr tmpNode = NULL;
-	xsltDocumentPtr oldDocInfo;
 
 	tctxt = xsltXPathGetTransformContext(ctxt);
 
-	oldDocInfo = tctxt->document;
-
-	if (xpctxt->node == NULL) {
-	    xsltTransformError(tctxt, NULL, tctxt->inst,
-		"Internal error in xsltKeyFunction(): "
-		"The context node is not set on the XPath context.\n");
-	    tctxt->state = XSLT_STATE_STOPPED;
-	    goto error;
-	}
-	/*
-	 * Get the associated namespace URI if qualified name
-	 */
-	qname = obj1->stringval;
-	key = xmlSplitQName2(qname, &prefix);
-	if (key == NULL) {
-	    key = xmlStrdup(obj1->stringval);
-	    keyURI = NULL;
-	    if (prefix != NULL)
-		xmlFree(prefix);
-	} else {
-	    if (prefix != NULL) {
-		keyURI = xmlXPathNsLookup(xpctxt, prefix);
-		if (keyURI == NULL) {
-		    xsltTransformError(tctxt, NULL, tctxt->inst,
-			"key() : prefix %s is not bound\n", prefix);
-		    /*
-		    * TODO: Shouldn't we stop here?
-		    */
-		}
-		xmlFree(prefix);
-	    } else {
-		keyURI = NULL;
-	    }
-	}
-
 	/*
 	 * Force conversion of first arg to string
 	 */
@@ -467,80 +559,11 @@ xsltKeyFunction(xmlXPathParserContextPtr ctxt, int nargs){
 	    xsltTransformError(tctxt, NULL, tctxt->inst,
 		"key() : invalid arg expecting a string\n");
 	    ctxt->error = XPATH_INVALID_TYPE;
-	    goto error;
-	}
-	value = obj2->stringval;
-
-	/*
-	* We need to ensure that ctxt->document is available for
-	* xsltGetKey().
-	* First find the relevant doc, which is the context node's
-	* owner doc; using context->doc is not safe, since
-	* the doc could have been acquired via the document() function,
-	* or the doc might be a Result Tree Fragment.
-	* FUTURE INFO: In XSLT 2.0 the key() function takes an additional
-	* argument indicating the doc to use.
-	*/
-	if (xpctxt->node->type == XML_NAMESPACE_DECL) {
-	    /*
-	    * REVISIT: This is a libxml hack! Check xpath.c for details.
-	    * The XPath module sets the owner element of a ns-node on
-	    * the ns->next field.
-	    */
-	    if ((((xmlNsPtr) xpctxt->node)->next != NULL) &&
-		(((xmlNsPtr) xpctxt->node)->next->type == XML_ELEMENT_NODE))
-	    {
-		tmpNode = (xmlNodePtr) ((xmlNsPtr) xpctxt->node)->next;
-	    }
-	} else
-	    tmpNode = xpctxt->node;
-
-	if ((tmpNode == NULL) || (tmpNode->doc == NULL)) {
-	    xsltTransformError(tctxt, NULL, tctxt->inst,
-		"Internal error in xsltKeyFunction(): "
-		"Couldn't get the doc of the XPath context node.\n");
-	    goto error;
-	}
-
-	if ((tctxt->document == NULL) ||
-	    (tctxt->document->doc != tmpNode->doc))
-	{
-	    if (tmpNode->doc->name && (tmpNode->doc->name[0] == ' ')) {
-		/*
-		* This is a Result Tree Fragment.
-		*/
-		if (tmpNode->doc->_private == NULL) {
-		    tmpNode->doc->_private = xsltNewDocument(tctxt, tmpNode->doc);
-		    if (tmpNode->doc->_private == NULL)
-			goto error;
-		}
-		tctxt->document = (xsltDocumentPtr) tmpNode->doc->_private;
-	    } else {
-		/*
-		* May be the initial source doc or a doc acquired via the
-		* document() function.
-		*/
-		tctxt->document = xsltFindDocument(tctxt, tmpNode->doc);
-	    }
-	    if (tctxt->document == NULL) {
-		xsltTransformError(tctxt, NULL, tctxt->inst,
-		    "Internal error in xsltKeyFunction(): "
-		    "Could not get the document info of a context doc.\n");
-		tctxt->state = XSLT_STATE_STOPPED;
-		goto error;
-	    }
+	} else {
+	    nodelist = xsltKeyLookup(ctxt, obj1->stringval, obj2->stringval);
 	}
-	/*
-	* Get/compute the key value.
-	*/
-	nodelist = xsltGetKey(tctxt, key, keyURI, value);
-
-error:
-	tctxt->document = oldDocInfo;
 	valuePush(ctxt, xmlXPathWrapNodeSet(
 	    xmlXPathNodeSetMerge(NULL, nodelist)));
-	if (key != NULL)
-	    xmlFree(key);
     }
 
     if (obj1 != NULL)
@@ -549,6 +572,70 @@ error:
 	xmlXPathFreeObject(obj2);
 }
 
+/**
+ * xsltFirstInKeyFunction:
+ * @ctxt:  the XPath Parser context
+ * @nargs:  the number of arguments
+ *
+ * Implement the test of the Muenchian grouping method, to which
+ * xsltXPathCompile() rewrites the predicates
+ * generate-id() = generate-id(key(name, value)[1]) and
+ * count(. | key(name, value)[1]) = 1:
+ *   boolean libxslt:first-in-key(string, object, boolean)
+ * It is true if the context node is the first node of key(name, value),
+ * and equal to the last argument if that node-set is empty. Unlike
+ * key(), it doesn't copy the nodes of the key.
+ */
+static void
+xsltFirstInKeyFunction(xmlXPathParserContextPtr ctxt, int nargs) {
+    xmlXPathObjectPtr value;
+    xmlNodeSetPtr nodelist = NULL;
+    xmlChar *name, *str;
+    int empty, i;
+
+    if (nargs != 3) {
+	xmlXPathSetArityError(ctxt);
+	return;
+    }
+    empty = xmlXPathPopBoolean(ctxt);
+    value = valuePop(ctxt);
+    name = xmlXPathPopString(ctxt);
+    if ((value == NULL) || (name == NULL) || (ctxt->error != 0)) {
+	xmlXPathFreeObject(value);
+	xmlFree(name);
+	xmlXPathSetError(ctxt, XPATH_INVALID_OPERAND);
+	return;
+    }
+
+    if ((value->type == XPATH_NODESET) || (value->type == XPATH_XSLT_TREE)) {
+	/* The first node of the union comes from the first value found. */
+	for (i = 0; (value->nodesetval != NULL) &&
+		    (i < value->nodesetval->nodeNr); i++) {
+	    str = xmlXPathCastNodeToString(value->nodesetval->nodeTab[i]);
+	    if (str == NULL)
+		break;
+	    nodelist = xsltKeyLookup(ctxt, name, str);
+	    xmlFree(str);
+	    if ((nodelist != NULL) && (nodelist->nodeNr > 0))
+		break;
+	}
+    } else {
+	str = xmlXPathCastToString(value);
+	if (str != NULL) {
+	    nodelist = xsltKeyLookup(ctxt, name, str);
+	    xmlFree(str);
+	}
+    }
+
+    if ((nodelist == NULL) || (nodelist->nodeNr == 0))
+	valuePush(ctxt, xmlXPathNewBoolean(empty));
+    else
+	valuePush(ctxt, xmlXPathNewBoolean(
+	    nodelist->nodeTab[0] == ctxt->context->node));
+    xmlXPathFreeObject(value);
+    xmlFree(name);
+}
+
 /**
  * xsltUnparsedEntityURIFunction:
  * @ctxt:  the XPath Parser context
@@ -683,6 +770,43 @@ xsltFormatNumberFunction(xmlXPathParserContextPtr ctxt, int nargs)
     xmlXPathFreeObject(decimalObj);
 }
 
+/*
+ * Returns the first node of @nodelist in document order or NULL if it
+ * is empty. Node-sets from key() or extension functions aren't always
+ * sorted.
+ */
+static xmlNodePtr
+xsltFirstNodeInDocOrder(xmlNodeSetPtr nodelist) {
+    xmlNodePtr cur;
+    int i;
+
+    if ((nodelist == NULL) || (nodelist->nodeNr <= 0))
+        return(NULL);
+    cur = nodelist->nodeTab[0];
+    for (i = 1;i < nodelist->nodeNr;i++) {
+        if (xmlXPathCmpNodes(cur, nodelist->nodeTab[i]) == -1)
+            cur = nodelist->nodeTab[i];
+    }
+    return(cur);
+}
+
+/*
+ * Returns where the identifier of @cur is stored, or NULL after
+ * reporting an error if @cur can't have one.
+ */
+static void **
+xsltIdPSVIPtr(xmlXPathParserContextPtr ctxt, xmlNodePtr cur) {
+    void **psviPtr;
+
+    psviPtr = xsltGetPSVIPtr(cur);
+    if (psviPtr == NULL) {
+        xsltTransformError(xsltXPathGetTransformContext(ctxt), NULL, NULL,
+                "generate-id(): invalid node type %d\n", cur->type);
+        ctxt->error = XPATH_INVALID_TYPE;
+    }
+    return(psviPtr);
+}
+
 /**
  * xsltGenerateIdFunction:
  * @ctxt:  the XPath Parser context
@@ -708,7 +832,6 @@ xsltGenerateIdFunction(xmlXPathParserContextPtr ctxt, int nargs){
 	cur = ctxt->context->node;
     } else if (nargs == 1) {
 	xmlNodeSetPtr nodelist;
-	int i, ret;
 
 	if ((ctxt->value == NULL) || (ctxt->value->type != XPATH_NODESET)) {
 	    ctxt->error = XPATH_INVALID_TYPE;
@@ -722,12 +845,7 @@ xsltGenerateIdFunction(xmlXPathParserContextPtr ctxt, int nargs){
 	    valuePush(ctxt, xmlXPathNewCString(""));
 	    goto out;
 	}
-	cur = nodelist->nodeTab[0];
-	for (i = 1;i < nodelist->nodeNr;i++) {
-	    ret = xmlXPathCmpNodes(cur, nodelist->nodeTab[i]);
-	    if (ret == -1)
-	        cur = nodelist->nodeTab[i];
-	}
+	cur = xsltFirstNodeInDocOrder(nodelist);
     } else {
 	xsltTransformError(tctxt, NULL, NULL,
 		"generate-id() : invalid number of args %d\n", nargs);
@@ -751,13 +869,9 @@ xsltGenerateIdFunction(xmlXPathParserContextPtr ctxt, int nargs){
         cur = (xmlNodePtr) ns->next;
     }
 
-    psviPtr = xsltGetPSVIPtr(cur);
-    if (psviPtr == NULL) {
-        xsltTransformError(tctxt, NULL, NULL,
-                "generate-id(): invalid node type %d\n", cur->type);
-        ctxt->error = XPATH_INVALID_TYPE;
+    psviPtr = xsltIdPSVIPtr(ctxt, cur);
+    if (psviPtr == NULL)
         goto out;
-    }
 
     if (xsltGetSourceNodeFlags(cur) & XSLT_SOURCE_NODE_HAS_ID) {
         id = (unsigned long) (size_t) *psviPtr;
@@ -818,6 +932,73 @@ out:
     xmlXPathFreeObject(obj);
 }
 
+/**
+ * xsltSameIdFunction:
+ * @ctxt:  the XPath Parser context
+ * @nargs:  the number of arguments
+ *
+ * Implement the comparison of identifiers to which xsltXPathCompile()
+ * rewrites generate-id(a) = generate-id(b):
+ *   boolean libxslt:same-id(node-set, node-set)
+ * It is true if the first nodes of both node-sets in document order
+ * would get the same identifier, without generating any identifier.
+ */
+static void
+xsltSameIdFunction(xmlXPathParserContextPtr ctxt, int nargs) {
+    xmlXPathObjectPtr obj1, obj2;
+    xmlNodePtr cur1, cur2, cur;
+    int ret, i;
+
+    if (nargs != 2) {
+	xmlXPathSetArityError(ctxt);
+	return;
+    }
+    if ((ctxt->value == NULL) || (ctxt->value->type != XPATH_NODESET) ||
+        (ctxt->valueNr < 2) ||
+        (ctxt->valueTab[ctxt->valueNr - 2]->type != XPATH_NODESET)) {
+	xsltTransformError(xsltXPathGetTransformContext(ctxt), NULL, NULL,
+		"generate-id() : invalid arg expecting a node-set\n");
+	ctxt->error = XPATH_INVALID_TYPE;
+	return;
+    }
+    obj2 = valuePop(ctxt);
+    obj1 = valuePop(ctxt);
+
+    cur1 = xsltFirstNodeInDocOrder(obj1->nodesetval);
+    cur2 = xsltFirstNodeInDocOrder(obj2->nodesetval);
+    /*
+    * Refuse the nodes for which generate-id() fails. Namespace nodes
+    * are identified by their parent, stored in 'next', and prefix.
+    */
+    for (i = 0; i < 2; i++) {
+        cur = (i == 0) ? cur1 : cur2;
+        if (cur == NULL)
+            continue;
+        if (cur->type == XML_NAMESPACE_DECL)
+            cur = (xmlNodePtr) ((xmlNsPtr) cur)->next;
+        if (xsltIdPSVIPtr(ctxt, cur) == NULL)
+            goto out;
+    }
+    if ((cur1 == NULL) || (cur2 == NULL)) {
+        /* The identifier of an empty node-set is the empty string. */
+        ret = (cur1 == cur2);
+    } else if ((cur1->type == XML_NAMESPACE_DECL) ||
+               (cur2->type == XML_NAMESPACE_DECL)) {
+        xmlNsPtr ns1 = (xmlNsPtr) cur1, ns2 = (xmlNsPtr) cur2;
+
+        ret = ((cur1->type == cur2->type) && (ns1->next == ns2->next) &&
+               (xmlStrEqual(ns1->prefix ? ns1->prefix : BAD_CAST "",
+                            ns2->prefix ? ns2->prefix : BAD_CAST "")));
+    } else {
+        ret = (cur1 == cur2);
+    }
+    valuePush(ctxt, xmlXPathNewBoolean(ret));
+
+out:
+    xmlXPathFreeObject(obj1);
+    xmlXPathFreeObject(obj2);
+}
+
 /**
  * xsltSystemPropertyFunction:
  * @ctxt:  the XPath Parser context
@@ -1092,4 +1273,12 @@ xsltRegisterAllFunctions(xmlXPathContextPtr ctxt)
                          xsltElementAvailableFunction);
     xmlXPathRegisterFunc(ctxt, (const xmlChar *) "function-available",
                          xsltFunctionAvailableFunction);
+
+    /*
+     * Targets of the rewrites of xsltXPathCompile().
+     */
+    xmlXPathRegisterFuncNS(ctxt, (const xmlChar *) "first-in-key",
+                           XSLT_LIBXSLT_NAMESPACE, xsltFirstInKeyFunction);
+    xmlXPathRegisterFuncNS(ctxt, (const xmlChar *) "same-id",
+                           XSLT_LIBXSLT_NAMESPACE, xsltSameIdFunction);
 }
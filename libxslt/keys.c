@@ -28,6 +28,7 @@
 #include "imports.h"
 #include "templates.h"
 #include "keys.h"
+#include "xsltprivate.h"
 
 #ifdef WITH_XSLT_DEBUG
 #define WITH_XSLT_DEBUG_KEYS
@@ -532,7 +533,7 @@ fprintf(stderr, "xsltInitDocKeyTable %s\n", name);
 #endif
 	xsltTransformError(ctxt, NULL, keyd? keyd->inst : NULL,
 	    "Failed to find key definition for %s\n", name);
-	ctxt->state = XSLT_STATE_STOPPED;
+	XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
         return(-1);
     }
 #ifdef KEY_INIT_DEBUG
@@ -658,7 +659,7 @@ fprintf(stderr, "xsltInitCtxtKey %s : %d\n", keyDef->name, ctxt->keyInitLevel);
 #endif
 	xsltTransformError(ctxt, NULL, keyDef->inst,
 	    "Key definition for %s is recursive\n", keyDef->name);
-	ctxt->state = XSLT_STATE_STOPPED;
+	XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
         return(-1);
     }
     ctxt->keyInitLevel++;
@@ -705,7 +706,7 @@ fprintf(stderr, "xsltInitCtxtKey %s : %d\n", keyDef->name, ctxt->keyInitLevel);
 #endif
 	xsltTransformError(ctxt, NULL, keyDef->inst,
 	    "Failed to evaluate the 'match' expression.\n");
-	ctxt->state = XSLT_STATE_STOPPED;
+	XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
 	goto error;
     } else {
 	if (matchRes->type == XPATH_NODESET) {
@@ -727,7 +728,7 @@ fprintf(stderr, "xsltInitCtxtKey %s : %d\n", keyDef->name, ctxt->keyInitLevel);
 #endif
 	    xsltTransformError(ctxt, NULL, keyDef->inst,
 		"The 'match' expression did not evaluate to a node set.\n");
-	    ctxt->state = XSLT_STATE_STOPPED;
+	    XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
 	    goto error;
 	}
     }
@@ -787,7 +788,7 @@ fprintf(stderr, "xsltInitCtxtKey %s : %d\n", keyDef->name, ctxt->keyInitLevel);
 	if (useRes == NULL) {
 	    xsltTransformError(ctxt, NULL, keyDef->inst,
 		"Failed to evaluate the 'use' expression.\n");
-	    ctxt->state = XSLT_STATE_STOPPED;
+	    XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
 	    break;
 	}
 	if (useRes->type == XPATH_NODESET) {
@@ -34,6 +34,7 @@
 #include "keys.h"
 #include "pattern.h"
 #include "documents.h"
+#include "xsltprivate.h"
 
 #ifdef WITH_XSLT_DEBUG
 #define WITH_XSLT_DEBUG_PATTERN
@@ -488,7 +489,7 @@ xsltPatPushState(xsltTransformContextPtr ctxt, xsltStepStates *states,
 	if (tmp == NULL) {
 	    xsltGenericError(xsltGenericErrorContext,
 	     "xsltPatPushState: memory re-allocation failure.\n");
-	    ctxt->state = XSLT_STATE_STOPPED;
+	    XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
 	    return(-1);
 	}
 	states->states = tmp;
@@ -2258,7 +2259,7 @@ doc_info_mismatch:
 	"Internal error in xsltComputeAllKeys(): "
 	"The context's document info doesn't match the "
 	"document info of the current result tree.\n");
-    ctxt->state = XSLT_STATE_STOPPED;
+    XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
     return(-1);
 }
 
@@ -2532,3 +2533,355 @@ xsltFreeTemplateHashes(xsltStylesheetPtr style) {
         xmlHashFree(style->namedTemplates, NULL);
 }
 
+
+/************************************************************************
+ *									*
+ *			Streamability checks				*
+ *									*
+ ************************************************************************/
+
+#define IS_STREAM_NAME_START(c)						\
+    ((((c) >= 'a') && ((c) <= 'z')) || (((c) >= 'A') && ((c) <= 'Z')) || \
+     ((c) == '_') || ((c) >= 0x80))
+
+#define IS_STREAM_NAME_CHAR(c)						\
+    (IS_STREAM_NAME_START(c) || (((c) >= '0') && ((c) <= '9')) ||	\
+     ((c) == '.') || ((c) == '-'))
+
+/*
+ * Skip a QName, a "prefix:*" name test or a "*" and return the
+ * position after it.
+ */
+static const xmlChar *
+xsltStreamSkipName(const xmlChar *cur) {
+    if (*cur == '*')
+        return(cur + 1);
+    while (IS_STREAM_NAME_CHAR(*cur))
+        cur++;
+    if ((cur[0] == ':') && (cur[1] != ':')) {
+        cur++;
+        if (*cur == '*')
+            return(cur + 1);
+        while (IS_STREAM_NAME_CHAR(*cur))
+            cur++;
+    }
+    return(cur);
+}
+
+static int
+xsltStreamNameIs(const xmlChar *name, int len, const char *str) {
+    return((len == (int) strlen(str)) &&
+           (memcmp(name, str, len) == 0));
+}
+
+/**
+ * xsltStreamableExpr:
+ * @expr:  an XPath expression
+ * @flags:  XSLT_STREAM_LOCAL and XSLT_STREAM_PREDICATE
+ * @reason:  where to store why the expression is not streamable
+ *
+ * Check whether the expression can be evaluated while the input is
+ * read in a single forward pass: it may only use the child, descendant,
+ * self, attribute and namespace axes, relative paths and no last(),
+ * key() or id(). With XSLT_STREAM_LOCAL the expression must not look
+ * at the children of the context node either. With
+ * XSLT_STREAM_PREDICATE the expression is a pattern predicate which
+ * must not depend on the position of the node.
+ *
+ * The check is lexical and errs on the conservative side.
+ *
+ * Returns 1 if the expression is streamable, 0 otherwise.
+ */
+int
+xsltStreamableExpr(const xmlChar *expr, int flags, const char **reason) {
+    const xmlChar *cur = expr;
+    int operand = 0;		/* the previous token ends an operand */
+    int axisOk = 0;		/* the next node test is on a local axis */
+    int local = flags & XSLT_STREAM_LOCAL;
+
+    if (expr == NULL)
+        return(1);
+
+    if (flags & XSLT_STREAM_PREDICATE) {
+        const xmlChar *end;
+
+        while (xmlIsBlank_ch(*cur))
+            cur++;
+        end = cur;
+        if (*end == '$') {
+            end = xsltStreamSkipName(end + 1);
+        } else {
+            while (((*end >= '0') && (*end <= '9')) || (*end == '.'))
+                end++;
+        }
+        while (xmlIsBlank_ch(*end))
+            end++;
+        if ((end != cur) && (*end == 0)) {
+            *reason = "positional predicates need the preceding siblings";
+            return(0);
+        }
+        cur = expr;
+    }
+
+    while (*cur != 0) {
+        xmlChar c = *cur;
+
+        if (xmlIsBlank_ch(c)) {
+            cur++;
+            continue;
+        }
+        if ((c == '"') || (c == '\'')) {
+            cur++;
+            while ((*cur != 0) && (*cur != c))
+                cur++;
+            if (*cur != 0)
+                cur++;
+            operand = 1;
+            continue;
+        }
+        if (((c >= '0') && (c <= '9')) ||
+            ((c == '.') && (cur[1] >= '0') && (cur[1] <= '9'))) {
+            while (((*cur >= '0') && (*cur <= '9')) || (*cur == '.'))
+                cur++;
+            operand = 1;
+            continue;
+        }
+        if (c == '$') {
+            cur = xsltStreamSkipName(cur + 1);
+            operand = 1;
+            continue;
+        }
+        if (c == '.') {
+            if (cur[1] == '.') {
+                *reason = "'..' selects the parent node";
+                return(0);
+            }
+            if (local) {
+                *reason = "'.' uses the content of the context node";
+                return(0);
+            }
+            cur++;
+            operand = 1;
+            continue;
+        }
+        if (c == '/') {
+            if (!operand) {
+                *reason = "absolute paths select from the whole input";
+                return(0);
+            }
+            cur += (cur[1] == '/') ? 2 : 1;
+            operand = 0;
+            axisOk = 0;
+            continue;
+        }
+        if (c == '@') {
+            cur = xsltStreamSkipName(cur + 1);
+            operand = 1;
+            continue;
+        }
+        if ((c == '*') && (operand)) {
+            /* multiplication */
+            cur++;
+            operand = 0;
+            continue;
+        }
+        if ((c == '*') || (IS_STREAM_NAME_START(c))) {
+            const xmlChar *name = cur;
+            const xmlChar *next;
+            int len;
+
+            cur = xsltStreamSkipName(cur);
+            len = cur - name;
+            next = cur;
+            while (xmlIsBlank_ch(*next))
+                next++;
+
+            if ((next[0] == ':') && (next[1] == ':')) {
+                if (xsltStreamNameIs(name, len, "self") ||
+                    xsltStreamNameIs(name, len, "attribute") ||
+                    xsltStreamNameIs(name, len, "namespace")) {
+                    axisOk = 1;
+                } else if (xsltStreamNameIs(name, len, "child") ||
+                           xsltStreamNameIs(name, len, "descendant") ||
+                           xsltStreamNameIs(name, len, "descendant-or-self")) {
+                    if (local) {
+                        *reason = "it selects the children of the "
+                                  "context node";
+                        return(0);
+                    }
+                    axisOk = 1;
+                } else {
+                    *reason = "only the downward axes are streamable";
+                    return(0);
+                }
+                cur = next + 2;
+                operand = 0;
+                continue;
+            }
+            if ((operand) &&
+                (xsltStreamNameIs(name, len, "and") ||
+                 xsltStreamNameIs(name, len, "or") ||
+                 xsltStreamNameIs(name, len, "mod") ||
+                 xsltStreamNameIs(name, len, "div"))) {
+                operand = 0;
+                continue;
+            }
+            if (*next == '(') {
+                if (xsltStreamNameIs(name, len, "last")) {
+                    *reason = "last() needs the following nodes";
+                    return(0);
+                }
+                if (xsltStreamNameIs(name, len, "key") ||
+                    xsltStreamNameIs(name, len, "id")) {
+                    *reason = "key() and id() index the whole input";
+                    return(0);
+                }
+                if ((flags & XSLT_STREAM_PREDICATE) &&
+                    (xsltStreamNameIs(name, len, "position"))) {
+                    *reason = "positional predicates need the preceding "
+                              "siblings";
+                    return(0);
+                }
+                if ((local) && (!axisOk) &&
+                    (xsltStreamNameIs(name, len, "node") ||
+                     xsltStreamNameIs(name, len, "text") ||
+                     xsltStreamNameIs(name, len, "comment") ||
+                     xsltStreamNameIs(name, len, "processing-instruction"))) {
+                    *reason = "it selects the children of the context node";
+                    return(0);
+                }
+                cur = next + 1;
+                operand = 0;
+                axisOk = 0;
+                continue;
+            }
+            if ((local) && (!axisOk)) {
+                *reason = "it selects the children of the context node";
+                return(0);
+            }
+            operand = 1;
+            axisOk = 0;
+            continue;
+        }
+        if ((c == ')') || (c == ']')) {
+            cur++;
+            operand = 1;
+            continue;
+        }
+        /* '(', '[', ',', '|' and the operators */
+        cur++;
+        operand = 0;
+        axisOk = 0;
+    }
+
+    return(1);
+}
+
+/**
+ * xsltStreamableChildStep:
+ * @expr:  an XPath expression
+ *
+ * Returns 1 if the expression is a single child step without
+ * predicates like "item", "p:*" or "node()", 0 otherwise.
+ */
+int
+xsltStreamableChildStep(const xmlChar *expr) {
+    const xmlChar *cur = expr, *end;
+
+    if (expr == NULL)
+        return(0);
+    while (xmlIsBlank_ch(*cur))
+        cur++;
+    if (xmlStrncmp(cur, BAD_CAST "child::", 7) == 0)
+        cur += 7;
+    if ((*cur != '*') && (!IS_STREAM_NAME_START(*cur)))
+        return(0);
+    end = xsltStreamSkipName(cur);
+    if (xsltStreamNameIs(cur, end - cur, "node") ||
+        xsltStreamNameIs(cur, end - cur, "text") ||
+        xsltStreamNameIs(cur, end - cur, "comment") ||
+        xsltStreamNameIs(cur, end - cur, "processing-instruction")) {
+        cur = end;
+        while (xmlIsBlank_ch(*cur))
+            cur++;
+        if (*cur == '(') {
+            cur++;
+            while (xmlIsBlank_ch(*cur))
+                cur++;
+            if (*cur != ')')
+                return(0);
+            end = cur + 1;
+        }
+    }
+    while (xmlIsBlank_ch(*end))
+        end++;
+    return(*end == 0);
+}
+
+/**
+ * xsltStreamablePattern:
+ * @comp:  a compiled pattern
+ * @top:  where to store which top-level nodes the pattern can match
+ * @reason:  where to store why the pattern is not streamable
+ *
+ * Check whether the pattern can be matched while the input is read in
+ * a single forward pass. The ancestors of a node are available, its
+ * preceding siblings are not. On return @top has XSLT_STREAM_DOC set
+ * if the pattern can match the document node, XSLT_STREAM_ROOT if it
+ * matches the document element as such and XSLT_STREAM_ANY if it can
+ * match the document element as well as deeper elements.
+ *
+ * Returns 1 if the pattern is streamable, 0 otherwise.
+ */
+int
+xsltStreamablePattern(xsltCompMatchPtr comp, int *top, const char **reason) {
+    int i, j, elem, doc;
+
+    *top = 0;
+    for (; comp != NULL; comp = comp->next) {
+        if (comp->direct) {
+            *reason = "consecutive predicates are evaluated over the "
+                      "whole input";
+            return(0);
+        }
+        elem = doc = 0;
+        for (j = 0; j < comp->nbStep; j++) {
+            xsltOp op = comp->steps[j].op;
+
+            if ((op == XSLT_OP_PARENT) || (op == XSLT_OP_ANCESTOR))
+                break;
+            if (op == XSLT_OP_ROOT)
+                doc = 1;
+            else if ((op == XSLT_OP_ELEM) || (op == XSLT_OP_ALL) ||
+                     (op == XSLT_OP_NS) || (op == XSLT_OP_NODE))
+                elem = 1;
+        }
+        for (i = 0; i < comp->nbStep; i++) {
+            switch (comp->steps[i].op) {
+                case XSLT_OP_ID:
+                case XSLT_OP_KEY:
+                    *reason = "key() and id() index the whole input";
+                    return(0);
+                case XSLT_OP_PREDICATE:
+                    if (!xsltStreamableExpr(comp->steps[i].value,
+                                            XSLT_STREAM_PREDICATE, reason))
+                        return(0);
+                    break;
+                default:
+                    break;
+            }
+        }
+        if (doc)
+            *top |= XSLT_STREAM_DOC;
+        if (!elem)
+            continue;
+        if ((j < comp->nbStep) && (comp->steps[j].op == XSLT_OP_PARENT) &&
+            (j + 1 < comp->nbStep) && (comp->steps[j + 1].op == XSLT_OP_ROOT))
+            *top |= XSLT_STREAM_ROOT;
+        else if ((j >= comp->nbStep) ||
+                 ((j + 1 < comp->nbStep) &&
+                  (comp->steps[j + 1].op == XSLT_OP_ROOT)))
+            *top |= XSLT_STREAM_ANY;
+    }
+    return(1);
+}
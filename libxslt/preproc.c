@@ -40,6 +40,8 @@
 #include "imports.h"
 #include "extensions.h"
 #include "pattern.h"
+#include "attributes.h"
+#include "xsltprivate.h"
 
 #ifdef WITH_XSLT_DEBUG
 #define WITH_XSLT_DEBUG_PREPROC
@@ -303,14 +305,14 @@ xsltNewStylePreComp(xsltStylesheetPtr style, xsltStyleType type) {
     /*
     * Old behaviour.
     */
-    cur = (xsltStylePreCompPtr) xmlMalloc(sizeof(xsltStylePreComp));
+    cur = (xsltStylePreCompPtr) xmlMalloc(sizeof(xsltStylePreCompPriv));
     if (cur == NULL) {
 	xsltTransformError(NULL, style, NULL,
 		"xsltNewStylePreComp : malloc failed\n");
 	style->errors++;
 	return(NULL);
     }
-    memset(cur, 0, sizeof(xsltStylePreComp));
+    memset(cur, 0, sizeof(xsltStylePreCompPriv));
 #endif /* XSLT_REFACTORED */
 
     /*
@@ -798,6 +800,11 @@ xsltCopyComp(xsltStylesheetPtr style, xmlNodePtr inst) {
 	comp->has_use = 0;
     else
 	comp->has_use = 1;
+#ifndef XSLT_REFACTORED
+    if (comp->use != NULL)
+	XSLT_COMP_PRIV(comp)->useAttrSets =
+	    xsltCompileUseAttributeSets(style, inst, comp->use);
+#endif
 }
 
 #ifdef XSLT_REFACTORED
@@ -967,6 +974,11 @@ xsltElementComp(xsltStylesheetPtr style, xmlNodePtr inst) {
     comp->use = xsltEvalStaticAttrValueTemplate(style, inst,
 		       (const xmlChar *)"use-attribute-sets",
 		       NULL, &comp->has_use);
+#ifndef XSLT_REFACTORED
+    if (comp->use != NULL)
+	XSLT_COMP_PRIV(comp)->useAttrSets =
+	    xsltCompileUseAttributeSets(style, inst, comp->use);
+#endif
 
 error:
     return;
@@ -1349,6 +1361,11 @@ xsltWithParamComp(xsltStylesheetPtr style, xmlNodePtr inst) {
 	return;
     inst->psvi = comp;
     comp->inst = inst;
+    /*
+    * Bound to a parameter slot of the called template, if any, by
+    * xsltResolveCallTemplates().
+    */
+    XSLT_COMP_PRIV(comp)->slot = -1;
 
     /*
     * Attribute "name".
@@ -1827,6 +1844,11 @@ xsltVariableComp(xsltStylesheetPtr style, xmlNodePtr inst) {
 
     inst->psvi = comp;
     comp->inst = inst;
+    /*
+    * Local variables and params get their slot in the template's
+    * frame assigned by xsltNumberTemplateVariables().
+    */
+    XSLT_COMP_PRIV(comp)->slot = -1;
     /*
      * The full template resolution can be done statically
      */
@@ -1905,6 +1927,11 @@ xsltParamComp(xsltStylesheetPtr style, xmlNodePtr inst) {
 	return;
     inst->psvi = comp;
     comp->inst = inst;
+    /*
+    * Local variables and params get their slot in the template's
+    * frame assigned by xsltNumberTemplateVariables().
+    */
+    XSLT_COMP_PRIV(comp)->slot = -1;
 
     /*
      * Attribute "name".
@@ -2366,3 +2393,286 @@ xsltStylePreCompute(xsltStylesheetPtr style, xmlNodePtr inst) {
     }
 }
 #endif /* XSLT_REFACTORED */
+
+/************************************************************************
+ *									*
+ *			Streamability check				*
+ *									*
+ ************************************************************************/
+
+typedef struct _xsltStreamCheck xsltStreamCheck;
+typedef xsltStreamCheck *xsltStreamCheckPtr;
+struct _xsltStreamCheck {
+    xsltStylesheetPtr style;
+    int errors;
+    int quiet;			/* only count the errors */
+    xsltTemplatePtr *visited;	/* templates checked as top-level */
+    int nbVisited;
+    int maxVisited;
+};
+
+static void
+xsltStreamReport(xsltStreamCheckPtr check, xmlNodePtr node,
+                 const xmlChar *what, const char *reason) {
+    check->errors++;
+    if (check->quiet)
+        return;
+    xsltTransformError(NULL, check->style, node,
+                       "'%s' is not streamable: %s\n", what, reason);
+}
+
+static void
+xsltStreamCheckExpr(xsltStreamCheckPtr check, xmlNodePtr node,
+                    const xmlChar *expr, int top) {
+    const char *reason = NULL;
+
+    if (!xsltStreamableExpr(expr, top ? XSLT_STREAM_LOCAL : 0, &reason))
+        xsltStreamReport(check, node, expr, reason);
+}
+
+/*
+ * Check the expressions of the attribute value templates of @node.
+ */
+static void
+xsltStreamCheckAVTs(xsltStreamCheckPtr check, xmlNodePtr node, int top) {
+    xmlAttrPtr attr;
+
+    for (attr = node->properties; attr != NULL; attr = attr->next) {
+        const xmlChar *val, *start;
+        xmlChar *expr;
+
+        if ((attr->children == NULL) ||
+            (attr->children->type != XML_TEXT_NODE) ||
+            (attr->children->next != NULL))
+            continue;
+        if ((attr->ns == NULL) && (IS_XSLT_ELEM(node)) &&
+            (xmlStrEqual(attr->name, BAD_CAST "select") ||
+             xmlStrEqual(attr->name, BAD_CAST "test")))
+            continue;
+        val = attr->children->content;
+        while ((val = xmlStrchr(val, '{')) != NULL) {
+            if (val[1] == '{') {
+                val += 2;
+                continue;
+            }
+            start = ++val;
+            while ((*val != 0) && (*val != '}')) {
+                if ((*val == '"') || (*val == '\'')) {
+                    xmlChar quote = *val++;
+
+                    while ((*val != 0) && (*val != quote))
+                        val++;
+                    if (*val == 0)
+                        break;
+                }
+                val++;
+            }
+            expr = xmlStrndup(start, val - start);
+            if (expr != NULL) {
+                xsltStreamCheckExpr(check, node, expr, top);
+                xmlFree(expr);
+            }
+            if (*val == 0)
+                break;
+        }
+    }
+}
+
+static void xsltStreamCheckList(xsltStreamCheckPtr check, xmlNodePtr cur,
+                                int top);
+
+/*
+ * Check the body of a template, once for the templates processing the
+ * document node or the document element.
+ */
+static void
+xsltStreamCheckTemplate(xsltStreamCheckPtr check, xsltTemplatePtr templ,
+                        int top) {
+    int i;
+
+    if (top) {
+        for (i = 0; i < check->nbVisited; i++) {
+            if (check->visited[i] == templ)
+                return;
+        }
+        if (check->nbVisited >= check->maxVisited) {
+            xsltTemplatePtr *tmp;
+            int max = check->maxVisited ? check->maxVisited * 2 : 8;
+
+            tmp = (xsltTemplatePtr *) xmlRealloc(check->visited,
+                                        max * sizeof(xsltTemplatePtr));
+            if (tmp == NULL) {
+                xsltTransformError(NULL, check->style, templ->elem,
+                                   "xsltCheckStreamable: out of memory\n");
+                check->errors++;
+                return;
+            }
+            check->visited = tmp;
+            check->maxVisited = max;
+        }
+        check->visited[check->nbVisited++] = templ;
+    }
+    xsltStreamCheckList(check, templ->content, top);
+}
+
+/*
+ * Check a list of sequence constructors. @top is set if the context
+ * node is the document node or the document element, whose children
+ * are only read when templates are applied to them.
+ */
+static void
+xsltStreamCheckList(xsltStreamCheckPtr check, xmlNodePtr cur, int top) {
+    for (; cur != NULL; cur = cur->next) {
+        if (cur->type != XML_ELEMENT_NODE)
+            continue;
+        xsltStreamCheckAVTs(check, cur, top);
+        if (IS_XSLT_ELEM(cur) && (cur->psvi != NULL)) {
+#ifdef XSLT_REFACTORED
+            xsltStreamReport(check, cur, cur->name,
+                             "not supported by this build");
+#else
+            xsltStylePreCompPtr comp = (xsltStylePreCompPtr) cur->psvi;
+
+            switch (comp->type) {
+                case XSLT_FUNC_APPLYTEMPLATES:
+                    if (top) {
+                        xmlNodePtr child;
+
+                        /*
+                        * Applying templates to the children of the
+                        * document element pulls them from the input.
+                        */
+                        if (!xsltStreamableChildStep(comp->select))
+                            xsltStreamCheckExpr(check, cur, comp->select, 1);
+                        for (child = cur->children; child != NULL;
+                             child = child->next) {
+                            if (IS_XSLT_ELEM(child) &&
+                                IS_XSLT_NAME(child, "sort"))
+                                xsltStreamReport(check, child,
+                                    BAD_CAST "xsl:sort",
+                                    "sorting the top-level nodes needs "
+                                    "all of them");
+                        }
+                    } else {
+                        xsltStreamCheckExpr(check, cur, comp->select, 0);
+                    }
+                    break;
+                case XSLT_FUNC_NUMBER:
+                    if (comp->numdata.value == NULL)
+                        xsltStreamReport(check, cur, BAD_CAST "xsl:number",
+                                         "it counts the preceding nodes");
+                    else
+                        xsltStreamCheckExpr(check, cur, comp->numdata.value,
+                                            top);
+                    break;
+                case XSLT_FUNC_CALLTEMPLATE:
+                    if ((top) && (comp->templ != NULL))
+                        xsltStreamCheckTemplate(check, comp->templ, top);
+                    break;
+                case XSLT_FUNC_SORT:
+                    xsltStreamCheckExpr(check, cur, comp->select, 0);
+                    break;
+                case XSLT_FUNC_IF:
+                case XSLT_FUNC_WHEN:
+                    xsltStreamCheckExpr(check, cur, comp->test, top);
+                    break;
+                default:
+                    xsltStreamCheckExpr(check, cur, comp->select, top);
+                    break;
+            }
+#endif
+        }
+        xsltStreamCheckList(check, cur->children, top);
+    }
+}
+
+/**
+ * xsltCheckStreamable:
+ * @style:  a compiled XSLT stylesheet
+ *
+ * Check whether the stylesheet can transform its input while it is
+ * read in a single forward pass, see xsltApplyStylesheetStream().
+ * The children of the document element are read one by one when
+ * templates are applied to them and freed afterwards, so the patterns
+ * and expressions may only look downwards, and the templates for the
+ * document node and the document element may only use its attributes.
+ * Every construct preventing streaming is reported as an error.
+ *
+ * Returns 1 if the stylesheet is streamable, 0 if not.
+ */
+int
+xsltCheckStreamable(xsltStylesheetPtr style) {
+    xsltStreamCheck check;
+    xsltStylesheetPtr cur;
+    xsltTemplatePtr templ;
+    xmlNodePtr root, child;
+
+    if (style == NULL)
+        return(0);
+    memset(&check, 0, sizeof(check));
+    check.style = style;
+
+    for (cur = style; cur != NULL; cur = xsltNextImport(cur)) {
+        root = xmlDocGetRootElement(cur->doc);
+        if (cur->keys != NULL)
+            xsltStreamReport(&check, root, BAD_CAST "xsl:key",
+                             "keys index the whole input");
+
+        for (templ = cur->templates; templ != NULL; templ = templ->next) {
+            xsltCompMatchPtr pat;
+            const char *reason = NULL;
+            int top = 0;
+
+            if (templ->match != NULL) {
+                pat = xsltCompilePattern(templ->match, cur->doc, templ->elem,
+                                         cur, NULL);
+                if (pat != NULL) {
+                    if (!xsltStreamablePattern(pat, &top, &reason))
+                        xsltStreamReport(&check, templ->elem, templ->match,
+                                         reason);
+                    xsltFreeCompMatchList(pat);
+                }
+            }
+            XSLT_TEMPL_PRIV(templ)->streamNoRoot = 0;
+            if (top & (XSLT_STREAM_DOC | XSLT_STREAM_ROOT)) {
+                xsltStreamCheckTemplate(&check, templ, 1);
+            } else {
+                xsltStreamCheckTemplate(&check, templ, 0);
+                if (top & XSLT_STREAM_ANY) {
+                    xsltStreamCheck probe;
+
+                    /*
+                    * The template may also match the document element,
+                    * refuse that at runtime if its body can't handle it.
+                    */
+                    memset(&probe, 0, sizeof(probe));
+                    probe.style = cur;
+                    probe.quiet = 1;
+                    xsltStreamCheckTemplate(&probe, templ, 1);
+                    XSLT_TEMPL_PRIV(templ)->streamNoRoot =
+                        (probe.errors != 0);
+                    if (probe.visited != NULL)
+                        xmlFree(probe.visited);
+                }
+            }
+        }
+
+        /*
+        * Global variables are evaluated with the document node as
+        * context.
+        */
+        if (root == NULL)
+            continue;
+        for (child = root->children; child != NULL; child = child->next) {
+            if ((IS_XSLT_ELEM(child)) &&
+                ((IS_XSLT_NAME(child, "variable")) ||
+                 (IS_XSLT_NAME(child, "param")))) {
+                xsltStreamCheckList(&check, child, 1);
+            }
+        }
+    }
+
+    if (check.visited != NULL)
+        xmlFree(check.visited);
+    return(check.errors == 0);
+}
@@ -34,6 +34,8 @@ XSLTPUBFUN void XSLTCALL
 					 xmlNodePtr inst);
 XSLTPUBFUN void XSLTCALL
 		xsltFreeStylePreComps	(xsltStylesheetPtr style);
+XSLTPUBFUN int XSLTCALL
+		xsltCheckStreamable	(xsltStylesheetPtr style);
 
 #ifdef __cplusplus
 }
@@ -44,6 +44,7 @@
 #include "xsltutils.h"
 #include "extensions.h"
 #include "security.h"
+#include "xsltprivate.h"
 
 
 struct _xsltSecurityPrefs {
@@ -289,7 +290,7 @@ xsltCheckFilename (const char *path)
 static int
 xsltCheckWritePath(xsltSecurityPrefsPtr sec,
 		   xsltTransformContextPtr ctxt,
-		   const char *path)
+		   const char *path, int create)
 {
     int ret;
     xsltSecurityCheck check;
@@ -305,6 +306,9 @@ xsltCheckWritePath(xsltSecurityPrefsPtr sec,
 	}
     }
 
+    if (!create)
+        return(1);
+
     directory = xmlParserGetDirectory (path);
 
     if (directory != NULL) {
@@ -325,7 +329,7 @@ xsltCheckWritePath(xsltSecurityPrefsPtr sec,
 		    return(0);
 		}
 	    }
-	    ret = xsltCheckWritePath(sec, ctxt, directory);
+	    ret = xsltCheckWritePath(sec, ctxt, directory, 1);
 	    if (ret == 1)
 		ret = mkdir(directory, 0755);
 	}
@@ -337,20 +341,13 @@ xsltCheckWritePath(xsltSecurityPrefsPtr sec,
     return(1);
 }
 
-/**
- * xsltCheckWrite:
- * @sec:  the security options
- * @ctxt:  an XSLT transformation context
- * @URL:  the resource to be written
- *
- * Check if the resource is allowed to be written, if necessary makes
- * some preliminary work like creating directories
- *
- * Return 1 if write is allowed, 0 if not and -1 in case or error.
+/*
+ * Common part of xsltCheckWrite() and xsltCheckWriteNoCreate().
  */
-int
-xsltCheckWrite(xsltSecurityPrefsPtr sec,
-	       xsltTransformContextPtr ctxt, const xmlChar *URL) {
+static int
+xsltCheckWriteURL(xsltSecurityPrefsPtr sec,
+		  xsltTransformContextPtr ctxt, const xmlChar *URL,
+		  int create) {
     int ret;
     xmlURIPtr uri;
     xsltSecurityCheck check;
@@ -371,14 +368,14 @@ xsltCheckWrite(xsltSecurityPrefsPtr sec,
 #if defined(_WIN32)
         if ((uri->path)&&(uri->path[0]=='/')&&
             (uri->path[1]!='\0')&&(uri->path[2]==':'))
-            ret = xsltCheckWritePath(sec, ctxt, uri->path+1);
+            ret = xsltCheckWritePath(sec, ctxt, uri->path+1, create);
         else
 #endif
         {
             /*
              * Check if we are allowed to write this file
              */
-	    ret = xsltCheckWritePath(sec, ctxt, uri->path);
+	    ret = xsltCheckWritePath(sec, ctxt, uri->path, create);
         }
 
 	if (ret <= 0) {
@@ -404,6 +401,41 @@ xsltCheckWrite(xsltSecurityPrefsPtr sec,
     return(1);
 }
 
+/**
+ * xsltCheckWrite:
+ * @sec:  the security options
+ * @ctxt:  an XSLT transformation context
+ * @URL:  the resource to be written
+ *
+ * Check if the resource is allowed to be written, if necessary makes
+ * some preliminary work like creating directories
+ *
+ * Return 1 if write is allowed, 0 if not and -1 in case or error.
+ */
+int
+xsltCheckWrite(xsltSecurityPrefsPtr sec,
+	       xsltTransformContextPtr ctxt, const xmlChar *URL) {
+    return(xsltCheckWriteURL(sec, ctxt, URL, 1));
+}
+
+/**
+ * xsltCheckWriteNoCreate:
+ * @sec:  the security options
+ * @ctxt:  an XSLT transformation context
+ * @URL:  the resource to be written
+ *
+ * Check if the resource is allowed to be written, like xsltCheckWrite(),
+ * but without creating any directory, for resources handed to an output
+ * sink instead of being written.
+ *
+ * Return 1 if write is allowed, 0 if not and -1 in case or error.
+ */
+int
+xsltCheckWriteNoCreate(xsltSecurityPrefsPtr sec,
+		       xsltTransformContextPtr ctxt, const xmlChar *URL) {
+    return(xsltCheckWriteURL(sec, ctxt, URL, 0));
+}
+
 
 /**
  * xsltCheckRead:
@@ -30,6 +30,7 @@
 #include "transform.h"
 #include "namespaces.h"
 #include "attributes.h"
+#include "xsltprivate.h"
 
 #ifdef WITH_XSLT_DEBUG
 #define WITH_XSLT_DEBUG_TEMPLATES
@@ -95,7 +96,7 @@ xsltEvalXPathPredicate(xsltTransformContextPtr ctxt, xmlXPathCompExprPtr comp,
 	XSLT_TRACE(ctxt,XSLT_TRACE_TEMPLATES,xsltGenericDebug(xsltGenericDebugContext,
 	     "xsltEvalXPathPredicate: failed\n"));
 #endif
-	ctxt->state = XSLT_STATE_STOPPED;
+	XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
 	ret = 0;
     }
 
@@ -163,7 +164,7 @@ xsltEvalXPathStringNs(xsltTransformContextPtr ctxt, xmlXPathCompExprPtr comp,
 	}
 	xmlXPathFreeObject(res);
     } else {
-	ctxt->state = XSLT_STATE_STOPPED;
+	XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
     }
 #ifdef WITH_XSLT_DEBUG_TEMPLATES
     XSLT_TRACE(ctxt,XSLT_TRACE_TEMPLATES,xsltGenericDebug(xsltGenericDebugContext,
@@ -474,6 +475,7 @@ xsltEvalStaticAttrValueTemplate(xsltStylesheetPtr style, xmlNodePtr inst,
 
     ret = xmlStrchr(expr, '{');
     if (ret != NULL) {
+	xsltNoteAVTCalls(style, expr);
 	xmlFree(expr);
 	return(NULL);
     }
@@ -588,7 +590,12 @@ xsltAttrTemplateProcess(xsltTransformContextPtr ctxt, xmlNodePtr target,
 		* Evaluate the Attribute Value Template.
 		*/
 		xmlChar *val;
-		val = xsltEvalAVT(ctxt, attr->psvi, attr->parent);
+		xmlDictPtr dict = NULL;
+
+		if ((ctxt->internalized) && (target->doc != NULL) &&
+		    (target->doc->dict == ctxt->dict))
+		    dict = ctxt->dict;
+		val = xsltEvalAVTDict(ctxt, attr->psvi, attr->parent, dict);
 		if (val == NULL) {
 		    /*
 		    * TODO: Damn, we need an easy mechanism to report
@@ -686,7 +693,11 @@ xsltAttrListTemplateProcess(xsltTransformContextPtr ctxt,
 	    xmlStrEqual(attr->name, (const xmlChar *)"use-attribute-sets") &&
 	    xmlStrEqual(attr->ns->href, XSLT_NAMESPACE))
 	{
-	    xsltApplyAttributeSet(ctxt, ctxt->node, (xmlNodePtr) attr, NULL);
+	    if (attr->psvi != NULL)
+		xsltApplyUseAttributeSets(ctxt, ctxt->node, attr->psvi);
+	    else
+		xsltApplyAttributeSet(ctxt, ctxt->node, (xmlNodePtr) attr,
+				      NULL);
 	}
 #endif
 	attr = attr->next;
@@ -806,7 +817,13 @@ xsltAttrListTemplateProcess(xsltTransformContextPtr ctxt,
 		/*
 		* Evaluate the Attribute Value Template.
 		*/
-		valueAVT = xsltEvalAVT(ctxt, attr->psvi, attr->parent);
+		xmlDictPtr dict = NULL;
+
+		if ((ctxt->internalized) && (target->doc != NULL) &&
+		    (target->doc->dict == ctxt->dict))
+		    dict = ctxt->dict;
+		valueAVT = xsltEvalAVTDict(ctxt, attr->psvi, attr->parent,
+		                           dict);
 		if (valueAVT == NULL) {
 		    /*
 		    * TODO: Damn, we need an easy mechanism to report
@@ -0,0 +1,715 @@
+/*
+ * threadpool.c: Implementation of the thread pool running the tasks
+ *               spawned by transformations
+ *
+ * Each worker owns a double-ended queue of tasks. A worker takes the
+ * newest task of its own queue first, then the tasks submitted from
+ * the other threads, then steals the oldest task of another worker.
+ * A thread waiting for its tasks runs them too, so a group of tasks
+ * always completes even when no worker is available.
+ *
+ * See Copyright for the status of this software.
+ */
+
+#define IN_LIBXSLT
+#include "libxslt.h"
+
+#include <string.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include <libxml/xmlmemory.h>
+#include <libxml/xmlversion.h>
+#include "xsltInternals.h"
+#include "xsltutils.h"
+#include "threadpool.h"
+#include "xsltprivate.h"
+
+#if defined(LIBXML_THREAD_ENABLED) && defined(HAVE_PTHREAD_H)
+#define XSLT_THREAD_POOL
+#include <pthread.h>
+#endif
+
+#define XSLT_POOL_DEFAULT_WORKERS 4
+#define XSLT_POOL_MAX_WORKERS 256
+
+#ifdef XSLT_THREAD_POOL
+
+typedef struct _xsltTask xsltTask;
+typedef xsltTask *xsltTaskPtr;
+struct _xsltTask {
+    xsltTaskPtr next;		/* towards the tail */
+    xsltTaskPtr prev;		/* towards the head */
+    xsltTaskFunc func;
+    void *data;
+    xsltTaskGroupPtr group;
+};
+
+/*
+ * Tasks are pushed at the head. The owner of a queue takes the
+ * newest task at the head, the other threads the oldest at the tail.
+ */
+typedef struct _xsltTaskQueue xsltTaskQueue;
+typedef xsltTaskQueue *xsltTaskQueuePtr;
+struct _xsltTaskQueue {
+    pthread_mutex_t lock;
+    xsltTaskPtr head;
+    xsltTaskPtr tail;
+};
+
+typedef struct _xsltThreadPool xsltThreadPool;
+typedef xsltThreadPool *xsltThreadPoolPtr;
+
+typedef struct _xsltPoolWorker xsltPoolWorker;
+typedef xsltPoolWorker *xsltPoolWorkerPtr;
+struct _xsltPoolWorker {
+    xsltThreadPoolPtr pool;
+    xsltTaskQueue queue;
+    pthread_t thread;
+    int active;			/* run by the executor of the application */
+};
+
+struct _xsltThreadPool {
+    int maxWorkers;
+    xsltExecutorFunc executor;
+    void *executorData;
+    xsltPoolWorkerPtr workers;
+    xsltTaskQueue shared;	/* tasks submitted from other threads */
+
+    pthread_mutex_t lock;
+    pthread_cond_t work;	/* tasks were queued or shutdown */
+    pthread_cond_t idle;	/* an executor run returned */
+    int nbQueued;		/* tasks in all the queues */
+    int nbIdle;			/* threads waiting for work */
+    int nbThreads;		/* threads started */
+    int nbActive;		/* workers run by the executor */
+    int shutdown;
+};
+
+struct _xsltTaskGroup {
+    xsltTransformContextPtr ctxt;
+    xsltThreadPoolPtr pool;
+    pthread_mutex_t lock;
+    pthread_cond_t done;	/* a task completed */
+    int nbTasks;		/* queued and running tasks */
+    int cancelled;
+};
+
+static pthread_mutex_t xsltPoolMutex = PTHREAD_MUTEX_INITIALIZER;
+static xsltThreadPoolPtr xsltPool = NULL;
+static int xsltPoolMaxWorkers = 0;
+static xsltExecutorFunc xsltPoolExecutor = NULL;
+static void *xsltPoolExecutorData = NULL;
+
+static pthread_once_t xsltPoolKeyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t xsltPoolKey;
+
+static void
+xsltPoolKeyInit(void) {
+    pthread_key_create(&xsltPoolKey, NULL);
+}
+
+/*
+ * The worker run by the calling thread, if any.
+ */
+static xsltPoolWorkerPtr
+xsltPoolCurrentWorker(xsltThreadPoolPtr pool) {
+    xsltPoolWorkerPtr worker;
+
+    worker = (xsltPoolWorkerPtr) pthread_getspecific(xsltPoolKey);
+    if ((worker == NULL) || (worker->pool != pool))
+        return(NULL);
+    return(worker);
+}
+
+static int
+xsltPoolDefaultWorkers(void) {
+#if defined(HAVE_UNISTD_H) && defined(_SC_NPROCESSORS_ONLN)
+    long nbCpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (nbCpus > XSLT_POOL_MAX_WORKERS)
+        return(XSLT_POOL_MAX_WORKERS);
+    if (nbCpus > 0)
+        return((int) nbCpus);
+#endif
+    return(XSLT_POOL_DEFAULT_WORKERS);
+}
+
+static void
+xsltTaskQueuePush(xsltTaskQueuePtr queue, xsltTaskPtr task) {
+    pthread_mutex_lock(&queue->lock);
+    task->prev = NULL;
+    task->next = queue->head;
+    if (queue->head != NULL)
+        queue->head->prev = task;
+    else
+        queue->tail = task;
+    queue->head = task;
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static void
+xsltTaskQueueUnlink(xsltTaskQueuePtr queue, xsltTaskPtr task) {
+    if (task->prev != NULL)
+        task->prev->next = task->next;
+    else
+        queue->head = task->next;
+    if (task->next != NULL)
+        task->next->prev = task->prev;
+    else
+        queue->tail = task->prev;
+    task->next = NULL;
+    task->prev = NULL;
+}
+
+/*
+ * Take a task of @group, or any task if @group is NULL, from the head
+ * or the tail of @queue.
+ */
+static xsltTaskPtr
+xsltTaskQueueTake(xsltTaskQueuePtr queue, xsltTaskGroupPtr group,
+                  int fromHead) {
+    xsltTaskPtr task;
+
+    pthread_mutex_lock(&queue->lock);
+    task = fromHead ? queue->head : queue->tail;
+    if (group != NULL) {
+        while ((task != NULL) && (task->group != group))
+            task = fromHead ? task->next : task->prev;
+    }
+    if (task != NULL)
+        xsltTaskQueueUnlink(queue, task);
+    pthread_mutex_unlock(&queue->lock);
+
+    return(task);
+}
+
+/*
+ * Remove @task from @queue if no thread took it yet.
+ */
+static int
+xsltTaskQueueRemove(xsltTaskQueuePtr queue, xsltTaskPtr task) {
+    xsltTaskPtr cur;
+
+    pthread_mutex_lock(&queue->lock);
+    for (cur = queue->head; cur != NULL; cur = cur->next) {
+        if (cur == task) {
+            xsltTaskQueueUnlink(queue, task);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return(cur != NULL);
+}
+
+/*
+ * Find the next task to run for @worker, which is NULL for a thread
+ * outside of the pool. Only the tasks of @group are taken if it isn't
+ * NULL.
+ */
+static xsltTaskPtr
+xsltPoolTake(xsltThreadPoolPtr pool, xsltPoolWorkerPtr worker,
+             xsltTaskGroupPtr group) {
+    xsltTaskPtr task = NULL;
+    int start, i;
+
+    if (worker != NULL)
+        task = xsltTaskQueueTake(&worker->queue, group, 1);
+    if (task == NULL)
+        task = xsltTaskQueueTake(&pool->shared, group, 0);
+    if (task == NULL) {
+        start = (worker != NULL) ? worker - pool->workers : 0;
+        for (i = 1; i <= pool->maxWorkers; i++) {
+            xsltPoolWorkerPtr victim =
+                &pool->workers[(start + i) % pool->maxWorkers];
+
+            if (victim == worker)
+                continue;
+            task = xsltTaskQueueTake(&victim->queue, group, 0);
+            if (task != NULL)
+                break;
+        }
+    }
+
+    if (task != NULL) {
+        pthread_mutex_lock(&pool->lock);
+        pool->nbQueued--;
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return(task);
+}
+
+static void
+xsltPoolRun(xsltTaskPtr task) {
+    xsltTaskGroupPtr group = task->group;
+
+    task->func(task->data);
+    xmlFree(task);
+
+    /* The group can be freed as soon as the lock is released. */
+    pthread_mutex_lock(&group->lock);
+    group->nbTasks--;
+    pthread_cond_broadcast(&group->done);
+    pthread_mutex_unlock(&group->lock);
+}
+
+static void *
+xsltPoolThreadMain(void *data) {
+    xsltPoolWorkerPtr worker = (xsltPoolWorkerPtr) data;
+    xsltThreadPoolPtr pool = worker->pool;
+    xsltTaskPtr task;
+
+    pthread_setspecific(xsltPoolKey, worker);
+    while (1) {
+        task = xsltPoolTake(pool, worker, NULL);
+        if (task != NULL) {
+            xsltPoolRun(task);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        if (pool->shutdown) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        if (pool->nbQueued == 0) {
+            pool->nbIdle++;
+            pthread_cond_wait(&pool->work, &pool->lock);
+            pool->nbIdle--;
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    return(NULL);
+}
+
+/*
+ * Run a worker on a thread of the executor of the application until
+ * there is no task left.
+ */
+static void
+xsltPoolExecutorRun(void *data) {
+    xsltPoolWorkerPtr worker = (xsltPoolWorkerPtr) data;
+    xsltThreadPoolPtr pool = worker->pool;
+    void *prev;
+    xsltTaskPtr task;
+
+    /* The executor may run it from another worker. */
+    prev = pthread_getspecific(xsltPoolKey);
+    pthread_setspecific(xsltPoolKey, worker);
+    while (1) {
+        task = xsltPoolTake(pool, worker, NULL);
+        if (task != NULL) {
+            xsltPoolRun(task);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        if (pool->nbQueued == 0) {
+            worker->active = 0;
+            pool->nbActive--;
+            pthread_cond_broadcast(&pool->idle);
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+    pthread_setspecific(xsltPoolKey, prev);
+}
+
+static xsltThreadPoolPtr
+xsltNewThreadPool(int maxWorkers, xsltExecutorFunc executor,
+                  void *executorData) {
+    xsltThreadPoolPtr pool;
+    int i;
+
+    pool = (xsltThreadPoolPtr) xmlMalloc(sizeof(xsltThreadPool));
+    if (pool == NULL)
+        return(NULL);
+    memset(pool, 0, sizeof(xsltThreadPool));
+    pool->workers = (xsltPoolWorkerPtr)
+        xmlMalloc(maxWorkers * sizeof(xsltPoolWorker));
+    if (pool->workers == NULL) {
+        xmlFree(pool);
+        return(NULL);
+    }
+    memset(pool->workers, 0, maxWorkers * sizeof(xsltPoolWorker));
+    pool->maxWorkers = maxWorkers;
+    pool->executor = executor;
+    pool->executorData = executorData;
+    for (i = 0; i < maxWorkers; i++) {
+        pool->workers[i].pool = pool;
+        pthread_mutex_init(&pool->workers[i].queue.lock, NULL);
+    }
+    pthread_mutex_init(&pool->shared.lock, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+
+    return(pool);
+}
+
+/*
+ * Stop the threads of @pool and free it. No task group may use it
+ * anymore.
+ */
+static void
+xsltFreeThreadPool(xsltThreadPoolPtr pool) {
+    int i;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->work);
+    while (pool->nbActive > 0)
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+    for (i = 0; i < pool->nbThreads; i++)
+        pthread_join(pool->workers[i].thread, NULL);
+
+    for (i = 0; i < pool->maxWorkers; i++)
+        pthread_mutex_destroy(&pool->workers[i].queue.lock);
+    pthread_mutex_destroy(&pool->shared.lock);
+    pthread_cond_destroy(&pool->idle);
+    pthread_cond_destroy(&pool->work);
+    pthread_mutex_destroy(&pool->lock);
+    xmlFree(pool->workers);
+    xmlFree(pool);
+}
+
+#endif /* XSLT_THREAD_POOL */
+
+/**
+ * xsltSetThreadPool:
+ * @maxWorkers:  the maximum number of workers, 0 for the number of
+ *               processors
+ * @executor:  the executor of the application or NULL
+ * @executorData:  user data passed to @executor
+ *
+ * Configure the thread pool running the tasks of the parallel
+ * features, like parallel xsl:apply-templates or the background
+ * writing of xsl:document results. By default libxslt starts up to
+ * @maxWorkers threads when tasks are submitted. If @executor is given,
+ * no thread is created: up to @maxWorkers workers are handed to the
+ * executor of the application, which runs them on its own threads.
+ * This must not be called while transformations are running.
+ *
+ * Returns 0 in case of success, -1 if threads are not supported.
+ */
+int
+xsltSetThreadPool(int maxWorkers, xsltExecutorFunc executor,
+                  void *executorData) {
+#ifdef XSLT_THREAD_POOL
+    xsltThreadPoolPtr old;
+
+    if (maxWorkers > XSLT_POOL_MAX_WORKERS)
+        maxWorkers = XSLT_POOL_MAX_WORKERS;
+
+    pthread_mutex_lock(&xsltPoolMutex);
+    old = xsltPool;
+    xsltPool = NULL;
+    xsltPoolMaxWorkers = (maxWorkers > 0) ? maxWorkers : 0;
+    xsltPoolExecutor = executor;
+    xsltPoolExecutorData = executorData;
+    pthread_mutex_unlock(&xsltPoolMutex);
+
+    if (old != NULL)
+        xsltFreeThreadPool(old);
+    return(0);
+#else
+    (void) maxWorkers;
+    (void) executor;
+    (void) executorData;
+    return(-1);
+#endif
+}
+
+/**
+ * xsltCleanupThreadPool:
+ *
+ * Stop the threads of the pool and reset its configuration.
+ */
+void
+xsltCleanupThreadPool(void) {
+#ifdef XSLT_THREAD_POOL
+    xsltSetThreadPool(0, NULL, NULL);
+#endif
+}
+
+/**
+ * xsltNewTaskGroup:
+ * @ctxt:  the transformation context spawning the tasks or NULL
+ *
+ * Create a group to run tasks on the thread pool, which is started
+ * on first use. The tasks of the group see it cancelled once @ctxt
+ * was stopped.
+ *
+ * Returns the new group or NULL if threads are not supported or in
+ * case of error.
+ */
+xsltTaskGroupPtr
+xsltNewTaskGroup(xsltTransformContextPtr ctxt) {
+#ifdef XSLT_THREAD_POOL
+    xsltTaskGroupPtr group;
+    xsltThreadPoolPtr pool;
+
+    pthread_once(&xsltPoolKeyOnce, xsltPoolKeyInit);
+
+    pthread_mutex_lock(&xsltPoolMutex);
+    if (xsltPool == NULL)
+        xsltPool = xsltNewThreadPool((xsltPoolMaxWorkers > 0) ?
+                                     xsltPoolMaxWorkers :
+                                     xsltPoolDefaultWorkers(),
+                                     xsltPoolExecutor,
+                                     xsltPoolExecutorData);
+    pool = xsltPool;
+    pthread_mutex_unlock(&xsltPoolMutex);
+    if (pool == NULL) {
+        xsltTransformError(ctxt, NULL, NULL,
+                           "xsltNewTaskGroup: out of memory\n");
+        return(NULL);
+    }
+
+    group = (xsltTaskGroupPtr) xmlMalloc(sizeof(xsltTaskGroup));
+    if (group == NULL) {
+        xsltTransformError(ctxt, NULL, NULL,
+                           "xsltNewTaskGroup: out of memory\n");
+        return(NULL);
+    }
+    memset(group, 0, sizeof(xsltTaskGroup));
+    group->ctxt = ctxt;
+    group->pool = pool;
+    pthread_mutex_init(&group->lock, NULL);
+    pthread_cond_init(&group->done, NULL);
+
+    return(group);
+#else
+    (void) ctxt;
+    return(NULL);
+#endif
+}
+
+/**
+ * xsltFreeTaskGroup:
+ * @group:  a task group
+ *
+ * Wait for the tasks of @group and free it.
+ */
+void
+xsltFreeTaskGroup(xsltTaskGroupPtr group) {
+#ifdef XSLT_THREAD_POOL
+    if (group == NULL)
+        return;
+    xsltTaskGroupWait(group);
+    pthread_cond_destroy(&group->done);
+    pthread_mutex_destroy(&group->lock);
+    xmlFree(group);
+#else
+    (void) group;
+#endif
+}
+
+#ifdef XSLT_THREAD_POOL
+/*
+ * Cancel @group if its transformation was stopped.
+ */
+static void
+xsltTaskGroupCheckStopped(xsltTaskGroupPtr group) {
+    if ((group->ctxt != NULL) &&
+        (XSLT_GET_STATE(group->ctxt) == XSLT_STATE_STOPPED))
+        xsltTaskGroupCancel(group);
+}
+#endif
+
+/**
+ * xsltTaskGroupSubmit:
+ * @group:  a task group
+ * @func:  the task function
+ * @data:  the argument of @func
+ *
+ * Queue a task of @group. The tasks submitted from a worker go to its
+ * own queue, the others to a queue shared by all the workers. A task
+ * is always run, even when its group was cancelled, it must check
+ * xsltTaskGroupCancelled() to give up early.
+ *
+ * Returns 0 if the task was queued, -1 if no worker could be started,
+ * the caller must then run @func itself.
+ */
+int
+xsltTaskGroupSubmit(xsltTaskGroupPtr group, xsltTaskFunc func,
+                    void *data) {
+#ifdef XSLT_THREAD_POOL
+    xsltThreadPoolPtr pool;
+    xsltPoolWorkerPtr worker, handed = NULL;
+    xsltTaskQueuePtr queue;
+    xsltTaskPtr task;
+    int i, running;
+
+    if ((group == NULL) || (func == NULL))
+        return(-1);
+    pool = group->pool;
+    xsltTaskGroupCheckStopped(group);
+
+    task = (xsltTaskPtr) xmlMalloc(sizeof(xsltTask));
+    if (task == NULL)
+        return(-1);
+    task->func = func;
+    task->data = data;
+    task->group = group;
+
+    pthread_mutex_lock(&group->lock);
+    group->nbTasks++;
+    pthread_mutex_unlock(&group->lock);
+
+    worker = xsltPoolCurrentWorker(pool);
+    queue = (worker != NULL) ? &worker->queue : &pool->shared;
+    xsltTaskQueuePush(queue, task);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->nbQueued++;
+    if (pool->executor != NULL) {
+        if (pool->nbActive < pool->maxWorkers) {
+            for (i = 0; i < pool->maxWorkers; i++) {
+                if (!pool->workers[i].active) {
+                    handed = &pool->workers[i];
+                    handed->active = 1;
+                    pool->nbActive++;
+                    break;
+                }
+            }
+        }
+    } else if (pool->nbIdle > 0) {
+        pthread_cond_signal(&pool->work);
+    } else if (pool->nbThreads < pool->maxWorkers) {
+        if (pthread_create(&pool->workers[pool->nbThreads].thread, NULL,
+                           xsltPoolThreadMain,
+                           &pool->workers[pool->nbThreads]) == 0)
+            pool->nbThreads++;
+    }
+    running = (pool->executor != NULL) ? pool->nbActive : pool->nbThreads;
+    pthread_mutex_unlock(&pool->lock);
+
+    if ((handed != NULL) &&
+        (pool->executor(pool->executorData, xsltPoolExecutorRun,
+                        handed) < 0)) {
+        pthread_mutex_lock(&pool->lock);
+        handed->active = 0;
+        pool->nbActive--;
+        running = pool->nbActive;
+        pthread_cond_broadcast(&pool->idle);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    /*
+    * Without any worker, the task would only run when the group is
+    * waited for.
+    */
+    if ((running == 0) && (worker == NULL) &&
+        (xsltTaskQueueRemove(queue, task))) {
+        pthread_mutex_lock(&pool->lock);
+        pool->nbQueued--;
+        pthread_mutex_unlock(&pool->lock);
+        pthread_mutex_lock(&group->lock);
+        group->nbTasks--;
+        pthread_mutex_unlock(&group->lock);
+        xmlFree(task);
+        return(-1);
+    }
+
+    return(0);
+#else
+    (void) group;
+    (void) func;
+    (void) data;
+    return(-1);
+#endif
+}
+
+/**
+ * xsltTaskGroupWait:
+ * @group:  a task group
+ *
+ * Wait until all the tasks of @group completed. The calling thread
+ * runs the tasks of the group which didn't start yet.
+ */
+void
+xsltTaskGroupWait(xsltTaskGroupPtr group) {
+#ifdef XSLT_THREAD_POOL
+    xsltThreadPoolPtr pool;
+    xsltPoolWorkerPtr worker;
+    xsltTaskPtr task;
+
+    if (group == NULL)
+        return;
+    pool = group->pool;
+    xsltTaskGroupCheckStopped(group);
+    worker = xsltPoolCurrentWorker(pool);
+
+    pthread_mutex_lock(&group->lock);
+    while (group->nbTasks > 0) {
+        pthread_mutex_unlock(&group->lock);
+        task = xsltPoolTake(pool, worker, group);
+        if (task != NULL)
+            xsltPoolRun(task);
+        pthread_mutex_lock(&group->lock);
+        if ((task == NULL) && (group->nbTasks > 0))
+            pthread_cond_wait(&group->done, &group->lock);
+    }
+    pthread_mutex_unlock(&group->lock);
+#else
+    (void) group;
+#endif
+}
+
+/**
+ * xsltTaskGroupCancel:
+ * @group:  a task group
+ *
+ * Ask the tasks of @group to give up. This can be called from any
+ * thread, usually by a task failing or by the thread running the
+ * transformation when it is stopped.
+ */
+void
+xsltTaskGroupCancel(xsltTaskGroupPtr group) {
+#ifdef XSLT_THREAD_POOL
+    if (group == NULL)
+        return;
+    pthread_mutex_lock(&group->lock);
+    group->cancelled = 1;
+    pthread_mutex_unlock(&group->lock);
+#else
+    (void) group;
+#endif
+}
+
+/**
+ * xsltTaskGroupCancelled:
+ * @group:  a task group
+ *
+ * Check whether the tasks of @group should give up, because the group
+ * was cancelled or its transformation was stopped. This can be called
+ * from any thread.
+ *
+ * Returns 1 if the group was cancelled, 0 otherwise.
+ */
+int
+xsltTaskGroupCancelled(xsltTaskGroupPtr group) {
+#ifdef XSLT_THREAD_POOL
+    int ret;
+
+    if (group == NULL)
+        return(0);
+    pthread_mutex_lock(&group->lock);
+    ret = group->cancelled;
+    pthread_mutex_unlock(&group->lock);
+    if ((ret == 0) && (group->ctxt != NULL) &&
+        (XSLT_GET_STATE(group->ctxt) == XSLT_STATE_STOPPED))
+        ret = 1;
+    return(ret);
+#else
+    (void) group;
+    return(0);
+#endif
+}
@@ -0,0 +1,84 @@
+/*
+ * Summary: thread pool shared by the parallel features
+ * Description: a small work-stealing executor running the tasks
+ *              spawned by a transformation, like parallel
+ *              xsl:apply-templates or background output, either on
+ *              its own threads or on an executor of the application.
+ *
+ * Copy: See Copyright for the status of this software.
+ */
+
+#ifndef __XML_XSLT_THREADPOOL_H__
+#define __XML_XSLT_THREADPOOL_H__
+
+#include "xsltexports.h"
+#include "xsltInternals.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * xsltTaskFunc:
+ * @data:  the task data
+ *
+ * Signature of a task run by the thread pool.
+ */
+typedef void (*xsltTaskFunc) (void *data);
+
+/**
+ * xsltExecutorFunc:
+ * @executor:  the user data given to xsltSetThreadPool()
+ * @run:  the function to call
+ * @data:  the argument of @run
+ *
+ * Signature of an executor provided by the application. It must
+ * eventually call @run with @data from one of its threads.
+ *
+ * Returns 0 if @run was accepted, -1 otherwise.
+ */
+typedef int (*xsltExecutorFunc) (void *executor,
+				 xsltTaskFunc run,
+				 void *data);
+
+/**
+ * xsltTaskGroup:
+ *
+ * The tasks spawned on behalf of a transformation context.
+ */
+typedef struct _xsltTaskGroup xsltTaskGroup;
+typedef xsltTaskGroup *xsltTaskGroupPtr;
+
+/*
+ * Configuration.
+ */
+XSLTPUBFUN int XSLTCALL
+		xsltSetThreadPool	(int maxWorkers,
+					 xsltExecutorFunc executor,
+					 void *executorData);
+XSLTPUBFUN void XSLTCALL
+		xsltCleanupThreadPool	(void);
+
+/*
+ * Tasks of a transformation.
+ */
+XSLTPUBFUN xsltTaskGroupPtr XSLTCALL
+		xsltNewTaskGroup	(xsltTransformContextPtr ctxt);
+XSLTPUBFUN void XSLTCALL
+		xsltFreeTaskGroup	(xsltTaskGroupPtr group);
+XSLTPUBFUN int XSLTCALL
+		xsltTaskGroupSubmit	(xsltTaskGroupPtr group,
+					 xsltTaskFunc func,
+					 void *data);
+XSLTPUBFUN void XSLTCALL
+		xsltTaskGroupWait	(xsltTaskGroupPtr group);
+XSLTPUBFUN void XSLTCALL
+		xsltTaskGroupCancel	(xsltTaskGroupPtr group);
+XSLTPUBFUN int XSLTCALL
+		xsltTaskGroupCancelled	(xsltTaskGroupPtr group);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __XML_XSLT_THREADPOOL_H__ */
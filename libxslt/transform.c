@@ -23,6 +23,10 @@
 #include <string.h>
 #include <stdio.h>
 #include <stddef.h>
+#include <time.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
 
 #include <libxml/xmlmemory.h>
 #include <libxml/parser.h>
@@ -37,6 +41,9 @@
 #include <libxml/HTMLtree.h>
 #include <libxml/debugXML.h>
 #include <libxml/uri.h>
+#ifdef LIBXML_READER_ENABLED
+#include <libxml/xmlreader.h>
+#endif
 #include "xslt.h"
 #include "xsltInternals.h"
 #include "xsltutils.h"
@@ -55,6 +62,31 @@
 #include "extra.h"
 #include "preproc.h"
 #include "security.h"
+#include "threadpool.h"
+#include "xsltprivate.h"
+
+#if defined(LIBXML_THREAD_ENABLED) && defined(HAVE_PTHREAD_H)
+#define XSLT_ASYNC_OUTPUT
+#define XSLT_PARALLEL_APPLY
+#define XSLT_STEP_TRANSFORM
+#include <pthread.h>
+#include <stdlib.h>
+#endif
+
+/*
+ * Number of operations between two checks of the deadline.
+ */
+#define XSLT_DEADLINE_CHECK_OPS 1000
+
+/*
+ * Whether the operations must be counted and checked against the
+ * limits of the context.
+ */
+#define XSLT_NEED_INTERRUPT_CHECK(ctxt) \
+    (((ctxt)->opLimit != 0) || \
+     (XSLT_CTXT_PRIV(ctxt)->checkInterval != 0) || \
+     (XSLT_CTXT_PRIV(ctxt)->step != NULL) || \
+     (XSLT_LOAD_FLAG(XSLT_CTXT_PRIV(ctxt)->cancelled)))
 
 #ifdef WITH_XSLT_DEBUG
 #define WITH_XSLT_DEBUG_EXTRA
@@ -67,10 +99,20 @@
 static int xsltGetHTMLIDs(const xmlChar *version, const xmlChar **publicID,
 			  const xmlChar **systemID);
 #endif
+static void xsltAsyncOutputDrain(xsltTransformContextPtr ctxt);
+static void xsltAsyncOutputFree(xsltTransformContextPtr ctxt);
+static void xsltParallelFree(xsltTransformContextPtr ctxt);
+static void xsltStepSuspend(xsltTransformContextPtr ctxt);
+static void xsltStepFree(xsltTransformContextPtr ctxt);
 
 int xsltMaxDepth = 3000;
 int xsltMaxVars = 15000;
 
+/*
+ * Number of parameter slots of xsl:call-template kept on the C stack.
+ */
+#define XSLT_CALL_TEMPLATE_SLOTS 8
+
 /*
  * Useful macros
  */
@@ -106,7 +148,8 @@ xsltApplyXSLTTemplate(xsltTransformContextPtr ctxt,
 		      xmlNodePtr contextNode,
 		      xmlNodePtr list,
 		      xsltTemplatePtr templ,
-		      xsltStackElemPtr withParams);
+		      xsltStackElemPtr withParams,
+		      xsltStackElemPtr *paramSlots);
 
 /**
  * templPush:
@@ -354,6 +397,19 @@ xsltPreCompEval(xsltTransformContextPtr ctxt, xmlNodePtr node,
     xmlNsPtr *oldXPNamespaces;
     int oldXPProximityPosition, oldXPContextSize, oldXPNsNr;
 
+#ifndef XSLT_REFACTORED
+    if (XSLT_COMP_PRIV(comp)->varName != NULL) {
+        res = xsltVariableSlotLookup(ctxt, comp);
+        if (res != NULL)
+            return(res);
+    }
+    if (XSLT_COMP_PRIV(comp)->hoist > 0) {
+        res = xsltHoistedLookup(ctxt, comp);
+        if (res != NULL)
+            return(res);
+    }
+#endif
+
     xpctxt = ctxt->xpathCtxt;
     oldXPContextNode = xpctxt->node;
     oldXPProximityPosition = xpctxt->proximityPosition;
@@ -383,6 +439,11 @@ xsltPreCompEval(xsltTransformContextPtr ctxt, xmlNodePtr node,
     xpctxt->nsNr = oldXPNsNr;
     xpctxt->namespaces = oldXPNamespaces;
 
+#ifndef XSLT_REFACTORED
+    if ((res != NULL) && (XSLT_COMP_PRIV(comp)->hoist > 0))
+        xsltHoistedStore(ctxt, comp, res);
+#endif
+
     return(res);
 }
 
@@ -403,6 +464,27 @@ xsltPreCompEvalToBoolean(xsltTransformContextPtr ctxt, xmlNodePtr node,
     xmlNsPtr *oldXPNamespaces;
     int oldXPProximityPosition, oldXPContextSize, oldXPNsNr;
 
+#ifndef XSLT_REFACTORED
+    if (XSLT_COMP_PRIV(comp)->varName != NULL) {
+        xmlXPathObjectPtr obj = xsltVariableSlotLookup(ctxt, comp);
+
+        if (obj != NULL) {
+            res = xmlXPathCastToBoolean(obj);
+            xmlXPathFreeObject(obj);
+            return(res);
+        }
+    }
+    if (XSLT_COMP_PRIV(comp)->hoist > 0) {
+        xmlXPathObjectPtr obj = xsltPreCompEval(ctxt, node, comp);
+
+        if (obj == NULL)
+            return(-1);
+        res = xmlXPathCastToBoolean(obj);
+        xmlXPathFreeObject(obj);
+        return(res);
+    }
+#endif
+
     xpctxt = ctxt->xpathCtxt;
     oldXPContextNode = xpctxt->node;
     oldXPProximityPosition = xpctxt->proximityPosition;
@@ -568,13 +650,13 @@ xsltNewTransformContext(xsltStylesheetPtr style, xmlDocPtr doc) {
 
     xsltInitGlobals();
 
-    cur = (xsltTransformContextPtr) xmlMalloc(sizeof(xsltTransformContext));
+    cur = (xsltTransformContextPtr) xmlMalloc(sizeof(xsltTransformContextPriv));
     if (cur == NULL) {
 	xsltTransformError(NULL, NULL, (xmlNodePtr)doc,
 		"xsltNewTransformContext : malloc failed\n");
 	return(NULL);
     }
-    memset(cur, 0, sizeof(xsltTransformContext));
+    memset(cur, 0, sizeof(xsltTransformContextPriv));
 
     cur->cache = xsltTransformCacheCreate();
     if (cur->cache == NULL)
@@ -620,6 +702,7 @@ xsltNewTransformContext(xsltStylesheetPtr style, xmlDocPtr doc) {
     cur->vars = NULL;
     cur->varsBase = 0;
     cur->maxTemplateVars = xsltMaxVars;
+    XSLT_CTXT_PRIV(cur)->cancelled = &XSLT_CTXT_PRIV(cur)->cancelFlag;
 
     /*
      * the profiling stack is not initialized by default
@@ -719,9 +802,20 @@ internal_err:
  */
 void
 xsltFreeTransformContext(xsltTransformContextPtr ctxt) {
+    xsltTransformContextPrivPtr priv = XSLT_CTXT_PRIV(ctxt);
+
     if (ctxt == NULL)
 	return;
 
+    /*
+     * Abort an incremental transformation, then wait for the pending
+     * xsl:document results, they still use the dictionary of the
+     * context.
+     */
+    xsltStepFree(ctxt);
+    xsltAsyncOutputFree(ctxt);
+    xsltParallelFree(ctxt);
+
     /*
      * Shutdown the extension modules associated to the stylesheet
      * used if needed.
@@ -738,6 +832,15 @@ xsltFreeTransformContext(xsltTransformContextPtr ctxt) {
 	xmlFree(ctxt->varsTab);
     if (ctxt->profTab != NULL)
 	xmlFree(ctxt->profTab);
+    if (priv->hoistTab != NULL) {
+	int i;
+
+	for (i = 0; i < priv->hoistMax; i++) {
+	    if (priv->hoistTab[i] != NULL)
+		xmlXPathFreeObject(priv->hoistTab[i]);
+	}
+	xmlFree(priv->hoistTab);
+    }
     if ((ctxt->extrasNr > 0) && (ctxt->extras != NULL)) {
 	int i;
 
@@ -758,10 +861,184 @@ xsltFreeTransformContext(xsltTransformContextPtr ctxt) {
     xsltGenericDebug(xsltGenericDebugContext,
                      "freeing transformation dictionary\n");
 #endif
-    memset(ctxt, -1, sizeof(xsltTransformContext));
+    memset(ctxt, -1, sizeof(xsltTransformContextPriv));
     xmlFree(ctxt);
 }
 
+/************************************************************************
+ *									*
+ *			Interruption of Transformations			*
+ *									*
+ ************************************************************************/
+
+/*
+ * Milliseconds on a monotonic clock if available.
+ */
+static unsigned long
+xsltClockMillis(void) {
+#if defined(HAVE_CLOCK_GETTIME)
+    struct timespec ts;
+
+#ifdef CLOCK_MONOTONIC
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    clock_gettime(CLOCK_REALTIME, &ts);
+#endif
+    return((unsigned long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+#elif defined(HAVE_GETTIMEOFDAY)
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return((unsigned long) tv.tv_sec * 1000 + tv.tv_usec / 1000);
+#else
+    return((unsigned long) time(NULL) * 1000);
+#endif
+}
+
+/*
+ * Recompute how often the clock and the yield function are checked.
+ */
+static void
+xsltUpdateCheckInterval(xsltTransformContextPtr ctxt) {
+    xsltTransformContextPrivPtr priv = XSLT_CTXT_PRIV(ctxt);
+
+    if (priv->yieldFunc != NULL)
+        priv->checkInterval = priv->yieldInterval;
+    else if (priv->deadline != 0)
+        priv->checkInterval = XSLT_DEADLINE_CHECK_OPS;
+    else
+        priv->checkInterval = 0;
+    priv->checkCount = priv->checkInterval;
+}
+
+/**
+ * xsltCheckInterrupt:
+ * @ctxt:  a XSLT transformation context
+ * @inst:  the instruction or node being processed
+ *
+ * Count an operation and check whether the transformation must stop
+ * because it was cancelled, it exceeded its operation limit or its
+ * deadline, or the yield function asked for it.
+ *
+ * Returns 0 to go on, -1 if the transformation was stopped.
+ */
+static int
+xsltCheckInterrupt(xsltTransformContextPtr ctxt, xmlNodePtr inst) {
+    xsltTransformContextPrivPtr priv = XSLT_CTXT_PRIV(ctxt);
+
+    if (XSLT_CTXT_PRIV(ctxt)->step != NULL)
+        xsltStepSuspend(ctxt);
+    if (ctxt->state == XSLT_STATE_STOPPED)
+        return(-1);
+    if (XSLT_LOAD_FLAG(priv->cancelled)) {
+        xsltTransformError(ctxt, NULL, inst, "Transformation cancelled\n");
+        XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
+        return(-1);
+    }
+    if ((ctxt->opLimit != 0) && (ctxt->opCount >= ctxt->opLimit)) {
+        xsltTransformError(ctxt, NULL, inst,
+                           "Operation limit exceeded\n");
+        XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
+        return(-1);
+    }
+    ctxt->opCount += 1;
+
+    if ((priv->checkInterval != 0) && (--priv->checkCount == 0)) {
+        priv->checkCount = priv->checkInterval;
+        if ((priv->deadline != 0) &&
+            ((long) (xsltClockMillis() - priv->deadline) >= 0)) {
+            xsltTransformError(ctxt, NULL, inst, "Time limit exceeded\n");
+            XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
+            return(-1);
+        }
+        if ((priv->yieldFunc != NULL) &&
+            (priv->yieldFunc(ctxt, priv->yieldData) != 0)) {
+            xsltTransformError(ctxt, NULL, inst,
+                               "Transformation stopped by the application\n");
+            XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
+            return(-1);
+        }
+    }
+    return(0);
+}
+
+/**
+ * xsltSetCtxtDeadline:
+ * @ctxt:  an XSLT transformation context
+ * @timeout:  the time left in milliseconds, 0 to remove the deadline
+ *
+ * Stop the transformation with an error once @timeout milliseconds
+ * have elapsed from now. The clock is read every few instructions, or
+ * at the interval of the yield function if there is one. A single
+ * XPath evaluation isn't interrupted, use the operation limits of
+ * libxml2 for that.
+ *
+ * Returns 0 in case of success, -1 in case of error.
+ */
+int
+xsltSetCtxtDeadline(xsltTransformContextPtr ctxt, unsigned long timeout) {
+    xsltTransformContextPrivPtr priv = XSLT_CTXT_PRIV(ctxt);
+
+    if (ctxt == NULL)
+        return(-1);
+    if (timeout == 0) {
+        priv->deadline = 0;
+    } else {
+        priv->deadline = xsltClockMillis() + timeout;
+        if (priv->deadline == 0)
+            priv->deadline = 1;
+    }
+    xsltUpdateCheckInterval(ctxt);
+    return(0);
+}
+
+/**
+ * xsltSetCtxtYieldFunc:
+ * @ctxt:  an XSLT transformation context
+ * @func:  the function to call or NULL
+ * @data:  user data passed to @func
+ * @interval:  the number of operations between two calls
+ *
+ * Call @func every @interval operations, an operation being the
+ * execution of an instruction or the processing of a node by a
+ * template rule. This lets a server yield to other work or implement
+ * its own limits: the transformation stops with an error if @func
+ * returns a non-zero value. @func is only called from the thread
+ * running the transformation, not from the workers of parallel
+ * xsl:apply-templates.
+ *
+ * Returns 0 in case of success, -1 in case of error.
+ */
+int
+xsltSetCtxtYieldFunc(xsltTransformContextPtr ctxt, xsltYieldFunc func,
+                     void *data, unsigned long interval) {
+    xsltTransformContextPrivPtr priv = XSLT_CTXT_PRIV(ctxt);
+
+    if ((ctxt == NULL) || ((func != NULL) && (interval == 0)))
+        return(-1);
+    priv->yieldFunc = func;
+    priv->yieldData = data;
+    priv->yieldInterval = (func != NULL) ? interval : 0;
+    xsltUpdateCheckInterval(ctxt);
+    return(0);
+}
+
+/**
+ * xsltCancelTransform:
+ * @ctxt:  an XSLT transformation context
+ *
+ * Ask the transformation to stop. This can be called from any thread
+ * as long as @ctxt isn't freed: the flag is checked before each
+ * instruction and the transformation then stops with an error,
+ * including its parallel workers.
+ */
+void
+xsltCancelTransform(xsltTransformContextPtr ctxt) {
+    if (ctxt == NULL)
+        return;
+    XSLT_STORE_FLAG(XSLT_CTXT_PRIV(ctxt)->cancelled, 1);
+}
+
 /************************************************************************
  *									*
  *			Copy of Nodes in an XSLT fashion		*
@@ -1131,7 +1408,7 @@ exit:
 	xsltTransformError(ctxt, NULL, target,
 	    "Internal error in xsltCopyText(): "
 	    "Failed to copy the string.\n");
-	ctxt->state = XSLT_STATE_STOPPED;
+	XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
     }
     return(copy);
 }
@@ -1603,6 +1880,229 @@ occupied:
     return(NULL);
 }
 
+/*
+ * The namespaces in scope of a subtree copied by xsltCopyTree(), mapped
+ * to their counterparts in the result tree. Result ns-decls which
+ * weren't derived from the source have a NULL source entry; they are
+ * only kept to detect shadowed prefixes.
+ */
+#define XSLT_COPY_NS_MAP_SIZE 16
+
+typedef struct _xsltCopyNsMap xsltCopyNsMap;
+typedef xsltCopyNsMap *xsltCopyNsMapPtr;
+struct _xsltCopyNsMap {
+    xmlNsPtr *tab;	/* pairs of source and result namespaces */
+    int nr;		/* the number of pairs */
+    int max;		/* the allocated number of pairs */
+    xmlNsPtr buf[2 * XSLT_COPY_NS_MAP_SIZE];
+};
+
+static void
+xsltCopyNsMapAdd(xsltCopyNsMapPtr map, xmlNsPtr src, xmlNsPtr dst) {
+    if (map->nr >= map->max) {
+	xmlNsPtr *tmp;
+
+	if (map->tab == map->buf) {
+	    tmp = (xmlNsPtr *) xmlMalloc(4 * map->max * sizeof(xmlNsPtr));
+	    if (tmp != NULL)
+		memcpy(tmp, map->buf, 2 * map->nr * sizeof(xmlNsPtr));
+	} else {
+	    tmp = (xmlNsPtr *) xmlRealloc(map->tab,
+		4 * map->max * sizeof(xmlNsPtr));
+	}
+	/*
+	* Without the entry, lookups fall back to a search in the
+	* result tree.
+	*/
+	if (tmp == NULL)
+	    return;
+	map->tab = tmp;
+	map->max *= 2;
+    }
+    map->tab[2 * map->nr] = src;
+    map->tab[2 * map->nr + 1] = dst;
+    map->nr++;
+}
+
+/*
+ * Returns the result namespace mapped to @src, or NULL if there's none
+ * or if its prefix is shadowed by an inner ns-decl.
+ */
+static xmlNsPtr
+xsltCopyNsMapLookup(xsltCopyNsMapPtr map, xmlNsPtr src) {
+    int i;
+
+    for (i = map->nr - 1; i >= 0; i--) {
+	if (map->tab[2 * i] == src)
+	    return(map->tab[2 * i + 1]);
+	if (xmlStrEqual(map->tab[2 * i + 1]->prefix, src->prefix))
+	    return(NULL);
+    }
+    return(NULL);
+}
+
+/*
+ * Records the ns-decls of @elem created by xsltGetSpecialNamespace()
+ * and not yet mapped since the entry @first.
+ */
+static void
+xsltCopyNsMapSync(xsltCopyNsMapPtr map, xmlNodePtr elem, int first) {
+    xmlNsPtr ns;
+    int i;
+
+    for (ns = elem->nsDef; ns != NULL; ns = ns->next) {
+	for (i = first; i < map->nr; i++) {
+	    if (map->tab[2 * i + 1] == ns)
+		break;
+	}
+	if (i >= map->nr)
+	    xsltCopyNsMapAdd(map, NULL, ns);
+    }
+}
+
+static void
+xsltCopyTreeListFast(xsltTransformContextPtr ctxt, xmlNodePtr invocNode,
+		     xmlNodePtr list, xmlNodePtr insert,
+		     xsltCopyNsMapPtr map);
+
+/**
+ * xsltCopyElemFast:
+ * @ctxt:  the XSLT transformation context
+ * @invocNode: responsible node in the stylesheet; used for error reports
+ * @node:  an element node below the top-most copied element
+ * @insert:  the parent in the result tree
+ * @map:  the namespaces in scope of @node and their result counterparts
+ *
+ * Deep copy of a descendant element for xsltCopyTree(). The namespaces
+ * of the element and its attributes are taken from @map instead of
+ * being searched in the result tree for every node; the result is the
+ * same as for xsltCopyTree(), which is used for the other cases.
+ */
+static void
+xsltCopyElemFast(xsltTransformContextPtr ctxt, xmlNodePtr invocNode,
+		 xmlNodePtr node, xmlNodePtr insert, xsltCopyNsMapPtr map)
+{
+    xmlNodePtr copy;
+    xmlNsPtr ns, origNs = NULL, copyNs = NULL;
+    xmlAttrPtr attr;
+    xmlChar *value;
+    int first = map->nr;
+
+    /*
+    * Names of nodes in fragments share the dictionary of the result,
+    * unless the node was built with a name of its own.
+    */
+    if ((node->doc != NULL) && (node->doc->dict != NULL) &&
+	(node->doc->dict == insert->doc->dict) &&
+	(xmlDictOwns(insert->doc->dict, node->name))) {
+	copy = xmlNewDocNodeEatName(insert->doc, NULL,
+	    (xmlChar *) node->name, NULL);
+	if (copy != NULL)
+	    copy->line = node->line;
+    } else {
+	copy = xmlDocCopyNode(node, insert->doc, 0);
+    }
+    if (copy == NULL) {
+	xsltTransformError(ctxt, NULL, invocNode,
+	    "xsltCopyTree: Copying of '%s' failed.\n", node->name);
+	return;
+    }
+    copy->doc = ctxt->output;
+    copy = xsltAddChild(insert, copy);
+    if (copy == NULL) {
+	xsltTransformError(ctxt, NULL, invocNode,
+	    "xsltCopyTree: Copying of '%s' failed.\n", node->name);
+	return;
+    }
+
+    /*
+    * Copy over the namespace declaration attributes, see
+    * xsltCopyNamespaceListInternal().
+    */
+    for (ns = node->nsDef; ns != NULL; ns = ns->next) {
+	xmlNsPtr luNs;
+
+	if (ns->type != XML_NAMESPACE_DECL)
+	    break;
+	luNs = xmlSearchNs(copy->doc, copy, ns->prefix);
+	if ((luNs == NULL) || (! xmlStrEqual(luNs->href, ns->href)))
+	    luNs = xmlNewNs(copy, ns->href, ns->prefix);
+	if (luNs != NULL)
+	    xsltCopyNsMapAdd(map, ns, luNs);
+    }
+
+    if (node->ns != NULL) {
+	copy->ns = xsltCopyNsMapLookup(map, node->ns);
+	if (copy->ns == NULL) {
+	    copy->ns = xsltGetSpecialNamespace(ctxt, invocNode,
+		node->ns->href, node->ns->prefix, copy);
+	    xsltCopyNsMapSync(map, copy, first);
+	}
+    } else if ((insert->type == XML_ELEMENT_NODE) &&
+	(insert->ns != NULL))
+    {
+	xsltGetSpecialNamespace(ctxt, invocNode, NULL, NULL, copy);
+	xsltCopyNsMapSync(map, copy, first);
+    }
+
+    /*
+    * Copy attribute nodes, see xsltCopyAttrListNoOverwrite().
+    */
+    for (attr = node->properties; attr != NULL; attr = attr->next) {
+	if (attr->ns != origNs) {
+	    origNs = attr->ns;
+	    if (attr->ns != NULL) {
+		copyNs = xsltCopyNsMapLookup(map, attr->ns);
+		if (copyNs == NULL) {
+		    copyNs = xsltGetSpecialNamespace(ctxt, invocNode,
+			attr->ns->href, attr->ns->prefix, copy);
+		    if (copyNs == NULL)
+			break;
+		    xsltCopyNsMapSync(map, copy, first);
+		}
+	    } else
+		copyNs = NULL;
+	}
+	if ((attr->children) && (attr->children->type == XML_TEXT_NODE) &&
+	    (attr->children->next == NULL)) {
+	    xmlNewNsProp(copy, copyNs, attr->name, attr->children->content);
+	} else if (attr->children != NULL) {
+	    value = xmlNodeListGetString(attr->doc, attr->children, 1);
+	    xmlNewNsProp(copy, copyNs, attr->name, BAD_CAST value);
+	    xmlFree(value);
+	} else {
+	    xmlNewNsProp(copy, copyNs, attr->name, NULL);
+	}
+    }
+
+    if (node->children != NULL)
+	xsltCopyTreeListFast(ctxt, invocNode, node->children, copy, map);
+    map->nr = first;
+}
+
+/**
+ * xsltCopyTreeListFast:
+ * @ctxt:  the XSLT transformation context
+ * @invocNode: responsible node in the stylesheet; used for error reports
+ * @list:  the children of a copied element
+ * @insert:  the parent in the result tree
+ * @map:  the namespaces in scope of @list and their result counterparts
+ *
+ * Copies the content of an element copied by xsltCopyTree().
+ */
+static void
+xsltCopyTreeListFast(xsltTransformContextPtr ctxt, xmlNodePtr invocNode,
+		     xmlNodePtr list, xmlNodePtr insert,
+		     xsltCopyNsMapPtr map)
+{
+    for (; list != NULL; list = list->next) {
+	if (list->type == XML_ELEMENT_NODE)
+	    xsltCopyElemFast(ctxt, invocNode, list, insert, map);
+	else
+	    xsltCopyTree(ctxt, invocNode, list, insert, 0, 1);
+    }
+}
+
 /**
  * xsltCopyTree:
  * @ctxt:  the XSLT transformation context
@@ -1628,9 +2128,13 @@ xsltCopyTree(xsltTransformContextPtr ctxt, xmlNodePtr invocNode,
 	     int topElemVisited)
 {
     xmlNodePtr copy;
+    xsltCopyNsMap map;
 
     if (node == NULL)
 	return(NULL);
+    map.tab = map.buf;
+    map.nr = 0;
+    map.max = XSLT_COPY_NS_MAP_SIZE;
     switch (node->type) {
         case XML_ELEMENT_NODE:
         case XML_ENTITY_REF_NODE:
@@ -1758,6 +2262,8 @@ xsltCopyTree(xsltTransformContextPtr ctxt, xmlNodePtr invocNode,
 			    */
 			    copy->ns = ns;
 			}
+			if (ns != NULL)
+			    xsltCopyNsMapAdd(&map, *curns, ns);
 			curns++;
 		    } while (*curns != NULL);
 		    xmlFree(nsList);
@@ -1772,6 +2278,16 @@ xsltCopyTree(xsltTransformContextPtr ctxt, xmlNodePtr invocNode,
 		    else
 			xsltCopyNamespaceListInternal(copy, node->nsDef);
 		}
+		if (topElemVisited == 0) {
+		    xmlNsPtr ns, luNs;
+
+		    for (ns = node->nsDef; ns != NULL; ns = ns->next) {
+			luNs = xmlSearchNs(copy->doc, copy, ns->prefix);
+			if ((luNs != NULL) &&
+			    (xmlStrEqual(luNs->href, ns->href)))
+			    xsltCopyNsMapAdd(&map, ns, luNs);
+		    }
+		}
 	    }
 	    /*
 	    * Set the namespace.
@@ -1800,8 +2316,21 @@ xsltCopyTree(xsltTransformContextPtr ctxt, xmlNodePtr invocNode,
 		xsltCopyAttrListNoOverwrite(ctxt, invocNode,
 		    copy, node->properties);
 	    }
-	    if (topElemVisited == 0)
+	    if (topElemVisited == 0) {
+		/*
+		* The namespaces in scope of the descendants are known
+		* now, see xsltCopyElemFast().
+		*/
+		if ((node->children != NULL) && (! isLRE)) {
+		    xsltCopyNsMapSync(&map, copy, 0);
+		    xsltCopyTreeListFast(ctxt, invocNode, node->children,
+			copy, &map);
+		    if (map.tab != map.buf)
+			xmlFree(map.tab);
+		    return(copy);
+		}
 		topElemVisited = 1;
+	    }
 	}
 	/*
 	* Copy the subtree.
@@ -1867,6 +2396,114 @@ xsltApplyFallbacks(xsltTransformContextPtr ctxt, xmlNodePtr node,
  *									*
  ************************************************************************/
 
+#ifdef LIBXML_READER_ENABLED
+/*
+ * xsltStreamResetExtras:
+ *
+ * Drop the per-document data cached by the patterns, it refers to
+ * nodes the reader is about to free.
+ */
+static void
+xsltStreamResetExtras(xsltTransformContextPtr ctxt) {
+    int i;
+
+    for (i = 0; i < ctxt->extrasNr; i++) {
+        if ((ctxt->extras[i].deallocate != NULL) &&
+            (ctxt->extras[i].info != NULL))
+            ctxt->extras[i].deallocate(ctxt->extras[i].info);
+        ctxt->extras[i].info = NULL;
+        ctxt->extras[i].deallocate = NULL;
+        ctxt->extras[i].val.ptr = NULL;
+    }
+}
+
+/*
+ * xsltStreamChildren:
+ * @ctxt:  a XSLT process context
+ * @node:  the streamed document element
+ * @select:  pattern the children must match or NULL
+ * @params:  the parameters passed to the templates
+ *
+ * Apply templates to the children of the document element of a
+ * streamed input, reading them one at a time. The reader frees each
+ * child once it moves past it.
+ */
+static void
+xsltStreamChildren(xsltTransformContextPtr ctxt, xmlNodePtr node,
+                   xsltCompMatchPtr select, xsltStackElemPtr params) {
+    xsltTransformContextPrivPtr priv = XSLT_CTXT_PRIV(ctxt);
+    xmlTextReaderPtr reader = (xmlTextReaderPtr) priv->streamReader;
+    xmlXPathContextPtr xpctxt = ctxt->xpathCtxt;
+    xmlNodePtr cur;
+    int ret, pos = 0, strip, stripChildren;
+    int oldSize, oldPos;
+
+    if (priv->streamConsumed) {
+        xsltTransformError(ctxt, NULL, node,
+            "The children of a streamed document element can only be "
+            "processed once.\n");
+        XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
+        return;
+    }
+    priv->streamConsumed = 1;
+    if (xmlTextReaderIsEmptyElement(reader))
+        return;
+
+    stripChildren = xsltNeedElemSpaceHandling(ctxt);
+    strip = stripChildren && xsltFindElemSpaceHandling(ctxt, node);
+    oldSize = xpctxt->contextSize;
+    oldPos = xpctxt->proximityPosition;
+
+    ret = xmlTextReaderRead(reader);
+    while ((ret == 1) && (ctxt->state != XSLT_STATE_STOPPED)) {
+        if (xmlTextReaderDepth(reader) < 1)
+            break;
+        cur = xmlTextReaderExpand(reader);
+        if (cur == NULL) {
+            ret = -1;
+            break;
+        }
+        if ((IS_XSLT_REAL_NODE(cur)) &&
+            ((!strip) || (!IS_BLANK_NODE(cur)))) {
+            if ((stripChildren) && (cur->children != NULL))
+                xsltApplyStripSpaces(ctxt, cur);
+            if ((select == NULL) ||
+                (xsltTestCompMatchList(ctxt, cur, select))) {
+                if (ctxt->depth >= ctxt->maxTemplateDepth) {
+                    xsltTransformError(ctxt, NULL, cur,
+                        "xsltStreamChildren: Maximum template depth "
+                        "exceeded.\n");
+                    XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
+                    break;
+                }
+                /*
+                * The size of the context is unknown until the end,
+                * the streamability check rejects last().
+                */
+                pos++;
+                ctxt->node = cur;
+                xpctxt->contextSize = pos;
+                xpctxt->proximityPosition = pos;
+                ctxt->depth++;
+                xsltProcessOneNode(ctxt, cur, params);
+                ctxt->depth--;
+                xsltStreamResetExtras(ctxt);
+            }
+        }
+        ret = xmlTextReaderNext(reader);
+    }
+    if (ret < 0) {
+        xsltTransformError(ctxt, NULL, node,
+            "xsltStreamChildren: error reading the input\n");
+        XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
+    }
+
+    ctxt->node = node;
+    xpctxt->contextSize = oldSize;
+    xpctxt->proximityPosition = oldPos;
+}
+#endif /* LIBXML_READER_ENABLED */
+
 /**
  * xsltDefaultProcessOneNode:
  * @ctxt:  a XSLT process context
@@ -1965,6 +2602,14 @@ xsltDefaultProcessOneNode(xsltTransformContextPtr ctxt, xmlNodePtr node,
 	default:
 	    return;
     }
+#ifdef LIBXML_READER_ENABLED
+    if ((XSLT_CTXT_PRIV(ctxt)->streamReader != NULL) &&
+        (node == XSLT_CTXT_PRIV(ctxt)->streamRoot)) {
+	xsltStreamChildren(ctxt, node, NULL, params);
+	return;
+    }
+#endif
+
     /*
      * Handling of Elements: first pass, counting
      */
@@ -2001,7 +2646,7 @@ xsltDefaultProcessOneNode(xsltTransformContextPtr ctxt, xmlNodePtr node,
                         "raise the maximum number of nested template calls and "
                         "variables/params (currently set to %d).\n",
                         ctxt->maxTemplateDepth);
-                    ctxt->state = XSLT_STATE_STOPPED;
+                    XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
                     return;
                 }
                 ctxt->depth++;
@@ -2020,7 +2665,7 @@ xsltDefaultProcessOneNode(xsltTransformContextPtr ctxt, xmlNodePtr node,
 		    * Instantiate the xsl:template.
 		    */
 		    xsltApplyXSLTTemplate(ctxt, cur, template->content,
-			template, params);
+			template, params, NULL);
 		} else /* if (ctxt->mode == NULL) */ {
 #ifdef WITH_XSLT_DEBUG_PROCESS
 		    XSLT_TRACE(ctxt,XSLT_TRACE_PROCESS_NODE,xsltGenericDebug(xsltGenericDebugContext,
@@ -2048,7 +2693,7 @@ xsltDefaultProcessOneNode(xsltTransformContextPtr ctxt, xmlNodePtr node,
 		    * Instantiate the xsl:template.
 		    */
 		    xsltApplyXSLTTemplate(ctxt, cur, template->content,
-			template, params);
+			template, params, NULL);
 		} else /* if (ctxt->mode == NULL) */ {
 #ifdef WITH_XSLT_DEBUG_PROCESS
 		    if (cur->content == NULL) {
@@ -2087,7 +2732,7 @@ xsltDefaultProcessOneNode(xsltTransformContextPtr ctxt, xmlNodePtr node,
 		    * Instantiate the xsl:template.
 		    */
 		    xsltApplyXSLTTemplate(ctxt, cur, template->content,
-			template, params);
+			template, params, NULL);
 		}
 		break;
 	    default:
@@ -2115,6 +2760,10 @@ xsltProcessOneNode(xsltTransformContextPtr ctxt, xmlNodePtr contextNode,
     xsltTemplatePtr templ;
     xmlNodePtr oldNode;
 
+    if ((XSLT_NEED_INTERRUPT_CHECK(ctxt)) &&
+        (xsltCheckInterrupt(ctxt, contextNode) < 0))
+        return;
+
     templ = xsltGetTemplate(ctxt, contextNode, NULL);
     /*
      * If no template is found, apply the default rule.
@@ -2155,7 +2804,8 @@ xsltProcessOneNode(xsltTransformContextPtr ctxt, xmlNodePtr contextNode,
 	     "xsltProcessOneNode: applying template '%s' for attribute %s\n",
 	                 templ->match, contextNode->name));
 #endif
-	xsltApplyXSLTTemplate(ctxt, contextNode, templ->content, templ, withParams);
+	xsltApplyXSLTTemplate(ctxt, contextNode, templ->content, templ,
+	    withParams, NULL);
 
 	ctxt->currentTemplateRule = oldCurTempRule;
     } else {
@@ -2176,7 +2826,8 @@ xsltProcessOneNode(xsltTransformContextPtr ctxt, xmlNodePtr contextNode,
 	                     templ->match, contextNode->name));
         }
 #endif
-	xsltApplyXSLTTemplate(ctxt, contextNode, templ->content, templ, withParams);
+	xsltApplyXSLTTemplate(ctxt, contextNode, templ->content, templ,
+	    withParams, NULL);
 
 	ctxt->currentTemplateRule = oldCurTempRule;
     }
@@ -2363,7 +3014,7 @@ xsltApplySequenceConstructor(xsltTransformContextPtr ctxt,
 	    "variables/params (currently set to %d).\n",
 	    ctxt->maxTemplateDepth);
         xsltDebug(ctxt, contextNode, list, NULL);
-	ctxt->state = XSLT_STATE_STOPPED;
+	XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
         return;
     }
     ctxt->depth++;
@@ -2382,16 +3033,9 @@ xsltApplySequenceConstructor(xsltTransformContextPtr ctxt,
     */
     cur = list;
     while (cur != NULL) {
-        if (ctxt->opLimit != 0) {
-            if (ctxt->opCount >= ctxt->opLimit) {
-		xsltTransformError(ctxt, NULL, cur,
-		    "xsltApplySequenceConstructor: "
-                    "Operation limit exceeded\n");
-	        ctxt->state = XSLT_STATE_STOPPED;
-                goto error;
-            }
-            ctxt->opCount += 1;
-        }
+        if ((XSLT_NEED_INTERRUPT_CHECK(ctxt)) &&
+            (xsltCheckInterrupt(ctxt, cur) < 0))
+            goto error;
 
         ctxt->inst = cur;
 
@@ -3055,6 +3699,9 @@ error:
 * @templ: the compiled xsl:template declaration;
 *         NULL if a sequence constructor
 * @withParams:  a set of caller-parameters (xsl:with-param) or NULL
+* @paramSlots:  the caller-parameters indexed by the parameter slots
+*               of @templ (see xsltResolveCallTemplates()) or NULL;
+*               takes precedence over @withParams
 *
 * Called by:
 * - xsltApplyImports()
@@ -3067,7 +3714,8 @@ xsltApplyXSLTTemplate(xsltTransformContextPtr ctxt,
 		      xmlNodePtr contextNode,
 		      xmlNodePtr list,
 		      xsltTemplatePtr templ,
-		      xsltStackElemPtr withParams)
+		      xsltStackElemPtr withParams,
+		      xsltStackElemPtr *paramSlots)
 {
     int oldVarsBase = 0;
     xmlNodePtr cur;
@@ -3081,6 +3729,9 @@ xsltApplyXSLTTemplate(xsltTransformContextPtr ctxt,
     xsltStyleItemParamPtr iparam;
 #else
     xsltStylePreCompPtr iparam;
+    xmlNodePtr content;
+    xsltStackElemPtr tailParams = NULL, *tailSlots = NULL;
+    int paramNr;
 #endif
 
 #ifdef WITH_DEBUGGER
@@ -3107,6 +3758,19 @@ xsltApplyXSLTTemplate(xsltTransformContextPtr ctxt,
         return;
     CHECK_STOPPED;
 
+#ifdef LIBXML_READER_ENABLED
+    if ((XSLT_TEMPL_PRIV(templ)->streamNoRoot) &&
+        (XSLT_CTXT_PRIV(ctxt)->streamReader != NULL) &&
+        (contextNode == XSLT_CTXT_PRIV(ctxt)->streamRoot)) {
+        xsltTransformError(ctxt, NULL, templ->elem,
+            "xsltApplyXSLTTemplate: template '%s' can't process the "
+            "document element of a streamed input\n",
+            templ->match ? templ->match : templ->name);
+        XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
+        return;
+    }
+#endif
+
     if (ctxt->varsNr >= ctxt->maxTemplateVars)
 	{
         xsltTransformError(ctxt, NULL, list,
@@ -3116,7 +3780,7 @@ xsltApplyXSLTTemplate(xsltTransformContextPtr ctxt,
 	    "raise the maximum number of variables/params (currently set to %d).\n",
 	    ctxt->maxTemplateVars);
         xsltDebug(ctxt, contextNode, list, NULL);
-	ctxt->state = XSLT_STATE_STOPPED;
+	XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
         return;
 	}
 
@@ -3149,6 +3813,11 @@ xsltApplyXSLTTemplate(xsltTransformContextPtr ctxt,
     if (templ->name != NULL)
 	XSLT_TRACE(ctxt,XSLT_TRACE_APPLY_TEMPLATE,xsltGenericDebug(xsltGenericDebugContext,
 	"applying xsl:template '%s'\n", templ->name));
+#endif
+#ifndef XSLT_REFACTORED
+    content = list;
+    paramNr = XSLT_TEMPL_PRIV(templ)->paramNr;
+tail_call:
 #endif
     /*
     * Process xsl:param instructions and skip those elements for
@@ -3186,6 +3855,17 @@ xsltApplyXSLTTemplate(xsltTransformContextPtr ctxt,
 	* compile time,
 	*/
 	tmpParam = NULL;
+#ifndef XSLT_REFACTORED
+	if (paramSlots != NULL) {
+	    int slot = XSLT_COMP_PRIV(iparam)->slot;
+
+	    if ((slot >= 0) && (slot < paramNr)) {
+		tmpParam = paramSlots[slot];
+		if (tmpParam != NULL)
+		    xsltLocalVariablePush(ctxt, tmpParam, -1);
+	    }
+	} else
+#endif
 	if (withParams) {
 	    tmpParam = withParams;
 	    do {
@@ -3224,6 +3904,61 @@ xsltApplyXSLTTemplate(xsltTransformContextPtr ctxt,
     */
     if (ctxt->varsNr > ctxt->varsBase)
 	xsltTemplateParamsCleanup(ctxt);
+
+#ifndef XSLT_REFACTORED
+    if (XSLT_CTXT_PRIV(ctxt)->tailCallTempl != NULL) {
+	/*
+	* A self-recursive xsl:call-template in tail position was
+	* deferred by xsltCallTemplate(): run it in this frame with
+	* the new parameters.
+	*/
+	if (tailParams != NULL)
+	    xsltFreeStackElemList(tailParams);
+	tailParams = XSLT_CTXT_PRIV(ctxt)->tailCallParams;
+	XSLT_CTXT_PRIV(ctxt)->tailCallTempl = NULL;
+	XSLT_CTXT_PRIV(ctxt)->tailCallParams = NULL;
+
+	if ((paramNr > 0) && (tailSlots == NULL)) {
+	    tailSlots = (xsltStackElemPtr *)
+		xmlMalloc(paramNr * sizeof(xsltStackElemPtr));
+	    if (tailSlots == NULL) {
+		xsltTransformError(ctxt, NULL, list,
+		    "xsltApplyXSLTTemplate: malloc failed\n");
+		XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
+	    }
+	}
+	if (ctxt->state != XSLT_STATE_STOPPED) {
+	    xsltStackElemPtr param;
+
+	    if (tailSlots != NULL) {
+		memset(tailSlots, 0, paramNr * sizeof(xsltStackElemPtr));
+		for (param = tailParams; param != NULL; param = param->next) {
+		    int slot;
+
+		    if (param->comp == NULL)
+			continue;
+		    slot = XSLT_COMP_PRIV(param->comp)->slot;
+		    if ((slot >= 0) && (slot < paramNr) &&
+			(tailSlots[slot] == NULL))
+			tailSlots[slot] = param;
+		}
+	    }
+	    withParams = tailParams;
+	    paramSlots = tailSlots;
+	    list = content;
+	    ctxt->node = contextNode;
+#ifdef WITH_PROFILER
+	    if (ctxt->profile)
+		templ->nbCalls++;
+#endif
+	    goto tail_call;
+	}
+    }
+    if (tailParams != NULL)
+	xsltFreeStackElemList(tailParams);
+    if (tailSlots != NULL)
+	xmlFree(tailSlots);
+#endif
     ctxt->varsBase = oldVarsBase;
 
     /*
@@ -3350,6 +4085,453 @@ xsltApplyOneTemplate(xsltTransformContextPtr ctxt,
  *									*
  ************************************************************************/
 
+/**
+ * xsltSaveDocumentResult:
+ * @filename:  the output file
+ * @res:  the result document
+ * @style:  the output settings
+ * @append:  append to an existing file
+ *
+ * Serialize the result of an xsl:document instruction.
+ *
+ * Returns the number of bytes written or -1 in case of failure.
+ */
+static int
+xsltSaveDocumentResult(const xmlChar *filename, xmlDocPtr res,
+                       xsltStylesheetPtr style, int append)
+{
+    int ret;
+
+    if (append) {
+        FILE *f;
+
+	f = fopen((const char *) filename, "ab");
+	if (f == NULL) {
+	    ret = -1;
+	} else {
+	    ret = xsltSaveResultToFile(f, res, style);
+	    fclose(f);
+	}
+    } else {
+	ret = xsltSaveResultToFilename((const char *) filename, res, style, 0);
+    }
+    return(ret);
+}
+
+/*
+ * Asynchronous output of xsl:document results.
+ *
+ * Finished result documents are handed to a few writer queues which
+ * are drained by tasks of the thread pool while the transformation
+ * goes on. Documents written to the same file always go to the same
+ * writer so appends keep their order. Each writer has a bounded queue,
+ * the transformation blocks when it is full. Completed jobs are collected
+ * and freed by the transformation thread, which also reports the
+ * failures with the instruction that produced the document.
+ */
+#ifdef XSLT_ASYNC_OUTPUT
+
+typedef struct _xsltAsyncOutputJob xsltAsyncOutputJob;
+typedef xsltAsyncOutputJob *xsltAsyncOutputJobPtr;
+struct _xsltAsyncOutputJob {
+    xsltAsyncOutputJobPtr next;
+    xmlNodePtr inst;		/* the xsl:document instruction */
+    xmlChar *filename;
+    xmlDocPtr res;
+    xsltStylesheetPtr style;	/* output settings */
+    int append;
+    int ret;			/* result of xsltSaveDocumentResult() */
+};
+
+typedef struct _xsltAsyncOutput xsltAsyncOutput;
+typedef xsltAsyncOutput *xsltAsyncOutputPtr;
+
+typedef struct _xsltAsyncWriter xsltAsyncWriter;
+typedef xsltAsyncWriter *xsltAsyncWriterPtr;
+struct _xsltAsyncWriter {
+    xsltAsyncOutputPtr pool;
+    xsltAsyncOutputJobPtr first;	/* queued jobs */
+    xsltAsyncOutputJobPtr last;
+    int nbJobs;			/* queued and running jobs */
+    int running;		/* a task drains the queue */
+};
+
+struct _xsltAsyncOutput {
+    xsltTaskGroupPtr group;
+    pthread_mutex_t lock;
+    pthread_cond_t done;	/* a job completed */
+    int maxQueued;
+    int nbWriters;
+    xsltAsyncWriterPtr writers;
+    xsltAsyncOutputJobPtr completed;
+};
+
+/*
+ * Task writing the documents queued to a writer.
+ */
+static void
+xsltAsyncWriterRun(void *data) {
+    xsltAsyncWriterPtr writer = (xsltAsyncWriterPtr) data;
+    xsltAsyncOutputPtr pool = writer->pool;
+    xsltAsyncOutputJobPtr job;
+
+    pthread_mutex_lock(&pool->lock);
+    while ((job = writer->first) != NULL) {
+        writer->first = job->next;
+        if (writer->first == NULL)
+            writer->last = NULL;
+        pthread_mutex_unlock(&pool->lock);
+
+        job->ret = xsltSaveDocumentResult(job->filename, job->res,
+                                          job->style, job->append);
+
+        pthread_mutex_lock(&pool->lock);
+        job->next = pool->completed;
+        pool->completed = job;
+        writer->nbJobs--;
+        pthread_cond_broadcast(&pool->done);
+    }
+    writer->running = 0;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * xsltAsyncOutputPath:
+ * @filename:  the output file
+ *
+ * Compute the name identifying the file written to @filename: the
+ * "file:" URIs accepted by libxml2 are turned to paths, and the
+ * directory of the file is resolved to an absolute path without "."
+ * or ".." components nor symbolic links.
+ *
+ * Returns the name of the file, @filename itself if its directory
+ * can't be resolved, or NULL in case of error.
+ */
+static xmlChar *
+xsltAsyncOutputPath(const xmlChar *filename) {
+    char resolved[PATH_MAX];
+    xmlChar *path, *ret;
+#ifndef _WIN32
+    char *sep;
+    const char *dir, *base;
+#endif
+
+    if (xmlStrncasecmp(filename, BAD_CAST "file://localhost/", 17) == 0)
+        path = BAD_CAST xmlURIUnescapeString(
+            (const char *) filename + 16, 0, NULL);
+    else if (xmlStrncasecmp(filename, BAD_CAST "file:///", 8) == 0)
+        path = BAD_CAST xmlURIUnescapeString(
+            (const char *) filename + 7, 0, NULL);
+    else
+        path = xmlStrdup(filename);
+    if (path == NULL)
+        return(NULL);
+
+#ifdef _WIN32
+    if (_fullpath(resolved, (const char *) path, sizeof(resolved)) == NULL)
+        return(path);
+    ret = xmlStrdup(BAD_CAST resolved);
+#else
+    /*
+     * Only the directory is resolved: the file itself may not exist
+     * yet, and its name must not change once it is created.
+     */
+    sep = strrchr((char *) path, '/');
+    if (sep == NULL) {
+        dir = ".";
+        base = (const char *) path;
+    } else if (sep == (char *) path) {
+        dir = "/";
+        base = sep + 1;
+    } else {
+        *sep = 0;
+        dir = (const char *) path;
+        base = sep + 1;
+    }
+    if (realpath(dir, resolved) == NULL) {
+        if (sep != NULL)
+            *sep = '/';
+        return(path);
+    }
+    ret = xmlStrdup(BAD_CAST resolved);
+    if (ret != NULL) {
+        if (resolved[strlen(resolved) - 1] != '/')
+            ret = xmlStrcat(ret, BAD_CAST "/");
+        ret = xmlStrcat(ret, BAD_CAST base);
+    }
+#endif
+    xmlFree(path);
+    return(ret);
+}
+
+/**
+ * xsltAsyncOutputReap:
+ * @ctxt:  an XSLT transformation context
+ * @list:  a list of completed jobs
+ *
+ * Report the failures of the completed jobs and free them.
+ */
+static void
+xsltAsyncOutputReap(xsltTransformContextPtr ctxt,
+                    xsltAsyncOutputJobPtr list) {
+    xsltAsyncOutputJobPtr job;
+
+    while (list != NULL) {
+        job = list;
+        list = job->next;
+        if (job->ret < 0) {
+            xsltTransformError(ctxt, NULL, job->inst,
+                             "xsltDocumentElem: unable to save to %s\n",
+                             job->filename);
+#ifdef WITH_XSLT_DEBUG_EXTRA
+        } else {
+            xsltGenericDebug(xsltGenericDebugContext,
+                             "Wrote %d bytes to %s\n", job->ret,
+                             job->filename);
+#endif
+        }
+        xmlFree(job->filename);
+        xsltFreeStylesheet(job->style);
+        xmlFreeDoc(job->res);
+        xmlFree(job);
+    }
+}
+
+#endif /* XSLT_ASYNC_OUTPUT */
+
+/**
+ * xsltAsyncOutputQueue:
+ * @ctxt:  an XSLT transformation context
+ * @inst:  the xsl:document instruction
+ * @filename:  the output file
+ * @res:  the result document
+ * @style:  the output settings
+ * @append:  append to an existing file
+ *
+ * Hand a result document to the writer threads, waiting for room
+ * in the queue of its writer if needed.
+ *
+ * Returns 0 if the job was queued, -1 if the document must be
+ * written by the caller.
+ */
+static int
+xsltAsyncOutputQueue(xsltTransformContextPtr ctxt, xmlNodePtr inst,
+                     xmlChar *filename, xmlDocPtr res,
+                     xsltStylesheetPtr style, int append) {
+#ifdef XSLT_ASYNC_OUTPUT
+    xsltAsyncOutputPtr pool =
+        (xsltAsyncOutputPtr) XSLT_CTXT_PRIV(ctxt)->asyncOutput;
+    xsltAsyncWriterPtr writer;
+    xsltAsyncOutputJobPtr job, completed;
+    unsigned long hash = 0;
+    xmlChar *path;
+    const xmlChar *cur;
+    int start = 0;
+
+    /*
+     * Route on the file rather than on its name, the same file may be
+     * named differently.
+     */
+    path = xsltAsyncOutputPath(filename);
+    if (path == NULL)
+        return(-1);
+    for (cur = path; *cur != 0; cur++)
+        hash = hash * 31 + *cur;
+    xmlFree(path);
+    writer = &pool->writers[hash % pool->nbWriters];
+
+    job = (xsltAsyncOutputJobPtr) xmlMalloc(sizeof(xsltAsyncOutputJob));
+    if (job == NULL)
+        return(-1);
+    job->next = NULL;
+    job->inst = inst;
+    job->filename = filename;
+    job->res = res;
+    job->style = style;
+    job->append = append;
+    job->ret = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while (writer->nbJobs >= pool->maxQueued)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    if (writer->last == NULL)
+        writer->first = job;
+    else
+        writer->last->next = job;
+    writer->last = job;
+    writer->nbJobs++;
+    if (!writer->running) {
+        writer->running = 1;
+        start = 1;
+    }
+    completed = pool->completed;
+    pool->completed = NULL;
+    pthread_mutex_unlock(&pool->lock);
+
+    if ((start) &&
+        (xsltTaskGroupSubmit(pool->group, xsltAsyncWriterRun, writer) < 0))
+        xsltAsyncWriterRun(writer);
+    xsltAsyncOutputReap(ctxt, completed);
+    return(0);
+#else
+    (void) ctxt;
+    (void) inst;
+    (void) filename;
+    (void) res;
+    (void) style;
+    (void) append;
+    return(-1);
+#endif
+}
+
+/**
+ * xsltAsyncOutputDrain:
+ * @ctxt:  an XSLT transformation context
+ *
+ * Wait until all the queued result documents are written.
+ */
+static void
+xsltAsyncOutputDrain(xsltTransformContextPtr ctxt) {
+#ifdef XSLT_ASYNC_OUTPUT
+    xsltAsyncOutputPtr pool =
+        (xsltAsyncOutputPtr) XSLT_CTXT_PRIV(ctxt)->asyncOutput;
+    xsltAsyncOutputJobPtr completed;
+
+    if (pool == NULL)
+        return;
+    xsltTaskGroupWait(pool->group);
+    pthread_mutex_lock(&pool->lock);
+    completed = pool->completed;
+    pool->completed = NULL;
+    pthread_mutex_unlock(&pool->lock);
+
+    xsltAsyncOutputReap(ctxt, completed);
+#else
+    (void) ctxt;
+#endif
+}
+
+/**
+ * xsltAsyncOutputFree:
+ * @ctxt:  an XSLT transformation context
+ *
+ * Write the pending result documents and release the writers.
+ */
+static void
+xsltAsyncOutputFree(xsltTransformContextPtr ctxt) {
+#ifdef XSLT_ASYNC_OUTPUT
+    xsltAsyncOutputPtr pool =
+        (xsltAsyncOutputPtr) XSLT_CTXT_PRIV(ctxt)->asyncOutput;
+
+    if (pool == NULL)
+        return;
+    xsltAsyncOutputDrain(ctxt);
+
+    xsltFreeTaskGroup(pool->group);
+    pthread_cond_destroy(&pool->done);
+    pthread_mutex_destroy(&pool->lock);
+    xmlFree(pool->writers);
+    xmlFree(pool);
+    XSLT_CTXT_PRIV(ctxt)->asyncOutput = NULL;
+#else
+    (void) ctxt;
+#endif
+}
+
+/**
+ * xsltSetCtxtAsyncOutput:
+ * @ctxt:  an XSLT transformation context
+ * @nbWriters:  the number of documents written at the same time, 0 to
+ *              disable
+ * @maxQueued:  the maximum number of documents queued per writer
+ *
+ * Let the result documents of xsl:document and exsl:document be
+ * serialized and written by tasks of the thread pool, see
+ * xsltSetThreadPool(), so the transformation doesn't wait for the
+ * output. The security checks are still done
+ * before the document is built and write errors are reported to the
+ * context before the transformation ends.
+ * Documents written this way can't be read back with document()
+ * during the same transformation.
+ *
+ * Returns 0 in case of success, -1 if threads are not supported or
+ * in case of error.
+ */
+int
+xsltSetCtxtAsyncOutput(xsltTransformContextPtr ctxt, int nbWriters,
+                       int maxQueued) {
+#ifdef XSLT_ASYNC_OUTPUT
+    xsltAsyncOutputPtr pool;
+    int i;
+
+    if (ctxt == NULL)
+        return(-1);
+    xsltAsyncOutputFree(ctxt);
+    if (nbWriters <= 0)
+        return(0);
+    if (maxQueued <= 0)
+        maxQueued = 1;
+
+    pool = (xsltAsyncOutputPtr) xmlMalloc(sizeof(xsltAsyncOutput));
+    if (pool == NULL) {
+        xsltTransformError(ctxt, NULL, NULL,
+                           "xsltSetCtxtAsyncOutput: out of memory\n");
+        return(-1);
+    }
+    memset(pool, 0, sizeof(xsltAsyncOutput));
+    pool->writers = (xsltAsyncWriterPtr)
+        xmlMalloc(nbWriters * sizeof(xsltAsyncWriter));
+    if (pool->writers == NULL) {
+        xsltTransformError(ctxt, NULL, NULL,
+                           "xsltSetCtxtAsyncOutput: out of memory\n");
+        xmlFree(pool);
+        return(-1);
+    }
+    memset(pool->writers, 0, nbWriters * sizeof(xsltAsyncWriter));
+    pool->group = xsltNewTaskGroup(ctxt);
+    if (pool->group == NULL) {
+        xmlFree(pool->writers);
+        xmlFree(pool);
+        return(-1);
+    }
+    for (i = 0; i < nbWriters; i++)
+        pool->writers[i].pool = pool;
+    pool->nbWriters = nbWriters;
+    pool->maxQueued = maxQueued;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    XSLT_CTXT_PRIV(ctxt)->asyncOutput = pool;
+
+    return(0);
+#else
+    (void) ctxt;
+    (void) nbWriters;
+    (void) maxQueued;
+    return(-1);
+#endif
+}
+
+/**
+ * xsltSetOutputSinkFunc:
+ * @ctxt:  an XSLT transformation context
+ * @func:  the function receiving the result documents or NULL
+ * @ctx:  user data passed to @func
+ *
+ * Hand the result documents of xsl:document and its extension
+ * counterparts to @func instead of writing them to the filesystem.
+ * The names of the documents are still checked against the security
+ * preferences for writes, but no directory is created. A NULL @func
+ * restores the default.
+ */
+void
+xsltSetOutputSinkFunc(xsltTransformContextPtr ctxt, xsltOutputSinkFunc func,
+                      void *ctx) {
+    if (ctxt == NULL)
+        return;
+    XSLT_CTXT_PRIV(ctxt)->outputSink = func;
+    XSLT_CTXT_PRIV(ctxt)->outputSinkCtxt = ctx;
+}
+
 /**
  * xsltDocumentElem:
  * @ctxt:  an XSLT processing context
@@ -3485,7 +4667,13 @@ xsltDocumentElem(xsltTransformContextPtr ctxt, xmlNodePtr node,
      * Security checking: can we write to this resource
      */
     if (ctxt->sec != NULL) {
-	ret = xsltCheckWrite(ctxt->sec, ctxt, filename);
+        /*
+         * An output sink writes no file, but gets the same names.
+         */
+        if (XSLT_CTXT_PRIV(ctxt)->outputSink == NULL)
+            ret = xsltCheckWrite(ctxt->sec, ctxt, filename);
+        else
+            ret = xsltCheckWriteNoCreate(ctxt->sec, ctxt, filename);
 	if (ret <= 0) {
             if (ret == 0)
                 xsltTransformError(ctxt, NULL, inst,
@@ -3820,18 +5008,27 @@ xsltDocumentElem(xsltTransformContextPtr ctxt, xmlNodePtr node,
 	xmlFree(prop);
     }
 
-    if (redirect_write_append) {
-        FILE *f;
+    if (XSLT_CTXT_PRIV(ctxt)->outputSink != NULL) {
+        xsltTransformContextPrivPtr priv = XSLT_CTXT_PRIV(ctxt);
 
-	f = fopen((const char *) filename, "ab");
-	if (f == NULL) {
-	    ret = -1;
-	} else {
-	    ret = xsltSaveResultToFile(f, res, style);
-	    fclose(f);
-	}
+        ret = priv->outputSink(priv->outputSinkCtxt, filename, res, style,
+                               redirect_write_append);
     } else {
-	ret = xsltSaveResultToFilename((const char *) filename, res, style, 0);
+        if (XSLT_CTXT_PRIV(ctxt)->asyncOutput != NULL) {
+            /*
+             * The writer takes ownership of the result, its output
+             * settings and the filename.
+             */
+            if (xsltAsyncOutputQueue(ctxt, inst, filename, res, style,
+                                     redirect_write_append) == 0) {
+                filename = NULL;
+                style = NULL;
+                res = NULL;
+                goto error;
+            }
+        }
+        ret = xsltSaveDocumentResult(filename, res, style,
+                                     redirect_write_append);
     }
     if (ret < 0) {
 	xsltTransformError(ctxt, NULL, inst,
@@ -3946,6 +5143,12 @@ xsltCopy(xsltTransformContextPtr ctxt, xmlNodePtr node,
 #endif
 		copy = xsltShallowCopyElem(ctxt, node, ctxt->insert, 0);
 		ctxt->insert = copy;
+#ifndef XSLT_REFACTORED
+		if (XSLT_COMP_PRIV(comp)->useAttrSets != NULL) {
+		    xsltApplyUseAttributeSets(ctxt, node,
+			XSLT_COMP_PRIV(comp)->useAttrSets);
+		} else
+#endif
 		if (comp->use != NULL) {
 		    xsltApplyAttributeSet(ctxt, node, inst, comp->use);
 		}
@@ -4113,7 +5316,8 @@ xsltElement(xsltTransformContextPtr ctxt, xmlNodePtr node,
     /*
      * Create the new element
      */
-    if (ctxt->output->dict == ctxt->dict) {
+    if ((ctxt->output->dict == ctxt->dict) &&
+	(xmlDictOwns(ctxt->dict, name))) {
 	copy = xmlNewDocNodeEatName(ctxt->output, NULL, (xmlChar *)name, NULL);
     } else {
 	copy = xmlNewDocNode(ctxt->output, NULL, (xmlChar *)name, NULL);
@@ -4223,6 +5427,12 @@ xsltElement(xsltTransformContextPtr ctxt, xmlNodePtr node,
     ctxt->insert = copy;
 
     if (comp->has_use) {
+#ifndef XSLT_REFACTORED
+	if (XSLT_COMP_PRIV(comp)->useAttrSets != NULL) {
+	    xsltApplyUseAttributeSets(ctxt, node,
+		XSLT_COMP_PRIV(comp)->useAttrSets);
+	} else
+#endif
 	if (comp->use != NULL) {
 	    xsltApplyAttributeSet(ctxt, node, inst, comp->use);
 	} else {
@@ -4482,7 +5692,7 @@ xsltCopyOf(xsltTransformContextPtr ctxt, xmlNodePtr node,
 		xsltTransformError(ctxt, NULL, inst,
 		    "Internal error in xsltCopyOf(): "
 		    "failed to cast an XPath object to string.\n");
-		ctxt->state = XSLT_STATE_STOPPED;
+		XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
 	    } else {
 		if (value[0] != 0) {
 		    /*
@@ -4499,7 +5709,7 @@ xsltCopyOf(xsltTransformContextPtr ctxt, xmlNodePtr node,
 	    }
 	}
     } else {
-	ctxt->state = XSLT_STATE_STOPPED;
+	XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
     }
 
     if (res != NULL)
@@ -4553,7 +5763,7 @@ xsltValueOf(xsltTransformContextPtr ctxt, xmlNodePtr node,
 	    xsltTransformError(ctxt, NULL, inst,
 		"Internal error in xsltValueOf(): "
 		"failed to cast an XPath object to string.\n");
-	    ctxt->state = XSLT_STATE_STOPPED;
+	    XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
 	    goto error;
 	}
 	if (value[0] != 0) {
@@ -4562,7 +5772,7 @@ xsltValueOf(xsltTransformContextPtr ctxt, xmlNodePtr node,
     } else {
 	xsltTransformError(ctxt, NULL, inst,
 	    "XPath evaluation returned no result.\n");
-	ctxt->state = XSLT_STATE_STOPPED;
+	XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
 	goto error;
     }
 
@@ -4611,9 +5821,6 @@ xsltNumber(xsltTransformContextPtr ctxt, xmlNodePtr node,
     if ((ctxt == NULL) || (node == NULL) || (inst == NULL) || (comp == NULL))
 	return;
 
-    comp->numdata.doc = inst->doc;
-    comp->numdata.node = inst;
-
     xpctxt = ctxt->xpathCtxt;
     oldXPNsNr = xpctxt->nsNr;
     oldXPNamespaces = xpctxt->namespaces;
@@ -4696,7 +5903,7 @@ xsltApplyImports(xsltTransformContextPtr ctxt, xmlNodePtr contextNode,
 	* URGENT TODO: Need xsl:with-param be handled somehow here?
 	*/
 	xsltApplyXSLTTemplate(ctxt, contextNode, templ->content,
-	    templ, NULL);
+	    templ, NULL, NULL);
 
 	ctxt->currentTemplateRule = oldCurTemplRule;
     }
@@ -4706,6 +5913,107 @@ xsltApplyImports(xsltTransformContextPtr ctxt, xmlNodePtr contextNode,
     }
 }
 
+#ifndef XSLT_REFACTORED
+/**
+ * xsltTailCallAdoptFragment:
+ * @ctxt:  a XSLT transformation context
+ * @params:  the caller-parameters of a pending tail call
+ * @param:  the caller-parameter referencing @doc
+ * @doc:  a result tree fragment
+ * @check:  only check whether @doc can be adopted
+ *
+ * Makes @param own the tree fragment @doc if it is currently owned by
+ * a variable or parameter of the current template frame, which goes
+ * away before the tail call is executed.
+ *
+ * Returns 0 if @doc will survive the current frame, -1 otherwise.
+ */
+static int
+xsltTailCallAdoptFragment(xsltTransformContextPtr ctxt,
+			  xsltStackElemPtr params, xsltStackElemPtr param,
+			  xmlDocPtr doc, int check)
+{
+    xsltStackElemPtr elem;
+    xmlDocPtr *prev;
+    int i;
+
+    if ((doc->name == NULL) || (doc->name[0] != ' ') ||
+	(doc->compression == XSLT_RVT_GLOBAL))
+	return(0);
+
+    for (elem = params; elem != NULL; elem = elem->next) {
+	for (prev = &elem->fragment; *prev != NULL;
+	     prev = (xmlDocPtr *) &(*prev)->next) {
+	    if (*prev == doc)
+		return(0);
+	}
+    }
+    for (i = ctxt->varsBase; i < ctxt->varsNr; i++) {
+	for (elem = ctxt->varsTab[i]; elem != NULL; elem = elem->next) {
+	    for (prev = &elem->fragment; *prev != NULL;
+		 prev = (xmlDocPtr *) &(*prev)->next) {
+		if (*prev != doc)
+		    continue;
+		if (! check) {
+		    *prev = (xmlDocPtr) doc->next;
+		    doc->prev = NULL;
+		    doc->next = (xmlNodePtr) param->fragment;
+		    param->fragment = doc;
+		}
+		return(0);
+	    }
+	}
+    }
+    return(-1);
+}
+
+/**
+ * xsltTailCallAdoptFragments:
+ * @ctxt:  a XSLT transformation context
+ * @params:  the caller-parameters of a pending tail call
+ * @check:  only check whether the fragments can be adopted
+ *
+ * Moves the tree fragments referenced by @params out of the current
+ * template frame, see xsltTailCallAdoptFragment().
+ *
+ * Returns 0 in case of success, -1 if a referenced fragment is not
+ * owned by the frame (e.g. local fragments of the sequence constructor).
+ */
+static int
+xsltTailCallAdoptFragments(xsltTransformContextPtr ctxt,
+			   xsltStackElemPtr params, int check)
+{
+    xsltStackElemPtr param;
+    xmlNodeSetPtr set;
+    xmlNodePtr cur;
+    int i;
+
+    for (param = params; param != NULL; param = param->next) {
+	if ((param->value == NULL) ||
+	    ((param->value->type != XPATH_NODESET) &&
+	     (param->value->type != XPATH_XSLT_TREE)))
+	    continue;
+	set = param->value->nodesetval;
+	if (set == NULL)
+	    continue;
+	for (i = 0; i < set->nodeNr; i++) {
+	    cur = set->nodeTab[i];
+	    if (cur->type == XML_NAMESPACE_DECL) {
+		cur = (xmlNodePtr) ((xmlNsPtr) cur)->next;
+		if ((cur == NULL) || (cur->type != XML_ELEMENT_NODE))
+		    return(-1);
+	    }
+	    if (cur->doc == NULL)
+		return(-1);
+	    if (xsltTailCallAdoptFragment(ctxt, params, param, cur->doc,
+		    check) < 0)
+		return(-1);
+	}
+    }
+    return(0);
+}
+#endif /* XSLT_REFACTORED */
+
 /**
  * xsltCallTemplate:
  * @ctxt:  a XSLT transformation context
@@ -4724,8 +6032,12 @@ xsltCallTemplate(xsltTransformContextPtr ctxt, xmlNodePtr node,
 	(xsltStyleItemCallTemplatePtr) castedComp;
 #else
     xsltStylePreCompPtr comp = (xsltStylePreCompPtr) castedComp;
+    xsltStackElemPtr slotBuf[XSLT_CALL_TEMPLATE_SLOTS];
+    int tailCall = 0, paramNr = 0;
 #endif
     xsltStackElemPtr withParams = NULL;
+    xsltStackElemPtr *paramSlots = NULL;
+    xsltTemplatePtr templ;
 
     if (ctxt->insert == NULL)
 	return;
@@ -4736,11 +6048,13 @@ xsltCallTemplate(xsltTransformContextPtr ctxt, xmlNodePtr node,
     }
 
     /*
-     * The template must have been precomputed
+     * The template is normally bound at compile time, see
+     * xsltResolveCallTemplates(); fall back to a lookup by name.
      */
-    if (comp->templ == NULL) {
-	comp->templ = xsltFindTemplate(ctxt, comp->name, comp->ns);
-	if (comp->templ == NULL) {
+    templ = comp->templ;
+    if (templ == NULL) {
+	templ = xsltFindTemplate(ctxt, comp->name, comp->ns);
+	if (templ == NULL) {
 	    if (comp->ns != NULL) {
 	        xsltTransformError(ctxt, NULL, inst,
 			"The called template '{%s}%s' was not found.\n",
@@ -4753,6 +6067,38 @@ xsltCallTemplate(xsltTransformContextPtr ctxt, xmlNodePtr node,
 	    return;
 	}
     }
+#ifndef XSLT_REFACTORED
+    else if ((XSLT_COMP_PRIV(comp)->tailCall) && (ctxt->templ == templ) &&
+	     (XSLT_CTXT_PRIV(ctxt)->tailCallTempl == NULL)
+#ifdef WITH_DEBUGGER
+	     && (ctxt->debugStatus == XSLT_DEBUG_NONE)
+#endif
+	     ) {
+	/*
+	* Self-recursive call in tail position, see xsltMarkTailCalls().
+	* The parameters are slotted by xsltApplyXSLTTemplate().
+	*/
+	tailCall = 1;
+    } else if (XSLT_TEMPL_PRIV(templ)->paramNr > 0) {
+	/*
+	* The xsl:with-param children were mapped to the parameter
+	* slots of the called template at compile time.
+	*/
+	paramNr = XSLT_TEMPL_PRIV(templ)->paramNr;
+	if (paramNr <= XSLT_CALL_TEMPLATE_SLOTS) {
+	    paramSlots = slotBuf;
+	} else {
+	    paramSlots = (xsltStackElemPtr *)
+		xmlMalloc(paramNr * sizeof(xsltStackElemPtr));
+	    if (paramSlots == NULL) {
+		xsltTransformError(ctxt, NULL, inst,
+		    "xsltCallTemplate: malloc failed\n");
+		return;
+	    }
+	}
+	memset(paramSlots, 0, paramNr * sizeof(xsltStackElemPtr));
+    }
+#endif
 
 #ifdef WITH_XSLT_DEBUG_PROCESS
     if ((comp != NULL) && (comp->name != NULL))
@@ -4768,20 +6114,23 @@ xsltCallTemplate(xsltTransformContextPtr ctxt, xmlNodePtr node,
 	while (cur != NULL) {
 #ifdef WITH_DEBUGGER
 	    if (ctxt->debugStatus != XSLT_DEBUG_NONE)
-		xslHandleDebugger(cur, node, comp->templ, ctxt);
+		xslHandleDebugger(cur, node, templ, ctxt);
 #endif
 	    if (ctxt->state == XSLT_STATE_STOPPED) break;
-	    /*
-	    * TODO: The "with-param"s could be part of the "call-template"
-	    *   structure. Avoid to "search" for params dynamically
-	    *   in the XML tree every time.
-	    */
 	    if (IS_XSLT_ELEM(cur)) {
 		if (IS_XSLT_NAME(cur, "with-param")) {
 		    param = xsltParseStylesheetCallerParam(ctxt, cur);
 		    if (param != NULL) {
 			param->next = withParams;
 			withParams = param;
+#ifndef XSLT_REFACTORED
+			if (paramSlots != NULL) {
+			    int slot = XSLT_COMP_PRIV(cur->psvi)->slot;
+
+			    if ((slot >= 0) && (slot < paramNr))
+				paramSlots[slot] = param;
+			}
+#endif
 		    }
 		} else {
 		    xsltGenericError(xsltGenericErrorContext,
@@ -4794,13 +6143,31 @@ xsltCallTemplate(xsltTransformContextPtr ctxt, xmlNodePtr node,
 	    cur = cur->next;
 	}
     }
+#ifndef XSLT_REFACTORED
+    if ((tailCall) &&
+	(xsltTailCallAdoptFragments(ctxt, withParams, 1) == 0)) {
+	/*
+	* Let the frame of the current template run the call once
+	* the current instantiation is finished, instead of growing
+	* the stack.
+	*/
+	xsltTailCallAdoptFragments(ctxt, withParams, 0);
+	XSLT_CTXT_PRIV(ctxt)->tailCallTempl = templ;
+	XSLT_CTXT_PRIV(ctxt)->tailCallParams = withParams;
+	return;
+    }
+#endif
     /*
      * Create a new frame using the params first
      */
-    xsltApplyXSLTTemplate(ctxt, node, comp->templ->content, comp->templ,
-	withParams);
+    xsltApplyXSLTTemplate(ctxt, node, templ->content, templ,
+	withParams, paramSlots);
     if (withParams != NULL)
 	xsltFreeStackElemList(withParams);
+#ifndef XSLT_REFACTORED
+    if ((paramSlots != NULL) && (paramSlots != slotBuf))
+	xmlFree(paramSlots);
+#endif
 
 #ifdef WITH_XSLT_DEBUG_PROCESS
     if ((comp != NULL) && (comp->name != NULL))
@@ -4810,16 +6177,681 @@ xsltCallTemplate(xsltTransformContextPtr ctxt, xmlNodePtr node,
 }
 
 /**
- * xsltApplyTemplates:
- * @ctxt:  a XSLT transformation context
- * @node:  the 'current node' in the source tree
- * @inst:  the element node of an XSLT 'apply-templates' instruction
- * @castedComp:  the compiled instruction
+ * xsltHasSortChild:
+ * @inst:  an xsl:apply-templates instruction
  *
- * Processes the XSLT 'apply-templates' instruction on the current node.
+ * Returns 1 if the instruction has xsl:sort children, 0 otherwise.
  */
-void
-xsltApplyTemplates(xsltTransformContextPtr ctxt, xmlNodePtr node,
+static int
+xsltHasSortChild(xmlNodePtr inst) {
+    xmlNodePtr cur;
+
+    for (cur = inst->children; cur != NULL; cur = cur->next) {
+	if (cur->type == XML_TEXT_NODE)
+	    continue;
+	if (! IS_XSLT_ELEM(cur))
+	    break;
+	if (IS_XSLT_NAME(cur, "sort"))
+	    return(1);
+    }
+    return(0);
+}
+
+/*
+ * Parallel xsl:apply-templates.
+ *
+ * When enabled with xsltSetCtxtParallel(), a large node list is cut
+ * into chunks of consecutive nodes which are transformed by worker
+ * contexts run as tasks of the thread pool, the transformation thread
+ * running the first one. Each worker has its own variable
+ * stack, RVT cache, dictionary and output document, and builds the
+ * results of a chunk under a container element declaring the
+ * namespaces in scope at the insertion point. Once all the chunks are
+ * done, the transformation thread moves their content into the result
+ * in document order.
+ *
+ * The source tree, the compiled stylesheet and the global variables,
+ * which are computed before dispatching, are only read by the workers.
+ * Stylesheets whose instructions have side effects or modify the
+ * source tree (xsl:message, xsl:document, extension elements, keys,
+ * generate-id()) are always transformed serially.
+ */
+#ifdef XSLT_PARALLEL_APPLY
+
+#define XSLT_PARALLEL_MIN_NODES 64
+#define XSLT_PARALLEL_CHUNKS_PER_WORKER 8
+
+typedef struct _xsltParallel xsltParallel;
+typedef xsltParallel *xsltParallelPtr;
+
+typedef struct _xsltParallelWorker xsltParallelWorker;
+typedef xsltParallelWorker *xsltParallelWorkerPtr;
+struct _xsltParallelWorker {
+    xsltParallelPtr par;
+    xsltTransformContextPtr ctxt;
+    xmlDocPtr output;		/* holds the chunk containers */
+};
+
+struct _xsltParallel {
+    int nbWorkers;
+    int minNodes;
+    int safe;			/* -1 if not checked yet */
+    int active;			/* a dispatch is running */
+    xsltParallelWorkerPtr workers;	/* created on first use */
+    xsltTaskGroupPtr group;
+    pthread_mutex_t globalLock;	/* serializes the global variables */
+
+    /* The current dispatch */
+    pthread_mutex_t lock;
+    xmlNodePtr *nodes;
+    int nbNodes;
+    int chunkSize;
+    int nbChunks;
+    int nextChunk;
+    xmlNodePtr *results;	/* container of each chunk */
+    xmlNsPtr *nsList;		/* namespaces in scope of the insertion */
+};
+
+/*
+ * Check an instruction list and its descendants for constructs which
+ * can't run in a worker context.
+ */
+static int
+xsltParallelSafeList(xmlNodePtr cur) {
+    for (; cur != NULL; cur = cur->next) {
+        if (cur->type != XML_ELEMENT_NODE)
+            continue;
+        if (IS_XSLT_ELEM(cur)) {
+            if ((IS_XSLT_NAME(cur, "message")) ||
+                (IS_XSLT_NAME(cur, "document")))
+                return(0);
+        } else if ((cur->ns != NULL) && (cur->psvi != NULL) &&
+                   (!xmlStrEqual(cur->ns->href,
+                                 BAD_CAST "http://exslt.org/functions"))) {
+            return(0);
+        }
+        if (!xsltParallelSafeList(cur->children))
+            return(0);
+    }
+    return(1);
+}
+
+/*
+ * Check the bodies of the top-level declarations of a stylesheet
+ * document, like attribute sets, global variables or func:function,
+ * except the templates.
+ */
+static int
+xsltParallelSafeDoc(xmlDocPtr doc) {
+    xmlNodePtr root, child;
+
+    root = xmlDocGetRootElement(doc);
+    if (root == NULL)
+        return(1);
+    for (child = root->children; child != NULL; child = child->next) {
+        if ((child->type != XML_ELEMENT_NODE) ||
+            ((IS_XSLT_ELEM(child)) && (IS_XSLT_NAME(child, "template"))))
+            continue;
+        if (!xsltParallelSafeList(child->children))
+            return(0);
+    }
+    return(1);
+}
+
+/*
+ * Check whether the templates of the stylesheet can be instantiated
+ * concurrently. The calls to generate-id() were noted when the
+ * expressions were compiled, see xsltNoteXPathCalls().
+ */
+static int
+xsltParallelSafe(xsltStylesheetPtr style) {
+    xsltStylesheetPtr cur;
+    xsltTemplatePtr templ;
+    xsltDocumentPtr incl;
+
+    if (XSLT_STYLE_PRIV(style->principal)->unsafeCalls)
+        return(0);
+    for (cur = style; cur != NULL; cur = xsltNextImport(cur)) {
+        if (cur->keys != NULL)
+            return(0);
+        for (templ = cur->templates; templ != NULL; templ = templ->next) {
+            if (!xsltParallelSafeList(templ->content))
+                return(0);
+        }
+        if (!xsltParallelSafeDoc(cur->doc))
+            return(0);
+        for (incl = cur->docList; incl != NULL; incl = incl->next) {
+            if (!xsltParallelSafeDoc(incl->doc))
+                return(0);
+        }
+    }
+    return(1);
+}
+
+static void
+xsltParallelCopyExtFunction(void *payload, void *data, const xmlChar *name,
+                            const xmlChar *URI,
+                            const xmlChar *name3 ATTRIBUTE_UNUSED) {
+    xmlXPathFunction func;
+
+    XML_CAST_FPTR(func) = payload;
+    xsltRegisterExtFunction((xsltTransformContextPtr) data, name, URI, func);
+}
+
+/*
+ * Create the worker contexts, sharing the settings and the global
+ * variables of @ctxt.
+ */
+static int
+xsltParallelInitWorkers(xsltTransformContextPtr ctxt, xsltParallelPtr par) {
+    xsltParallelWorkerPtr worker;
+    xsltTransformContextPtr wctxt;
+    xmlNodePtr root;
+    int i;
+
+    par->workers = (xsltParallelWorkerPtr)
+        xmlMalloc(par->nbWorkers * sizeof(xsltParallelWorker));
+    if (par->workers == NULL)
+        return(-1);
+    memset(par->workers, 0, par->nbWorkers * sizeof(xsltParallelWorker));
+
+    for (i = 0; i < par->nbWorkers; i++) {
+        worker = &par->workers[i];
+        worker->par = par;
+        wctxt = xsltNewTransformContext(ctxt->style, ctxt->initialContextDoc);
+        if (wctxt == NULL)
+            return(-1);
+        worker->ctxt = wctxt;
+
+        wctxt->initialContextDoc = ctxt->initialContextDoc;
+        wctxt->initialContextNode = ctxt->initialContextNode;
+        wctxt->globalVars = ctxt->globalVars;
+        XSLT_CTXT_PRIV(wctxt)->parallelParent = ctxt;
+        wctxt->type = ctxt->type;
+        wctxt->outputFile = ctxt->outputFile;
+        wctxt->sec = ctxt->sec;
+        wctxt->xinclude = ctxt->xinclude;
+        wctxt->parserOptions = ctxt->parserOptions;
+        wctxt->maxTemplateDepth = ctxt->maxTemplateDepth;
+        wctxt->maxTemplateVars = ctxt->maxTemplateVars;
+        wctxt->opLimit = ctxt->opLimit;
+        XSLT_CTXT_PRIV(wctxt)->cancelled = XSLT_CTXT_PRIV(ctxt)->cancelled;
+        wctxt->error = ctxt->error;
+        wctxt->errctx = ctxt->errctx;
+        wctxt->varsBase = wctxt->varsNr - 1;
+        if (ctxt->extFunctions != NULL)
+            xmlHashScanFull(ctxt->extFunctions, xsltParallelCopyExtFunction,
+                            wctxt);
+
+        worker->output = xmlNewDoc(NULL);
+        if (worker->output == NULL)
+            return(-1);
+        worker->output->dict = wctxt->dict;
+        xmlDictReference(wctxt->dict);
+        root = xmlNewDocNode(worker->output, NULL, BAD_CAST "parallel", NULL);
+        if (root == NULL)
+            return(-1);
+        xmlDocSetRootElement(worker->output, root);
+        wctxt->output = worker->output;
+    }
+    return(0);
+}
+
+/*
+ * Task transforming chunks with a worker context until none is left.
+ */
+static void
+xsltParallelWorkerRun(void *data) {
+    xsltParallelWorkerPtr worker = (xsltParallelWorkerPtr) data;
+    xsltParallelPtr par = worker->par;
+    xsltTransformContextPtr wctxt = worker->ctxt;
+    xmlXPathContextPtr xpctxt = wctxt->xpathCtxt;
+    xmlNodePtr container, cur;
+    int chunk, i, end, j;
+
+    while (1) {
+        if (xsltTaskGroupCancelled(par->group))
+            break;
+        pthread_mutex_lock(&par->lock);
+        if (par->nextChunk >= par->nbChunks) {
+            pthread_mutex_unlock(&par->lock);
+            break;
+        }
+        chunk = par->nextChunk++;
+        pthread_mutex_unlock(&par->lock);
+
+        container = xmlNewDocNode(worker->output, NULL, BAD_CAST "chunk",
+                                  NULL);
+        if (container == NULL) {
+            XSLT_SET_STATE(wctxt, XSLT_STATE_STOPPED);
+        } else {
+            xmlAddChild(worker->output->children, container);
+            if (par->nsList != NULL) {
+                for (j = 0; par->nsList[j] != NULL; j++)
+                    xmlNewNs(container, par->nsList[j]->href,
+                             par->nsList[j]->prefix);
+            }
+            par->results[chunk] = container;
+        }
+
+        wctxt->insert = container;
+        wctxt->lasttext = NULL;
+        xpctxt->contextSize = par->nbNodes;
+        i = chunk * par->chunkSize;
+        end = i + par->chunkSize;
+        if (end > par->nbNodes)
+            end = par->nbNodes;
+        for (; (i < end) && (wctxt->state != XSLT_STATE_STOPPED); i++) {
+            cur = par->nodes[i];
+            wctxt->node = cur;
+            if ((cur->type != XML_NAMESPACE_DECL) && (cur->doc != NULL))
+                xpctxt->doc = cur->doc;
+            xpctxt->proximityPosition = i + 1;
+            xsltProcessOneNode(wctxt, cur, NULL);
+        }
+        wctxt->insert = NULL;
+
+        if (wctxt->state == XSLT_STATE_STOPPED) {
+            xsltTaskGroupCancel(par->group);
+            break;
+        }
+    }
+}
+
+/*
+ * Strings of the worker nodes interned in the worker dictionary must
+ * be moved to the dictionary of the result document.
+ */
+static const xmlChar *
+xsltParallelAdoptName(xmlDictPtr dict, xmlDictPtr from, const xmlChar *str) {
+    if ((str == NULL) || (from == NULL) || (dict == from) ||
+        (!xmlDictOwns(from, str)) ||
+        ((dict != NULL) && (xmlDictOwns(dict, str))))
+        return(str);
+    if (dict != NULL)
+        return(xmlDictLookup(dict, str, -1));
+    return(xmlStrdup(str));
+}
+
+static xmlChar *
+xsltParallelAdoptContent(xmlDictPtr dict, xmlDictPtr from, xmlChar *str) {
+    if ((str == NULL) || (from == NULL) || (dict == from) ||
+        (!xmlDictOwns(from, str)) ||
+        ((dict != NULL) && (xmlDictOwns(dict, str))))
+        return(str);
+    return(xmlStrdup(str));
+}
+
+static xmlNsPtr
+xsltParallelAdoptNs(xmlDocPtr doc, xmlNodePtr container, xmlNsPtr *nsList,
+                    xmlNsPtr ns) {
+    xmlNsPtr def;
+    int i;
+
+    for (def = container->nsDef, i = 0; def != NULL; def = def->next, i++) {
+        if (def == ns)
+            return(nsList[i]);
+    }
+    /*
+    * The XML namespace isn't declared but belongs to the worker output,
+    * which is freed with the worker.
+    */
+    if ((ns->prefix != NULL) && (xmlStrEqual(ns->prefix, BAD_CAST "xml")))
+        return(xmlSearchNs(doc, (xmlNodePtr) doc, BAD_CAST "xml"));
+    return(ns);
+}
+
+/*
+ * Move a node built by a worker, and its descendants, to @doc. The
+ * references to the namespaces declared on the chunk container are
+ * redirected to the same declarations in scope in the result.
+ */
+static void
+xsltParallelAdoptTree(xmlDocPtr doc, xmlNodePtr node, xmlNodePtr container,
+                      xmlNsPtr *nsList) {
+    xmlDictPtr dict = doc->dict, from = node->doc->dict;
+    xmlNodePtr cur;
+    xmlAttrPtr attr;
+
+    switch (node->type) {
+        case XML_ELEMENT_NODE:
+            node->name = xsltParallelAdoptName(dict, from, node->name);
+            if (node->ns != NULL)
+                node->ns = xsltParallelAdoptNs(doc, container, nsList,
+                                               node->ns);
+            for (attr = node->properties; attr != NULL; attr = attr->next) {
+                if (attr->atype == XML_ATTRIBUTE_ID)
+                    xmlRemoveID(node->doc, attr);
+                attr->name = xsltParallelAdoptName(dict, from, attr->name);
+                if (attr->ns != NULL)
+                    attr->ns = xsltParallelAdoptNs(doc, container, nsList,
+                                                   attr->ns);
+                for (cur = attr->children; cur != NULL; cur = cur->next)
+                    xsltParallelAdoptTree(doc, cur, container, nsList);
+                attr->doc = doc;
+            }
+            for (cur = node->children; cur != NULL; cur = cur->next)
+                xsltParallelAdoptTree(doc, cur, container, nsList);
+            break;
+        case XML_PI_NODE:
+            node->name = xsltParallelAdoptName(dict, from, node->name);
+            /* Falls through. */
+        case XML_TEXT_NODE:
+        case XML_CDATA_SECTION_NODE:
+        case XML_COMMENT_NODE:
+            node->content = xsltParallelAdoptContent(dict, from,
+                                                     node->content);
+            break;
+        default:
+            break;
+    }
+    node->doc = doc;
+}
+
+/*
+ * Add the results of a chunk to the insertion point of @ctxt.
+ */
+static void
+xsltParallelSplice(xsltTransformContextPtr ctxt, xmlNodePtr inst,
+                   xmlNodePtr container, xmlNsPtr *nsList) {
+    xmlNodePtr cur, next;
+    xmlAttrPtr attr;
+    xmlNsPtr def;
+    int nbDefs = 0, nbNs = 0;
+
+    for (attr = container->properties; attr != NULL; attr = attr->next)
+        xsltCopyTree(ctxt, inst, (xmlNodePtr) attr, ctxt->insert, 0, 0);
+
+    for (def = container->nsDef; def != NULL; def = def->next)
+        nbDefs++;
+    if (nsList != NULL) {
+        while (nsList[nbNs] != NULL)
+            nbNs++;
+    }
+    if ((nbDefs != nbNs) || (ctxt->insert->doc != ctxt->output) ||
+        (ctxt->output == NULL)) {
+        /*
+        * A worker declared more namespaces on the container, copy the
+        * nodes so that they get declared where they are used.
+        */
+        xsltCopyTreeList(ctxt, inst, container->children, ctxt->insert,
+                         0, 0);
+        return;
+    }
+
+    for (cur = container->children; cur != NULL; cur = next) {
+        next = cur->next;
+        xmlUnlinkNode(cur);
+        xsltParallelAdoptTree(ctxt->output, cur, container, nsList);
+        xmlAddChild(ctxt->insert, cur);
+    }
+}
+
+/**
+ * xsltParallelApply:
+ * @ctxt:  a XSLT transformation context
+ * @inst:  the xsl:apply-templates instruction
+ * @list:  the selected nodes or NULL
+ * @children:  the first child of the context node if @list is NULL
+ * @nbChildren:  the number of nodes to process if @list is NULL
+ *
+ * Apply the templates to the nodes from worker threads if the context
+ * allows it.
+ *
+ * Returns 0 if the nodes were processed, -1 if the caller must
+ * process them.
+ */
+static int
+xsltParallelApply(xsltTransformContextPtr ctxt, xmlNodePtr inst,
+                  xmlNodeSetPtr list, xmlNodePtr children, int nbChildren) {
+    xsltParallelPtr par = (xsltParallelPtr) XSLT_CTXT_PRIV(ctxt)->parallel;
+    xsltTransformContextPtr wctxt;
+    xmlNodePtr *nodes = NULL, container, cur;
+    int nbNodes, i;
+
+    if ((par == NULL) || (par->active) || (ctxt->profile) ||
+        (XSLT_CTXT_PRIV(ctxt)->step != NULL) ||
+        (ctxt->debugStatus != XSLT_DEBUG_NONE) ||
+        (XSLT_CTXT_PRIV(ctxt)->streamReader != NULL) ||
+        (ctxt->insert == NULL))
+        return(-1);
+    nbNodes = (list != NULL) ? list->nodeNr : nbChildren;
+    if (nbNodes < par->minNodes)
+        return(-1);
+    if (par->safe < 0)
+        par->safe = xsltParallelSafe(ctxt->style);
+    if (!par->safe)
+        return(-1);
+
+    if ((par->workers == NULL) &&
+        (xsltParallelInitWorkers(ctxt, par) < 0)) {
+        xsltTransformError(ctxt, NULL, inst,
+            "xsl:apply-templates : failed to create the worker contexts\n");
+        par->safe = 0;
+        return(-1);
+    }
+
+    if (list != NULL) {
+        par->nodes = list->nodeTab;
+    } else {
+        nodes = (xmlNodePtr *) xmlMalloc(nbNodes * sizeof(xmlNodePtr));
+        if (nodes == NULL)
+            return(-1);
+        i = 0;
+        for (cur = children; (cur != NULL) && (i < nbNodes);
+             cur = cur->next) {
+            if (IS_XSLT_REAL_NODE(cur))
+                nodes[i++] = cur;
+        }
+        par->nodes = nodes;
+    }
+    par->nbNodes = nbNodes;
+    par->chunkSize =
+        nbNodes / (par->nbWorkers * XSLT_PARALLEL_CHUNKS_PER_WORKER);
+    if (par->chunkSize < 1)
+        par->chunkSize = 1;
+    par->nbChunks = (nbNodes + par->chunkSize - 1) / par->chunkSize;
+    par->nextChunk = 0;
+    par->results = (xmlNodePtr *) xmlMalloc(par->nbChunks *
+                                            sizeof(xmlNodePtr));
+    if (par->results == NULL) {
+        if (nodes != NULL)
+            xmlFree(nodes);
+        return(-1);
+    }
+    memset(par->results, 0, par->nbChunks * sizeof(xmlNodePtr));
+    par->nsList = xmlGetNsList(ctxt->output, ctxt->insert);
+    par->active = 1;
+
+    for (i = 0; i < par->nbWorkers; i++) {
+        wctxt = par->workers[i].ctxt;
+        wctxt->mode = ctxt->mode;
+        wctxt->modeURI = ctxt->modeURI;
+        wctxt->depth = ctxt->depth;
+        if (XSLT_CTXT_PRIV(wctxt)->deadline !=
+            XSLT_CTXT_PRIV(ctxt)->deadline) {
+            XSLT_CTXT_PRIV(wctxt)->deadline = XSLT_CTXT_PRIV(ctxt)->deadline;
+            xsltUpdateCheckInterval(wctxt);
+        }
+    }
+
+    /*
+    * The calling thread runs the first worker, the chunks left by
+    * workers which couldn't be queued are taken by the others.
+    */
+    for (i = 1; i < par->nbWorkers; i++) {
+        if (xsltTaskGroupSubmit(par->group, xsltParallelWorkerRun,
+                                &par->workers[i]) < 0)
+            break;
+    }
+    xsltParallelWorkerRun(&par->workers[0]);
+    xsltTaskGroupWait(par->group);
+    par->active = 0;
+
+    for (i = 0; i < par->nbWorkers; i++) {
+        wctxt = par->workers[i].ctxt;
+        if (wctxt->state > ctxt->state)
+            XSLT_SET_STATE(ctxt, wctxt->state);
+    }
+
+    /*
+    * Splice the results in document order.
+    */
+    for (i = 0; i < par->nbChunks; i++) {
+        container = par->results[i];
+        if (container == NULL)
+            continue;
+        if (ctxt->state != XSLT_STATE_STOPPED)
+            xsltParallelSplice(ctxt, inst, container, par->nsList);
+        xmlUnlinkNode(container);
+        xmlFreeNode(container);
+    }
+    ctxt->lasttext = NULL;
+
+    xmlFree(par->results);
+    par->results = NULL;
+    if (par->nsList != NULL) {
+        xmlFree(par->nsList);
+        par->nsList = NULL;
+    }
+    if (nodes != NULL)
+        xmlFree(nodes);
+    par->nodes = NULL;
+    return(0);
+}
+
+#endif /* XSLT_PARALLEL_APPLY */
+
+/**
+ * xsltParallelLockGlobals:
+ * @ctxt:  the context dispatching to the workers
+ * @lock:  1 to lock, 0 to unlock
+ *
+ * Serialize the use of the global variables of @ctxt by its workers,
+ * which evaluate them in @ctxt on first reference.
+ */
+void
+xsltParallelLockGlobals(xsltTransformContextPtr ctxt, int lock) {
+#ifdef XSLT_PARALLEL_APPLY
+    xsltParallelPtr par = (xsltParallelPtr) XSLT_CTXT_PRIV(ctxt)->parallel;
+
+    if (lock)
+        pthread_mutex_lock(&par->globalLock);
+    else
+        pthread_mutex_unlock(&par->globalLock);
+#else
+    (void) ctxt;
+    (void) lock;
+#endif
+}
+
+/**
+ * xsltParallelFree:
+ * @ctxt:  an XSLT transformation context
+ *
+ * Free the worker contexts of parallel xsl:apply-templates.
+ */
+static void
+xsltParallelFree(xsltTransformContextPtr ctxt) {
+#ifdef XSLT_PARALLEL_APPLY
+    xsltParallelPtr par = (xsltParallelPtr) XSLT_CTXT_PRIV(ctxt)->parallel;
+    int i;
+
+    if (par == NULL)
+        return;
+    if (par->workers != NULL) {
+        for (i = 0; i < par->nbWorkers; i++) {
+            if (par->workers[i].ctxt != NULL) {
+                /* The global variables belong to @ctxt. */
+                par->workers[i].ctxt->globalVars = NULL;
+                xsltFreeTransformContext(par->workers[i].ctxt);
+            }
+            if (par->workers[i].output != NULL)
+                xmlFreeDoc(par->workers[i].output);
+        }
+        xmlFree(par->workers);
+    }
+    xsltFreeTaskGroup(par->group);
+    pthread_mutex_destroy(&par->lock);
+    pthread_mutex_destroy(&par->globalLock);
+    xmlFree(par);
+    XSLT_CTXT_PRIV(ctxt)->parallel = NULL;
+#else
+    (void) ctxt;
+#endif
+}
+
+/**
+ * xsltSetCtxtParallel:
+ * @ctxt:  an XSLT transformation context
+ * @nbWorkers:  the number of worker contexts, 0 or 1 to disable
+ * @minNodes:  the minimum number of nodes to process in parallel,
+ *             0 for the default
+ *
+ * Let xsl:apply-templates transform the selected nodes from several
+ * threads of the pool, see xsltSetThreadPool(), when there are at
+ * least @minNodes of them. Each worker has its own transformation
+ * context and the results are added in the order of the nodes. The
+ * whole stylesheet must be free of side effects: it is transformed
+ * serially if it uses xsl:message, xsl:document, extension elements,
+ * keys or generate-id(). Extension functions registered by the
+ * application must be thread-safe. The global variables referenced
+ * by the workers are computed in @ctxt, one at a time.
+ *
+ * Returns 0 in case of success, -1 if threads are not supported or
+ * in case of error.
+ */
+int
+xsltSetCtxtParallel(xsltTransformContextPtr ctxt, int nbWorkers,
+                    int minNodes) {
+#ifdef XSLT_PARALLEL_APPLY
+    xsltParallelPtr par;
+
+    if (ctxt == NULL)
+        return(-1);
+    xsltParallelFree(ctxt);
+    if (nbWorkers <= 1)
+        return(0);
+
+    par = (xsltParallelPtr) xmlMalloc(sizeof(xsltParallel));
+    if (par == NULL) {
+        xsltTransformError(ctxt, NULL, NULL,
+                           "xsltSetCtxtParallel: out of memory\n");
+        return(-1);
+    }
+    memset(par, 0, sizeof(xsltParallel));
+    par->group = xsltNewTaskGroup(ctxt);
+    if (par->group == NULL) {
+        xmlFree(par);
+        return(-1);
+    }
+    par->nbWorkers = nbWorkers;
+    par->minNodes = (minNodes > 0) ? minNodes : XSLT_PARALLEL_MIN_NODES;
+    par->safe = -1;
+    pthread_mutex_init(&par->lock, NULL);
+    pthread_mutex_init(&par->globalLock, NULL);
+    XSLT_CTXT_PRIV(ctxt)->parallel = par;
+
+    return(0);
+#else
+    (void) ctxt;
+    (void) nbWorkers;
+    (void) minNodes;
+    return(-1);
+#endif
+}
+
+/**
+ * xsltApplyTemplates:
+ * @ctxt:  a XSLT transformation context
+ * @node:  the 'current node' in the source tree
+ * @inst:  the element node of an XSLT 'apply-templates' instruction
+ * @castedComp:  the compiled instruction
+ *
+ * Processes the XSLT 'apply-templates' instruction on the current node.
+ */
+void
+xsltApplyTemplates(xsltTransformContextPtr ctxt, xmlNodePtr node,
 	           xmlNodePtr inst, xsltElemPreCompPtr castedComp)
 {
 #ifdef XSLT_REFACTORED
@@ -4830,6 +6862,12 @@ xsltApplyTemplates(xsltTransformContextPtr ctxt, xmlNodePtr node,
 #endif
     int i;
     xmlNodePtr cur, oldContextNode;
+    xmlNodePtr childrenFirst = NULL;
+    int nbChildren = 0;
+#ifdef LIBXML_READER_ENABLED
+    int stream = 0;
+    xsltCompMatchPtr streamSelect = NULL;
+#endif
     xmlNodeSetPtr list = NULL, oldList;
     xsltStackElemPtr withParams = NULL;
     int oldXPProximityPosition, oldXPContextSize;
@@ -4877,6 +6915,33 @@ xsltApplyTemplates(xsltTransformContextPtr ctxt, xmlNodePtr node,
     ctxt->mode = comp->mode;
     ctxt->modeURI = comp->modeURI;
 
+#ifdef LIBXML_READER_ENABLED
+    if ((XSLT_CTXT_PRIV(ctxt)->streamReader != NULL) &&
+        (node == XSLT_CTXT_PRIV(ctxt)->streamRoot) &&
+        ((comp->select == NULL) || (xsltStreamableChildStep(comp->select)))) {
+	/*
+	* The children of a streamed document element are read while
+	* templates are applied to them.
+	*/
+	if (xsltHasSortChild(inst)) {
+	    xsltTransformError(ctxt, NULL, inst,
+		"xsl:apply-templates : cannot sort the children of a "
+		"streamed document element\n");
+	    XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
+	    goto error;
+	}
+	if (comp->select != NULL) {
+	    streamSelect = xsltCompilePattern(comp->select, inst->doc, inst,
+					      ctxt->style, ctxt);
+	    if (streamSelect == NULL)
+		goto error;
+	}
+	stream = 1;
+	ctxt->nodeList = NULL;
+	goto params;
+    }
+#endif
+
     if (comp->select != NULL) {
 	xmlXPathObjectPtr res = NULL;
 
@@ -4900,7 +6965,7 @@ xsltApplyTemplates(xsltTransformContextPtr ctxt, xmlNodePtr node,
 		xsltTransformError(ctxt, NULL, inst,
 		    "The 'select' expression did not evaluate to a "
 		    "node set.\n");
-		ctxt->state = XSLT_STATE_STOPPED;
+		XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
 		xmlXPathFreeObject(res);
 		goto error;
 	    }
@@ -4912,7 +6977,7 @@ xsltApplyTemplates(xsltTransformContextPtr ctxt, xmlNodePtr node,
 	} else {
 	    xsltTransformError(ctxt, NULL, inst,
 		"Failed to evaluate the 'select' expression.\n");
-	    ctxt->state = XSLT_STATE_STOPPED;
+	    XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
 	    goto error;
 	}
 	if (list == NULL) {
@@ -4952,16 +7017,37 @@ xsltApplyTemplates(xsltTransformContextPtr ctxt, xmlNodePtr node,
 	}
 #endif
     } else {
+	if (node->type != XML_NAMESPACE_DECL)
+	    cur = node->children;
+	else
+	    cur = NULL;
+	if (! xsltHasSortChild(inst)) {
+	    /*
+	    * The children are processed in document order, walk them
+	    * directly instead of building a node set. Only count them
+	    * for last().
+	    */
+	    childrenFirst = cur;
+	    while (cur != NULL) {
+		if (IS_XSLT_REAL_NODE(cur))
+		    nbChildren++;
+		cur = cur->next;
+	    }
+#ifdef WITH_XSLT_DEBUG_PROCESS
+	    XSLT_TRACE(ctxt,XSLT_TRACE_APPLY_TEMPLATES,xsltGenericDebug(xsltGenericDebugContext,
+		"xsltApplyTemplates: %d children\n", nbChildren));
+#endif
+	    if (nbChildren == 0)
+		goto exit;
+	    ctxt->nodeList = NULL;
+	    goto params;
+	}
 	/*
 	 * Build an XPath node set with the children
 	 */
 	list = xmlXPathNodeSetCreate(NULL);
 	if (list == NULL)
 	    goto error;
-	if (node->type != XML_NAMESPACE_DECL)
-	    cur = node->children;
-	else
-	    cur = NULL;
 	while (cur != NULL) {
             if (IS_XSLT_REAL_NODE(cur))
 		xmlXPathNodeSetAddUnique(list, cur);
@@ -4983,6 +7069,7 @@ xsltApplyTemplates(xsltTransformContextPtr ctxt, xmlNodePtr node,
     * for xsltDoSortFunction().
     */
     ctxt->nodeList = list;
+params:
     /*
     * Process xsl:with-param and xsl:sort instructions.
     * (The code became so verbose just to avoid the
@@ -5053,7 +7140,7 @@ xsltApplyTemplates(xsltTransformContextPtr ctxt, xmlNodePtr node,
 				"The number (%d) of xsl:sort instructions exceeds the "
 				"maximum allowed by this processor's settings.\n",
 				nbsorts);
-			    ctxt->state = XSLT_STATE_STOPPED;
+			    XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
 			    break;
 			} else {
 			    sorts[nbsorts++] = cur;
@@ -5075,6 +7162,36 @@ xsltApplyTemplates(xsltTransformContextPtr ctxt, xmlNodePtr node,
 	    cur = cur->next;
 	}
     }
+#ifdef LIBXML_READER_ENABLED
+    if (stream) {
+	xsltStreamChildren(ctxt, node, streamSelect, withParams);
+	goto exit;
+    }
+#endif
+#ifdef XSLT_PARALLEL_APPLY
+    if ((XSLT_CTXT_PRIV(ctxt)->parallel != NULL) && (withParams == NULL) &&
+        (ctxt->state == XSLT_STATE_OK) &&
+        (xsltParallelApply(ctxt, inst, list, childrenFirst, nbChildren) == 0))
+	goto exit;
+#endif
+    if (list == NULL) {
+	/*
+	* Apply templates for all the children.
+	*/
+	xpctxt->contextSize = nbChildren;
+	i = 0;
+	for (cur = childrenFirst; cur != NULL; cur = cur->next) {
+	    if (! IS_XSLT_REAL_NODE(cur))
+		continue;
+	    ctxt->node = cur;
+	    if (cur->doc != NULL)
+		xpctxt->doc = cur->doc;
+	    xpctxt->proximityPosition = ++i;
+	    xsltProcessOneNode(ctxt, cur, withParams);
+	}
+	goto exit;
+    }
+
     xpctxt->contextSize = list->nodeNr;
     /*
     * Apply templates for all selected source nodes.
@@ -5108,6 +7225,10 @@ error:
 	xsltFreeStackElemList(withParams);
     if (list != NULL)
 	xmlXPathFreeNodeSet(list);
+#ifdef LIBXML_READER_ENABLED
+    if (streamSelect != NULL)
+	xsltFreeCompMatchList(streamSelect);
+#endif
     /*
     * Restore context states.
     */
@@ -5206,7 +7327,7 @@ xsltChoose(xsltTransformContextPtr ctxt, xmlNodePtr contextNode,
 	    res = xsltPreCompEvalToBoolean(ctxt, contextNode, wcomp);
 
 	    if (res == -1) {
-		ctxt->state = XSLT_STATE_STOPPED;
+		XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
 		goto error;
 	    }
 	    testRes = (res == 1) ? 1 : 0;
@@ -5230,7 +7351,7 @@ xsltChoose(xsltTransformContextPtr ctxt, xmlNodePtr contextNode,
 		xmlXPathFreeObject(res);
 		res = NULL;
 	    } else {
-		ctxt->state = XSLT_STATE_STOPPED;
+		XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
 		goto error;
 	    }
 
@@ -5337,7 +7458,7 @@ xsltIf(xsltTransformContextPtr ctxt, xmlNodePtr contextNode,
 #endif
 
     if (res == -1) {
-	ctxt->state = XSLT_STATE_STOPPED;
+	XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
 	goto error;
     }
     if (res == 1) {
@@ -5375,11 +7496,11 @@ xsltIf(xsltTransformContextPtr ctxt, xmlNodePtr contextNode,
 		    xsltGenericDebug(xsltGenericDebugContext,
 		    "xsltIf: test didn't evaluate to a boolean\n"));
 #endif
-		ctxt->state = XSLT_STATE_STOPPED;
+		XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
 	    }
 	    xmlXPathFreeObject(xpobj);
 	} else {
-	    ctxt->state = XSLT_STATE_STOPPED;
+	    XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
 	}
     }
 #endif /* else of XSLT_FAST_IF */
@@ -5482,7 +7603,7 @@ xsltForEach(xsltTransformContextPtr ctxt, xmlNodePtr contextNode,
     } else {
 	xsltTransformError(ctxt, NULL, inst,
 	    "Failed to evaluate the 'select' expression.\n");
-	ctxt->state = XSLT_STATE_STOPPED;
+	XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
 	goto error;
     }
 
@@ -5856,7 +7977,9 @@ xsltApplyStylesheetInternal(xsltStylesheetPtr style, xmlDocPtr doc,
      * Check for XPath document order availability
      */
     root = xmlDocGetRootElement(doc);
-    if (root != NULL) {
+    if ((root != NULL) &&
+        ((userCtxt == NULL) ||
+         (XSLT_CTXT_PRIV(userCtxt)->streamReader == NULL))) {
 	if (((ptrdiff_t) root->content >= 0) &&
             (xslDebugStatus == XSLT_DEBUG_NONE))
 	    xmlXPathOrderDocElems(doc);
@@ -5889,6 +8012,10 @@ xsltApplyStylesheetInternal(xsltStylesheetPtr style, xmlDocPtr doc,
     else
         ctxt->outputFile = NULL;
 
+    if ((XSLT_STYLE_PRIV(style)->parallel > 1) &&
+        (XSLT_CTXT_PRIV(ctxt)->parallel == NULL))
+        xsltSetCtxtParallel(ctxt, XSLT_STYLE_PRIV(style)->parallel, 0);
+
     /*
      * internalize the modes if needed
      */
@@ -6006,7 +8133,8 @@ xsltApplyStylesheetInternal(xsltStylesheetPtr style, xmlDocPtr doc,
      * Start the evaluation, evaluate the params, the stylesheets globals
      * and start by processing the top node.
      */
-    if (xsltNeedElemSpaceHandling(ctxt))
+    if ((xsltNeedElemSpaceHandling(ctxt)) &&
+        (XSLT_CTXT_PRIV(ctxt)->streamReader == NULL))
 	xsltApplyStripSpaces(ctxt, xmlDocGetRootElement(doc));
     /*
     * Evaluate global params and user-provided params.
@@ -6033,6 +8161,10 @@ xsltApplyStylesheetInternal(xsltStylesheetPtr style, xmlDocPtr doc,
     */
     xsltProcessOneNode(ctxt, ctxt->node, NULL);
     /*
+    * Wait for the secondary result documents still being written.
+    */
+    xsltAsyncOutputDrain(ctxt);
+    /*
     * Remove all remaining vars from the stack.
     */
     xsltLocalVariablePop(ctxt, 0, -2);
@@ -6281,6 +8413,507 @@ xsltApplyStylesheetUser(xsltStylesheetPtr style, xmlDocPtr doc,
     return (res);
 }
 
+#ifdef LIBXML_READER_ENABLED
+/**
+ * xsltApplyStylesheetStream:
+ * @style:  a parsed XSLT stylesheet
+ * @reader:  a reader positioned at the start of the input
+ * @params:  a NULL terminated array of parameters names/values tuples
+ * @output:  the targetted output
+ * @profile:  profile FILE * output or NULL
+ * @userCtxt:  user provided transform context or NULL
+ *
+ * Apply the stylesheet to a document read progressively from @reader.
+ * The children of the document element are read, transformed and
+ * freed one at a time, so the memory used doesn't depend on their
+ * number. The stylesheet must pass xsltCheckStreamable(). Nodes
+ * following the document element are not processed.
+ *
+ * The reader is advanced to the document element if it isn't already
+ * positioned there. A @userCtxt must have been created for the
+ * document of the reader. The input document stays owned by the
+ * reader.
+ *
+ * Returns the result document or NULL in case of error
+ */
+xmlDocPtr
+xsltApplyStylesheetStream(xsltStylesheetPtr style, xmlTextReaderPtr reader,
+                          const char **params, const char *output,
+                          FILE * profile, xsltTransformContextPtr userCtxt)
+{
+    xsltTransformContextPtr ctxt;
+    xmlNodePtr root;
+    xmlDocPtr res;
+    int ret;
+
+    if ((style == NULL) || (reader == NULL))
+        return (NULL);
+    if (!xsltCheckStreamable(style))
+        return (NULL);
+
+    /*
+    * Read up to the document element.
+    */
+    ret = 1;
+    while ((ret == 1) &&
+           ((xmlTextReaderNodeType(reader) != XML_READER_TYPE_ELEMENT) ||
+            (xmlTextReaderDepth(reader) != 0)))
+        ret = xmlTextReaderRead(reader);
+    if (ret != 1) {
+        xsltTransformError(userCtxt, style, NULL,
+            "xsltApplyStylesheetStream: no document element\n");
+        return (NULL);
+    }
+    root = xmlTextReaderCurrentNode(reader);
+    if ((root == NULL) || (root->doc == NULL))
+        return (NULL);
+
+    if (userCtxt != NULL)
+        ctxt = userCtxt;
+    else
+        ctxt = xsltNewTransformContext(style, root->doc);
+    if (ctxt == NULL)
+        return (NULL);
+    XSLT_CTXT_PRIV(ctxt)->streamReader = reader;
+    XSLT_CTXT_PRIV(ctxt)->streamRoot = root;
+    XSLT_CTXT_PRIV(ctxt)->streamConsumed = 0;
+
+    res = xsltApplyStylesheetInternal(style, root->doc, params, output,
+                                      profile, ctxt);
+
+    /*
+    * Finish reading the input to report its errors.
+    */
+    if ((res != NULL) && (ctxt->state != XSLT_STATE_STOPPED)) {
+        do {
+            ret = xmlTextReaderNext(reader);
+        } while (ret == 1);
+        if (ret < 0) {
+            xsltTransformError(ctxt, NULL, NULL,
+                "xsltApplyStylesheetStream: error reading the input\n");
+            XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
+        }
+    }
+    if ((res != NULL) && (ctxt->state == XSLT_STATE_STOPPED)) {
+        xmlFreeDoc(res);
+        res = NULL;
+    }
+
+    XSLT_CTXT_PRIV(ctxt)->streamReader = NULL;
+    XSLT_CTXT_PRIV(ctxt)->streamRoot = NULL;
+    if (userCtxt == NULL)
+        xsltFreeTransformContext(ctxt);
+    return (res);
+}
+#endif /* LIBXML_READER_ENABLED */
+
+/************************************************************************
+ *									*
+ *		Incremental execution of transformations		*
+ *									*
+ ************************************************************************/
+
+#ifdef XSLT_STEP_TRANSFORM
+/*
+ * The stack of a transformation thread. Templates recurse on the C
+ * stack, so it gets the size of a usual main thread stack rather than
+ * the default of the platform, which can be much smaller.
+ */
+#define XSLT_STEP_STACK_SIZE (8 * 1024 * 1024)
+
+/*
+ * The maximum number of transformation threads, busy or idle.
+ */
+#define XSLT_STEP_MAX_THREADS 64
+
+/*
+ * The C stack of a transformation can't be suspended, so it runs on a
+ * thread of its own and the caller and that thread hand the turn to
+ * each other: exactly one of them runs at any time.
+ */
+typedef struct _xsltStep xsltStep;
+typedef xsltStep *xsltStepPtr;
+struct _xsltStep {
+    pthread_mutex_t lock;
+    pthread_cond_t turn;	/* signaled when the turn changes */
+    int running;		/* the transformation has the turn */
+    int done;			/* the transformation returned */
+    int abort;			/* stop at the next suspension */
+    unsigned long end;		/* operation count ending the step */
+    xmlDocPtr doc;
+    const char **params;
+    xmlDocPtr result;
+
+    /* the error handlers of the caller, which libxml2 keeps per thread */
+    xmlGenericErrorFunc genericError;
+    void *genericErrorContext;
+    xmlStructuredErrorFunc structuredError;
+    void *structuredErrorContext;
+};
+
+/*
+ * The transformation threads are kept once their transformation
+ * returned and run the next ones.
+ */
+typedef struct _xsltStepThread xsltStepThread;
+typedef xsltStepThread *xsltStepThreadPtr;
+struct _xsltStepThread {
+    xsltStepThreadPtr next;	/* in the idle list */
+    pthread_t thread;
+    pthread_cond_t wake;	/* a transformation was given or exit */
+    xsltTransformContextPtr ctxt; /* the transformation to run */
+    int exit;
+};
+
+static pthread_mutex_t xsltStepMutex = PTHREAD_MUTEX_INITIALIZER;
+static xsltStepThreadPtr xsltStepIdle = NULL;
+static int xsltStepNbThreads = 0;
+
+static void
+xsltStepRunTransform(xsltTransformContextPtr ctxt) {
+    xsltStepPtr step = (xsltStepPtr) XSLT_CTXT_PRIV(ctxt)->step;
+    xmlDocPtr res;
+
+    pthread_mutex_lock(&step->lock);
+    while (!step->running)
+        pthread_cond_wait(&step->turn, &step->lock);
+    pthread_mutex_unlock(&step->lock);
+
+    xmlSetGenericErrorFunc(step->genericErrorContext, step->genericError);
+    xmlSetStructuredErrorFunc(step->structuredErrorContext,
+                              step->structuredError);
+
+    if (step->abort)
+        res = NULL;
+    else
+        res = xsltApplyStylesheetInternal(ctxt->style, step->doc,
+                                          step->params, NULL, NULL, ctxt);
+
+    pthread_mutex_lock(&step->lock);
+    step->result = res;
+    step->done = 1;
+    step->running = 0;
+    pthread_cond_broadcast(&step->turn);
+    pthread_mutex_unlock(&step->lock);
+}
+
+static void *
+xsltStepThreadMain(void *data) {
+    xsltStepThreadPtr thr = (xsltStepThreadPtr) data;
+    xsltTransformContextPtr ctxt;
+
+    pthread_mutex_lock(&xsltStepMutex);
+    while (1) {
+        while ((thr->ctxt == NULL) && (!thr->exit))
+            pthread_cond_wait(&thr->wake, &xsltStepMutex);
+        if (thr->exit)
+            break;
+        ctxt = thr->ctxt;
+        pthread_mutex_unlock(&xsltStepMutex);
+
+        xsltStepRunTransform(ctxt);
+
+        pthread_mutex_lock(&xsltStepMutex);
+        thr->ctxt = NULL;
+        thr->next = xsltStepIdle;
+        xsltStepIdle = thr;
+    }
+    pthread_mutex_unlock(&xsltStepMutex);
+    return(NULL);
+}
+
+/*
+ * Hand @ctxt to an idle transformation thread, or to a new one if
+ * there are less than XSLT_STEP_MAX_THREADS.
+ */
+static int
+xsltStepStartThread(xsltTransformContextPtr ctxt) {
+    xsltStepThreadPtr thr;
+    pthread_attr_t attr;
+    int ret;
+
+    pthread_mutex_lock(&xsltStepMutex);
+    thr = xsltStepIdle;
+    if (thr != NULL) {
+        xsltStepIdle = thr->next;
+        thr->next = NULL;
+        thr->ctxt = ctxt;
+        pthread_cond_signal(&thr->wake);
+        pthread_mutex_unlock(&xsltStepMutex);
+        return(0);
+    }
+    if (xsltStepNbThreads >= XSLT_STEP_MAX_THREADS) {
+        pthread_mutex_unlock(&xsltStepMutex);
+        xsltTransformError(ctxt, NULL, NULL,
+            "xsltTransformBegin: too many incremental transformations\n");
+        return(-1);
+    }
+
+    thr = (xsltStepThreadPtr) xmlMalloc(sizeof(xsltStepThread));
+    if (thr == NULL) {
+        pthread_mutex_unlock(&xsltStepMutex);
+        xsltTransformError(ctxt, NULL, NULL,
+            "xsltTransformBegin: out of memory\n");
+        return(-1);
+    }
+    memset(thr, 0, sizeof(xsltStepThread));
+    thr->ctxt = ctxt;
+    pthread_cond_init(&thr->wake, NULL);
+    ret = pthread_attr_init(&attr);
+    if (ret == 0) {
+        pthread_attr_setstacksize(&attr, XSLT_STEP_STACK_SIZE);
+        ret = pthread_create(&thr->thread, &attr, xsltStepThreadMain, thr);
+        pthread_attr_destroy(&attr);
+    }
+    if (ret != 0) {
+        pthread_mutex_unlock(&xsltStepMutex);
+        pthread_cond_destroy(&thr->wake);
+        xmlFree(thr);
+        xsltTransformError(ctxt, NULL, NULL,
+            "xsltTransformBegin: failed to create a thread\n");
+        return(-1);
+    }
+    xsltStepNbThreads++;
+    pthread_mutex_unlock(&xsltStepMutex);
+    return(0);
+}
+
+/*
+ * Called from the transformation thread for each operation: give the
+ * turn back to the caller once the budget of the step is used.
+ */
+static void
+xsltStepSuspend(xsltTransformContextPtr ctxt) {
+    xsltStepPtr step = (xsltStepPtr) XSLT_CTXT_PRIV(ctxt)->step;
+
+    if (ctxt->opCount < step->end)
+        return;
+
+    pthread_mutex_lock(&step->lock);
+    step->running = 0;
+    pthread_cond_broadcast(&step->turn);
+    while (!step->running)
+        pthread_cond_wait(&step->turn, &step->lock);
+    pthread_mutex_unlock(&step->lock);
+
+    if (step->abort)
+        XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
+}
+
+/*
+ * Give the turn to the transformation until it suspends or returns.
+ */
+static void
+xsltStepRun(xsltStepPtr step, unsigned long end) {
+    pthread_mutex_lock(&step->lock);
+    if (!step->done) {
+        step->end = end;
+        step->running = 1;
+        pthread_cond_broadcast(&step->turn);
+        while (step->running)
+            pthread_cond_wait(&step->turn, &step->lock);
+    }
+    pthread_mutex_unlock(&step->lock);
+}
+
+static xmlDocPtr
+xsltStepFinish(xsltTransformContextPtr ctxt, int abort) {
+    xsltStepPtr step = (xsltStepPtr) XSLT_CTXT_PRIV(ctxt)->step;
+    xmlDocPtr res;
+
+    if (abort)
+        step->abort = 1;
+    while (!step->done)
+        xsltStepRun(step, ULONG_MAX);
+
+    /*
+    * The thread doesn't use the step anymore once it is done, it
+    * waits for another transformation.
+    */
+    res = step->result;
+    pthread_cond_destroy(&step->turn);
+    pthread_mutex_destroy(&step->lock);
+    xmlFree(step);
+    XSLT_CTXT_PRIV(ctxt)->step = NULL;
+    return(res);
+}
+
+static void
+xsltStepFree(xsltTransformContextPtr ctxt) {
+    if (XSLT_CTXT_PRIV(ctxt)->step != NULL)
+        xmlFreeDoc(xsltStepFinish(ctxt, 1));
+}
+
+/**
+ * xsltCleanupStepThreads:
+ *
+ * Stop the idle transformation threads of xsltTransformBegin().
+ */
+void
+xsltCleanupStepThreads(void) {
+    xsltStepThreadPtr thr, next;
+
+    pthread_mutex_lock(&xsltStepMutex);
+    thr = xsltStepIdle;
+    xsltStepIdle = NULL;
+    for (next = thr; next != NULL; next = next->next) {
+        next->exit = 1;
+        pthread_cond_signal(&next->wake);
+        xsltStepNbThreads--;
+    }
+    pthread_mutex_unlock(&xsltStepMutex);
+
+    while (thr != NULL) {
+        next = thr->next;
+        pthread_join(thr->thread, NULL);
+        pthread_cond_destroy(&thr->wake);
+        xmlFree(thr);
+        thr = next;
+    }
+}
+#else
+static void
+xsltStepSuspend(xsltTransformContextPtr ctxt ATTRIBUTE_UNUSED) {
+}
+
+static void
+xsltStepFree(xsltTransformContextPtr ctxt ATTRIBUTE_UNUSED) {
+}
+
+void
+xsltCleanupStepThreads(void) {
+}
+#endif /* XSLT_STEP_TRANSFORM */
+
+/**
+ * xsltTransformBegin:
+ * @ctxt:  a transformation context created for @doc
+ * @doc:  the source document
+ * @params:  a NULL terminated array of parameters names/values tuples
+ *
+ * Prepare the incremental transformation of @doc, run it with
+ * xsltTransformStep() and collect its result with xsltTransformEnd().
+ * This lets an event loop interleave a long transformation with other
+ * work.
+ *
+ * The C stack of a transformation can't be suspended, so each
+ * transformation in progress occupies a thread with an 8 MB stack.
+ * The threads are reused once their transformation ended, and at most
+ * 64 exist. The transformation only runs while the caller is inside
+ * xsltTransformStep(), so the callbacks of the context never run
+ * concurrently with the caller. The error handlers of libxml2 set on
+ * the calling thread are used by the transformation thread, its other
+ * thread local settings are not. Parallel xsl:apply-templates is
+ * disabled while stepping. @params is used until the transformation
+ * ends.
+ *
+ * Returns 0 in case of success, -1 in case of error, if threads
+ * aren't supported or if 64 transformations are in progress.
+ */
+int
+xsltTransformBegin(xsltTransformContextPtr ctxt, xmlDocPtr doc,
+                   const char **params) {
+#ifdef XSLT_STEP_TRANSFORM
+    xsltStepPtr step;
+
+    if ((ctxt == NULL) || (doc == NULL) ||
+        (XSLT_CTXT_PRIV(ctxt)->step != NULL))
+        return(-1);
+
+    step = (xsltStepPtr) xmlMalloc(sizeof(xsltStep));
+    if (step == NULL) {
+        xsltTransformError(ctxt, NULL, NULL,
+            "xsltTransformBegin: out of memory\n");
+        return(-1);
+    }
+    memset(step, 0, sizeof(xsltStep));
+    step->doc = doc;
+    step->params = params;
+    step->genericError = xmlGenericError;
+    step->genericErrorContext = xmlGenericErrorContext;
+    step->structuredError = xmlStructuredError;
+    step->structuredErrorContext = xmlStructuredErrorContext;
+    pthread_mutex_init(&step->lock, NULL);
+    pthread_cond_init(&step->turn, NULL);
+
+    XSLT_CTXT_PRIV(ctxt)->step = step;
+    if (xsltStepStartThread(ctxt) < 0) {
+        XSLT_CTXT_PRIV(ctxt)->step = NULL;
+        pthread_cond_destroy(&step->turn);
+        pthread_mutex_destroy(&step->lock);
+        xmlFree(step);
+        return(-1);
+    }
+    return(0);
+#else
+    xsltTransformError(ctxt, NULL, NULL,
+        "xsltTransformBegin: threads are not supported\n");
+    return(-1);
+#endif
+}
+
+/**
+ * xsltTransformStep:
+ * @ctxt:  a transformation context started with xsltTransformBegin()
+ * @budget:  the number of operations to run
+ *
+ * Run the transformation for up to @budget more operations, as
+ * counted in the opCount field of @ctxt, then suspend it.
+ *
+ * Returns XSLT_STEP_MORE if the transformation was suspended,
+ *         XSLT_STEP_DONE if it is complete and XSLT_STEP_ERROR if it
+ *         failed or wasn't started.
+ */
+int
+xsltTransformStep(xsltTransformContextPtr ctxt, unsigned long budget) {
+#ifdef XSLT_STEP_TRANSFORM
+    xsltStepPtr step;
+    unsigned long end;
+
+    if ((ctxt == NULL) || (XSLT_CTXT_PRIV(ctxt)->step == NULL))
+        return(XSLT_STEP_ERROR);
+    step = (xsltStepPtr) XSLT_CTXT_PRIV(ctxt)->step;
+
+    if (budget == 0)
+        budget = 1;
+    end = ctxt->opCount + budget;
+    if (end < ctxt->opCount)
+        end = ULONG_MAX;
+    xsltStepRun(step, end);
+
+    if (!step->done)
+        return(XSLT_STEP_MORE);
+    return((step->result != NULL) ? XSLT_STEP_DONE : XSLT_STEP_ERROR);
+#else
+    return(XSLT_STEP_ERROR);
+#endif
+}
+
+/**
+ * xsltTransformEnd:
+ * @ctxt:  a transformation context started with xsltTransformBegin()
+ *
+ * End an incremental transformation. If it isn't complete, it is
+ * aborted. Like after xsltApplyStylesheetUser(), @ctxt can't run
+ * another transformation and must be freed.
+ *
+ * Returns the result document owned by the caller, or NULL if the
+ *         transformation failed or was aborted.
+ */
+xmlDocPtr
+xsltTransformEnd(xsltTransformContextPtr ctxt) {
+#ifdef XSLT_STEP_TRANSFORM
+    xsltStepPtr step;
+
+    if ((ctxt == NULL) || (XSLT_CTXT_PRIV(ctxt)->step == NULL))
+        return(NULL);
+    step = (xsltStepPtr) XSLT_CTXT_PRIV(ctxt)->step;
+    return(xsltStepFinish(ctxt, !step->done));
+#else
+    return(NULL);
+#endif
+}
+
 /**
  * xsltRunStylesheetUser:
  * @style:  a parsed XSLT stylesheet
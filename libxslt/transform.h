@@ -14,6 +14,9 @@
 
 #include <libxml/parser.h>
 #include <libxml/xmlIO.h>
+#ifdef LIBXML_READER_ENABLED
+#include <libxml/xmlreader.h>
+#endif
 #include "xsltexports.h"
 #include <libxslt/xsltInternals.h>
 
@@ -46,10 +49,62 @@ XSLTPUBFUN xmlDocPtr XSLTCALL
 					 const char *output,
 					 FILE * profile,
 					 xsltTransformContextPtr userCtxt);
+#ifdef LIBXML_READER_ENABLED
+XSLTPUBFUN xmlDocPtr XSLTCALL
+		xsltApplyStylesheetStream(xsltStylesheetPtr style,
+					 xmlTextReaderPtr reader,
+					 const char **params,
+					 const char *output,
+					 FILE * profile,
+					 xsltTransformContextPtr userCtxt);
+#endif
 XSLTPUBFUN void XSLTCALL
                 xsltProcessOneNode      (xsltTransformContextPtr ctxt,
                                          xmlNodePtr node,
                                          xsltStackElemPtr params);
+XSLTPUBFUN int XSLTCALL
+		xsltSetCtxtAsyncOutput	(xsltTransformContextPtr ctxt,
+					 int nbWriters,
+					 int maxQueued);
+XSLTPUBFUN int XSLTCALL
+		xsltSetCtxtParallel	(xsltTransformContextPtr ctxt,
+					 int nbWorkers,
+					 int minNodes);
+XSLTPUBFUN int XSLTCALL
+		xsltSetCtxtDeadline	(xsltTransformContextPtr ctxt,
+					 unsigned long timeout);
+XSLTPUBFUN int XSLTCALL
+		xsltSetCtxtYieldFunc	(xsltTransformContextPtr ctxt,
+					 xsltYieldFunc func,
+					 void *data,
+					 unsigned long interval);
+XSLTPUBFUN void XSLTCALL
+		xsltCancelTransform	(xsltTransformContextPtr ctxt);
+
+/**
+ * xsltStepStatus:
+ *
+ * The results of xsltTransformStep().
+ */
+typedef enum {
+    XSLT_STEP_ERROR = -1,	/* the transformation failed */
+    XSLT_STEP_DONE = 0,		/* the result is ready */
+    XSLT_STEP_MORE = 1		/* the budget was used, call again */
+} xsltStepStatus;
+
+XSLTPUBFUN int XSLTCALL
+		xsltTransformBegin	(xsltTransformContextPtr ctxt,
+					 xmlDocPtr doc,
+					 const char **params);
+XSLTPUBFUN int XSLTCALL
+		xsltTransformStep	(xsltTransformContextPtr ctxt,
+					 unsigned long budget);
+XSLTPUBFUN xmlDocPtr XSLTCALL
+		xsltTransformEnd	(xsltTransformContextPtr ctxt);
+XSLTPUBFUN void XSLTCALL
+		xsltSetOutputSinkFunc	(xsltTransformContextPtr ctxt,
+					 xsltOutputSinkFunc func,
+					 void *ctx);
 /**
  * Private Interfaces.
  */
@@ -31,6 +31,7 @@
 #include "imports.h"
 #include "preproc.h"
 #include "keys.h"
+#include "xsltprivate.h"
 
 #ifdef WITH_XSLT_DEBUG
  #define WITH_XSLT_DEBUG_VARIABLE
@@ -835,6 +836,21 @@ xsltEvalVariable(xsltTransformContextPtr ctxt, xsltStackElemPtr variable,
 	xmlXPathContextPtr xpctxt = ctxt->xpathCtxt;
 	xsltStackElemPtr oldVar = ctxt->contextVariable;
 
+#ifndef XSLT_REFACTORED
+	/*
+	* Plain references to other local variables.
+	*/
+	if ((comp != NULL) && (XSLT_COMP_PRIV(comp)->varName != NULL)) {
+	    result = xsltVariableSlotLookup(ctxt, comp);
+	    if (result != NULL)
+		goto error;
+	}
+	if ((comp != NULL) && (XSLT_COMP_PRIV(comp)->hoist > 0)) {
+	    result = xsltHoistedLookup(ctxt, comp);
+	    if (result != NULL)
+		goto error;
+	}
+#endif
 	if ((comp != NULL) && (comp->comp != NULL)) {
 	    xpExpr = comp->comp;
 	} else {
@@ -921,12 +937,16 @@ xsltEvalVariable(xsltTransformContextPtr ctxt, xsltStackElemPtr variable,
 
 	if ((comp == NULL) || (comp->comp == NULL))
 	    xmlXPathFreeCompExpr(xpExpr);
+#ifndef XSLT_REFACTORED
+	if ((result != NULL) && (comp != NULL) && (XSLT_COMP_PRIV(comp)->hoist > 0))
+	    xsltHoistedStore(ctxt, comp, result);
+#endif
 	if (result == NULL) {
 	    xsltTransformError(ctxt, NULL,
 		(comp != NULL) ? comp->inst : NULL,
 		"Failed to evaluate the expression of variable '%s'.\n",
 		variable->name);
-	    ctxt->state = XSLT_STATE_STOPPED;
+	    XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
 
 #ifdef WITH_XSLT_DEBUG_VARIABLE
 #ifdef LIBXML_DEBUG_ENABLED
@@ -1080,16 +1100,16 @@ xsltEvalGlobalVariable(xsltStackElemPtr elem, xsltTransformContextPtr ctxt)
     ctxt->contextVariable = NULL;
 
     /*
-    * OPTIMIZE TODO: We should consider instantiating global vars/params
-    *  on-demand. The vars/params don't need to be evaluated if never
-    *  called; and in the case of global params, if values for such params
-    *  are provided by the user.
+    * Global vars/params are instantiated on-demand, the first time they
+    * are referenced (see xsltGlobalVariableLookup()), so this can happen
+    * anywhere in the transformation.
     */
     if (elem->select != NULL) {
 	xmlXPathCompExprPtr xpExpr = NULL;
 	xmlDocPtr oldXPDoc;
 	xmlNodePtr oldXPContextNode;
 	int oldXPProximityPosition, oldXPContextSize, oldXPNsNr;
+	int oldVarsBase;
 	xmlNsPtr *oldXPNamespaces;
 	xmlXPathContextPtr xpctxt = ctxt->xpathCtxt;
 
@@ -1124,11 +1144,17 @@ xsltEvalGlobalVariable(xsltStackElemPtr elem, xsltTransformContextPtr ctxt)
 	oldXPContextSize = xpctxt->contextSize;
 	oldXPNamespaces = xpctxt->namespaces;
 	oldXPNsNr = xpctxt->nsNr;
+	oldVarsBase = ctxt->varsBase;
 
 	xpctxt->node = ctxt->initialContextNode;
 	xpctxt->doc = ctxt->initialContextDoc;
 	xpctxt->contextSize = 1;
 	xpctxt->proximityPosition = 1;
+	/*
+	* Hide the local variables of the instruction which referenced
+	* the variable.
+	*/
+	ctxt->varsBase = ctxt->varsNr;
 
 	if (comp != NULL) {
 
@@ -1154,6 +1180,7 @@ xsltEvalGlobalVariable(xsltStackElemPtr elem, xsltTransformContextPtr ctxt)
 	/*
 	* Restore Context states.
 	*/
+	ctxt->varsBase = oldVarsBase;
 	xpctxt->doc = oldXPDoc;
 	xpctxt->node = oldXPContextNode;
 	xpctxt->contextSize = oldXPContextSize;
@@ -1170,7 +1197,7 @@ xsltEvalGlobalVariable(xsltStackElemPtr elem, xsltTransformContextPtr ctxt)
 	    else
 		xsltTransformError(ctxt, NULL, comp->inst,
 		    "Evaluating global variable %s failed\n", elem->name);
-	    ctxt->state = XSLT_STATE_STOPPED;
+	    XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
             goto error;
         }
 
@@ -1193,8 +1220,10 @@ xsltEvalGlobalVariable(xsltStackElemPtr elem, xsltTransformContextPtr ctxt)
 	    result = xmlXPathNewCString("");
 	} else {
 	    xmlDocPtr container;
-	    xmlNodePtr oldInsert;
+	    xmlNodePtr oldInsert, oldNode;
 	    xmlDocPtr  oldOutput, oldXPDoc;
+	    xsltTemplatePtr oldCurrentTemplateRule;
+	    int oldVarsBase, oldXPProximityPosition, oldXPContextSize;
 	    /*
 	    * Generate a result tree fragment.
 	    */
@@ -1209,20 +1238,40 @@ xsltEvalGlobalVariable(xsltStackElemPtr elem, xsltTransformContextPtr ctxt)
 
 	    oldOutput = ctxt->output;
 	    oldInsert = ctxt->insert;
+	    oldNode = ctxt->node;
+	    oldCurrentTemplateRule = ctxt->currentTemplateRule;
+	    oldVarsBase = ctxt->varsBase;
 
 	    oldXPDoc = ctxt->xpathCtxt->doc;
+	    oldXPProximityPosition = ctxt->xpathCtxt->proximityPosition;
+	    oldXPContextSize = ctxt->xpathCtxt->contextSize;
 
 	    ctxt->output = container;
 	    ctxt->insert = (xmlNodePtr) container;
+	    /*
+	    * Same context as for the root node of the source document,
+	    * and hide the local variables of the instruction which
+	    * referenced the variable.
+	    */
+	    ctxt->node = ctxt->initialContextNode;
+	    ctxt->currentTemplateRule = NULL;
+	    ctxt->varsBase = ctxt->varsNr;
 
 	    ctxt->xpathCtxt->doc = ctxt->initialContextDoc;
+	    ctxt->xpathCtxt->proximityPosition = 1;
+	    ctxt->xpathCtxt->contextSize = 1;
 	    /*
 	    * Process the sequence constructor.
 	    */
 	    xsltApplyOneTemplate(ctxt, ctxt->node, elem->tree, NULL, NULL);
 
 	    ctxt->xpathCtxt->doc = oldXPDoc;
+	    ctxt->xpathCtxt->proximityPosition = oldXPProximityPosition;
+	    ctxt->xpathCtxt->contextSize = oldXPContextSize;
 
+	    ctxt->varsBase = oldVarsBase;
+	    ctxt->currentTemplateRule = oldCurrentTemplateRule;
+	    ctxt->node = oldNode;
 	    ctxt->insert = oldInsert;
 	    ctxt->output = oldOutput;
 
@@ -1263,7 +1312,8 @@ error:
  * xsltEvalGlobalVariables:
  * @ctxt:  the XSLT transformation context
  *
- * Evaluates all global variables and parameters of a stylesheet.
+ * Registers all global variables and parameters of a stylesheet.
+ * Their values are computed the first time they are referenced.
  * For internal use only. This is called at start of a transformation.
  *
  * Returns 0 in case of success, -1 in case of error
@@ -1271,7 +1321,6 @@ error:
 int
 xsltEvalGlobalVariables(xsltTransformContextPtr ctxt) {
     xsltStackElemPtr elem;
-    xsltStackElemPtr head = NULL;
     xsltStylesheetPtr style;
 
     if ((ctxt == NULL) || (ctxt->document == NULL))
@@ -1315,8 +1364,6 @@ xsltEvalGlobalVariables(xsltTransformContextPtr ctxt) {
                     xsltFreeStackElem(def);
                     return(-1);
                 }
-                def->next = head;
-                head = def;
 	    } else if ((elem->comp != NULL) &&
 		       (elem->comp->type == XSLT_FUNC_VARIABLE)) {
 		/*
@@ -1339,19 +1386,9 @@ xsltEvalGlobalVariables(xsltTransformContextPtr ctxt) {
     }
 
     /*
-     * This part does the actual evaluation. Note that scanning the hash
-     * table would result in a non-deterministic order, leading to
-     * non-deterministic generated IDs.
+     * The evaluation is deferred to xsltGlobalVariableLookup(), so
+     * unused variables, e.g. loading large documents, cost nothing.
      */
-    elem = head;
-    while (elem != NULL) {
-        xsltStackElemPtr next;
-
-        xsltEvalGlobalVariable(elem, ctxt);
-        next = elem->next;
-        elem->next = NULL;
-        elem = next;
-    }
 
     return(0);
 }
@@ -1612,7 +1649,7 @@ xsltProcessUserParamInternal(xsltTransformContextPtr ctxt,
 	if (result == NULL) {
 	    xsltTransformError(ctxt, style, NULL,
 		"Evaluating user parameter %s failed\n", name);
-	    ctxt->state = XSLT_STATE_STOPPED;
+	    XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
 	    return(-1);
 	}
     }
@@ -1898,9 +1935,22 @@ xsltRegisterVariable(xsltTransformContextPtr ctxt,
 static xmlXPathObjectPtr
 xsltGlobalVariableLookup(xsltTransformContextPtr ctxt, const xmlChar *name,
 		         const xmlChar *ns_uri) {
+    xsltTransformContextPtr parent;
     xsltStackElemPtr elem;
     xmlXPathObjectPtr ret = NULL;
 
+    /*
+     * The workers of parallel xsl:apply-templates compute the global
+     * variables in the context which dispatched the nodes.
+     */
+    parent = XSLT_CTXT_PRIV(ctxt)->parallelParent;
+    if (parent != NULL) {
+	xsltParallelLockGlobals(parent, 1);
+	ret = xsltGlobalVariableLookup(parent, name, ns_uri);
+	xsltParallelLockGlobals(parent, 0);
+	return(ret);
+    }
+
     /*
      * Lookup the global variables in XPath global variable hash table
      */
@@ -1971,6 +2021,152 @@ xsltVariableLookup(xsltTransformContextPtr ctxt, const xmlChar *name,
     return(NULL);
 }
 
+/**
+ * xsltVariableSlotLookup:
+ * @ctxt:  the XSLT transformation context
+ * @comp:  the compiled instruction
+ *
+ * Fetches the value of the local variable or param referenced by the
+ * expression of @comp, if that expression is a plain variable
+ * reference bound at compile time. The frame slot recorded at compile
+ * time is only a hint: the stack entry is checked against the name of
+ * the variable, so callers must fall back to a regular XPath evaluation
+ * if NULL is returned.
+ *
+ * Returns a copy of the value or NULL if not found
+ */
+xmlXPathObjectPtr
+xsltVariableSlotLookup(xsltTransformContextPtr ctxt,
+		       xsltStylePreCompPtr comp) {
+#ifdef XSLT_REFACTORED
+    (void) ctxt;
+    (void) comp;
+    return(NULL);
+#else
+    xsltStylePreCompPrivPtr priv = XSLT_COMP_PRIV(comp);
+    xsltStackElemPtr elem;
+    int i;
+
+    if ((ctxt == NULL) || (comp == NULL) || (priv->varName == NULL))
+	return(NULL);
+    i = ctxt->varsBase + priv->varSlot;
+    if ((priv->varSlot < 0) || (i >= ctxt->varsNr))
+	return(NULL);
+    elem = ctxt->varsTab[i];
+    if ((elem->name != priv->varName) || (elem->nameURI != priv->varNs))
+	return(NULL);
+    if (elem->computed == 0) {
+	elem->value = xsltEvalVariable(ctxt, elem, NULL);
+	elem->computed = 1;
+    }
+    if (elem->value == NULL)
+	return(NULL);
+    return(xmlXPathObjectCopy(elem->value));
+#endif
+}
+
+/**
+ * xsltHoistedLookup:
+ * @ctxt:  the XSLT transformation context
+ * @comp:  the compiled instruction
+ *
+ * Fetches the value of the expression of @comp if it was found to be
+ * context-independent at compile time and was already evaluated in
+ * this transformation.
+ *
+ * Returns a copy of the value or NULL if not available
+ */
+xmlXPathObjectPtr
+xsltHoistedLookup(xsltTransformContextPtr ctxt, xsltStylePreCompPtr comp) {
+#ifdef XSLT_REFACTORED
+    (void) ctxt;
+    (void) comp;
+    return(NULL);
+#else
+    xsltTransformContextPrivPtr priv = XSLT_CTXT_PRIV(ctxt);
+    int hoist;
+
+    if ((ctxt == NULL) || (comp == NULL))
+	return(NULL);
+    hoist = XSLT_COMP_PRIV(comp)->hoist;
+    if ((hoist <= 0) || (hoist > priv->hoistMax) ||
+	(priv->hoistTab[hoist - 1] == NULL))
+	return(NULL);
+    priv->hoistReuses++;
+    return(xmlXPathObjectCopy(priv->hoistTab[hoist - 1]));
+#endif
+}
+
+/**
+ * xsltHoistedStore:
+ * @ctxt:  the XSLT transformation context
+ * @comp:  the compiled instruction
+ * @value:  the value of the expression of @comp
+ *
+ * Keeps a copy of @value for later evaluations of a context-independent
+ * expression, see xsltHoistedLookup().
+ */
+void
+xsltHoistedStore(xsltTransformContextPtr ctxt, xsltStylePreCompPtr comp,
+		 xmlXPathObjectPtr value) {
+#ifdef XSLT_REFACTORED
+    (void) ctxt;
+    (void) comp;
+    (void) value;
+#else
+    if (comp == NULL)
+	return;
+    xsltHoistedStoreIndex(ctxt, XSLT_COMP_PRIV(comp)->hoist, value);
+#endif
+}
+
+/**
+ * xsltHoistedStoreIndex:
+ * @ctxt:  the XSLT transformation context
+ * @hoist:  1 + the index of the value in the cache
+ * @value:  the value of the expression
+ *
+ * Like xsltHoistedStore() for context-independent expressions which
+ * are not owned by a compiled instruction, like those of attribute
+ * value templates.
+ */
+void
+xsltHoistedStoreIndex(xsltTransformContextPtr ctxt, int hoist,
+		      xmlXPathObjectPtr value) {
+#ifdef XSLT_REFACTORED
+    (void) ctxt;
+    (void) hoist;
+    (void) value;
+#else
+    xsltTransformContextPrivPtr priv = XSLT_CTXT_PRIV(ctxt);
+
+    if ((ctxt == NULL) || (hoist <= 0) || (value == NULL))
+	return;
+    if (priv->hoistTab == NULL) {
+	int hoistNr;
+
+	if (ctxt->style == NULL)
+	    return;
+	hoistNr = XSLT_STYLE_PRIV(ctxt->style)->hoistNr;
+	if (hoistNr < hoist)
+	    return;
+	priv->hoistTab = (xmlXPathObjectPtr *)
+	    xmlMalloc(hoistNr * sizeof(xmlXPathObjectPtr));
+	if (priv->hoistTab == NULL) {
+	    xsltTransformError(ctxt, NULL, NULL,
+		"xsltHoistedStore: malloc failed\n");
+	    return;
+	}
+	memset(priv->hoistTab, 0, hoistNr * sizeof(xmlXPathObjectPtr));
+	priv->hoistMax = hoistNr;
+    }
+    if ((hoist > priv->hoistMax) || (priv->hoistTab[hoist - 1] != NULL))
+	return;
+    priv->hoistTab[hoist - 1] = xmlXPathObjectCopy(value);
+    priv->hoistEvals++;
+#endif
+}
+
 /**
  * xsltParseStylesheetCallerParam:
  * @ctxt:  the XSLT transformation context
@@ -2355,12 +2551,20 @@ local_variable_found:
 		     "variable not found '%s'\n", name));
 #endif
 
-	if (ns_uri) {
-	    xsltTransformError(tctxt, NULL, tctxt->inst,
-		"Variable '{%s}%s' has not been declared.\n", ns_uri, name);
-	} else {
-	    xsltTransformError(tctxt, NULL, tctxt->inst,
-		"Variable '%s' has not been declared.\n", name);
+	/*
+	* The evaluation of a global variable on first use might have
+	* failed, which was already reported.
+	*/
+	if ((tctxt->globalVars == NULL) ||
+	    (xmlHashLookup2(tctxt->globalVars, name, ns_uri) == NULL)) {
+	    if (ns_uri) {
+		xsltTransformError(tctxt, NULL, tctxt->inst,
+		    "Variable '{%s}%s' has not been declared.\n",
+		    ns_uri, name);
+	    } else {
+		xsltTransformError(tctxt, NULL, tctxt->inst,
+		    "Variable '%s' has not been declared.\n", name);
+	    }
 	}
     } else {
 
@@ -16,6 +16,7 @@
 #define IN_LIBXSLT
 #include "libxslt.h"
 
+#include <stdio.h>
 #include <string.h>
 
 #include <libxml/xmlmemory.h>
@@ -43,6 +44,7 @@
 #include "extra.h"
 #include "security.h"
 #include "xsltlocale.h"
+#include "xsltprivate.h"
 
 #ifdef WITH_XSLT_DEBUG
 #define WITH_XSLT_DEBUG_PARSING
@@ -419,13 +421,13 @@ static xsltTemplatePtr
 xsltNewTemplate(void) {
     xsltTemplatePtr cur;
 
-    cur = (xsltTemplatePtr) xmlMalloc(sizeof(xsltTemplate));
+    cur = (xsltTemplatePtr) xmlMalloc(sizeof(xsltTemplatePriv));
     if (cur == NULL) {
 	xsltTransformError(NULL, NULL, NULL,
 		"xsltNewTemplate : malloc failed\n");
 	return(NULL);
     }
-    memset(cur, 0, sizeof(xsltTemplate));
+    memset(cur, 0, sizeof(xsltTemplatePriv));
     cur->priority = XSLT_PAT_NO_PRIORITY;
     return(cur);
 }
@@ -456,7 +458,7 @@ xsltFreeTemplate(xsltTemplatePtr template) {
     if (template->templCalledTab) xmlFree(template->templCalledTab);
     if (template->templCountTab) xmlFree(template->templCountTab);
 
-    memset(template, -1, sizeof(xsltTemplate));
+    memset(template, -1, sizeof(xsltTemplatePriv));
     xmlFree(template);
 }
 
@@ -755,13 +757,13 @@ static xsltStylesheetPtr
 xsltNewStylesheetInternal(xsltStylesheetPtr parent) {
     xsltStylesheetPtr ret = NULL;
 
-    ret = (xsltStylesheetPtr) xmlMalloc(sizeof(xsltStylesheet));
+    ret = (xsltStylesheetPtr) xmlMalloc(sizeof(xsltStylesheetPriv));
     if (ret == NULL) {
 	xsltTransformError(NULL, NULL, NULL,
 		"xsltNewStylesheet : malloc failed\n");
 	goto internal_err;
     }
-    memset(ret, 0, sizeof(xsltStylesheet));
+    memset(ret, 0, sizeof(xsltStylesheetPriv));
 
     ret->parent = parent;
     ret->omitXmlDeclaration = -1;
@@ -1012,6 +1014,7 @@ xsltFreeStylesheet(xsltStylesheetPtr style)
     xsltFreeAttributeSetsHashes(style);
     xsltFreeNamespaceAliasHashes(style);
     xsltFreeStylePreComps(style);
+    xsltFreeEscapedTexts(style);
     /*
     * Free documents of all included stylsheet modules of this
     * stylesheet level.
@@ -1080,7 +1083,7 @@ xsltFreeStylesheet(xsltStylesheetPtr style)
     if (style->xpathCtxt != NULL)
 	xmlXPathFreeContext(style->xpathCtxt);
 
-    memset(style, -1, sizeof(xsltStylesheet));
+    memset(style, -1, sizeof(xsltStylesheetPriv));
     xmlFree(style);
 }
 
@@ -3769,6 +3772,21 @@ xsltGatherNamespaces(xsltStylesheetPtr style) {
 	    }
 	} while (cur != NULL);
     }
+
+    /*
+     * Bind the prefix of the functions xsltXPathCompile() rewrites to.
+     */
+    if (style->nsHash == NULL) {
+	style->nsHash = xmlHashCreate(10);
+	if (style->nsHash == NULL) {
+	    xsltTransformError(NULL, style, NULL,
+		 "xsltGatherNamespaces: failed to create hash table\n");
+	    style->errors++;
+	    return;
+	}
+    }
+    xmlHashUpdateEntry(style->nsHash, BAD_CAST XSLT_REWRITE_PREFIX,
+	(void *) XSLT_LIBXSLT_NAMESPACE, NULL);
 }
 
 #ifdef XSLT_REFACTORED
@@ -5003,6 +5021,10 @@ xsltParseTemplateContent(xsltStylesheetPtr style, xmlNodePtr templ) {
 				    }
 				}
 			    }
+			    if ((text->type == XML_TEXT_NODE) &&
+			        (text->name != xmlStringTextNoenc) &&
+				(text->content != NULL))
+				xsltAddEscapedText(style, text->content);
 
 			    next = text->next;
 			    xmlUnlinkNode(text);
@@ -5041,11 +5063,38 @@ xsltParseTemplateContent(xsltStylesheetPtr style, xmlNodePtr templ) {
 	        xmlAttrPtr attr = cur->properties;
 
 		while (attr != NULL) {
-		    xsltCompileAttr(style, attr);
+		    if ((attr->ns == NULL) ||
+			(!xmlStrEqual(attr->ns->href, XSLT_NAMESPACE)))
+			xsltCompileAttr(style, attr);
+		    else if ((xmlStrEqual(attr->name,
+					  BAD_CAST "use-attribute-sets")) &&
+			     (attr->children != NULL) &&
+			     (attr->children->type == XML_TEXT_NODE) &&
+			     (attr->children->next == NULL))
+			attr->psvi = xsltCompileUseAttributeSets(style,
+				(xmlNodePtr) attr, attr->children->content);
 		    attr = attr->next;
 		}
 	    }
 	}
+	else if ((cur->type == XML_TEXT_NODE) &&
+	         (cur->content != NULL) && (style->internalized) &&
+		 (cur->doc->dict != NULL))
+	{
+	    const xmlChar *tmp;
+
+	    /*
+	     * Literal text: internalize it so that it is shared by the
+	     * result text nodes, and escape it once for the serializer.
+	     */
+	    tmp = xmlDictLookup(cur->doc->dict, cur->content, -1);
+	    if ((tmp != NULL) && (tmp != cur->content)) {
+		xmlNodeSetContent(cur, NULL);
+		cur->content = (xmlChar *) tmp;
+	    }
+	    if (tmp != NULL)
+		xsltAddEscapedText(style, tmp);
+	}
 	/*
 	 * Skip to next node
 	 */
@@ -5370,6 +5419,660 @@ error:
 
 #else /* XSLT_REFACTORED */
 
+/**
+ * xsltLookupLocalVariable:
+ * @style:  the XSLT stylesheet
+ * @inst:  the instruction holding the reference
+ * @qname:  the start of the QName of the variable
+ * @len:  the length of @qname
+ * @scope:  the local variables and params in scope, innermost last
+ * @nbScope:  the number of entries in @scope
+ *
+ * Returns the index in @scope of the variable referenced by @qname,
+ * -1 if it doesn't reference a local variable and -2 if the QName
+ *    can't be resolved.
+ */
+static int
+xsltLookupLocalVariable(xsltStylesheetPtr style, xmlNodePtr inst,
+			const xmlChar *qname, int len,
+			xsltStylePreCompPtr *scope, int nbScope) {
+    const xmlChar *name, *prefix, *URI = NULL;
+    xmlChar *tmp;
+    int i;
+
+    tmp = xmlStrndup(qname, len);
+    if (tmp == NULL)
+	return(-2);
+    if (xmlValidateQName(tmp, 0) != 0) {
+	xmlFree(tmp);
+	return(-2);
+    }
+    name = xsltSplitQName(style->dict, tmp, &prefix);
+    xmlFree(tmp);
+    if (name == NULL)
+	return(-2);
+    if (prefix != NULL) {
+	xmlNsPtr ns = xmlSearchNs(inst->doc, inst, prefix);
+
+	if (ns == NULL)
+	    return(-2);
+	URI = ns->href;
+    }
+
+    for (i = nbScope - 1; i >= 0; i--) {
+	if ((xmlStrEqual(scope[i]->name, name)) &&
+	    (xmlStrEqual(scope[i]->ns, URI)))
+	    return(i);
+    }
+    return(-1);
+}
+
+/**
+ * xsltBindVariableRef:
+ * @style:  the XSLT stylesheet
+ * @comp:  the compiled instruction
+ * @scope:  the local variables and params in scope, innermost last
+ * @nbScope:  the number of entries in @scope
+ *
+ * If the expression of @comp is a plain variable reference "$qname"
+ * to a local variable or param in scope, record the frame slot of
+ * that variable so the value can be fetched without going through
+ * the XPath engine, see xsltVariableSlotLookup().
+ */
+static void
+xsltBindVariableRef(xsltStylesheetPtr style, xsltStylePreCompPtr comp,
+		    xsltStylePreCompPtr *scope, int nbScope) {
+    xsltStylePreCompPrivPtr priv = XSLT_COMP_PRIV(comp);
+    const xmlChar *expr, *end, *last;
+    int i;
+
+    priv->varName = NULL;
+    priv->varNs = NULL;
+    priv->varSlot = -1;
+    if ((nbScope <= 0) || (comp->comp == NULL))
+	return;
+    expr = (comp->select != NULL) ? comp->select : comp->test;
+    if (expr == NULL)
+	return;
+
+    while (IS_BLANK(*expr))
+	expr++;
+    if (*expr != '$')
+	return;
+    expr++;
+    end = expr;
+    while ((*end != 0) && (!IS_BLANK(*end)))
+	end++;
+    if (end == expr)
+	return;
+    last = end;
+    while (IS_BLANK(*last))
+	last++;
+    if (*last != 0)
+	return;
+
+    i = xsltLookupLocalVariable(style, comp->inst, expr, end - expr,
+				scope, nbScope);
+    if (i < 0)
+	return;
+    priv->varName = scope[i]->name;
+    priv->varNs = scope[i]->ns;
+    priv->varSlot = XSLT_COMP_PRIV(scope[i])->slot;
+}
+
+/*
+ * Functions of the core library and XSLT which don't depend on the
+ * context node, position or size when called with arguments.
+ */
+static const char *const xsltContextFreeFuncs[] = {
+    "boolean", "ceiling", "concat", "contains", "count", "element-available",
+    "false", "floor", "format-number", "function-available", "local-name",
+    "name", "namespace-uri", "normalize-space", "not", "number", "round",
+    "starts-with", "string", "string-length", "substring", "substring-after",
+    "substring-before", "sum", "system-property", "translate", "true",
+    "generate-id", NULL
+};
+
+/*
+ * Of those, the ones defaulting to the context node without arguments.
+ */
+static const char *const xsltContextDefaultFuncs[] = {
+    "generate-id", "local-name", "name", "namespace-uri", "normalize-space",
+    "number", "string", "string-length", NULL
+};
+
+static const char *const xsltPositionFuncs[] = {
+    "last", "position", NULL
+};
+
+static const char *const xsltNodeTypeNames[] = {
+    "comment", "node", "processing-instruction", "text", NULL
+};
+
+static int
+xsltFuncNameIn(const char *const *list, const xmlChar *name, int len) {
+    for (; *list != NULL; list++) {
+	if ((xmlStrncmp(BAD_CAST *list, name, len) == 0) &&
+	    ((*list)[len] == 0))
+	    return(1);
+    }
+    return(0);
+}
+
+#define IS_XPATH_NAME_START(c) \
+    ((((c) >= 'a') && ((c) <= 'z')) || (((c) >= 'A') && ((c) <= 'Z')) || \
+     ((c) == '_') || ((c) >= 0x80))
+#define IS_XPATH_NAME_CHAR(c) \
+    ((IS_XPATH_NAME_START(c)) || (((c) >= '0') && ((c) <= '9')) || \
+     ((c) == '-') || ((c) == '.'))
+
+/**
+ * xsltIsContextFreeExpr:
+ * @style:  the XSLT stylesheet
+ * @inst:  the instruction holding @expr
+ * @expr:  an XPath expression
+ * @scope:  the local variables and params in scope, innermost last
+ * @nbScope:  the number of entries in @scope
+ *
+ * Conservative lexical check of @expr: it must not contain location
+ * paths relative to the context node or its document, functions
+ * depending on the context or extension functions, nor references
+ * to local variables. Location paths and context functions are allowed
+ * inside predicates, whose context is derived from the filtered value.
+ *
+ * Returns 1 if @expr evaluates to the same value anywhere in a
+ *    transformation, 0 otherwise.
+ */
+static int
+xsltIsContextFreeExpr(xsltStylesheetPtr style, xmlNodePtr inst,
+		      const xmlChar *expr, xsltStylePreCompPtr *scope,
+		      int nbScope) {
+    const xmlChar *cur = expr, *start, *next;
+    int depth = 0, operand = 0, path = 0, nbTokens = 0;
+    int len;
+
+    while (*cur != 0) {
+	if (IS_BLANK(*cur)) {
+	    cur++;
+	    continue;
+	}
+	nbTokens++;
+	start = cur;
+
+	if ((*cur == '"') || (*cur == '\'')) {
+	    cur = xmlStrchr(cur + 1, *start);
+	    if (cur == NULL)
+		return(0);
+	    cur++;
+	    operand = 1;
+	    path = 0;
+	} else if (((*cur >= '0') && (*cur <= '9')) ||
+		   ((*cur == '.') && (cur[1] >= '0') && (cur[1] <= '9'))) {
+	    while (((*cur >= '0') && (*cur <= '9')) || (*cur == '.'))
+		cur++;
+	    operand = 1;
+	    path = 0;
+	} else if (*cur == '$') {
+	    cur++;
+	    while ((IS_XPATH_NAME_CHAR(*cur)) || (*cur == ':'))
+		cur++;
+	    if (xsltLookupLocalVariable(style, inst, start + 1,
+		    cur - (start + 1), scope, nbScope) != -1)
+		return(0);
+	    operand = 1;
+	    path = 0;
+	} else if (*cur == '/') {
+	    cur++;
+	    if (*cur == '/')
+		cur++;
+	    /* Absolute location paths depend on the context document. */
+	    if ((! operand) && (depth == 0))
+		return(0);
+	    operand = 0;
+	    path = 1;
+	} else if (*cur == '[') {
+	    cur++;
+	    depth++;
+	    operand = 0;
+	    path = 0;
+	} else if (*cur == ']') {
+	    cur++;
+	    if (--depth < 0)
+		return(0);
+	    operand = 1;
+	    path = 0;
+	} else if ((*cur == ')') ||
+		   ((*cur == '*') && (! operand))) {
+	    /* The end of a group or a name test. */
+	    if ((*cur == '*') && (! path) && (depth == 0))
+		return(0);
+	    cur++;
+	    operand = 1;
+	    path = 0;
+	} else if ((*cur == '.') || (*cur == '@')) {
+	    /* Abbreviated steps. */
+	    if ((! path) && (depth == 0))
+		return(0);
+	    if (*cur == '@') {
+		cur++;
+		path = 1;
+		operand = 0;
+		continue;
+	    }
+	    cur++;
+	    if (*cur == '.')
+		cur++;
+	    operand = 1;
+	    path = 0;
+	} else if (IS_XPATH_NAME_START(*cur)) {
+	    while (IS_XPATH_NAME_CHAR(*cur))
+		cur++;
+	    if ((*cur == ':') && (cur[1] != ':')) {
+		cur++;
+		if (*cur == '*')
+		    cur++;
+		else
+		    while (IS_XPATH_NAME_CHAR(*cur))
+			cur++;
+	    }
+	    len = cur - start;
+	    if (operand) {
+		/* An operator name: and, or, div, mod. */
+		operand = 0;
+		path = 0;
+		continue;
+	    }
+	    next = cur;
+	    while (IS_BLANK(*next))
+		next++;
+	    if ((*next == ':') && (next[1] == ':')) {
+		/* An axis name. */
+		if ((! path) && (depth == 0))
+		    return(0);
+		cur = next + 2;
+		path = 1;
+		continue;
+	    }
+	    if ((*next == '(') &&
+		(! xsltFuncNameIn(xsltNodeTypeNames, start, len))) {
+		/* A function call. */
+		next++;
+		while (IS_BLANK(*next))
+		    next++;
+		if (! xsltFuncNameIn(xsltContextFreeFuncs, start, len)) {
+		    if (depth == 0)
+			return(0);
+		    if ((! xsltFuncNameIn(xsltContextDefaultFuncs, start,
+					  len)) &&
+			(! xsltFuncNameIn(xsltPositionFuncs, start, len)))
+			return(0);
+		} else if ((depth == 0) && (*next == ')') &&
+			   (xsltFuncNameIn(xsltContextDefaultFuncs, start,
+					   len))) {
+		    return(0);
+		}
+		cur = next;
+		operand = 0;
+		path = 0;
+		continue;
+	    }
+	    /* A name test or a node type test. */
+	    if ((! path) && (depth == 0))
+		return(0);
+	    operand = 1;
+	    path = 0;
+	} else {
+	    /* Operators, commas and opening parentheses. */
+	    cur++;
+	    if (((*start == '!') || (*start == '<') || (*start == '>')) &&
+		(*cur == '='))
+		cur++;
+	    operand = 0;
+	    path = 0;
+	}
+    }
+    if (depth != 0)
+	return(0);
+    /* Don't bother with plain variable references and literals. */
+    return(nbTokens > 1);
+}
+
+/**
+ * xsltMarkContextFree:
+ * @style:  the XSLT stylesheet
+ * @comp:  the compiled instruction
+ * @scope:  the local variables and params in scope, innermost last
+ * @nbScope:  the number of entries in @scope
+ *
+ * Assigns an index in the per-transformation cache of values to the
+ * expression of @comp if it doesn't depend on the context, so that it
+ * is evaluated at most once per transformation, see xsltHoistedLookup().
+ */
+static void
+xsltMarkContextFree(xsltStylesheetPtr style, xsltStylePreCompPtr comp,
+		    xsltStylePreCompPtr *scope, int nbScope) {
+    const xmlChar *expr;
+
+    XSLT_COMP_PRIV(comp)->hoist = 0;
+    if (comp->comp == NULL)
+	return;
+    switch (comp->type) {
+	case XSLT_FUNC_VARIABLE:
+	case XSLT_FUNC_PARAM:
+	case XSLT_FUNC_WITHPARAM:
+	case XSLT_FUNC_VALUEOF:
+	case XSLT_FUNC_COPYOF:
+	case XSLT_FUNC_FOREACH:
+	case XSLT_FUNC_APPLYTEMPLATES:
+	    expr = comp->select;
+	    break;
+	case XSLT_FUNC_IF:
+	case XSLT_FUNC_WHEN:
+	    expr = comp->test;
+	    break;
+	default:
+	    return;
+    }
+    if ((expr == NULL) ||
+	(! xsltIsContextFreeExpr(style, comp->inst, expr, scope, nbScope)))
+	return;
+    XSLT_COMP_PRIV(comp)->hoist = ++XSLT_STYLE_PRIV(style->principal)->hoistNr;
+}
+
+typedef struct {
+    xsltStylesheetPtr style;
+    xmlNodePtr inst;
+    xsltStylePreCompPtr *scope;
+    int nbScope;
+} xsltAVTScope;
+
+/**
+ * xsltIsContextFreeAVTExpr:
+ * @data:  the xsltAVTScope of the literal result element
+ * @expr:  the expression of an attribute value template
+ *
+ * Like xsltIsContextFreeExpr() but also accepts plain references to
+ * global variables, whose string value would otherwise be converted
+ * again by each evaluation.
+ *
+ * Returns 1 if @expr evaluates to the same value anywhere in a
+ *    transformation, 0 otherwise.
+ */
+static int
+xsltIsContextFreeAVTExpr(void *data, const xmlChar *expr) {
+    xsltAVTScope *avtScope = (xsltAVTScope *) data;
+    const xmlChar *cur, *end;
+
+    cur = expr;
+    while (IS_BLANK(*cur))
+	cur++;
+    if (*cur == '$') {
+	end = ++cur;
+	while ((IS_XPATH_NAME_CHAR(*end)) || (*end == ':'))
+	    end++;
+	expr = end;
+	while (IS_BLANK(*expr))
+	    expr++;
+	if (*expr == 0)
+	    return(xsltLookupLocalVariable(avtScope->style, avtScope->inst,
+			cur, end - cur, avtScope->scope,
+			avtScope->nbScope) == -1);
+	expr = cur - 1;
+    }
+    return(xsltIsContextFreeExpr(avtScope->style, avtScope->inst, expr,
+				 avtScope->scope, avtScope->nbScope));
+}
+
+/**
+ * xsltNumberVariables:
+ * @style:  the XSLT stylesheet
+ * @list:  the first node of a sequence constructor
+ * @scope:  the stack of local variables in scope
+ * @scopeMax:  the allocated size of @scope
+ * @nbScope:  the number of variables in scope before @list
+ *
+ * Walks a sequence constructor following the lexical scoping rules
+ * of xsl:variable. Each variable gets the slot it will occupy in the
+ * frame of the template at transformation time, and references
+ * to it are bound by xsltBindVariableRef().
+ */
+static void
+xsltNumberVariables(xsltStylesheetPtr style, xmlNodePtr list,
+		    xsltStylePreCompPtr **scope, int *scopeMax, int nbScope) {
+    xmlNodePtr cur;
+    xsltStylePreCompPtr comp;
+
+    for (cur = list; cur != NULL; cur = cur->next) {
+	if (cur->type != XML_ELEMENT_NODE)
+	    continue;
+	comp = NULL;
+	if ((IS_XSLT_ELEM(cur)) && (cur->psvi != NULL)) {
+	    comp = (xsltStylePreCompPtr) cur->psvi;
+	    xsltBindVariableRef(style, comp, *scope, nbScope);
+	    xsltMarkContextFree(style, comp, *scope, nbScope);
+	} else if (! IS_XSLT_ELEM(cur)) {
+	    xmlAttrPtr attr;
+	    xsltAVTScope avtScope;
+
+	    avtScope.style = style;
+	    avtScope.inst = cur;
+	    avtScope.scope = *scope;
+	    avtScope.nbScope = nbScope;
+	    for (attr = cur->properties; attr != NULL; attr = attr->next) {
+		if ((attr->psvi != NULL) &&
+		    ((attr->ns == NULL) ||
+		     (!xmlStrEqual(attr->ns->href, XSLT_NAMESPACE))))
+		    xsltHoistAVT(style, attr->psvi, xsltIsContextFreeAVTExpr,
+				 &avtScope);
+	    }
+	}
+	/*
+	* The content of a variable is evaluated before the variable
+	* itself is pushed.
+	*/
+	if (cur->children != NULL)
+	    xsltNumberVariables(style, cur->children, scope, scopeMax,
+				nbScope);
+	if ((comp == NULL) || (comp->type != XSLT_FUNC_VARIABLE) ||
+	    (comp->name == NULL))
+	    continue;
+
+	if (nbScope >= *scopeMax) {
+	    xsltStylePreCompPtr *tmp;
+	    int newMax = *scopeMax == 0 ? 10 : *scopeMax * 2;
+
+	    tmp = (xsltStylePreCompPtr *) xmlRealloc(*scope,
+		    newMax * sizeof(*tmp));
+	    if (tmp == NULL)
+		return;
+	    *scope = tmp;
+	    *scopeMax = newMax;
+	}
+	XSLT_COMP_PRIV(comp)->slot = nbScope;
+	(*scope)[nbScope++] = comp;
+    }
+}
+
+/**
+ * xsltNumberTemplateVariables:
+ * @style:  the XSLT stylesheet
+ * @templ:  the compiled template
+ *
+ * Assigns consecutive slots to the leading xsl:param elements of
+ * @templ, in the order xsltApplyXSLTTemplate() will process them,
+ * followed by the local variables of the template body.
+ * This allows callers bound at compile time to pass their
+ * xsl:with-param values by index instead of by name, and plain
+ * variable references to be resolved without a search by name.
+ */
+static void
+xsltNumberTemplateVariables(xsltStylesheetPtr style, xsltTemplatePtr templ) {
+    xmlNodePtr cur;
+    xsltStylePreCompPtr comp;
+    xsltStylePreCompPtr *scope = NULL;
+    xsltTemplatePrivPtr priv = XSLT_TEMPL_PRIV(templ);
+    int scopeMax = 0;
+
+    priv->paramNr = 0;
+    for (cur = templ->content; cur != NULL; cur = cur->next) {
+	if (cur->type == XML_TEXT_NODE)
+	    continue;
+	if ((cur->type != XML_ELEMENT_NODE) ||
+	    (cur->psvi == NULL) ||
+	    (! IS_XSLT_ELEM(cur)) ||
+	    (! IS_XSLT_NAME(cur, "param")))
+	    break;
+	comp = (xsltStylePreCompPtr) cur->psvi;
+	if (priv->paramNr >= scopeMax) {
+	    xsltStylePreCompPtr *tmp;
+	    int newMax = scopeMax == 0 ? 10 : scopeMax * 2;
+
+	    tmp = (xsltStylePreCompPtr *) xmlRealloc(scope,
+		    newMax * sizeof(*tmp));
+	    if (tmp == NULL) {
+		xmlFree(scope);
+		return;
+	    }
+	    scope = tmp;
+	    scopeMax = newMax;
+	}
+	xsltBindVariableRef(style, comp, scope, priv->paramNr);
+	xsltMarkContextFree(style, comp, scope, priv->paramNr);
+	if (cur->children != NULL)
+	    xsltNumberVariables(style, cur->children, &scope, &scopeMax,
+				priv->paramNr);
+	XSLT_COMP_PRIV(comp)->slot = priv->paramNr;
+	scope[priv->paramNr++] = comp;
+    }
+    xsltNumberVariables(style, cur, &scope, &scopeMax, priv->paramNr);
+
+    if (scope != NULL)
+	xmlFree(scope);
+}
+
+/**
+ * xsltMarkTailCalls:
+ * @templ:  the compiled template
+ * @list:  a sequence constructor in tail position of @templ
+ *
+ * Flags the xsl:call-template instructions calling @templ itself as the
+ * last instruction of @list, looking through xsl:if and xsl:choose.
+ * Nothing is output or evaluated after such a call returns, so it
+ * can reuse the frame of the template, see xsltApplyXSLTTemplate().
+ */
+static void
+xsltMarkTailCalls(xsltTemplatePtr templ, xmlNodePtr list) {
+    xmlNodePtr last = NULL, cur;
+    xsltStylePreCompPtr comp;
+
+    for (cur = list; cur != NULL; cur = cur->next) {
+	if ((cur->type != XML_COMMENT_NODE) && (cur->type != XML_PI_NODE))
+	    last = cur;
+    }
+    if ((last == NULL) || (last->type != XML_ELEMENT_NODE) ||
+	(last->psvi == NULL) || (! IS_XSLT_ELEM(last)))
+	return;
+    comp = (xsltStylePreCompPtr) last->psvi;
+
+    switch (comp->type) {
+	case XSLT_FUNC_CALLTEMPLATE:
+	    if (comp->templ == templ)
+		XSLT_COMP_PRIV(comp)->tailCall = 1;
+	    break;
+	case XSLT_FUNC_IF:
+	    xsltMarkTailCalls(templ, last->children);
+	    break;
+	case XSLT_FUNC_CHOOSE:
+	    for (cur = last->children; cur != NULL; cur = cur->next) {
+		if ((cur->type == XML_ELEMENT_NODE) && (IS_XSLT_ELEM(cur)) &&
+		    ((IS_XSLT_NAME(cur, "when")) ||
+		     (IS_XSLT_NAME(cur, "otherwise"))))
+		    xsltMarkTailCalls(templ, cur->children);
+	    }
+	    break;
+	default:
+	    break;
+    }
+}
+
+/**
+ * xsltResolveCallTemplates:
+ * @style:  the principal XSLT stylesheet
+ *
+ * Binds the xsl:call-template instructions of @style and of all its
+ * imported stylesheets to the called named template, applying the
+ * import precedence rules, and maps their xsl:with-param children
+ * to the parameter slots of that template. Self-recursive calls in
+ * tail position are flagged by xsltMarkTailCalls().
+ * Unresolved calls are left alone and reported at transformation time.
+ */
+static void
+xsltResolveCallTemplates(xsltStylesheetPtr style) {
+    xsltStylesheetPtr sheet, cur;
+    xsltElemPreCompPtr item;
+    xsltStylePreCompPtr comp, wparam, param;
+    xsltTemplatePtr templ;
+    xmlNodePtr child, pnode;
+
+    for (sheet = style; sheet != NULL; sheet = xsltNextImport(sheet)) {
+	for (item = sheet->preComps; item != NULL; item = item->next) {
+	    if (item->type != XSLT_FUNC_CALLTEMPLATE)
+		continue;
+	    comp = (xsltStylePreCompPtr) item;
+	    if ((comp->name == NULL) || (comp->inst == NULL))
+		continue;
+
+	    templ = NULL;
+	    for (cur = style; cur != NULL; cur = xsltNextImport(cur)) {
+		if (cur->namedTemplates != NULL) {
+		    templ = (xsltTemplatePtr) xmlHashLookup2(
+			cur->namedTemplates, comp->name, comp->ns);
+		    if (templ != NULL)
+			break;
+		}
+	    }
+	    if (templ == NULL)
+		continue;
+	    comp->templ = templ;
+
+	    for (child = comp->inst->children; child != NULL;
+		 child = child->next)
+	    {
+		if ((child->type != XML_ELEMENT_NODE) ||
+		    (child->psvi == NULL) ||
+		    (! IS_XSLT_ELEM(child)) ||
+		    (! IS_XSLT_NAME(child, "with-param")))
+		    continue;
+		wparam = (xsltStylePreCompPtr) child->psvi;
+		XSLT_COMP_PRIV(wparam)->slot = -1;
+		for (pnode = templ->content; pnode != NULL;
+		     pnode = pnode->next)
+		{
+		    if (pnode->type == XML_TEXT_NODE)
+			continue;
+		    if ((pnode->type != XML_ELEMENT_NODE) ||
+			(pnode->psvi == NULL) ||
+			(! IS_XSLT_ELEM(pnode)) ||
+			(! IS_XSLT_NAME(pnode, "param")))
+			break;
+		    param = (xsltStylePreCompPtr) pnode->psvi;
+		    if ((xmlStrEqual(param->name, wparam->name)) &&
+			(xmlStrEqual(param->ns, wparam->ns)))
+		    {
+			XSLT_COMP_PRIV(wparam)->slot = XSLT_COMP_PRIV(param)->slot;
+			break;
+		    }
+		}
+	    }
+	}
+    }
+
+    for (sheet = style; sheet != NULL; sheet = xsltNextImport(sheet)) {
+	for (templ = sheet->templates; templ != NULL; templ = templ->next)
+	    xsltMarkTailCalls(templ, templ->content);
+    }
+}
+
 /**
  * xsltParseStylesheetTemplate:
  * @style:  the XSLT stylesheet
@@ -5494,6 +6197,7 @@ xsltParseStylesheetTemplate(xsltStylesheetPtr style, xmlNodePtr template) {
     xsltParseTemplateContent(style, template);
     ret->elem = template;
     ret->content = template->children;
+    xsltNumberTemplateVariables(style, ret);
     xsltAddTemplate(style, ret, ret->mode, ret->modeURI);
 
 error:
@@ -6150,6 +6854,24 @@ xsltParseStylesheetTop(xsltStylesheetPtr style, xmlNodePtr top) {
 	xmlFree(prop);
     }
 
+    /*
+     * Extension attribute asking for parallel xsl:apply-templates.
+     */
+    prop = xmlGetNsProp(top, (const xmlChar *)"parallel",
+                        XSLT_LIBXSLT_NAMESPACE);
+    if (prop != NULL) {
+	int value;
+
+	if ((sscanf((const char *) prop, "%d", &value) == 1) && (value >= 0)) {
+	    XSLT_STYLE_PRIV(style)->parallel = value;
+	} else {
+	    xsltTransformError(NULL, style, top,
+		"libxslt:parallel: invalid number of threads '%s'\n", prop);
+	    style->warnings++;
+	}
+	xmlFree(prop);
+    }
+
     /*
      * process xsl:import elements
      */
@@ -6709,8 +7431,12 @@ xsltParseStylesheetUser(xsltStylesheetPtr style, xmlDocPtr doc) {
     }
 #endif /* else of XSLT_REFACTORED */
 
-    if (style->parent == NULL)
+    if (style->parent == NULL) {
         xsltResolveStylesheetAttributeSet(style);
+#ifndef XSLT_REFACTORED
+        xsltResolveCallTemplates(style);
+#endif
+    }
 
     if (style->errors != 0) {
         /*
@@ -419,6 +419,39 @@ typedef void (*xsltTransformFunction) (xsltTransformContextPtr ctxt,
 typedef void (*xsltSortFunc) (xsltTransformContextPtr ctxt, xmlNodePtr *sorts,
 			      int nbsorts);
 
+/**
+ * xsltOutputSinkFunc:
+ * @ctx:     the user data given to xsltSetOutputSinkFunc()
+ * @href:    the resolved URI of the result document
+ * @res:     the result document
+ * @style:   the output settings of the result document
+ * @append:  whether the output should be appended to the previous one
+ *           with the same @href
+ *
+ * Signature of the function receiving the result documents of
+ * xsl:document and its extension counterparts instead of the
+ * filesystem. @res and @style belong to the caller, use
+ * xsltSaveResultTo() and friends to serialize them.
+ *
+ * Returns a positive or null value in case of success, -1 in case
+ * of error.
+ */
+typedef int (*xsltOutputSinkFunc) (void *ctx, const xmlChar *href,
+				   xmlDocPtr res, xsltStylesheetPtr style,
+				   int append);
+
+/**
+ * xsltYieldFunc:
+ * @ctxt:    the transformation context
+ * @data:    the user data given to xsltSetCtxtYieldFunc()
+ *
+ * Signature of the function called periodically while a
+ * transformation runs, from the thread running it.
+ *
+ * Returns 0 to go on, any other value to stop the transformation.
+ */
+typedef int (*xsltYieldFunc) (xsltTransformContextPtr ctxt, void *data);
+
 typedef enum {
     XSLT_FUNC_COPY=1,
     XSLT_FUNC_SORT,
@@ -0,0 +1,322 @@
+/*
+ * Summary: internal structures and helpers of libxslt
+ * Description: state and functions shared by the modules of libxslt
+ *              which are neither part of its API nor of its ABI.
+ *              This header is only used during the compilation of
+ *              libxslt and is not installed.
+ *
+ * Copy: See Copyright for the status of this software.
+ */
+
+#ifndef __XML_XSLT_PRIVATE_H__
+#define __XML_XSLT_PRIVATE_H__
+
+#include "xsltInternals.h"
+#include "pattern.h"
+#include "security.h"
+
+/*
+ * The structures below extend the public ones they start with. They
+ * are only allocated by libxslt, so the public layouts are unchanged
+ * and the extensions can be reached by a cast.
+ */
+
+/**
+ * xsltTemplatePriv:
+ *
+ * The private part of a compiled template.
+ */
+typedef struct _xsltTemplatePriv xsltTemplatePriv;
+typedef xsltTemplatePriv *xsltTemplatePrivPtr;
+struct _xsltTemplatePriv {
+    xsltTemplate templ;		/* the public part, must be first */
+
+    int paramNr;		/* the number of leading xsl:param elements */
+
+    int streamNoRoot;		/* can't process a streamed document element */
+};
+
+#define XSLT_TEMPL_PRIV(templ) ((xsltTemplatePrivPtr) (templ))
+
+#ifndef XSLT_REFACTORED
+/**
+ * xsltStylePreCompPriv:
+ *
+ * The private part of a precomputed XSLT instruction.
+ */
+typedef struct _xsltStylePreCompPriv xsltStylePreCompPriv;
+typedef xsltStylePreCompPriv *xsltStylePreCompPrivPtr;
+struct _xsltStylePreCompPriv {
+    xsltStylePreComp comp;	/* the public part, must be first */
+
+    int      slot;		/* param, with-param, variable: the slot */
+
+    /*
+     * Set if the expression is a plain reference to a local variable
+     * or param, resolved at compile time.
+     */
+    const xmlChar *varName;	/* the name of the referenced variable */
+    const xmlChar *varNs;	/* the namespace name of the variable */
+    int      varSlot;		/* the slot of the variable in the frame */
+
+    int      tailCall;		/* call-template: self-recursive call in
+				   tail position */
+
+    int      hoist;		/* context-independent expression: 1 + its
+				   index in the per-transformation cache */
+
+    void    *useAttrSets;	/* copy, element: the compiled
+				   use-attribute-sets */
+};
+
+#define XSLT_COMP_PRIV(comp) ((xsltStylePreCompPrivPtr) (comp))
+#endif /* XSLT_REFACTORED */
+
+/**
+ * xsltStylesheetPriv:
+ *
+ * The private part of a stylesheet.
+ */
+typedef struct _xsltStylesheetPriv xsltStylesheetPriv;
+typedef xsltStylesheetPriv *xsltStylesheetPrivPtr;
+struct _xsltStylesheetPriv {
+    xsltStylesheet style;	/* the public part, must be first */
+
+    /*
+     * The number of context-independent expressions in templates
+     * (principal stylesheet only).
+     */
+    int hoistNr;
+
+    /*
+     * Number of threads asked by the libxslt:parallel attribute.
+     */
+    int parallel;
+
+    /*
+     * Escaped forms of the literal text of templates, by address
+     * (principal stylesheet only).
+     */
+    void *escapedTexts;
+
+    /*
+     * The uses of attribute sets by the instructions and literal result
+     * elements of this stylesheet, see xsltCompileUseAttributeSets().
+     */
+    void *useAttrSets;
+
+    /*
+     * An expression calls generate-id() or an evaluate() extension
+     * function (principal stylesheet only), see xsltNoteXPathCalls().
+     */
+    int unsafeCalls;
+};
+
+#define XSLT_STYLE_PRIV(style) ((xsltStylesheetPrivPtr) (style))
+
+/**
+ * xsltTransformContextPriv:
+ *
+ * The private part of a transformation context.
+ */
+typedef struct _xsltTransformContextPriv xsltTransformContextPriv;
+typedef xsltTransformContextPriv *xsltTransformContextPrivPtr;
+struct _xsltTransformContextPriv {
+    xsltTransformContext ctxt;	/* the public part, must be first */
+
+    /*
+     * Pending self-recursive xsl:call-template in tail position,
+     * executed by the frame of xsltApplyXSLTTemplate().
+     */
+    xsltTemplatePtr tailCallTempl;
+    xsltStackElemPtr tailCallParams;
+
+    /*
+     * Values of the context-independent expressions, evaluated once
+     * per transformation, and how often they were reused.
+     */
+    xmlXPathObjectPtr *hoistTab;
+    int hoistMax;
+    unsigned long hoistEvals;
+    unsigned long hoistReuses;
+
+    /*
+     * Background writers for xsl:document results, see
+     * xsltSetCtxtAsyncOutput().
+     */
+    void *asyncOutput;
+
+    /*
+     * Receiver of the xsl:document results, see xsltSetOutputSinkFunc().
+     */
+    xsltOutputSinkFunc outputSink;
+    void *outputSinkCtxt;
+
+    /*
+     * Worker contexts of parallel xsl:apply-templates, see
+     * xsltSetCtxtParallel(), or for a worker context, the context
+     * which dispatched the nodes.
+     */
+    void *parallel;
+    xsltTransformContextPtr parallelParent;
+
+    /*
+     * Interruption of the transformation, see xsltSetCtxtDeadline(),
+     * xsltCancelTransform() and xsltSetCtxtYieldFunc().
+     */
+    int cancelFlag;
+    int *cancelled;		/* the flag, shared with worker contexts */
+    unsigned long deadline;	/* in milliseconds, 0 if none */
+    xsltYieldFunc yieldFunc;
+    void *yieldData;
+    unsigned long yieldInterval;
+    unsigned long checkInterval; /* operations between two checks */
+    unsigned long checkCount;	/* operations until the next check */
+
+    /*
+     * Incremental execution, see xsltTransformStep().
+     */
+    void *step;
+
+    /*
+     * Streamed input, see xsltApplyStylesheetStream().
+     */
+    void *streamReader;		/* the xmlTextReaderPtr */
+    xmlNodePtr streamRoot;	/* the document element being read */
+    int streamConsumed;		/* its children were already processed */
+};
+
+#define XSLT_CTXT_PRIV(ctxt) ((xsltTransformContextPrivPtr) (ctxt))
+
+/*
+ * The cancellation flag and the state of a context are read from other
+ * threads: the state of the context dispatching parallel
+ * xsl:apply-templates is checked by its workers, and set by them when
+ * they compute a global variable in it.
+ */
+#if defined(__clang__) || \
+    (defined(__GNUC__) && \
+     ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 7))))
+#define XSLT_LOAD_FLAG(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define XSLT_STORE_FLAG(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#else
+#define XSLT_LOAD_FLAG(p) (*(volatile int *) (p))
+#define XSLT_STORE_FLAG(p, v) (*(volatile int *) (p) = (v))
+#endif
+
+#define XSLT_GET_STATE(ctxt) \
+    ((xsltTransformState) XSLT_LOAD_FLAG((int *) &(ctxt)->state))
+#define XSLT_SET_STATE(ctxt, st) \
+    XSLT_STORE_FLAG((int *) &(ctxt)->state, (int) (st))
+
+/*
+ * attributes.c
+ */
+void *
+		xsltCompileUseAttributeSets	(xsltStylesheetPtr style,
+						 xmlNodePtr inst,
+						 const xmlChar *names);
+void
+		xsltApplyUseAttributeSets	(xsltTransformContextPtr ctxt,
+						 xmlNodePtr node,
+						 void *use);
+
+/*
+ * attrvt.c
+ */
+xmlChar *
+		xsltEvalAVTDict			(xsltTransformContextPtr ctxt,
+						 void *avt,
+						 xmlNodePtr node,
+						 xmlDictPtr dict);
+void
+		xsltHoistAVT			(xsltStylesheetPtr style,
+						 void *avt,
+						 int (*contextFree) (void *data,
+						     const xmlChar *expr),
+						 void *data);
+
+/*
+ * xslt.c: the prefix bound to the libxslt namespace in the namespace
+ * hash of stylesheets, for the functions of functions.c to which
+ * xsltXPathCompile() rewrites some tests. The xmlns prefix can't be
+ * declared in a stylesheet, so no namespace in scope hides it.
+ */
+#define XSLT_REWRITE_PREFIX	"xmlns"
+
+/*
+ * pattern.c: streamability checks
+ */
+#define XSLT_STREAM_LOCAL	(1 << 0)
+#define XSLT_STREAM_PREDICATE	(1 << 1)
+
+#define XSLT_STREAM_DOC		(1 << 0)
+#define XSLT_STREAM_ROOT	(1 << 1)
+#define XSLT_STREAM_ANY		(1 << 2)
+
+int
+		xsltStreamableExpr	(const xmlChar *expr,
+					 int flags,
+					 const char **reason);
+int
+		xsltStreamableChildStep	(const xmlChar *expr);
+int
+		xsltStreamablePattern	(xsltCompMatchPtr comp,
+					 int *top,
+					 const char **reason);
+
+/*
+ * security.c
+ */
+int
+		xsltCheckWriteNoCreate		(xsltSecurityPrefsPtr sec,
+						 xsltTransformContextPtr ctxt,
+						 const xmlChar *URL);
+
+/*
+ * xsltutils.c: calls in the expressions of stylesheets
+ */
+void
+		xsltNoteXPathCalls		(xsltStylesheetPtr style,
+						 const xmlChar *expr);
+void
+		xsltNoteAVTCalls		(xsltStylesheetPtr style,
+						 const xmlChar *avt);
+
+/*
+ * xsltutils.c: escaped literal text of stylesheets
+ */
+int
+		xsltAddEscapedText		(xsltStylesheetPtr style,
+						 const xmlChar *text);
+void
+		xsltFreeEscapedTexts		(xsltStylesheetPtr style);
+
+/*
+ * transform.c
+ */
+void
+		xsltParallelLockGlobals		(xsltTransformContextPtr ctxt,
+						 int lock);
+void
+		xsltCleanupStepThreads		(void);
+
+/*
+ * variables.c
+ */
+xmlXPathObjectPtr
+		xsltVariableSlotLookup		(xsltTransformContextPtr ctxt,
+						 xsltStylePreCompPtr comp);
+xmlXPathObjectPtr
+		xsltHoistedLookup		(xsltTransformContextPtr ctxt,
+						 xsltStylePreCompPtr comp);
+void
+		xsltHoistedStore		(xsltTransformContextPtr ctxt,
+						 xsltStylePreCompPtr comp,
+						 xmlXPathObjectPtr value);
+void
+		xsltHoistedStoreIndex		(xsltTransformContextPtr ctxt,
+						 int hoist,
+						 xmlXPathObjectPtr value);
+
+#endif /* __XML_XSLT_PRIVATE_H__ */
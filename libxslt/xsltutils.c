@@ -18,6 +18,7 @@
 #include <trio.h>
 #endif
 
+#include <limits.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdarg.h>
@@ -35,17 +36,28 @@
 #include <libxml/HTMLtree.h>
 #include <libxml/xmlerror.h>
 #include <libxml/xmlIO.h>
+#include <libxml/parserInternals.h>
 #include "xsltutils.h"
 #include "templates.h"
 #include "xsltInternals.h"
 #include "imports.h"
 #include "transform.h"
+#include "xsltprivate.h"
 
 #if defined(_WIN32)
 #include <windows.h>
 #define XSLT_WIN32_PERFORMANCE_COUNTER
 #endif
 
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define XSLT_ESCAPE_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define XSLT_ESCAPE_NEON
+#endif
+
 /************************************************************************
  *									*
  *			Convenience function				*
@@ -525,7 +537,7 @@ xsltMessage(xsltTransformContextPtr ctxt, xmlNodePtr node, xmlNodePtr inst) {
 	xmlFree(message);
     }
     if (terminate)
-	ctxt->state = XSLT_STATE_STOPPED;
+	XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
 }
 
 /************************************************************************
@@ -675,7 +687,7 @@ xsltPrintErrorContext(xsltTransformContextPtr ctxt,
 
     if (ctxt != NULL) {
         if (ctxt->state == XSLT_STATE_OK)
-	    ctxt->state = XSLT_STATE_ERROR;
+	    XSLT_SET_STATE(ctxt, XSLT_STATE_ERROR);
 	if (ctxt->error != NULL) {
 	    error = ctxt->error;
 	    errctx = ctxt->errctx;
@@ -769,7 +781,7 @@ xsltTransformError(xsltTransformContextPtr ctxt,
 
     if (ctxt != NULL) {
         if (ctxt->state == XSLT_STATE_OK)
-	    ctxt->state = XSLT_STATE_ERROR;
+	    XSLT_SET_STATE(ctxt, XSLT_STATE_ERROR);
 	if (ctxt->error != NULL) {
 	    error = ctxt->error;
 	    errctx = ctxt->errctx;
@@ -1133,7 +1145,7 @@ xsltComputeSortResultInternal(xsltTransformContextPtr ctxt, xmlNodePtr sort,
 		}
 	    }
 	} else {
-	    ctxt->state = XSLT_STATE_STOPPED;
+	    XSLT_SET_STATE(ctxt, XSLT_STATE_STOPPED);
 	    results[i] = NULL;
 	}
     }
@@ -1549,6 +1561,672 @@ xsltSetCtxtParseOptions(xsltTransformContextPtr ctxt, int options)
  *									*
  ************************************************************************/
 
+/*
+ * Serialization of XML result trees
+ *
+ * For the common case of a result tree written without indentation to
+ * an UTF-8 buffer, the nodes are serialized here rather than by
+ * xmlNodeDumpOutput(), producing the same bytes. Runs of characters
+ * which don't need escaping are found a vector at a time and copied in
+ * bulk, and small writes are gathered before reaching the buffer.
+ */
+
+#define XSLT_ESC_TEXT	1	/* escaped in text nodes */
+#define XSLT_ESC_ATTR	2	/* escaped in attribute values */
+#define XSLT_ESC_UTF8	4	/* non-ASCII, written as character refs */
+
+static const unsigned char xsltEscapeTable[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 2, 0, 0, 3, 0, 0, /* 0x00 */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0x10 */
+    0, 0, 2, 0, 0, 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0x20 */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 3, 0, 3, 0, /* 0x30 */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0x40 */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0x50 */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0x60 */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0x70 */
+    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, /* 0x80 */
+    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, /* 0x90 */
+    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, /* 0xA0 */
+    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, /* 0xB0 */
+    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, /* 0xC0 */
+    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, /* 0xD0 */
+    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, /* 0xE0 */
+    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4  /* 0xF0 */
+};
+
+/**
+ * xsltEscapeScan:
+ * @str:  a string
+ * @len:  the length of @str
+ * @mask:  the XSLT_ESC_* classes of characters to look for
+ *
+ * Returns the length of the prefix of @str without any character to
+ *         escape.
+ */
+static size_t
+xsltEscapeScan(const xmlChar *str, size_t len, int mask) {
+    size_t i = 0;
+
+#if defined(XSLT_ESCAPE_SSE2)
+    const __m128i lt = _mm_set1_epi8('<');
+    const __m128i gt = _mm_set1_epi8('>');
+    const __m128i amp = _mm_set1_epi8('&');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i quot = _mm_set1_epi8('"');
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i tab = _mm_set1_epi8('\t');
+
+    while (i + 16 <= len) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (str + i));
+        __m128i m;
+
+        m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, lt),
+                                      _mm_cmpeq_epi8(v, gt)),
+                         _mm_or_si128(_mm_cmpeq_epi8(v, amp),
+                                      _mm_cmpeq_epi8(v, cr)));
+        if (mask & XSLT_ESC_ATTR)
+            m = _mm_or_si128(m,
+                    _mm_or_si128(_mm_cmpeq_epi8(v, quot),
+                                 _mm_or_si128(_mm_cmpeq_epi8(v, nl),
+                                              _mm_cmpeq_epi8(v, tab))));
+        if (mask & XSLT_ESC_UTF8)
+            m = _mm_or_si128(m, v);
+        if (_mm_movemask_epi8(m) != 0)
+            break;
+        i += 16;
+    }
+#elif defined(XSLT_ESCAPE_NEON)
+    const uint8x16_t lt = vdupq_n_u8('<');
+    const uint8x16_t gt = vdupq_n_u8('>');
+    const uint8x16_t amp = vdupq_n_u8('&');
+    const uint8x16_t cr = vdupq_n_u8('\r');
+    const uint8x16_t quot = vdupq_n_u8('"');
+    const uint8x16_t nl = vdupq_n_u8('\n');
+    const uint8x16_t tab = vdupq_n_u8('\t');
+    const uint8x16_t high = vdupq_n_u8(0x80);
+
+    while (i + 16 <= len) {
+        uint8x16_t v = vld1q_u8(str + i);
+        uint8x16_t m;
+
+        m = vorrq_u8(vorrq_u8(vceqq_u8(v, lt), vceqq_u8(v, gt)),
+                     vorrq_u8(vceqq_u8(v, amp), vceqq_u8(v, cr)));
+        if (mask & XSLT_ESC_ATTR)
+            m = vorrq_u8(m, vorrq_u8(vceqq_u8(v, quot),
+                                     vorrq_u8(vceqq_u8(v, nl),
+                                              vceqq_u8(v, tab))));
+        if (mask & XSLT_ESC_UTF8)
+            m = vorrq_u8(m, vcgeq_u8(v, high));
+        if (vmaxvq_u8(m) != 0)
+            break;
+        i += 16;
+    }
+#endif
+
+    /*
+     * The tail, or the block holding the first character to escape.
+     */
+    while ((i < len) && ((xsltEscapeTable[str[i]] & mask) == 0))
+        i++;
+    return(i);
+}
+
+/*
+ * The literal text of templates is escaped when the stylesheet is
+ * compiled. Result text nodes copied from it share its address in the
+ * dictionary, which is immutable, so their escaped form is found by
+ * address without looking at the text again.
+ */
+typedef struct _xsltEscapedText xsltEscapedText;
+struct _xsltEscapedText {
+    const xmlChar *text;	/* the text, in the stylesheet dictionary */
+    const xmlChar *escaped;	/* its escaped form */
+    size_t len;			/* the length of @escaped */
+};
+
+typedef struct _xsltEscapedTexts xsltEscapedTexts;
+typedef xsltEscapedTexts *xsltEscapedTextsPtr;
+struct _xsltEscapedTexts {
+    int size;			/* a power of 2 */
+    int nb;
+    xsltEscapedText *tab;
+};
+
+#define XSLT_ESCAPED_HASH(text, size) \
+    ((int) ((((size_t) (text)) >> 3) * 2654435761u) & ((size) - 1))
+
+static xsltEscapedText *
+xsltLookupEscapedText(xsltEscapedTextsPtr texts, const xmlChar *text) {
+    int i;
+
+    if (texts->size == 0)
+        return(NULL);
+    i = XSLT_ESCAPED_HASH(text, texts->size);
+    while (texts->tab[i].text != NULL) {
+        if (texts->tab[i].text == text)
+            return(&texts->tab[i]);
+        i = (i + 1) & (texts->size - 1);
+    }
+    return(NULL);
+}
+
+static int
+xsltGrowEscapedTexts(xsltEscapedTextsPtr texts) {
+    xsltEscapedText *old = texts->tab, *tab;
+    int size = texts->size ? texts->size * 2 : 64;
+    int i, j;
+
+    tab = (xsltEscapedText *) xmlMalloc(size * sizeof(xsltEscapedText));
+    if (tab == NULL)
+        return(-1);
+    memset(tab, 0, size * sizeof(xsltEscapedText));
+    for (i = 0; i < texts->size; i++) {
+        if (old[i].text == NULL)
+            continue;
+        j = XSLT_ESCAPED_HASH(old[i].text, size);
+        while (tab[j].text != NULL)
+            j = (j + 1) & (size - 1);
+        tab[j] = old[i];
+    }
+    xmlFree(old);
+    texts->tab = tab;
+    texts->size = size;
+    return(0);
+}
+
+/**
+ * xsltAddEscapedText:
+ * @style:  the stylesheet
+ * @text:  literal text of a template, owned by the dictionary of @style
+ *
+ * Escape @text for the XML output method once, for the result text
+ * nodes copied from it.
+ *
+ * Returns 0 in case of success, -1 in case of error.
+ */
+int
+xsltAddEscapedText(xsltStylesheetPtr style, const xmlChar *text) {
+    xsltEscapedTextsPtr texts;
+    xsltEscapedText *entry;
+    const xmlChar *escaped = text;
+    size_t len, i, run, size;
+    xmlChar *buf = NULL;
+
+    if ((style == NULL) || (text == NULL) || (style->dict == NULL) ||
+        (!xmlDictOwns(style->dict, text)))
+        return(-1);
+    if (style->principal != NULL)
+        style = style->principal;
+
+    texts = (xsltEscapedTextsPtr) XSLT_STYLE_PRIV(style)->escapedTexts;
+    if (texts == NULL) {
+        texts = (xsltEscapedTextsPtr) xmlMalloc(sizeof(xsltEscapedTexts));
+        if (texts == NULL)
+            return(-1);
+        memset(texts, 0, sizeof(xsltEscapedTexts));
+        XSLT_STYLE_PRIV(style)->escapedTexts = texts;
+    }
+    if (xsltLookupEscapedText(texts, text) != NULL)
+        return(0);
+    if ((texts->nb + 1) * 2 > texts->size) {
+        if (xsltGrowEscapedTexts(texts) < 0)
+            return(-1);
+    }
+
+    len = strlen((const char *) text);
+    run = xsltEscapeScan(text, len, XSLT_ESC_TEXT);
+    if (run < len) {
+        /*
+         * At most 5 bytes per character, for "&#13;".
+         */
+        size = run;
+        for (i = run; i < len; i++) {
+            switch (text[i]) {
+                case '<': case '>': size += 4; break;
+                case '&': case '\r': size += 5; break;
+                default: size += 1; break;
+            }
+        }
+        buf = (xmlChar *) xmlMalloc(size + 1);
+        if (buf == NULL)
+            return(-1);
+        memcpy(buf, text, run);
+        size = run;
+        for (i = run; i < len; i++) {
+            switch (text[i]) {
+                case '<': memcpy(buf + size, "&lt;", 4); size += 4; break;
+                case '>': memcpy(buf + size, "&gt;", 4); size += 4; break;
+                case '&': memcpy(buf + size, "&amp;", 5); size += 5; break;
+                case '\r': memcpy(buf + size, "&#13;", 5); size += 5; break;
+                default: buf[size++] = text[i]; break;
+            }
+        }
+        buf[size] = 0;
+        escaped = xmlDictLookup(style->dict, buf, size);
+        xmlFree(buf);
+        if (escaped == NULL)
+            return(-1);
+        len = size;
+    }
+
+    i = XSLT_ESCAPED_HASH(text, texts->size);
+    while (texts->tab[i].text != NULL)
+        i = (i + 1) & (texts->size - 1);
+    entry = &texts->tab[i];
+    entry->text = text;
+    entry->escaped = escaped;
+    entry->len = len;
+    texts->nb++;
+    return(0);
+}
+
+/**
+ * xsltFreeEscapedTexts:
+ * @style:  the stylesheet
+ *
+ * Free the escaped literal text of @style.
+ */
+void
+xsltFreeEscapedTexts(xsltStylesheetPtr style) {
+    xsltEscapedTextsPtr texts;
+
+    if ((style == NULL) || (XSLT_STYLE_PRIV(style)->escapedTexts == NULL))
+        return;
+    texts = (xsltEscapedTextsPtr) XSLT_STYLE_PRIV(style)->escapedTexts;
+    xmlFree(texts->tab);
+    xmlFree(texts);
+    XSLT_STYLE_PRIV(style)->escapedTexts = NULL;
+}
+
+typedef struct _xsltSerializer xsltSerializer;
+typedef xsltSerializer *xsltSerializerPtr;
+struct _xsltSerializer {
+    xmlOutputBufferPtr buf;
+    const char *encoding;
+    xsltEscapedTextsPtr escaped; /* the literal text of the stylesheet */
+    int noEmpty;		/* write <a></a> rather than <a/> */
+    int len;			/* bytes gathered in chunk */
+    char chunk[4000];
+};
+
+static void
+xsltSerializerFlush(xsltSerializerPtr ser) {
+    if (ser->len > 0) {
+        xmlOutputBufferWrite(ser->buf, ser->len, ser->chunk);
+        ser->len = 0;
+    }
+}
+
+static void
+xsltSerializerWrite(xsltSerializerPtr ser, const char *str, size_t len) {
+    if (len > sizeof(ser->chunk) - ser->len) {
+        xsltSerializerFlush(ser);
+        if (len >= sizeof(ser->chunk)) {
+            while (len > INT_MAX / 2) {
+                xmlOutputBufferWrite(ser->buf, INT_MAX / 2, str);
+                str += INT_MAX / 2;
+                len -= INT_MAX / 2;
+            }
+            xmlOutputBufferWrite(ser->buf, len, str);
+            return;
+        }
+    }
+    memcpy(ser->chunk + ser->len, str, len);
+    ser->len += len;
+}
+
+#define xsltSerializerWriteLit(ser, lit) \
+    xsltSerializerWrite(ser, lit, sizeof(lit) - 1)
+
+static void
+xsltSerializerWriteString(xsltSerializerPtr ser, const xmlChar *str) {
+    if (str != NULL)
+        xsltSerializerWrite(ser, (const char *) str, strlen((const char *) str));
+}
+
+static void
+xsltSerializerWriteQName(xsltSerializerPtr ser, xmlNsPtr ns,
+                         const xmlChar *name) {
+    if ((ns != NULL) && (ns->prefix != NULL)) {
+        xsltSerializerWriteString(ser, ns->prefix);
+        xsltSerializerWriteLit(ser, ":");
+    }
+    xsltSerializerWriteString(ser, name);
+}
+
+/*
+ * Decode the UTF-8 sequence at @cur the way the libxml2 attribute
+ * serializer does. Returns its length, or 0 if it is written as a
+ * single byte reference with a serialization error.
+ */
+static int
+xsltSerializerDecode(const xmlChar *cur, int *val) {
+    int l = 1;
+
+    if (*cur < 0xC0) {
+        return(0);
+    } else if (*cur < 0xE0) {
+        *val = ((cur[0] & 0x1F) << 6) | (cur[1] & 0x3F);
+        l = 2;
+    } else if ((*cur < 0xF0) && (cur[2] != 0)) {
+        *val = ((cur[0] & 0x0F) << 12) | ((cur[1] & 0x3F) << 6) |
+               (cur[2] & 0x3F);
+        l = 3;
+    } else if ((*cur < 0xF8) && (cur[2] != 0) && (cur[3] != 0)) {
+        *val = ((cur[0] & 0x07) << 18) | ((cur[1] & 0x3F) << 12) |
+               ((cur[2] & 0x3F) << 6) | (cur[3] & 0x3F);
+        l = 4;
+    }
+    if ((l == 1) || (!IS_CHAR(*val)))
+        return(0);
+    return(l);
+}
+
+/*
+ * Write the text @str escaped for the XSLT_ESC_* classes in @mask.
+ */
+static void
+xsltSerializerWriteEscaped(xsltSerializerPtr ser, const xmlChar *str,
+                           int mask) {
+    size_t len = strlen((const char *) str);
+    size_t i = 0, run;
+    char ref[16];
+    int val, l;
+
+    while (1) {
+        run = xsltEscapeScan(str + i, len - i, mask);
+        if (run > 0) {
+            xsltSerializerWrite(ser, (const char *) str + i, run);
+            i += run;
+        }
+        if (i >= len)
+            break;
+
+        switch (str[i]) {
+            case '<':
+                xsltSerializerWriteLit(ser, "&lt;");
+                break;
+            case '>':
+                xsltSerializerWriteLit(ser, "&gt;");
+                break;
+            case '&':
+                xsltSerializerWriteLit(ser, "&amp;");
+                break;
+            case '\r':
+                xsltSerializerWriteLit(ser, "&#13;");
+                break;
+            case '"':
+                xsltSerializerWriteLit(ser, "&quot;");
+                break;
+            case '\n':
+                xsltSerializerWriteLit(ser, "&#10;");
+                break;
+            case '\t':
+                xsltSerializerWriteLit(ser, "&#9;");
+                break;
+            default:
+                /*
+                 * Non-ASCII, the caller checked it decodes. A last
+                 * byte is kept as is.
+                 */
+                if (str[i + 1] == 0) {
+                    xsltSerializerWrite(ser, (const char *) str + i, 1);
+                    break;
+                }
+                l = xsltSerializerDecode(str + i, &val);
+                snprintf(ref, sizeof(ref), "&#x%X;", (unsigned) val);
+                xsltSerializerWriteString(ser, (const xmlChar *) ref);
+                i += l;
+                continue;
+        }
+        i++;
+    }
+}
+
+/*
+ * Whether the non-ASCII characters of an attribute value can be
+ * written as character references without serialization errors.
+ */
+static int
+xsltSerializerAttrValid(const xmlChar *str) {
+    int val;
+
+    while (*str != 0) {
+        if ((*str >= 0x80) && (str[1] != 0)) {
+            int l = xsltSerializerDecode(str, &val);
+
+            if (l == 0)
+                return(0);
+            str += l;
+        } else {
+            str++;
+        }
+    }
+    return(1);
+}
+
+/*
+ * Write @str escaped as an attribute value of @doc.
+ */
+static void
+xsltSerializerWriteAttrText(xsltSerializerPtr ser, xmlDocPtr doc,
+                            xmlAttrPtr attr, const xmlChar *str) {
+    int mask = XSLT_ESC_ATTR;
+
+    if ((doc == NULL) || (doc->encoding == NULL)) {
+        mask |= XSLT_ESC_UTF8;
+        if (!xsltSerializerAttrValid(str)) {
+            xmlBufferPtr tmp = xmlBufferCreate();
+
+            /*
+             * Let libxml2 report the broken characters.
+             */
+            if (tmp != NULL) {
+                xmlAttrSerializeTxtContent(tmp, doc, attr, str);
+                xsltSerializerWrite(ser, (const char *) xmlBufferContent(tmp),
+                                    xmlBufferLength(tmp));
+                xmlBufferFree(tmp);
+            }
+            return;
+        }
+    }
+    xsltSerializerWriteEscaped(ser, str, mask);
+}
+
+static void
+xsltSerializeAttr(xsltSerializerPtr ser, xmlAttrPtr attr) {
+    xmlNodePtr child;
+
+    xsltSerializerWriteLit(ser, " ");
+    xsltSerializerWriteQName(ser, attr->ns, attr->name);
+    xsltSerializerWriteLit(ser, "=\"");
+    for (child = attr->children; child != NULL; child = child->next) {
+        if (child->type == XML_TEXT_NODE) {
+            if (child->content != NULL)
+                xsltSerializerWriteAttrText(ser, attr->doc, attr,
+                                            child->content);
+        } else if (child->type == XML_ENTITY_REF_NODE) {
+            xsltSerializerWriteLit(ser, "&");
+            xsltSerializerWriteString(ser, child->name);
+            xsltSerializerWriteLit(ser, ";");
+        }
+    }
+    xsltSerializerWriteLit(ser, "\"");
+}
+
+/*
+ * Whether @cur is written here rather than by xmlNodeDumpOutput().
+ * Namespace names needing escapes are left to libxml2, which quotes
+ * them differently depending on its version.
+ */
+static int
+xsltSerializerHandles(xmlNodePtr cur) {
+    xmlNsPtr ns;
+    size_t len;
+
+    switch (cur->type) {
+        case XML_ELEMENT_NODE:
+            for (ns = cur->nsDef; ns != NULL; ns = ns->next) {
+                if (ns->href == NULL)
+                    continue;
+                len = strlen((const char *) ns->href);
+                if (xsltEscapeScan(ns->href, len,
+                                   XSLT_ESC_ATTR | XSLT_ESC_UTF8) < len)
+                    return(0);
+            }
+            return(1);
+        case XML_TEXT_NODE:
+        case XML_CDATA_SECTION_NODE:
+        case XML_COMMENT_NODE:
+        case XML_PI_NODE:
+        case XML_ENTITY_REF_NODE:
+            return(1);
+        default:
+            return(0);
+    }
+}
+
+static void
+xsltSerializeCDATA(xsltSerializerPtr ser, const xmlChar *content) {
+    const xmlChar *start, *end;
+
+    if ((content == NULL) || (*content == 0)) {
+        xsltSerializerWriteLit(ser, "<![CDATA[]]>");
+        return;
+    }
+    start = end = content;
+    while (*end != 0) {
+        if ((end[0] == ']') && (end[1] == ']') && (end[2] == '>')) {
+            end += 2;
+            xsltSerializerWriteLit(ser, "<![CDATA[");
+            xsltSerializerWrite(ser, (const char *) start, end - start);
+            xsltSerializerWriteLit(ser, "]]>");
+            start = end;
+        }
+        end++;
+    }
+    if (start != end) {
+        xsltSerializerWriteLit(ser, "<![CDATA[");
+        xsltSerializerWriteString(ser, start);
+        xsltSerializerWriteLit(ser, "]]>");
+    }
+}
+
+/*
+ * Serialize the subtree @root like xmlNodeDumpOutput() without
+ * formatting.
+ */
+static void
+xsltSerializeNode(xsltSerializerPtr ser, xmlDocPtr doc, xmlNodePtr root) {
+    xmlNodePtr cur = root;
+    xmlNsPtr ns;
+    xmlAttrPtr attr;
+
+    while (1) {
+        if (!xsltSerializerHandles(cur)) {
+            xsltSerializerFlush(ser);
+            xmlNodeDumpOutput(ser->buf, doc, cur, 0, 0, ser->encoding);
+        } else switch (cur->type) {
+            case XML_ELEMENT_NODE:
+                xsltSerializerWriteLit(ser, "<");
+                xsltSerializerWriteQName(ser, cur->ns, cur->name);
+                for (ns = cur->nsDef; ns != NULL; ns = ns->next) {
+                    if ((ns->type != XML_LOCAL_NAMESPACE) ||
+                        (ns->href == NULL) ||
+                        (xmlStrEqual(ns->prefix, BAD_CAST "xml")))
+                        continue;
+                    if (ns->prefix != NULL) {
+                        xsltSerializerWriteLit(ser, " xmlns:");
+                        xsltSerializerWriteString(ser, ns->prefix);
+                    } else {
+                        xsltSerializerWriteLit(ser, " xmlns");
+                    }
+                    xsltSerializerWriteLit(ser, "=\"");
+                    xsltSerializerWriteString(ser, ns->href);
+                    xsltSerializerWriteLit(ser, "\"");
+                }
+                for (attr = cur->properties; attr != NULL; attr = attr->next)
+                    xsltSerializeAttr(ser, attr);
+                if (cur->children != NULL) {
+                    xsltSerializerWriteLit(ser, ">");
+                    cur = cur->children;
+                    continue;
+                }
+                if (ser->noEmpty) {
+                    xsltSerializerWriteLit(ser, "></");
+                    xsltSerializerWriteQName(ser, cur->ns, cur->name);
+                    xsltSerializerWriteLit(ser, ">");
+                } else {
+                    xsltSerializerWriteLit(ser, "/>");
+                }
+                break;
+            case XML_TEXT_NODE:
+                if (cur->content == NULL)
+                    break;
+                if (cur->name == xmlStringTextNoenc) {
+                    xsltSerializerWriteString(ser, cur->content);
+                } else {
+                    xsltEscapedText *lit = NULL;
+
+                    if (ser->escaped != NULL)
+                        lit = xsltLookupEscapedText(ser->escaped,
+                                                    cur->content);
+                    if (lit != NULL)
+                        xsltSerializerWrite(ser, (const char *) lit->escaped,
+                                            lit->len);
+                    else
+                        xsltSerializerWriteEscaped(ser, cur->content,
+                                                   XSLT_ESC_TEXT);
+                }
+                break;
+            case XML_CDATA_SECTION_NODE:
+                xsltSerializeCDATA(ser, cur->content);
+                break;
+            case XML_COMMENT_NODE:
+                if (cur->content != NULL) {
+                    xsltSerializerWriteLit(ser, "<!--");
+                    xsltSerializerWriteString(ser, cur->content);
+                    xsltSerializerWriteLit(ser, "-->");
+                }
+                break;
+            case XML_PI_NODE:
+                xsltSerializerWriteLit(ser, "<?");
+                xsltSerializerWriteString(ser, cur->name);
+                if (cur->content != NULL) {
+                    xsltSerializerWriteLit(ser, " ");
+                    xsltSerializerWriteString(ser, cur->content);
+                }
+                xsltSerializerWriteLit(ser, "?>");
+                break;
+            case XML_ENTITY_REF_NODE:
+                xsltSerializerWriteLit(ser, "&");
+                xsltSerializerWriteString(ser, cur->name);
+                xsltSerializerWriteLit(ser, ";");
+                break;
+            default:
+                break;
+        }
+
+        /*
+         * Move to the next node, closing the elements left.
+         */
+        while (1) {
+            if (cur == root)
+                return;
+            if (cur->next != NULL) {
+                cur = cur->next;
+                break;
+            }
+            cur = cur->parent;
+            if (cur->type == XML_ELEMENT_NODE) {
+                xsltSerializerWriteLit(ser, "</");
+                xsltSerializerWriteQName(ser, cur->ns, cur->name);
+                xsltSerializerWriteLit(ser, ">");
+            }
+        }
+    }
+}
+
 /**
  * xsltSaveResultTo:
  * @buf:  an output buffer
@@ -1697,6 +2375,26 @@ xsltSaveResultTo(xmlOutputBufferPtr buf, xmlDocPtr result,
 	if (result->children != NULL) {
             xmlNodePtr children = result->children;
 	    xmlNodePtr child = children;
+	    xsltSerializer ser;
+	    int fast;
+
+	    /*
+	     * Serialize here unless the output is formatted, converted
+	     * or written as XHTML by libxml2.
+	     */
+	    fast = ((indent != 1) && (buf->encoder == NULL) &&
+		    ((result->intSubset == NULL) ||
+		     (xmlIsXHTML(result->intSubset->SystemID,
+				 result->intSubset->ExternalID) <= 0)));
+	    if (fast) {
+		ser.buf = buf;
+		ser.encoding = (const char *) encoding;
+		ser.escaped = (xsltEscapedTextsPtr) XSLT_STYLE_PRIV(
+		    (style->principal != NULL) ?
+		    style->principal : style)->escapedTexts;
+		ser.noEmpty = xmlSaveNoEmptyTags;
+		ser.len = 0;
+	    }
 
             /*
              * Hack to avoid quadratic behavior when scanning
@@ -1706,8 +2404,13 @@ xsltSaveResultTo(xmlOutputBufferPtr buf, xmlDocPtr result,
             result->children = NULL;
 
 	    while (child != NULL) {
-		xmlNodeDumpOutput(buf, result, child, 0, (indent == 1),
-			          (const char *) encoding);
+		if (fast) {
+		    xsltSerializeNode(&ser, result, child);
+		    xsltSerializerFlush(&ser);
+		} else {
+		    xmlNodeDumpOutput(buf, result, child, 0, (indent == 1),
+				      (const char *) encoding);
+		}
 		if (indent && ((child->type == XML_DTD_NODE) ||
 		    ((child->type == XML_COMMENT_NODE) &&
 		     (child->next != NULL))))
@@ -1911,6 +2614,135 @@ xsltSaveResultToString(xmlChar **doc_txt_ptr, int * doc_txt_len,
     return 0;
 }
 
+/**
+ * xsltNewMemoryOutputs:
+ *
+ * Create an empty set of in-memory outputs, to be used as the user
+ * data of xsltMemoryOutputSink().
+ *
+ * Returns the new set or NULL in case of error.
+ */
+xsltMemoryOutputsPtr
+xsltNewMemoryOutputs(void) {
+    xsltMemoryOutputsPtr ret;
+
+    ret = (xsltMemoryOutputsPtr) xmlMalloc(sizeof(xsltMemoryOutputs));
+    if (ret == NULL) {
+	xsltGenericError(xsltGenericErrorContext,
+		"xsltNewMemoryOutputs : malloc failed\n");
+	return(NULL);
+    }
+    memset(ret, 0, sizeof(xsltMemoryOutputs));
+    ret->index = xmlHashCreate(0);
+    if (ret->index == NULL) {
+	xmlFree(ret);
+	return(NULL);
+    }
+    return(ret);
+}
+
+/**
+ * xsltFreeMemoryOutputs:
+ * @outputs:  a set of in-memory outputs
+ *
+ * Free the outputs and their content.
+ */
+void
+xsltFreeMemoryOutputs(xsltMemoryOutputsPtr outputs) {
+    xsltMemoryOutputPtr cur, next;
+
+    if (outputs == NULL)
+	return;
+    cur = outputs->first;
+    while (cur != NULL) {
+	next = cur->next;
+	xmlFree(cur->href);
+	if (cur->content != NULL)
+	    xmlFree(cur->content);
+	xmlFree(cur);
+	cur = next;
+    }
+    xmlHashFree(outputs->index, NULL);
+    xmlFree(outputs);
+}
+
+/**
+ * xsltMemoryOutputSink:
+ * @ctx:  the xsltMemoryOutputsPtr collecting the outputs
+ * @href:  the resolved URI of the result document
+ * @res:  the result document
+ * @style:  the output settings
+ * @append:  append to the previous output with the same @href
+ *
+ * An xsltOutputSinkFunc keeping the serialized result documents in
+ * memory. A document replaces the previous one with the same @href
+ * unless @append is set.
+ *
+ * Returns the number of bytes added or -1 in case of error.
+ */
+int
+xsltMemoryOutputSink(void *ctx, const xmlChar *href, xmlDocPtr res,
+		     xsltStylesheetPtr style, int append) {
+    xsltMemoryOutputsPtr outputs = (xsltMemoryOutputsPtr) ctx;
+    xsltMemoryOutputPtr cur;
+    xmlChar *content;
+    int size;
+
+    if ((outputs == NULL) || (href == NULL) || (res == NULL) ||
+        (style == NULL))
+	return(-1);
+    if (xsltSaveResultToString(&content, &size, res, style) < 0)
+	return(-1);
+
+    cur = (xsltMemoryOutputPtr) xmlHashLookup(outputs->index, href);
+    if (cur == NULL) {
+	cur = (xsltMemoryOutputPtr) xmlMalloc(sizeof(xsltMemoryOutput));
+	if (cur == NULL)
+	    goto error;
+	memset(cur, 0, sizeof(xsltMemoryOutput));
+	cur->href = xmlStrdup(href);
+	if ((cur->href == NULL) ||
+	    (xmlHashAddEntry(outputs->index, cur->href, cur) < 0)) {
+	    if (cur->href != NULL)
+		xmlFree(cur->href);
+	    xmlFree(cur);
+	    goto error;
+	}
+	if (outputs->last == NULL)
+	    outputs->first = cur;
+	else
+	    outputs->last->next = cur;
+	outputs->last = cur;
+    }
+
+    if ((append) && (cur->content != NULL)) {
+	xmlChar *tmp;
+
+	if (content == NULL)
+	    return(0);
+	if (size > INT_MAX - 1 - cur->size)
+	    goto error;
+	tmp = (xmlChar *) xmlRealloc(cur->content, cur->size + size + 1);
+	if (tmp == NULL)
+	    goto error;
+	memcpy(tmp + cur->size, content, size + 1);
+	cur->content = tmp;
+	cur->size += size;
+	xmlFree(content);
+    } else {
+	if (cur->content != NULL)
+	    xmlFree(cur->content);
+	cur->content = content;
+	cur->size = size;
+    }
+    return(size);
+
+error:
+    if (content != NULL)
+	xmlFree(content);
+    return(-1);
+}
+
 /**
  * xsltGetSourceNodeFlags:
  * @node:  Node from source document
@@ -2307,6 +3139,12 @@ xsltSaveProfiling(xsltTransformContextPtr ctxt, FILE *output) {
 	totalt += templ1->time;
     }
     fprintf(output, "\n%30s%26s %6d %6ld\n", "Total", "", total, totalt);
+    if (XSLT_CTXT_PRIV(ctxt)->hoistEvals > 0)
+	fprintf(output, "\n%d context-independent expressions: "
+		"%lu evaluations, %lu reused\n",
+		XSLT_STYLE_PRIV(ctxt->style)->hoistNr,
+		XSLT_CTXT_PRIV(ctxt)->hoistEvals,
+		XSLT_CTXT_PRIV(ctxt)->hoistReuses);
 
 
     /* print call graph */
@@ -2432,6 +3270,9 @@ xsltSaveProfiling(xsltTransformContextPtr ctxt, FILE *output) {
  * <template rank="3" match="item1" name=""
  *         mode="" calls="5" time="17" average="3"/>
  * </profile>
+ * If context-independent expressions were evaluated, the profile element
+ * carries their number of evaluations in "hoisted" and the number of times
+ * their value was reused in "reused".
  * The caller will need to free up the returned tree with xmlFreeDoc()
  *
  * Returns the xmlDocPtr corresponding to the result or NULL if not available.
@@ -2501,6 +3342,12 @@ xsltGetProfileInformation(xsltTransformContextPtr ctxt)
     ret = xmlNewDoc(BAD_CAST "1.0");
     root = xmlNewDocNode(ret, NULL, BAD_CAST "profile", NULL);
     xmlDocSetRootElement(ret, root);
+    if (XSLT_CTXT_PRIV(ctxt)->hoistEvals > 0) {
+        snprintf(buf, sizeof(buf), "%lu", XSLT_CTXT_PRIV(ctxt)->hoistEvals);
+        xmlSetProp(root, BAD_CAST "hoisted", BAD_CAST buf);
+        snprintf(buf, sizeof(buf), "%lu", XSLT_CTXT_PRIV(ctxt)->hoistReuses);
+        xmlSetProp(root, BAD_CAST "reused", BAD_CAST buf);
+    }
 
     for (i = 0; i < nb; i++) {
         child = xmlNewChild(root, NULL, BAD_CAST "template", NULL);
@@ -2533,6 +3380,390 @@ xsltGetProfileInformation(xsltTransformContextPtr ctxt)
  *									*
  ************************************************************************/
 
+#define IS_XPATH_TOKEN_CHAR(c) \
+    ((((c) >= 'a') && ((c) <= 'z')) || (((c) >= 'A') && ((c) <= 'Z')) || \
+     (((c) >= '0') && ((c) <= '9')) || ((c) == '_') || ((c) == '-') || \
+     ((c) == '.') || ((c) == ':') || ((c) >= 0x80))
+
+/*
+ * Matches the token @tok at @cur and skips the blanks following it.
+ * Returns the position after the blanks or NULL.
+ */
+static const xmlChar *
+xsltMatchXPathToken(const xmlChar *cur, const char *tok) {
+    int len = strlen(tok);
+
+    if (cur == NULL)
+	return(NULL);
+    while (IS_BLANK_CH(*cur))
+	cur++;
+    if (xmlStrncmp(cur, BAD_CAST tok, len) != 0)
+	return(NULL);
+    cur += len;
+    if ((IS_XPATH_TOKEN_CHAR(cur[-1])) && (IS_XPATH_TOKEN_CHAR(*cur)))
+	return(NULL);
+    while (IS_BLANK_CH(*cur))
+	cur++;
+    return(cur);
+}
+
+/*
+ * Skips an argument of a function call at @cur. Returns the position
+ * of the ',' or ')' ending it or NULL.
+ */
+static const xmlChar *
+xsltSkipXPathArgument(const xmlChar *cur) {
+    xmlChar stack[32];
+    int depth = 0;
+
+    while (*cur != 0) {
+	if ((*cur == '"') || (*cur == '\'')) {
+	    cur = xmlStrchr(cur + 1, *cur);
+	    if (cur == NULL)
+		return(NULL);
+	} else if ((*cur == '(') || (*cur == '[')) {
+	    if (depth >= 32)
+		return(NULL);
+	    stack[depth++] = (*cur == '(') ? ')' : ']';
+	} else if ((*cur == ')') || (*cur == ']')) {
+	    if (depth == 0)
+		return((*cur == ')') ? cur : NULL);
+	    if (stack[--depth] != *cur)
+		return(NULL);
+	} else if ((*cur == ',') && (depth == 0)) {
+	    return(cur);
+	}
+	cur++;
+    }
+    return(NULL);
+}
+
+/*
+ * Matches key(name, value)[1] at @cur, setting @args and @len to the
+ * text of the arguments.
+ */
+static const xmlChar *
+xsltMatchFirstOfKey(const xmlChar *cur, const xmlChar **args, int *len) {
+    const xmlChar *end;
+
+    cur = xsltMatchXPathToken(cur, "key");
+    cur = xsltMatchXPathToken(cur, "(");
+    if (cur == NULL)
+	return(NULL);
+    end = xsltSkipXPathArgument(cur);
+    if ((end == NULL) || (*end != ',') || (end == cur))
+	return(NULL);
+    end = xsltSkipXPathArgument(end + 1);
+    if ((end == NULL) || (*end != ')'))
+	return(NULL);
+    *args = cur;
+    *len = end - cur;
+    cur = xsltMatchXPathToken(end, ")");
+    cur = xsltMatchXPathToken(cur, "[");
+    cur = xsltMatchXPathToken(cur, "1");
+    return(xsltMatchXPathToken(cur, "]"));
+}
+
+/* Matches generate-id() or generate-id(.) at @cur. */
+static const xmlChar *
+xsltMatchContextId(const xmlChar *cur) {
+    const xmlChar *tmp;
+
+    cur = xsltMatchXPathToken(cur, "generate-id");
+    cur = xsltMatchXPathToken(cur, "(");
+    if (cur == NULL)
+	return(NULL);
+    tmp = xsltMatchXPathToken(cur, ".");
+    if (tmp != NULL)
+	cur = tmp;
+    return(xsltMatchXPathToken(cur, ")"));
+}
+
+/*
+ * Matches the test of the Muenchian grouping method at @cur, setting
+ * @empty to its value when the key has no node.
+ */
+static const xmlChar *
+xsltMatchGroupingTest(const xmlChar *cur, const xmlChar **args, int *len,
+		      int *empty) {
+    const xmlChar *tmp;
+
+    /* generate-id() = generate-id(key(name, value)[1]) */
+    *empty = 0;
+    tmp = xsltMatchContextId(cur);
+    tmp = xsltMatchXPathToken(tmp, "=");
+    tmp = xsltMatchXPathToken(tmp, "generate-id");
+    tmp = xsltMatchXPathToken(tmp, "(");
+    if (tmp != NULL)
+	tmp = xsltMatchFirstOfKey(tmp, args, len);
+    tmp = xsltMatchXPathToken(tmp, ")");
+    if (tmp != NULL)
+	return(tmp);
+
+    /* generate-id(key(name, value)[1]) = generate-id() */
+    tmp = xsltMatchXPathToken(cur, "generate-id");
+    tmp = xsltMatchXPathToken(tmp, "(");
+    if (tmp != NULL)
+	tmp = xsltMatchFirstOfKey(tmp, args, len);
+    tmp = xsltMatchXPathToken(tmp, ")");
+    tmp = xsltMatchXPathToken(tmp, "=");
+    if (tmp != NULL)
+	tmp = xsltMatchContextId(tmp);
+    if (tmp != NULL)
+	return(tmp);
+
+    /* count(. | key(name, value)[1]) = 1 */
+    *empty = 1;
+    tmp = xsltMatchXPathToken(cur, "count");
+    tmp = xsltMatchXPathToken(tmp, "(");
+    tmp = xsltMatchXPathToken(tmp, ".");
+    tmp = xsltMatchXPathToken(tmp, "|");
+    if (tmp != NULL)
+	tmp = xsltMatchFirstOfKey(tmp, args, len);
+    tmp = xsltMatchXPathToken(tmp, ")");
+    tmp = xsltMatchXPathToken(tmp, "=");
+    tmp = xsltMatchXPathToken(tmp, "1");
+    if (tmp != NULL)
+	return(tmp);
+
+    /* count(key(name, value)[1] | .) = 1 */
+    tmp = xsltMatchXPathToken(cur, "count");
+    tmp = xsltMatchXPathToken(tmp, "(");
+    if (tmp != NULL)
+	tmp = xsltMatchFirstOfKey(tmp, args, len);
+    tmp = xsltMatchXPathToken(tmp, "|");
+    tmp = xsltMatchXPathToken(tmp, ".");
+    tmp = xsltMatchXPathToken(tmp, ")");
+    tmp = xsltMatchXPathToken(tmp, "=");
+    return(xsltMatchXPathToken(tmp, "1"));
+}
+
+/*
+ * Matches generate-id(arg) at @cur, setting @arg and @len to the text
+ * of the argument, which is empty for the context node.
+ */
+static const xmlChar *
+xsltMatchIdCall(const xmlChar *cur, const xmlChar **arg, int *len) {
+    const xmlChar *end;
+
+    cur = xsltMatchXPathToken(cur, "generate-id");
+    cur = xsltMatchXPathToken(cur, "(");
+    if (cur == NULL)
+	return(NULL);
+    end = xsltSkipXPathArgument(cur);
+    if ((end == NULL) || (*end != ')'))
+	return(NULL);
+    *arg = cur;
+    *len = end - cur;
+    return(xsltMatchXPathToken(end, ")"));
+}
+
+/*
+ * Matches generate-id(a) = generate-id(b) or generate-id(a) !=
+ * generate-id(b) at @cur, setting @negate for the latter.
+ */
+static const xmlChar *
+xsltMatchIdComparison(const xmlChar *cur, const xmlChar **arg1, int *len1,
+		      const xmlChar **arg2, int *len2, int *negate) {
+    const xmlChar *tmp;
+
+    cur = xsltMatchIdCall(cur, arg1, len1);
+    if (cur == NULL)
+	return(NULL);
+    *negate = 0;
+    tmp = xsltMatchXPathToken(cur, "!=");
+    if (tmp != NULL)
+	*negate = 1;
+    else
+	tmp = xsltMatchXPathToken(cur, "=");
+    return(xsltMatchIdCall(tmp, arg2, len2));
+}
+
+/*
+ * Appends the argument of generate-id() to @buf, with the context node
+ * made explicit.
+ */
+static int
+xsltAddIdArgument(xmlBufferPtr buf, const xmlChar *arg, int len) {
+    while ((len > 0) && (IS_BLANK_CH(arg[len - 1])))
+	len--;
+    if (len == 0)
+	return(xmlBufferCat(buf, BAD_CAST "."));
+    return(xmlBufferAdd(buf, arg, len));
+}
+
+/**
+ * xsltRewriteGroupingTests:
+ * @str:  an XPath expression
+ *
+ * Recognizes the test of the Muenchian grouping method, as a whole
+ * expression or as a whole predicate:
+ *   generate-id() = generate-id(key(name, value)[1])
+ *   count(. | key(name, value)[1]) = 1
+ * and rewrites it to libxslt:first-in-key(name, value, empty), which
+ * checks the context node against the key table without building the
+ * node-set of the key nor any identifier. Other comparisons of
+ * generate-id(a) and generate-id(b) with = or != are rewritten to
+ * libxslt:same-id(a, b), which compares the nodes themselves. The
+ * functions are called with XSLT_REWRITE_PREFIX.
+ *
+ * Returns the rewritten expression or NULL if there is nothing to
+ *         rewrite.
+ */
+static xmlChar *
+xsltRewriteGroupingTests(const xmlChar *str) {
+    const xmlChar *cur = str, *copied = str, *start, *end, *args, *args2;
+    xmlBufferPtr buf = NULL;
+    int len, len2, empty, negate, grouping, res = 0;
+    xmlChar *ret;
+
+    if (xmlStrstr(str, BAD_CAST "generate-id") == NULL) {
+	if (xmlStrstr(str, BAD_CAST "key") == NULL)
+	    return(NULL);
+    }
+
+    while (*cur != 0) {
+	if ((cur == str) || (*cur == '[')) {
+	    start = (*cur == '[') ? cur + 1 : cur;
+	    grouping = 1;
+	    end = xsltMatchGroupingTest(start, &args, &len, &empty);
+	    if (end == NULL) {
+		grouping = 0;
+		end = xsltMatchIdComparison(start, &args, &len, &args2, &len2,
+					    &negate);
+	    }
+	    if ((end != NULL) &&
+		(((*cur == '[') && (*end == ']')) ||
+		 ((*cur != '[') && (*end == 0)))) {
+		if (buf == NULL) {
+		    buf = xmlBufferCreate();
+		    if (buf == NULL)
+			return(NULL);
+		}
+		res |= xmlBufferAdd(buf, copied, start - copied);
+		if (grouping) {
+		    res |= xmlBufferCat(buf,
+			BAD_CAST XSLT_REWRITE_PREFIX ":first-in-key(");
+		    res |= xmlBufferAdd(buf, args, len);
+		    res |= xmlBufferCat(buf, empty ? BAD_CAST ", true())" :
+						   BAD_CAST ", false())");
+		} else {
+		    if (negate)
+			res |= xmlBufferCat(buf, BAD_CAST "not(");
+		    res |= xmlBufferCat(buf,
+			BAD_CAST XSLT_REWRITE_PREFIX ":same-id(");
+		    res |= xsltAddIdArgument(buf, args, len);
+		    res |= xmlBufferCat(buf, BAD_CAST ", ");
+		    res |= xsltAddIdArgument(buf, args2, len2);
+		    res |= xmlBufferCat(buf, negate ? BAD_CAST "))" :
+						    BAD_CAST ")");
+		}
+		copied = cur = end;
+		continue;
+	    }
+	}
+	if ((*cur == '"') || (*cur == '\'')) {
+	    cur = xmlStrchr(cur + 1, *cur);
+	    if (cur == NULL)
+		break;
+	}
+	cur++;
+    }
+    if (buf == NULL)
+	return(NULL);
+    res |= xmlBufferCat(buf, copied);
+    ret = (res == 0) ? xmlBufferDetach(buf) : NULL;
+    xmlBufferFree(buf);
+    return(ret);
+}
+
+/**
+ * xsltNoteXPathCalls:
+ * @style:  the stylesheet
+ * @expr:  an XPath expression of @style
+ *
+ * Flags the principal stylesheet of @style if @expr calls
+ * generate-id(), which numbers the nodes of the transformation, or a
+ * prefixed evaluate() function like dyn:evaluate(), whose argument
+ * can't be checked. libxml2 only resolves the functions when an
+ * expression is evaluated, so the calls are found in the text given
+ * to the compiler. The literals are skipped.
+ */
+void
+xsltNoteXPathCalls(xsltStylesheetPtr style, const xmlChar *expr) {
+    const xmlChar *cur = expr, *start;
+    int len;
+
+    if ((style == NULL) || (style->principal == NULL) || (expr == NULL))
+	return;
+    while (*cur != 0) {
+	if ((*cur == '"') || (*cur == '\'')) {
+	    cur = xmlStrchr(cur + 1, *cur);
+	    if (cur == NULL)
+		return;
+	    cur++;
+	    continue;
+	}
+	if ((! IS_XPATH_TOKEN_CHAR(*cur)) || (*cur == ':')) {
+	    cur++;
+	    continue;
+	}
+	start = cur;
+	while (IS_XPATH_TOKEN_CHAR(*cur))
+	    cur++;
+	len = cur - start;
+	if (xsltMatchXPathToken(cur, "(") == NULL)
+	    continue;
+	if (((len == 11) &&
+	     (xmlStrncmp(start, BAD_CAST "generate-id", 11) == 0)) ||
+	    ((len > 9) &&
+	     (xmlStrncmp(cur - 9, BAD_CAST ":evaluate", 9) == 0))) {
+	    XSLT_STYLE_PRIV(style->principal)->unsafeCalls = 1;
+	    return;
+	}
+    }
+}
+
+/**
+ * xsltNoteAVTCalls:
+ * @style:  the stylesheet
+ * @avt:  an attribute value template of @style
+ *
+ * Like xsltNoteXPathCalls() for the expressions of an attribute value
+ * template evaluated at run time.
+ */
+void
+xsltNoteAVTCalls(xsltStylesheetPtr style, const xmlChar *avt) {
+    const xmlChar *cur = avt, *start;
+    xmlChar *expr;
+
+    if ((style == NULL) || (avt == NULL))
+	return;
+    while ((cur = xmlStrchr(cur, '{')) != NULL) {
+	if (cur[1] == '{') {
+	    cur += 2;
+	    continue;
+	}
+	start = ++cur;
+	while ((*cur != 0) && (*cur != '}')) {
+	    if ((*cur == '"') || (*cur == '\'')) {
+		cur = xmlStrchr(cur + 1, *cur);
+		if (cur == NULL)
+		    return;
+	    }
+	    cur++;
+	}
+	expr = xmlStrndup(start, cur - start);
+	if (expr != NULL) {
+	    xsltNoteXPathCalls(style, expr);
+	    xmlFree(expr);
+	}
+	if (*cur == 0)
+	    return;
+	cur++;
+    }
+}
+
 /**
  * xsltXPathCompileFlags:
  * @style: the stylesheet
@@ -2548,6 +3779,7 @@ xmlXPathCompExprPtr
 xsltXPathCompileFlags(xsltStylesheetPtr style, const xmlChar *str, int flags) {
     xmlXPathContextPtr xpathCtxt;
     xmlXPathCompExprPtr ret;
+    xmlChar *rewritten;
 
     if (style != NULL) {
         xpathCtxt = style->principal->xpathCtxt;
@@ -2562,9 +3794,21 @@ xsltXPathCompileFlags(xsltStylesheetPtr style, const xmlChar *str, int flags) {
     xpathCtxt->flags = flags;
 
     /*
-    * Compile the expression.
+    * Compile the expression, with the tests of the Muenchian grouping
+    * method and the comparisons of generate-id() rewritten to compare
+    * nodes directly.
     */
-    ret = xmlXPathCtxtCompile(xpathCtxt, str);
+    rewritten = (style != NULL) ? xsltRewriteGroupingTests(str) : NULL;
+    if (rewritten != NULL) {
+	ret = xmlXPathCtxtCompile(xpathCtxt, rewritten);
+	if (ret != NULL)
+	    xsltNoteXPathCalls(style, rewritten);
+	xmlFree(rewritten);
+    } else {
+	ret = xmlXPathCtxtCompile(xpathCtxt, str);
+	if ((ret != NULL) && (style != NULL))
+	    xsltNoteXPathCalls(style, str);
+    }
 
     if (style == NULL) {
 	xmlXPathFreeContext(xpathCtxt);
@@ -245,6 +245,37 @@ XSLTPUBFUN int XSLTCALL
                                                  xmlDocPtr result,
                                                  xsltStylesheetPtr style);
 
+/*
+ * In-memory output of secondary result documents.
+ */
+typedef struct _xsltMemoryOutput xsltMemoryOutput;
+typedef xsltMemoryOutput *xsltMemoryOutputPtr;
+struct _xsltMemoryOutput {
+    xsltMemoryOutputPtr next;	/* the next output in creation order */
+    xmlChar *href;		/* the resolved URI of the document */
+    xmlChar *content;		/* the serialized document */
+    int size;			/* the size of @content */
+};
+
+typedef struct _xsltMemoryOutputs xsltMemoryOutputs;
+typedef xsltMemoryOutputs *xsltMemoryOutputsPtr;
+struct _xsltMemoryOutputs {
+    xsltMemoryOutputPtr first;	/* the outputs in creation order */
+    xsltMemoryOutputPtr last;
+    xmlHashTablePtr index;	/* the outputs by href */
+};
+
+XSLTPUBFUN xsltMemoryOutputsPtr XSLTCALL
+		xsltNewMemoryOutputs		(void);
+XSLTPUBFUN void XSLTCALL
+		xsltFreeMemoryOutputs		(xsltMemoryOutputsPtr outputs);
+XSLTPUBFUN int XSLTCALL
+		xsltMemoryOutputSink		(void *ctx,
+						 const xmlChar *href,
+						 xmlDocPtr res,
+						 xsltStylesheetPtr style,
+						 int append);
+
 /*
  * XPath interface
  */
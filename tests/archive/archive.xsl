@@ -0,0 +1,18 @@
+<xsl:stylesheet version="1.1"
+    xmlns:xsl="http://www.w3.org/1999/XSL/Transform">
+
+<!-- names leaving the extraction directory are kept out of archives -->
+
+<xsl:output method="text"/>
+
+<xsl:template match="/">
+  <xsl:for-each select="doc/file">
+    <xsl:document href="{.}" method="text">
+      <xsl:value-of select="."/>
+      <xsl:text>&#10;</xsl:text>
+    </xsl:document>
+  </xsl:for-each>
+  <xsl:text>done&#10;</xsl:text>
+</xsl:template>
+
+</xsl:stylesheet>
@@ -0,0 +1,28 @@
+<xsl:stylesheet version="1.1"
+    xmlns:xsl="http://www.w3.org/1999/XSL/Transform">
+
+<!-- appends to the same file under different names keep their order -->
+
+<xsl:output method="text"/>
+
+<xsl:template match="/">
+  <xsl:document href="append-path.tmp" method="text">
+    <xsl:text>start&#10;</xsl:text>
+  </xsl:document>
+  <xsl:for-each select="//line">
+    <xsl:variable name="href">
+      <xsl:choose>
+        <xsl:when test="position() mod 3 = 0">append-path.tmp</xsl:when>
+        <xsl:when test="position() mod 3 = 1">./append-path.tmp</xsl:when>
+        <xsl:otherwise>../async/append-path.tmp</xsl:otherwise>
+      </xsl:choose>
+    </xsl:variable>
+    <xsl:document href="{$href}" method="text" append="yes">
+      <xsl:value-of select="."/>
+      <xsl:text>&#10;</xsl:text>
+    </xsl:document>
+  </xsl:for-each>
+  <xsl:text>done&#10;</xsl:text>
+</xsl:template>
+
+</xsl:stylesheet>
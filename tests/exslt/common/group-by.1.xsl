@@ -0,0 +1,14 @@
+<xsl:stylesheet version="1.0" xmlns:xsl="http://www.w3.org/1999/XSL/Transform"
+    xmlns:exsl="http://exslt.org/common" exclude-result-prefixes="exsl">
+<xsl:template match="/">
+  <r>
+    <xsl:for-each select="exsl:group-by(//emp, '@dept')">
+      <dept name="{@dept}" first="{@name}"/>
+    </xsl:for-each>
+    <xsl:for-each select="exsl:group-by(//emp, 'count(skill)')">
+      <skills n="{count(skill)}" first="{@name}"/>
+    </xsl:for-each>
+    <n><xsl:value-of select="count(exsl:group-by(/.., '1'))"/></n>
+  </r>
+</xsl:template>
+</xsl:stylesheet>
@@ -0,0 +1,22 @@
+<xsl:stylesheet xmlns:xsl="http://www.w3.org/1999/XSL/Transform" version="1.0"
+ xmlns:dyn="http://exslt.org/dynamic"
+ exclude-result-prefixes="dyn"
+>
+<xsl:output indent="yes"/>
+
+<xsl:template match="/doc">
+<result>
+  <xsl:apply-templates select="item"/>
+  <map xmlns:p="urn:b"><xsl:copy-of select="dyn:map(item, 'string(p:x)')"/></map>
+  <map><xsl:value-of select="sum(dyn:map(item, 'count(*)'))"/></map>
+</result>
+</xsl:template>
+
+<xsl:template match="item">
+  <item>
+    <first xmlns:p="urn:a"><xsl:value-of select="dyn:evaluate(@expr)"/></first>
+    <second xmlns:p="urn:b"><xsl:value-of select="dyn:evaluate(@expr)"/></second>
+    <nested><xsl:value-of select="dyn:evaluate(&quot;dyn:evaluate('count(*) * 2')&quot;)"/></nested>
+  </item>
+</xsl:template>
+</xsl:stylesheet>
@@ -0,0 +1,36 @@
+<xsl:stylesheet version="1.0" xmlns:xsl="http://www.w3.org/1999/XSL/Transform"
+    xmlns:func="http://exslt.org/functions" xmlns:my="urn:my"
+    xmlns:libxslt="http://xmlsoft.org/XSLT/namespace"
+    extension-element-prefixes="func" exclude-result-prefixes="my libxslt">
+<xsl:output method="xml" indent="no"/>
+<func:function name="my:fib" libxslt:memoize="yes">
+  <xsl:param name="n"/>
+  <xsl:choose>
+    <xsl:when test="$n &lt; 2"><func:result select="$n"/></xsl:when>
+    <xsl:otherwise><func:result select="my:fib($n - 1) + my:fib($n - 2)"/></xsl:otherwise>
+  </xsl:choose>
+</func:function>
+<func:function name="my:label" libxslt:memoize="yes">
+  <xsl:param name="code"/>
+  <xsl:param name="upper" select="false()"/>
+  <xsl:choose>
+    <xsl:when test="$upper"><func:result select="translate(concat('L-', $code), 'abcdefghijklmnopqrstuvwxyz', 'ABCDEFGHIJKLMNOPQRSTUVWXYZ')"/></xsl:when>
+    <xsl:otherwise><func:result select="concat('l-', $code)"/></xsl:otherwise>
+  </xsl:choose>
+</func:function>
+<func:function name="my:names" libxslt:memoize="yes">
+  <xsl:param name="nodes"/>
+  <func:result select="count($nodes)"/>
+</func:function>
+<func:function name="my:tree" libxslt:memoize="yes">
+  <xsl:param name="s"/>
+  <func:result><t><xsl:value-of select="$s"/></t></func:result>
+</func:function>
+<xsl:template match="/">
+  <r fib="{my:fib(20)}">
+    <xsl:for-each select="//i">
+      <i a="{my:label(@c)}" b="{my:label(@c, true())}" c="{my:label(number(@c))}" n="{my:names(//i[@c = current()/@c])}" t="{string(my:tree(@c))}"/>
+    </xsl:for-each>
+  </r>
+</xsl:template>
+</xsl:stylesheet>
@@ -0,0 +1,13 @@
+<xsl:stylesheet version="1.0" xmlns:xsl="http://www.w3.org/1999/XSL/Transform"
+    xmlns:func="http://exslt.org/functions" xmlns:my="urn:my"
+    xmlns:libxslt="http://xmlsoft.org/XSLT/namespace"
+    extension-element-prefixes="func" exclude-result-prefixes="my libxslt">
+<xsl:output method="xml" indent="no"/>
+<func:function name="my:square" libxslt:memoize="true">
+  <xsl:param name="n"/>
+  <func:result select="$n * $n"/>
+</func:function>
+<xsl:template match="/">
+  <r><xsl:value-of select="my:square(7)"/></r>
+</xsl:template>
+</xsl:stylesheet>
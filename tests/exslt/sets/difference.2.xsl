@@ -0,0 +1,34 @@
+<?xml version="1.0"?>
+
+<xsl:stylesheet xmlns:xsl="http://www.w3.org/1999/XSL/Transform" version="1.0"
+xmlns:set="http://exslt.org/sets" >
+
+<!-- Test set:intersection, difference on large node-sets -->
+
+<xsl:variable name="even" select="//n[@v mod 2 = 0]"/>
+<xsl:variable name="third" select="//n[@v mod 3 = 0]"/>
+<xsl:variable name="ns1" select="//n[@v &lt; 200]/namespace::*"/>
+<xsl:variable name="ns2" select="//n[@v &gt;= 150]/namespace::*[name() != 'xml']"/>
+
+<xsl:template match="/">
+  <out>
+    Multiples of 6 above 250:
+    <xsl:for-each select="set:intersection($even, $third)[@v &gt; 250]">
+         <xsl:value-of select="@v"/>;
+    </xsl:for-each>
+    Even and not multiples of 3:
+    <xsl:value-of select="count(set:difference($even, $third))"/>
+    Last even and not multiple of 3:
+    <xsl:value-of select="set:difference($even, $third)[last()]/@v"/>
+    Odd multiples of 3:
+    <xsl:value-of select="count(set:difference($third, $even))"/>
+    Namespaces in both:
+    <xsl:value-of select="count(set:intersection($ns1, $ns2))"/>
+    Namespaces only in the first:
+    <xsl:value-of select="count(set:difference($ns1, $ns2))"/>
+    Same nodes:
+    <xsl:value-of select="count(set:intersection(//n, //n))"/>
+  </out>
+</xsl:template>
+
+</xsl:stylesheet>
@@ -0,0 +1,38 @@
+<?xml version="1.0"?>
+
+<xsl:stylesheet xmlns:xsl="http://www.w3.org/1999/XSL/Transform" version="1.0"
+xmlns:set="http://exslt.org/sets" >
+
+<!-- Test set:distinct with a key expression -->
+
+<xsl:template match="/">
+  <out>
+  <by-value>:
+    <xsl:for-each select="set:distinct(//city)">
+          <xsl:value-of select="@name"/>;
+    </xsl:for-each>
+  </by-value>
+  <by-country>:
+    <xsl:for-each select="set:distinct(//city, '@country')">
+          <xsl:value-of select="@name"/>;
+    </xsl:for-each>
+  </by-country>
+  <by-initial>:
+    <xsl:for-each select="set:distinct(//city, 'substring(@name, 1, 1)')">
+          <xsl:value-of select="@name"/>;
+    </xsl:for-each>
+  </by-initial>
+  <by-position>:
+    <xsl:for-each select="set:distinct(//city, 'position() mod 3')">
+          <xsl:value-of select="@name"/>;
+    </xsl:for-each>
+  </by-position>
+  <descendants>:
+    <xsl:for-each select="set:distinct(//*[@name])">
+          <xsl:value-of select="@name"/>;
+    </xsl:for-each>
+  </descendants>
+  </out>
+</xsl:template>
+
+</xsl:stylesheet>
@@ -0,0 +1,48 @@
+<?xml version="1.0"?>
+<xsl:stylesheet version="1.0"
+    xmlns:xsl="http://www.w3.org/1999/XSL/Transform"
+    xmlns:str="http://exslt.org/strings"
+    xmlns:exsl="http://exslt.org/common"
+    exclude-result-prefixes="str exsl">
+
+<xsl:variable name="global">
+	<e f="&lt;" t="&amp;lt;"/>
+	<e f="&lt;&lt;" t="&#xab;"/>
+	<e f="&amp;" t="&amp;amp;"/>
+</xsl:variable>
+
+<xsl:template match="/">
+	<xsl:variable name="from" select="doc/map/e/@f"/>
+	<xsl:variable name="to" select="doc/map/e/@t"/>
+	<xsl:variable name="g" select="exsl:node-set($global)/e"/>
+<out>
+	<xsl:for-each select="doc/s">
+	<test>
+	<xsl:value-of select="str:replace(., $from, $to)"/>
+	</test>
+	<test>
+	<xsl:value-of select="str:replace(., $from, $to[position() &gt; 2])"/>
+	</test>
+	<test>
+	<xsl:value-of select="str:replace(., $g/@f, $g/@t)"/>
+	</test>
+	<xsl:call-template name="local">
+		<xsl:with-param name="s" select="."/>
+	</xsl:call-template>
+	</xsl:for-each>
+</out>
+</xsl:template>
+
+<xsl:template name="local">
+	<xsl:param name="s"/>
+	<xsl:variable name="local">
+		<e f="a" t="[{string-length($s)}]"/>
+		<e f="ab" t="(ab)"/>
+	</xsl:variable>
+	<xsl:variable name="l" select="exsl:node-set($local)/e"/>
+	<test>
+	<xsl:value-of select="str:replace($s, $l/@f, $l/@t)"/>
+	</test>
+</xsl:template>
+
+</xsl:stylesheet>
@@ -0,0 +1,17 @@
+<?xml version="1.0"?>
+<xsl:stylesheet version="1.0"
+    xmlns:xsl="http://www.w3.org/1999/XSL/Transform"
+    xmlns:str="http://exslt.org/strings"
+    exclude-result-prefixes="str">
+
+<xsl:template match="/">
+<out>
+	<xsl:for-each select="doc/s">
+	<test delimiter="{@d}">
+	<xsl:copy-of select="str:split(., @d)"/>
+	</test>
+	</xsl:for-each>
+</out>
+</xsl:template>
+
+</xsl:stylesheet>
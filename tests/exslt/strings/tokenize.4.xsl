@@ -0,0 +1,23 @@
+<?xml version="1.0"?>
+<xsl:stylesheet version="1.0"
+    xmlns:xsl="http://www.w3.org/1999/XSL/Transform"
+    xmlns:str="http://exslt.org/strings"
+    exclude-result-prefixes="str">
+
+<xsl:template match="/">
+<out>
+	<xsl:for-each select="doc/s">
+	<test delimiters="{@d}">
+	<xsl:copy-of select="str:tokenize(., @d)"/>
+	</test>
+	</xsl:for-each>
+	<test delimiters="">
+	<xsl:copy-of select="str:tokenize('h&#xe9;&#x20ac;!', '')"/>
+	</test>
+	<test>
+	<xsl:copy-of select="str:tokenize('&#9;one two&#10;&#13;three  ')"/>
+	</test>
+</out>
+</xsl:template>
+
+</xsl:stylesheet>
@@ -0,0 +1,38 @@
+<xsl:stylesheet version="1.0"
+    xmlns:xsl="http://www.w3.org/1999/XSL/Transform">
+
+<xsl:output method="xml" indent="no"/>
+
+<xsl:template match="/">
+  <out>
+    <xsl:apply-templates select="doc/list"/>
+  </out>
+</xsl:template>
+
+<xsl:template match="list">
+  <plain><xsl:apply-templates/></plain>
+  <param>
+    <xsl:apply-templates mode="p">
+      <xsl:with-param name="tag" select="concat('#', @id)"/>
+    </xsl:apply-templates>
+  </param>
+  <sorted>
+    <xsl:apply-templates select="*">
+      <xsl:sort select="." order="descending"/>
+    </xsl:apply-templates>
+  </sorted>
+  <empty><xsl:apply-templates select="empty"/><xsl:apply-templates/></empty>
+</xsl:template>
+
+<xsl:template match="*">[<xsl:value-of select="concat(name(), ':', position(), '/', last())"/>]</xsl:template>
+<xsl:template match="comment()">(c<xsl:value-of select="position()"/>)</xsl:template>
+<xsl:template match="processing-instruction()">(pi<xsl:value-of select="position()"/>)</xsl:template>
+<xsl:template match="text()">(t<xsl:value-of select="position()"/>)</xsl:template>
+
+<xsl:template match="*" mode="p">
+  <xsl:param name="tag"/>
+  <xsl:value-of select="concat($tag, '-', ., ':', position(), '/', last(), ' ')"/>
+</xsl:template>
+<xsl:template match="text()|comment()|processing-instruction()" mode="p"/>
+
+</xsl:stylesheet>
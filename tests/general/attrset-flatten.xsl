@@ -0,0 +1,26 @@
+<xsl:stylesheet version="1.0" xmlns:xsl="http://www.w3.org/1999/XSL/Transform" xmlns:p="urn:p" xmlns:q="urn:q">
+<xsl:import href="attrset-flatten.imp"/>
+<xsl:output method="xml" indent="no"/>
+<xsl:attribute-set name="base" use-attribute-sets="extra">
+  <xsl:attribute name="class">main</xsl:attribute>
+  <xsl:attribute name="id"><xsl:value-of select="concat('n', .)"/></xsl:attribute>
+</xsl:attribute-set>
+<xsl:attribute-set name="extra">
+  <xsl:attribute name="{concat('dyn', position())}">d</xsl:attribute>
+  <xsl:attribute name="p:x">px</xsl:attribute>
+  <xsl:attribute name="y" namespace="urn:y">ny</xsl:attribute>
+  <xsl:attribute name="xml:space">preserve</xsl:attribute>
+  <xsl:attribute name="n" namespace="{string(@ns)}">dynns</xsl:attribute>
+  <xsl:attribute name="empty"/>
+</xsl:attribute-set>
+<xsl:template match="/">
+  <r>
+    <xsl:for-each select="//i">
+      <a xsl:use-attribute-sets="base q:qual missing" class="lre" title="{.}"/>
+      <xsl:element name="e" use-attribute-sets=" extra  q:qual "/>
+      <xsl:copy use-attribute-sets="base"><xsl:value-of select="."/></xsl:copy>
+      <b xsl:use-attribute-sets="q:qual"><c/><xsl:element name="late" use-attribute-sets="q:qual"/></b>
+    </xsl:for-each>
+  </r>
+</xsl:template>
+</xsl:stylesheet>
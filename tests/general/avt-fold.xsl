@@ -0,0 +1,14 @@
+<xsl:stylesheet version="1.0" xmlns:xsl="http://www.w3.org/1999/XSL/Transform">
+<xsl:output method="xml" indent="no"/>
+<xsl:variable name="g" select="'glob'"/>
+<xsl:variable name="n" select="count(//i)"/>
+<xsl:template match="/">
+  <r>
+  <xsl:for-each select="//i">
+    <a x="{$g}-{.}" y="{'lit'}{1.50}{.5}" z="{{}}{}" w="{concat($g, 'x')}" n="{$n + 1}" v="{position()}"/>
+    <xsl:variable name="g" select="string(.)"/>
+    <b x="{$g}" y="{ $g }"/>
+  </xsl:for-each>
+  </r>
+</xsl:template>
+</xsl:stylesheet>
@@ -3,4 +3,7 @@
     <xsl:element name="elem"/>
   </func:function>
   <xsl:variable name="v" select="abc:f()"/>
+  <xsl:template match="/">
+    <xsl:value-of select="$v"/>
+  </xsl:template>
 </xsl:stylesheet>
@@ -0,0 +1,13 @@
+<xsl:stylesheet version="1.0" xmlns:xsl="http://www.w3.org/1999/XSL/Transform">
+<xsl:output method="text"/>
+<xsl:template match="/">
+  <xsl:call-template name="loop"><xsl:with-param name="n" select="5"/><xsl:with-param name="zz" select="'q'"/></xsl:call-template>
+  <xsl:call-template name="many"><xsl:with-param name="p9" select="9"/><xsl:with-param name="p1" select="1"/><xsl:with-param name="p10">ten</xsl:with-param></xsl:call-template>
+</xsl:template>
+<xsl:template name="loop"><xsl:param name="n"/><xsl:param name="acc" select="'x'"/>
+<xsl:value-of select="concat($n,$acc,' ')"/>
+<xsl:if test="$n &gt; 0"><xsl:call-template name="loop"><xsl:with-param name="acc" select="concat($acc,'y')"/><xsl:with-param name="n" select="$n - 1"/></xsl:call-template></xsl:if>
+</xsl:template>
+<xsl:template name="many"><xsl:param name="p1"/><xsl:param name="p2" select="2"/><xsl:param name="p3"/><xsl:param name="p4"/><xsl:param name="p5"/><xsl:param name="p6"/><xsl:param name="p7"/><xsl:param name="p8"/><xsl:param name="p9"/><xsl:param name="p10"/>
+[<xsl:value-of select="concat($p1,$p2,$p9,$p10)"/>]</xsl:template>
+</xsl:stylesheet>
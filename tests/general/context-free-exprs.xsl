@@ -0,0 +1,34 @@
+<xsl:stylesheet version="1.0"
+    xmlns:xsl="http://www.w3.org/1999/XSL/Transform">
+
+<xsl:output method="text"/>
+
+<xsl:param name="sep" select="','"/>
+<xsl:variable name="config" select="/doc/config"/>
+
+<xsl:template match="/">
+  <xsl:apply-templates select="doc/item"/>
+</xsl:template>
+
+<xsl:template match="item">
+  <!-- evaluated once per transformation -->
+  <xsl:variable name="lang" select="string($config/@lang)"/>
+  <xsl:variable name="first" select="$config/entry[1]"/>
+  <xsl:value-of select="concat($lang, ':')"/>
+  <xsl:value-of select="$first"/>
+  <xsl:value-of select="count($config/entry[position() &gt; 1])"/>
+  <!-- depend on the context -->
+  <xsl:value-of select="concat($sep, @name)"/>
+  <xsl:value-of select="concat($sep, position())"/>
+  <xsl:variable name="sep" select="'|'"/>
+  <xsl:value-of select="concat($sep, string-length())"/>
+  <xsl:for-each select="$config/entry[@key = 'b']">
+    <xsl:value-of select="concat($sep, ., last())"/>
+  </xsl:for-each>
+  <xsl:if test="$config/entry[. = 'x'] or string(.) = 'y'">
+    <xsl:text>!</xsl:text>
+  </xsl:if>
+  <xsl:text>&#10;</xsl:text>
+</xsl:template>
+
+</xsl:stylesheet>
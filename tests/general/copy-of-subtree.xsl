@@ -0,0 +1,21 @@
+<xsl:stylesheet version="1.0"
+    xmlns:xsl="http://www.w3.org/1999/XSL/Transform"
+    xmlns:a="urn:a">
+
+<xsl:variable name="frag">
+  <a:wrap a:id="f" xmlns:b="urn:b">
+    <b:item>one</b:item>
+    <item xml:lang="en">two<![CDATA[ & three]]></item>
+  </a:wrap>
+</xsl:variable>
+
+<xsl:template match="/">
+  <out xmlns="urn:default">
+    <xsl:copy-of select="doc/env"/>
+    <xsl:copy-of select="doc/env/body/*"/>
+    <xsl:copy-of select="$frag"/>
+    <plain><xsl:copy-of select="doc/plain"/></plain>
+  </out>
+</xsl:template>
+
+</xsl:stylesheet>
@@ -0,0 +1,29 @@
+<xsl:stylesheet version="1.0"
+    xmlns:xsl="http://www.w3.org/1999/XSL/Transform">
+
+<!-- the functions which grouping tests are rewritten to are hidden -->
+
+<xsl:output method="text"/>
+
+<xsl:key name="k" match="item" use="@group"/>
+
+<xsl:template match="/">
+  <xsl:value-of select="function-available('libxslt-first-in-key')"/>
+  <xsl:text> </xsl:text>
+  <xsl:value-of select="function-available('libxslt-same-id')"/>
+  <xsl:text> </xsl:text>
+  <xsl:value-of select="function-available('first-in-key')"/>
+  <xsl:text> </xsl:text>
+  <xsl:value-of select="function-available('same-id')"/>
+  <xsl:text>&#10;</xsl:text>
+  <xsl:for-each
+      select="//item[generate-id() = generate-id(key('k', @group)[1])]">
+    <xsl:value-of select="@group"/>
+    <xsl:if test="generate-id(.) != generate-id(//item[last()])">
+      <xsl:text>,</xsl:text>
+    </xsl:if>
+  </xsl:for-each>
+  <xsl:text>&#10;</xsl:text>
+</xsl:template>
+
+</xsl:stylesheet>
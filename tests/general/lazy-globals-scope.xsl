@@ -0,0 +1,16 @@
+<xsl:stylesheet version="1.0"
+    xmlns:xsl="http://www.w3.org/1999/XSL/Transform">
+
+<xsl:output method="text"/>
+
+<xsl:variable name="g" select="$x"/>
+<xsl:variable name="x" select="'global'"/>
+
+<!-- $g is first referenced where a local $x is in scope -->
+<xsl:template match="/">
+  <xsl:variable name="x" select="'local'"/>
+  <xsl:value-of select="concat($g, ' ', $x)"/>
+  <xsl:text>&#10;</xsl:text>
+</xsl:template>
+
+</xsl:stylesheet>
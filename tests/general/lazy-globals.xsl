@@ -0,0 +1,26 @@
+<xsl:stylesheet version="1.0"
+    xmlns:xsl="http://www.w3.org/1999/XSL/Transform">
+
+<xsl:output method="text"/>
+
+<!-- Never referenced: must not be evaluated -->
+<xsl:variable name="unused" select="document('no-such-file.xml')"/>
+
+<xsl:variable name="x" select="'global'"/>
+
+<!-- Evaluated on first reference, in the context of the root node -->
+<xsl:variable name="summary">
+  <xsl:value-of select="concat(name(*), ':', count(//item), ':', $x)"/>
+</xsl:variable>
+
+<xsl:template match="/">
+  <xsl:apply-templates select="doc/item"/>
+</xsl:template>
+
+<xsl:template match="item">
+  <xsl:variable name="x" select="'local'"/>
+  <xsl:value-of select="concat(@id, ' ', $summary, ' ', $x)"/>
+  <xsl:text>&#10;</xsl:text>
+</xsl:template>
+
+</xsl:stylesheet>
@@ -0,0 +1,16 @@
+<xsl:stylesheet version="1.0" xmlns:xsl="http://www.w3.org/1999/XSL/Transform" xmlns:p="urn:p">
+<xsl:output method="text"/>
+<xsl:param name="g" select="'G'"/>
+<xsl:template match="/">
+  <xsl:variable name="a" select="'A'"/>
+  <xsl:variable name="p:b"><xsl:value-of select="$a"/>B</xsl:variable>
+  <xsl:for-each select="//x">
+    <xsl:variable name="c" select="string(@v)"/>
+    <xsl:if test="$c"><xsl:value-of select="$c"/>,</xsl:if>
+    <xsl:value-of select=" $p:b "/>
+  </xsl:for-each>
+  <xsl:value-of select="$g"/>
+  <xsl:call-template name="t"><xsl:with-param name="x" select="$a"/></xsl:call-template>
+</xsl:template>
+<xsl:template name="t"><xsl:param name="x"/><xsl:param name="y" select="$x"/><xsl:variable name="z" select="$y"/>[<xsl:value-of select="$z"/>]</xsl:template>
+</xsl:stylesheet>
@@ -0,0 +1,32 @@
+<xsl:stylesheet version="1.0" xmlns:xsl="http://www.w3.org/1999/XSL/Transform">
+<xsl:output indent="yes"/>
+<xsl:key name="by-dept" match="emp" use="@dept"/>
+<xsl:key name="by-skill" match="emp" use="skill"/>
+<xsl:template match="/">
+  <r>
+    <xsl:for-each select="//emp[generate-id() = generate-id(key('by-dept', @dept)[1])]">
+      <dept name="{@dept}" count="{count(key('by-dept', @dept))}"/>
+    </xsl:for-each>
+    <xsl:for-each select="//emp[count(. | key('by-dept', @dept)[1]) = 1]">
+      <dept2 name="{@dept}"/>
+    </xsl:for-each>
+    <xsl:for-each select="//emp[generate-id(key('by-dept', string(@dept))[1]) = generate-id(.)]">
+      <dept3 name="{@dept}"/>
+    </xsl:for-each>
+    <xsl:for-each select="//emp/skill[generate-id(..) = generate-id(key('by-skill', .)[1])]">
+      <skill name="{.}"/>
+    </xsl:for-each>
+    <xsl:for-each select="//emp">
+      <xsl:if test="generate-id() = generate-id(key('by-skill', skill)[1])">
+        <first-by-skill name="{@name}"/>
+      </xsl:if>
+      <xsl:if test="count(.|key('none', 'x')[1])=1"><none/></xsl:if>
+    </xsl:for-each>
+    <xsl:apply-templates select="//emp" mode="m"/>
+  </r>
+</xsl:template>
+<xsl:template match="emp[generate-id()=generate-id(key('by-dept',@dept)[1])]" mode="m">
+  <leader name="{@name}"/>
+</xsl:template>
+<xsl:template match="emp" mode="m"/>
+</xsl:stylesheet>
@@ -0,0 +1,14 @@
+<xsl:stylesheet version="1.0" xmlns:xsl="http://www.w3.org/1999/XSL/Transform"
+  xmlns:libxslt="http://xmlsoft.org/XSLT/namespace" xmlns:o="urn:out"
+  libxslt:parallel="4" exclude-result-prefixes="libxslt">
+<xsl:variable name="factor" select="3"/>
+<xsl:variable name="tree"><t>T</t></xsl:variable>
+<xsl:template match="/">
+  <o:out><xsl:apply-templates select="root/rec"/></o:out>
+</xsl:template>
+<xsl:template match="rec">
+  <xsl:variable name="v"><x><xsl:value-of select="@k * $factor"/></x></xsl:variable>
+  <o:r pos="{position()}" last="{last()}" v="{$v}"><xsl:value-of select="name"/>-<xsl:copy-of select="$tree"/></o:r>
+  <xsl:text>&#10;</xsl:text>
+</xsl:template>
+</xsl:stylesheet>
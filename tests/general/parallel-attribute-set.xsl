@@ -0,0 +1,29 @@
+<xsl:stylesheet version="1.0"
+    xmlns:xsl="http://www.w3.org/1999/XSL/Transform">
+
+<!-- generate-id() in an attribute set numbers the nodes in order, even
+     when xsl:apply-templates could run from several threads, and every
+     item does enough work for the chunks to be shared -->
+
+<xsl:output method="xml" indent="yes"/>
+
+<xsl:attribute-set name="ids">
+  <xsl:attribute name="id">
+    <xsl:value-of select="generate-id()"/>
+  </xsl:attribute>
+</xsl:attribute-set>
+
+<xsl:template match="/list">
+  <list note="generate-id is only mentioned here">
+    <xsl:apply-templates select="item"/>
+  </list>
+</xsl:template>
+
+<xsl:template match="item">
+  <entry xsl:use-attribute-sets="ids"
+         pairs="{count(//item[. &lt; current()]/following-sibling::item)}">
+    <xsl:value-of select="."/>
+  </entry>
+</xsl:template>
+
+</xsl:stylesheet>
@@ -0,0 +1,20 @@
+<xsl:stylesheet version="1.0" xmlns:xsl="http://www.w3.org/1999/XSL/Transform"
+  xmlns:libxslt="http://xmlsoft.org/XSLT/namespace"
+  libxslt:parallel="4" exclude-result-prefixes="libxslt">
+<xsl:output method="text"/>
+<!-- Never referenced: must not be evaluated, as in serial mode -->
+<xsl:variable name="unused" select="document('no-such-file.xml')"/>
+<xsl:variable name="recursive" select="$recursive"/>
+<!-- First referenced by the workers -->
+<xsl:variable name="x" select="'global'"/>
+<xsl:variable name="g" select="$x"/>
+<xsl:variable name="count"><xsl:value-of select="count(//rec)"/></xsl:variable>
+<xsl:template match="/">
+  <xsl:apply-templates select="root/rec"/>
+</xsl:template>
+<xsl:template match="rec">
+  <xsl:variable name="x" select="'local'"/>
+  <xsl:value-of select="concat(@k, '/', $count, ' ', $g, ' ', $x)"/>
+  <xsl:text>&#10;</xsl:text>
+</xsl:template>
+</xsl:stylesheet>
@@ -0,0 +1,32 @@
+<xsl:stylesheet version="1.0"
+    xmlns:xsl="http://www.w3.org/1999/XSL/Transform">
+
+<!-- A global variable computed while xsl:apply-templates may run from
+     several threads stops the transformation, and the chunks still
+     being transformed give up -->
+
+<xsl:variable name="deep">
+  <xsl:call-template name="deep"/>
+</xsl:variable>
+
+<xsl:template name="deep">
+  <xsl:call-template name="deep"/>
+  <xsl:text>never</xsl:text>
+</xsl:template>
+
+<xsl:template match="/list">
+  <list>
+    <xsl:apply-templates select="item"/>
+  </list>
+</xsl:template>
+
+<xsl:template match="item">
+  <entry pairs="{count(//item[. &lt; current()]/following-sibling::item)}">
+    <xsl:if test=". = 40">
+      <xsl:value-of select="$deep"/>
+    </xsl:if>
+    <xsl:value-of select="."/>
+  </entry>
+</xsl:template>
+
+</xsl:stylesheet>
@@ -0,0 +1,27 @@
+<xsl:stylesheet version="1.0" xmlns:xsl="http://www.w3.org/1999/XSL/Transform">
+<xsl:output indent="yes"/>
+<xsl:key name="by-id" match="item" use="@id"/>
+<xsl:template match="/">
+  <r>
+    <xsl:for-each select="//item">
+      <item id="{@id}"
+            self="{generate-id() = generate-id(.)}"
+            ref="{generate-id(key('by-id', @ref)) = generate-id()}"
+            not-first="{generate-id() != generate-id(../item)}"
+            parent="{generate-id(sub/..) = generate-id( )}"
+            empty="{generate-id(missing) = generate-id(nothing)}"
+            one-empty="{generate-id(missing) != generate-id(sub)}"
+            attr="{generate-id(@id) = generate-id(key('by-id', @id)/@id)}"
+            ns="{generate-id(namespace::a) = generate-id(../namespace::a)}"
+            ns-b="{generate-id(namespace::b) = generate-id(../namespace::b)}"
+            union="{generate-id(../item[3] | ../item[1]) = generate-id(../item[1])}"/>
+    </xsl:for-each>
+    <xsl:for-each select="//item[generate-id(sub) != generate-id(/doc/item[1]/sub)]">
+      <other id="{@id}"/>
+    </xsl:for-each>
+    <xsl:if test="not(generate-id(/doc) = generate-id(//item))">
+      <ok/>
+    </xsl:if>
+  </r>
+</xsl:template>
+</xsl:stylesheet>
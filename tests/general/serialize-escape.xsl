@@ -0,0 +1,14 @@
+<xsl:stylesheet version="1.0" xmlns:xsl="http://www.w3.org/1999/XSL/Transform">
+<xsl:template match="/">
+  <out xmlns:p="urn:p?a=1&amp;b=2">
+    <xsl:for-each select="doc/s">
+      <a v="{.}" p:w="{string-length(.)}"><xsl:value-of select="."/></a>
+      <xsl:text>&#10;</xsl:text>
+    </xsl:for-each>
+    <xsl:comment> c &lt; </xsl:comment>
+    <xsl:processing-instruction name="pi">x &amp; y</xsl:processing-instruction>
+    <xsl:text disable-output-escaping="yes">&lt;raw/&gt;</xsl:text>
+    <empty/>
+  </out>
+</xsl:template>
+</xsl:stylesheet>
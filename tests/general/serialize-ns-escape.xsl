@@ -0,0 +1,18 @@
+<xsl:stylesheet version="1.0"
+    xmlns:xsl="http://www.w3.org/1999/XSL/Transform">
+
+<!-- Namespace names with characters escaped in attribute values -->
+<xsl:template match="/">
+  <out>
+    <xsl:element name="a:e" namespace="urn:a&amp;b">
+      <xsl:element name="q:e" namespace='urn:q"x'>
+        <xsl:element name="m:e" namespace="urn:m&quot;&apos;&lt;&#9;&#233;">
+          <in attr="&amp;&quot;">text</in>
+        </xsl:element>
+      </xsl:element>
+    </xsl:element>
+    <plain xmlns:p="urn:plain"/>
+  </out>
+</xsl:template>
+
+</xsl:stylesheet>
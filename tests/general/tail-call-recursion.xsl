@@ -0,0 +1,57 @@
+<xsl:stylesheet version="1.0"
+    xmlns:xsl="http://www.w3.org/1999/XSL/Transform"
+    xmlns:exsl="http://exslt.org/common"
+    exclude-result-prefixes="exsl">
+
+<xsl:output method="text"/>
+
+<!-- Recursion deeper than the default template depth limit -->
+<xsl:template name="sum">
+  <xsl:param name="n"/>
+  <xsl:param name="acc" select="0"/>
+  <xsl:choose>
+    <xsl:when test="$n = 0">
+      <xsl:value-of select="$acc"/>
+    </xsl:when>
+    <xsl:otherwise>
+      <xsl:call-template name="sum">
+        <xsl:with-param name="n" select="$n - 1"/>
+        <xsl:with-param name="acc" select="$acc + $n"/>
+      </xsl:call-template>
+    </xsl:otherwise>
+  </xsl:choose>
+</xsl:template>
+
+<!-- Result tree fragments passed on to the next iteration -->
+<xsl:template name="path">
+  <xsl:param name="items"/>
+  <xsl:param name="done"/>
+  <xsl:variable name="acc">
+    <xsl:copy-of select="$done"/>
+    <xsl:value-of select="$items[1]/@id"/>
+  </xsl:variable>
+  <xsl:if test="$items">
+    <xsl:text>[</xsl:text>
+    <xsl:value-of select="$acc"/>
+    <xsl:text>]</xsl:text>
+  </xsl:if>
+  <xsl:if test="count($items) &gt; 1">
+    <xsl:call-template name="path">
+      <xsl:with-param name="items" select="$items[position() &gt; 1]"/>
+      <xsl:with-param name="done" select="exsl:node-set($acc)"/>
+    </xsl:call-template>
+  </xsl:if>
+</xsl:template>
+
+<xsl:template match="/">
+  <xsl:call-template name="sum">
+    <xsl:with-param name="n" select="5000"/>
+  </xsl:call-template>
+  <xsl:text>&#10;</xsl:text>
+  <xsl:call-template name="path">
+    <xsl:with-param name="items" select="//item"/>
+  </xsl:call-template>
+  <xsl:text>&#10;</xsl:text>
+</xsl:template>
+
+</xsl:stylesheet>
@@ -2,4 +2,5 @@
 <xsl:stylesheet xmlns:xsl="http://www.w3.org/1999/XSL/Transform"
                 version="1.0">
   <xsl:variable name="ok"><xsl:value-of select="$ok"/></xsl:variable>
+  <xsl:template match="/"><xsl:value-of select="$ok"/></xsl:template>
 </xsl:stylesheet>
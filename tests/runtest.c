@@ -23,7 +23,9 @@
 #endif
 
 #include <libxml/parser.h>
+#include <libxml/xmlreader.h>
 #include <libxslt/extensions.h>
+#include <libxslt/security.h>
 #include <libxslt/transform.h>
 #include <libxslt/xsltInternals.h>
 #include <libxslt/xsltlocale.h>
@@ -575,17 +577,65 @@ static int compareFileMem(const char *filename, const char *mem, int size) {
  *									*
  ************************************************************************/
 
+/*
+ * Run a transformation with a context set up for a feature. Returns
+ * -1 if the feature isn't available in this build, 0 otherwise.
+ */
+typedef int (*ctxtapply) (xsltTransformContextPtr ctxt, xmlDocPtr doc,
+                          const char **params, xmlDocPtr *res);
+
+/*
+ * The documents produced by the xsl:document instructions of a test,
+ * compared with the .docs file of the test.
+ */
+static char testDocuments[32769];
+static int testDocumentsSize = 0;
+
+static void
+addTestDocument(const char *mem, int size) {
+    if (size > (int) sizeof(testDocuments) - 1 - testDocumentsSize)
+        size = sizeof(testDocuments) - 1 - testDocumentsSize;
+    memcpy(&testDocuments[testDocumentsSize], mem, size);
+    testDocumentsSize += size;
+    testDocuments[testDocumentsSize] = 0;
+}
+
+/*
+ * Collect the file written by the xsl:document instructions of a test,
+ * named after the test with a .tmp suffix, then remove it.
+ */
+static void
+collectDocumentFile(const char *filename) {
+    char *tmpFilename;
+    char bytes[4096];
+    int fd, res;
+
+    tmpFilename = changeSuffix(filename, ".tmp");
+    if (checkTestFile(tmpFilename)) {
+        fd = open(tmpFilename, RD_FLAGS);
+        if (fd >= 0) {
+            while ((res = read(fd, bytes, sizeof(bytes))) > 0)
+                addTestDocument(bytes, res);
+            close(fd);
+        }
+        unlink(tmpFilename);
+    }
+    free(tmpFilename);
+}
+
 static int
-xsltTest(const char *filename, int options) {
+xsltTestCtxt(const char *filename, int options, ctxtapply apply) {
     xsltStylesheetPtr style;
     xmlDocPtr styleDoc, doc = NULL, outDoc;
     xmlChar *out = NULL;
     const char *outSuffix, *errSuffix;
-    char *docFilename, *outFilename, *errFilename;
+    char *docFilename, *outFilename, *errFilename, *docsFilename;
     int outSize = 0;
     int res;
     int ret = 0;
 
+    testDocumentsSize = 0;
+
     if (strcmp(filename, "./test-10-3.xsl") == 0) {
         void *locale = xsltNewLocale(BAD_CAST "de", 0);
         xmlChar *str1, *str2;
@@ -650,7 +700,26 @@ xsltTest(const char *filename, int options) {
             NULL
         };
 
-        outDoc = xsltApplyStylesheet(style, doc, params);
+        if (apply == NULL) {
+            outDoc = xsltApplyStylesheet(style, doc, params);
+        } else {
+            xsltTransformContextPtr ctxt;
+
+            ctxt = xsltNewTransformContext(style, doc);
+            if (ctxt == NULL) {
+                fprintf(stderr, "failed to create a context for %s\n",
+                        filename);
+                fatalError();
+            }
+            outDoc = NULL;
+            res = apply(ctxt, doc, params, &outDoc);
+            xsltFreeTransformContext(ctxt);
+            if (res < 0) {
+                xsltFreeStylesheet(style);
+                xmlFreeDoc(doc);
+                goto out;
+            }
+        }
         if (outDoc == NULL) {
             /* xsltproc compat */
 	    testErrorHandler(NULL, "no result for %s\n", docFilename);
@@ -681,11 +750,227 @@ xsltTest(const char *filename, int options) {
     }
     free(errFilename);
 
+    collectDocumentFile(filename);
+    docsFilename = changeSuffix(filename, ".docs");
+    res = compareFileMem(docsFilename, testDocuments, testDocumentsSize);
+    if (res != 0) {
+        fprintf(stderr, "Documents for %s failed\n", filename);
+        ret = -1;
+    }
+    free(docsFilename);
+
 out:
     free(docFilename);
     return(ret);
 }
 
+static int
+xsltTest(const char *filename, int options) {
+    return(xsltTestCtxt(filename, options, NULL));
+}
+
+static int
+asyncOutputApply(xsltTransformContextPtr ctxt, xmlDocPtr doc,
+                 const char **params, xmlDocPtr *res) {
+    if (xsltSetCtxtAsyncOutput(ctxt, 4, 2) < 0)
+        return(-1);
+    *res = xsltApplyStylesheetUser(ctxt->style, doc, params, NULL, NULL,
+                                   ctxt);
+    return(0);
+}
+
+static int
+asyncOutputTest(const char *filename, int options) {
+    return(xsltTestCtxt(filename, options, asyncOutputApply));
+}
+
+/*
+ * Output sink receiving the documents instead of the filesystem, and
+ * security preferences refusing the names with a "denied" component.
+ */
+static xsltSecurityPrefsPtr outputSinkSec = NULL;
+
+static int
+outputSinkFunc(void *ctx ATTRIBUTE_UNUSED, const xmlChar *href,
+               xmlDocPtr res, xsltStylesheetPtr style, int append) {
+    xmlChar *buf = NULL;
+    int size = 0;
+
+    if (xsltSaveResultToString(&buf, &size, res, style) < 0)
+        return(-1);
+    addTestDocument(append ? "append " : "write ", append ? 7 : 6);
+    addTestDocument((const char *) href, xmlStrlen(href));
+    addTestDocument("\n", 1);
+    if (buf != NULL)
+        addTestDocument((const char *) buf, size);
+    xmlFree(buf);
+    return(size);
+}
+
+static int
+outputSinkCheck(xsltSecurityPrefsPtr sec ATTRIBUTE_UNUSED,
+                xsltTransformContextPtr ctxt ATTRIBUTE_UNUSED,
+                const char *value) {
+    return(strstr(value, "denied/") == NULL);
+}
+
+static int
+outputSinkApply(xsltTransformContextPtr ctxt, xmlDocPtr doc,
+                const char **params, xmlDocPtr *res) {
+    if (outputSinkSec == NULL) {
+        outputSinkSec = xsltNewSecurityPrefs();
+        if (outputSinkSec == NULL)
+            return(-1);
+        xsltSetSecurityPrefs(outputSinkSec, XSLT_SECPREF_WRITE_FILE,
+                             outputSinkCheck);
+        xsltSetSecurityPrefs(outputSinkSec, XSLT_SECPREF_CREATE_DIRECTORY,
+                             xsltSecurityForbid);
+    }
+    if (xsltSetCtxtSecurityPrefs(outputSinkSec, ctxt) < 0)
+        return(-1);
+    xsltSetOutputSinkFunc(ctxt, outputSinkFunc, NULL);
+    *res = xsltApplyStylesheetUser(ctxt->style, doc, params, NULL, NULL,
+                                   ctxt);
+    return(0);
+}
+
+static int
+outputSinkTest(const char *filename, int options) {
+    return(xsltTestCtxt(filename, options, outputSinkApply));
+}
+
+/*
+ * Incremental execution: the transformation runs in small steps, then
+ * a second run is aborted after one step and a third one is freed with
+ * its context after one step. The test extension module only supports
+ * one context at a time, so the aborted runs come last.
+ */
+static int
+stepApply(xsltTransformContextPtr ctxt, xmlDocPtr doc,
+          const char **params, xmlDocPtr *res) {
+    xsltTransformContextPtr aborted;
+    int oldErrorsSize;
+    int status;
+
+    if (xsltTransformBegin(ctxt, doc, params) < 0)
+        return(-1);
+    do {
+        status = xsltTransformStep(ctxt, 16);
+    } while (status == XSLT_STEP_MORE);
+    *res = xsltTransformEnd(ctxt);
+
+    /* Only the messages of the complete run are compared. */
+    oldErrorsSize = testErrorsSize;
+
+    aborted = xsltNewTransformContext(ctxt->style, doc);
+    if (aborted != NULL) {
+        if (xsltTransformBegin(aborted, doc, params) == 0) {
+            xsltTransformStep(aborted, 1);
+            xmlFreeDoc(xsltTransformEnd(aborted));
+        }
+        xsltFreeTransformContext(aborted);
+    }
+
+    aborted = xsltNewTransformContext(ctxt->style, doc);
+    if (aborted != NULL) {
+        if (xsltTransformBegin(aborted, doc, params) == 0)
+            xsltTransformStep(aborted, 1);
+        xsltFreeTransformContext(aborted);
+    }
+
+    testErrorsSize = oldErrorsSize;
+    testErrors[testErrorsSize] = 0;
+    return(0);
+}
+
+static int
+stepTest(const char *filename, int options) {
+    return(xsltTestCtxt(filename, options, stepApply));
+}
+
+/*
+ * Streaming: the input document is read again with a reader and
+ * transformed by a context created for the document of the reader.
+ */
+static int
+streamApply(xsltTransformContextPtr ctxt, xmlDocPtr doc,
+            const char **params, xmlDocPtr *res) {
+#ifdef LIBXML_READER_ENABLED
+    xsltTransformContextPtr streamCtxt;
+    xmlTextReaderPtr reader;
+    xmlNodePtr root;
+    int ret;
+
+    reader = xmlReaderForFile((const char *) doc->URL, NULL,
+                              XSLT_PARSE_OPTIONS);
+    if (reader == NULL)
+        return(-1);
+    do {
+        ret = xmlTextReaderRead(reader);
+    } while ((ret == 1) &&
+             (xmlTextReaderNodeType(reader) != XML_READER_TYPE_ELEMENT));
+    root = xmlTextReaderCurrentNode(reader);
+    if ((ret != 1) || (root == NULL)) {
+        xmlFreeTextReader(reader);
+        return(-1);
+    }
+
+    streamCtxt = xsltNewTransformContext(ctxt->style, root->doc);
+    if (streamCtxt != NULL) {
+        *res = xsltApplyStylesheetStream(ctxt->style, reader, params, NULL,
+                                         NULL, streamCtxt);
+        xsltFreeTransformContext(streamCtxt);
+    }
+    xmlFreeTextReader(reader);
+    return(0);
+#else
+    return(-1);
+#endif
+}
+
+static int
+streamTest(const char *filename, int options) {
+    return(xsltTestCtxt(filename, options, streamApply));
+}
+
+/*
+ * Parallel xsl:apply-templates from 4 workers, as soon as 2 nodes are
+ * selected.
+ */
+static int
+parallelApply(xsltTransformContextPtr ctxt, xmlDocPtr doc,
+              const char **params, xmlDocPtr *res) {
+    if (xsltSetCtxtParallel(ctxt, 4, 2) < 0)
+        return(-1);
+    *res = xsltApplyStylesheetUser(ctxt->style, doc, params, NULL, NULL,
+                                   ctxt);
+    return(0);
+}
+
+static int
+parallelTest(const char *filename, int options) {
+    return(xsltTestCtxt(filename, options, parallelApply));
+}
+
+/*
+ * Deadline: the transformations of the timeout tests run much longer
+ * than 100 milliseconds.
+ */
+static int
+deadlineApply(xsltTransformContextPtr ctxt, xmlDocPtr doc,
+              const char **params, xmlDocPtr *res) {
+    if (xsltSetCtxtDeadline(ctxt, 100) < 0)
+        return(-1);
+    *res = xsltApplyStylesheetUser(ctxt->style, doc, params, NULL, NULL,
+                                   ctxt);
+    return(0);
+}
+
+static int
+deadlineTest(const char *filename, int options) {
+    return(xsltTestCtxt(filename, options, deadlineApply));
+}
+
 /************************************************************************
  *									*
  *			Tests Descriptions				*
@@ -708,6 +993,10 @@ testDesc testDescriptions[] = {
       xsltTest, "general", "./*.xsl", 0 },
     { "general tests without dictionaries",
       xsltTest, "general", "./*.xsl", XML_PARSE_NODICT },
+    { "general tests (incremental)",
+      stepTest, "general", "./*.xsl", 0 },
+    { "general tests (parallel)",
+      parallelTest, "general", "./*.xsl", 0 },
 #if defined(LIBXML_ICONV_ENABLED) || defined(LIBXML_ICU_ENABLED)
     { "encoding tests",
       xsltTest, "encoding", "./*.xsl", 0 },
@@ -744,6 +1033,14 @@ testDesc testDescriptions[] = {
       xsltTest, "exslt/sets", "./*.xsl", 0 },
     { "exslt strings tests",
       xsltTest, "exslt/strings", "./*.xsl", 0 },
+    { "async output tests",
+      asyncOutputTest, "async", "./*.xsl", 0 },
+    { "output sink tests",
+      outputSinkTest, "sink", "./*.xsl", 0 },
+    { "streaming tests",
+      streamTest, "stream", "./*.xsl", 0 },
+    { "timeout tests",
+      deadlineTest, "timeout", "./*.xsl", 0 },
 #ifdef LIBXSLT_DEFAULT_PLUGINS_PATH
     { "plugin tests",
       xsltTest, "plugins", "./*.xsl", 0 },
@@ -890,6 +1187,8 @@ main(int argc ATTRIBUTE_UNUSED, char **argv ATTRIBUTE_UNUSED) {
 	printf("Total %d tests, %d errors\n",
 	       nb_tests, nb_errors);
     }
+    if (outputSinkSec != NULL)
+        xsltFreeSecurityPrefs(outputSinkSec);
     xmlCleanupParser();
 
     return(ret);
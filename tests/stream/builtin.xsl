@@ -0,0 +1,16 @@
+<xsl:stylesheet version="1.0"
+    xmlns:xsl="http://www.w3.org/1999/XSL/Transform">
+
+<!-- the built-in templates descend through the streamed children -->
+
+<xsl:output method="text"/>
+
+<xsl:template match="entry[@level = 'warn']">
+  <xsl:text>WARNING: </xsl:text>
+  <xsl:apply-templates/>
+  <xsl:text>&#10;</xsl:text>
+</xsl:template>
+
+<xsl:template match="entry"/>
+
+</xsl:stylesheet>
@@ -0,0 +1,13 @@
+<xsl:stylesheet version="1.0"
+    xmlns:xsl="http://www.w3.org/1999/XSL/Transform">
+
+<!-- the preceding siblings are already freed when streaming -->
+
+<xsl:output method="text"/>
+
+<xsl:template match="value">
+  <xsl:value-of select=". + sum(preceding-sibling::value)"/>
+  <xsl:text>&#10;</xsl:text>
+</xsl:template>
+
+</xsl:stylesheet>
@@ -0,0 +1,29 @@
+<xsl:stylesheet version="1.0"
+    xmlns:xsl="http://www.w3.org/1999/XSL/Transform">
+
+<!-- each child of the document element is read, transformed and freed -->
+
+<xsl:output method="xml" indent="yes"/>
+
+<xsl:template match="/orders">
+  <summary region="{@region}">
+    <xsl:apply-templates/>
+  </summary>
+</xsl:template>
+
+<xsl:template match="order[@status = 'open']">
+  <open id="{@id}" total="{sum(item/@qty)}">
+    <xsl:for-each select="item">
+      <xsl:if test="position() != 1">,</xsl:if>
+      <xsl:value-of select="."/>
+    </xsl:for-each>
+  </open>
+</xsl:template>
+
+<xsl:template match="order">
+  <closed id="{@id}"/>
+</xsl:template>
+
+<xsl:template match="*"/>
+
+</xsl:stylesheet>
@@ -0,0 +1,35 @@
+<xsl:stylesheet version="1.0"
+    xmlns:xsl="http://www.w3.org/1999/XSL/Transform">
+
+<!-- the deadline stops the computation of a global variable -->
+
+<xsl:output method="text"/>
+
+<xsl:variable name="table">
+  <xsl:for-each select="//a">
+    <xsl:variable name="i" select="position()"/>
+    <xsl:for-each select="//a">
+      <xsl:for-each select="//a">
+        <xsl:for-each select="//a">
+          <xsl:for-each select="//a">
+            <xsl:for-each select="//a">
+              <xsl:for-each select="//a">
+                <xsl:for-each select="//a">
+                  <xsl:for-each select="//a">
+                    <xsl:value-of select="$i * position()"/>
+                  </xsl:for-each>
+                </xsl:for-each>
+              </xsl:for-each>
+            </xsl:for-each>
+          </xsl:for-each>
+        </xsl:for-each>
+      </xsl:for-each>
+    </xsl:for-each>
+  </xsl:for-each>
+</xsl:variable>
+
+<xsl:template match="/">
+  <xsl:value-of select="string-length($table)"/>
+</xsl:template>
+
+</xsl:stylesheet>
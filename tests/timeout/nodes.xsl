@@ -0,0 +1,30 @@
+<xsl:stylesheet version="1.0"
+    xmlns:xsl="http://www.w3.org/1999/XSL/Transform">
+
+<!-- the deadline also stops nested loops over node sets -->
+
+<xsl:output method="text"/>
+
+<xsl:template match="/">
+  <xsl:for-each select="//a">
+    <xsl:for-each select="//a">
+      <xsl:for-each select="//a">
+        <xsl:for-each select="//a">
+          <xsl:for-each select="//a">
+            <xsl:for-each select="//a">
+              <xsl:for-each select="//a">
+                <xsl:for-each select="//a">
+                  <xsl:for-each select="//a">
+                    <xsl:value-of select="position()"/>
+                  </xsl:for-each>
+                </xsl:for-each>
+              </xsl:for-each>
+            </xsl:for-each>
+          </xsl:for-each>
+        </xsl:for-each>
+      </xsl:for-each>
+    </xsl:for-each>
+  </xsl:for-each>
+</xsl:template>
+
+</xsl:stylesheet>
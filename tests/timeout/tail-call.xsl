@@ -0,0 +1,17 @@
+<xsl:stylesheet version="1.0"
+    xmlns:xsl="http://www.w3.org/1999/XSL/Transform">
+
+<!-- infinite recursion in tail position runs in constant stack until the
+     deadline stops it -->
+<xsl:template name="loop">
+  <xsl:param name="n" select="0"/>
+  <xsl:call-template name="loop">
+    <xsl:with-param name="n" select="$n + 1"/>
+  </xsl:call-template>
+</xsl:template>
+
+<xsl:template match="/">
+  <xsl:call-template name="loop"/>
+</xsl:template>
+
+</xsl:stylesheet>
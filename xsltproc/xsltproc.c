@@ -38,6 +38,9 @@
 #include <libxml/parser.h>
 #include <libxml/parserInternals.h>
 #include <libxml/uri.h>
+#ifdef LIBXML_READER_ENABLED
+#include <libxml/xmlreader.h>
+#endif
 
 #include <libxslt/xslt.h>
 #include <libxslt/xsltInternals.h>
@@ -45,6 +48,8 @@
 #include <libxslt/xsltutils.h>
 #include <libxslt/extensions.h>
 #include <libxslt/security.h>
+#include <libxslt/preproc.h>
+#include <libxslt/threadpool.h>
 
 #include <libexslt/exsltconfig.h>
 
@@ -91,6 +96,14 @@ static int nbpaths = 0;
 static char *output = NULL;
 static int errorno = 0;
 static const char *writesubtree = NULL;
+static int writers = 0;
+static int parallel = 0;
+static unsigned long timeout = 0;
+static const char *archive = NULL;
+static xsltMemoryOutputsPtr archiveOutputs = NULL;
+#ifdef LIBXML_READER_ENABLED
+static int stream = 0;
+#endif
 
 /*
  * Entity loading control and customization.
@@ -311,6 +324,117 @@ xsltSubtreeCheck(xsltSecurityPrefsPtr sec ATTRIBUTE_UNUSED,
     return(0);
 }
 
+/*
+ * xsltArchiveNameIsSafe:
+ *
+ * check that a member name stays below the directory where the
+ * archive is extracted
+ */
+static int
+xsltArchiveNameIsSafe(const char *name) {
+    const char *cur = name;
+
+    while (*cur != 0) {
+        if ((cur[0] == '.') && (cur[1] == '.') &&
+            ((cur[2] == '/') || (cur[2] == 0)))
+            return(0);
+        while ((*cur != 0) && (*cur != '/'))
+            cur++;
+        while (*cur == '/')
+            cur++;
+    }
+    return(1);
+}
+
+/*
+ * xsltWriteArchive:
+ *
+ * write the documents collected by xsl:document to a single ustar
+ * archive
+ */
+static int
+xsltWriteArchive(const char *filename, xsltMemoryOutputsPtr outputs) {
+    static const char zeros[1024];
+    xsltMemoryOutputPtr cur;
+    FILE *f;
+    int ret = 0;
+
+    f = fopen(filename, "wb");
+    if (f == NULL) {
+        fprintf(stderr, "unable to open archive %s\n", filename);
+        return(-1);
+    }
+    for (cur = outputs->first; cur != NULL; cur = cur->next) {
+        unsigned char header[512];
+        const char *name = (const char *) cur->href;
+        const char *base;
+        size_t len, prefixLen;
+        unsigned int sum = 0;
+        int j;
+
+        if (strncmp(name, "file://", 7) == 0)
+            name += 7;
+        while (*name == '/')
+            name++;
+        if (!xsltArchiveNameIsSafe(name)) {
+            fprintf(stderr, "unsafe name for archive: %s\n", cur->href);
+            ret = -1;
+            continue;
+        }
+        len = strlen(name);
+        base = name;
+        prefixLen = 0;
+        if (len > 100) {
+            /* split at a slash, ustar allows a 155 bytes prefix */
+            base = name + len - 100;
+            while ((*base != 0) && (*base != '/'))
+                base++;
+            prefixLen = base - name;
+            if ((*base == 0) || (prefixLen > 155)) {
+                fprintf(stderr, "name too long for archive: %s\n",
+                        cur->href);
+                ret = -1;
+                continue;
+            }
+            base++;
+        }
+
+        memset(header, 0, sizeof(header));
+        memcpy(header, base, strlen(base));
+        memcpy(header + 100, "0000644", 7);
+        memcpy(header + 108, "0000000", 7);
+        memcpy(header + 116, "0000000", 7);
+        snprintf((char *) header + 124, 12, "%011o", (unsigned) cur->size);
+        snprintf((char *) header + 136, 12, "%011lo",
+                 (unsigned long) time(NULL));
+        memset(header + 148, ' ', 8);
+        header[156] = '0';
+        memcpy(header + 257, "ustar", 6);
+        memcpy(header + 263, "00", 2);
+        memcpy(header + 345, name, prefixLen);
+        for (j = 0; j < 512; j++)
+            sum += header[j];
+        snprintf((char *) header + 148, 8, "%06o", sum);
+        header[155] = ' ';
+
+        if ((fwrite(header, 1, 512, f) != 512) ||
+            ((cur->size > 0) &&
+             (fwrite(cur->content, 1, cur->size, f) != (size_t) cur->size)) ||
+            (fwrite(zeros, 1, (512 - cur->size % 512) % 512, f) !=
+             (size_t) (512 - cur->size % 512) % 512)) {
+            ret = -1;
+            break;
+        }
+    }
+    if (fwrite(zeros, 1, 1024, f) != 1024)
+        ret = -1;
+    if (fclose(f) != 0)
+        ret = -1;
+    if (ret < 0)
+        fprintf(stderr, "failed to write archive %s\n", filename);
+    return(ret);
+}
+
 static xmlDocPtr
 xsltReadFile(const char *filename) {
     xmlDocPtr doc;
@@ -377,6 +501,16 @@ xsltProcess(xmlDocPtr doc, xsltStylesheetPtr cur, const char *filename) {
 	if (ctxt == NULL)
 	    return;
 	xsltSetCtxtParseOptions(ctxt, options);
+	if ((writers > 0) &&
+	    (xsltSetCtxtAsyncOutput(ctxt, writers, 16) < 0))
+	    fprintf(stderr, "background writers not supported\n");
+	if ((parallel > 1) &&
+	    (xsltSetCtxtParallel(ctxt, parallel, 0) < 0))
+	    fprintf(stderr, "parallel processing not supported\n");
+	if (timeout > 0)
+	    xsltSetCtxtDeadline(ctxt, timeout);
+	if (archiveOutputs != NULL)
+	    xsltSetOutputSinkFunc(ctxt, xsltMemoryOutputSink, archiveOutputs);
 #ifdef LIBXML_XINCLUDE_ENABLED
 	if (xinclude)
 	    ctxt->xinclude = 1;
@@ -446,6 +580,16 @@ xsltProcess(xmlDocPtr doc, xsltStylesheetPtr cur, const char *filename) {
 	if (ctxt == NULL)
 	    return;
 	xsltSetCtxtParseOptions(ctxt, options);
+	if ((writers > 0) &&
+	    (xsltSetCtxtAsyncOutput(ctxt, writers, 16) < 0))
+	    fprintf(stderr, "background writers not supported\n");
+	if ((parallel > 1) &&
+	    (xsltSetCtxtParallel(ctxt, parallel, 0) < 0))
+	    fprintf(stderr, "parallel processing not supported\n");
+	if (timeout > 0)
+	    xsltSetCtxtDeadline(ctxt, timeout);
+	if (archiveOutputs != NULL)
+	    xsltSetOutputSinkFunc(ctxt, xsltMemoryOutputSink, archiveOutputs);
 #ifdef LIBXML_XINCLUDE_ENABLED
 	if (xinclude)
 	    ctxt->xinclude = 1;
@@ -473,6 +617,86 @@ xsltProcess(xmlDocPtr doc, xsltStylesheetPtr cur, const char *filename) {
     }
 }
 
+#ifdef LIBXML_READER_ENABLED
+static void
+xsltProcessStream(xsltStylesheetPtr cur, const char *filename) {
+    xmlTextReaderPtr reader;
+    xmlNodePtr root;
+    xmlDocPtr res;
+    xsltTransformContextPtr ctxt;
+    int ret;
+
+    if (timing)
+        startTimer();
+    if (strcmp(filename, "-") == 0)
+        reader = xmlReaderForFd(STDIN_FILENO, "-", encoding, options);
+    else
+        reader = xmlReaderForFile(filename, encoding, options);
+    if (reader == NULL) {
+        fprintf(stderr, "unable to parse %s\n", filename);
+        errorno = 6;
+        return;
+    }
+    do {
+        ret = xmlTextReaderRead(reader);
+    } while ((ret == 1) &&
+             (xmlTextReaderNodeType(reader) != XML_READER_TYPE_ELEMENT));
+    root = xmlTextReaderCurrentNode(reader);
+    if ((ret != 1) || (root == NULL)) {
+        fprintf(stderr, "unable to parse %s\n", filename);
+        errorno = 6;
+        xmlFreeTextReader(reader);
+        return;
+    }
+
+    ctxt = xsltNewTransformContext(cur, root->doc);
+    if (ctxt == NULL) {
+        xmlFreeTextReader(reader);
+        return;
+    }
+    xsltSetCtxtParseOptions(ctxt, options);
+    if ((writers > 0) &&
+        (xsltSetCtxtAsyncOutput(ctxt, writers, 16) < 0))
+        fprintf(stderr, "background writers not supported\n");
+    if ((parallel > 1) &&
+        (xsltSetCtxtParallel(ctxt, parallel, 0) < 0))
+        fprintf(stderr, "parallel processing not supported\n");
+    if (timeout > 0)
+        xsltSetCtxtDeadline(ctxt, timeout);
+    if (archiveOutputs != NULL)
+        xsltSetOutputSinkFunc(ctxt, xsltMemoryOutputSink, archiveOutputs);
+    ctxt->maxTemplateDepth = xsltMaxDepth;
+    ctxt->maxTemplateVars = xsltMaxVars;
+
+    res = xsltApplyStylesheetStream(cur, reader, params, output,
+                                    profile ? stderr : NULL, ctxt);
+    if (ctxt->state == XSLT_STATE_ERROR)
+        errorno = 9;
+    else if (ctxt->state == XSLT_STATE_STOPPED)
+        errorno = 10;
+    xsltFreeTransformContext(ctxt);
+    xmlFreeTextReader(reader);
+    if (timing)
+        endTimer("Streaming stylesheet");
+    if (res == NULL) {
+        fprintf(stderr, "no result for %s\n", filename);
+        return;
+    }
+
+    if (timing)
+        startTimer();
+    if (output != NULL) {
+        if (xsltSaveResultToFilename(output, res, cur, 0) < 0)
+            errorno = 11;
+    } else if (!noout) {
+        xsltSaveResultToFile(stdout, res, cur);
+    }
+    if (timing)
+        endTimer("Saving result");
+    xmlFreeDoc(res);
+}
+#endif /* LIBXML_READER_ENABLED */
+
 static void usage(const char *name) {
     printf("Usage: %s [options] stylesheet file [file ...]\n", name);
     printf("   Options:\n");
@@ -508,6 +732,13 @@ static void usage(const char *name) {
     printf("\t--nowrite : refuse to write to any file or resource\n");
     printf("\t--nomkdir : refuse to create directories\n");
     printf("\t--writesubtree path : allow file write only with the path subtree\n");
+    printf("\t--writers val : write xsl:document results from val threads\n");
+    printf("\t--parallel val : apply templates to large node sets from val threads\n");
+    printf("\t--timeout ms : stop the transformations running longer than ms milliseconds\n");
+    printf("\t--archive file : save xsl:document results to a tar archive\n");
+#ifdef LIBXML_READER_ENABLED
+    printf("\t--stream : read the documents progressively if the stylesheet allows it\n");
+#endif
 #ifdef LIBXML_CATALOG_ENABLED
     printf("\t--catalogs : use SGML catalogs from $SGML_CATALOG_FILES\n");
     printf("\t             otherwise XML Catalogs starting from \n");
@@ -733,6 +964,59 @@ main(int argc, char **argv)
                 if (value > 0)
                     xsltMaxVars = value;
             }
+        } else if ((!strcmp(argv[i], "-writers")) ||
+                   (!strcmp(argv[i], "--writers"))) {
+            int value;
+
+            i++;
+            if (i == argc) {
+                fprintf(stderr, "number of writers not specified!\n");
+                return (2);
+            }
+
+            if (sscanf(argv[i], "%d", &value) == 1) {
+                if (value > 0)
+                    writers = value;
+            }
+        } else if ((!strcmp(argv[i], "-parallel")) ||
+                   (!strcmp(argv[i], "--parallel"))) {
+            int value;
+
+            i++;
+            if (i == argc) {
+                fprintf(stderr, "number of threads not specified!\n");
+                return (2);
+            }
+
+            if (sscanf(argv[i], "%d", &value) == 1) {
+                if (value > 0)
+                    parallel = value;
+            }
+        } else if ((!strcmp(argv[i], "-timeout")) ||
+                   (!strcmp(argv[i], "--timeout"))) {
+            unsigned long value;
+
+            i++;
+            if (i == argc) {
+                fprintf(stderr, "timeout not specified!\n");
+                return (2);
+            }
+
+            if (sscanf(argv[i], "%lu", &value) == 1)
+                timeout = value;
+        } else if ((!strcmp(argv[i], "-archive")) ||
+                   (!strcmp(argv[i], "--archive"))) {
+            i++;
+            if (i == argc) {
+                fprintf(stderr, "archive file not specified!\n");
+                return (2);
+            }
+            archive = argv[i];
+#ifdef LIBXML_READER_ENABLED
+        } else if ((!strcmp(argv[i], "-stream")) ||
+                   (!strcmp(argv[i], "--stream"))) {
+            stream++;
+#endif
         } else if ((!strcmp(argv[i], "-huge")) ||
                    (!strcmp(argv[i], "--huge"))) {
             options |= XML_PARSE_HUGE;
@@ -763,6 +1047,19 @@ main(int argc, char **argv)
     if (nodict != 0)
         options |= XML_PARSE_NODICT;
 
+    if (archive != NULL) {
+        archiveOutputs = xsltNewMemoryOutputs();
+        if (archiveOutputs == NULL)
+            return (2);
+    }
+
+    /*
+     * Let the thread pool run all the writers and workers at once
+     */
+    if ((writers > 0) || (parallel > 1))
+        xsltSetThreadPool(writers + ((parallel > 1) ? parallel - 1 : 0),
+                          NULL, NULL);
+
     /*
      * Register the EXSLT extensions and the test module
      */
@@ -785,6 +1082,22 @@ main(int argc, char **argv)
             (!strcmp(argv[i], "--seed-rand"))) {
             i++;
             continue;
+        } else if ((!strcmp(argv[i], "-writers")) ||
+            (!strcmp(argv[i], "--writers"))) {
+            i++;
+            continue;
+        } else if ((!strcmp(argv[i], "-parallel")) ||
+            (!strcmp(argv[i], "--parallel"))) {
+            i++;
+            continue;
+        } else if ((!strcmp(argv[i], "-timeout")) ||
+            (!strcmp(argv[i], "--timeout"))) {
+            i++;
+            continue;
+        } else if ((!strcmp(argv[i], "-archive")) ||
+            (!strcmp(argv[i], "--archive"))) {
+            i++;
+            continue;
         } else if ((!strcmp(argv[i], "-o")) ||
                    (!strcmp(argv[i], "-output")) ||
                    (!strcmp(argv[i], "--output"))) {
@@ -866,8 +1179,32 @@ main(int argc, char **argv)
     }
 
 
+#ifdef LIBXML_READER_ENABLED
+    if ((stream) && (cur != NULL) && (cur->errors == 0)) {
+#ifdef LIBXML_HTML_ENABLED
+        if (html)
+            stream = 0;
+#endif
+#ifdef LIBXML_XINCLUDE_ENABLED
+        if (xinclude)
+            stream = 0;
+#endif
+        if ((stream) && (!xsltCheckStreamable(cur))) {
+            fprintf(stderr,
+                    "stylesheet is not streamable, loading the documents\n");
+            stream = 0;
+        }
+    }
+#endif
+
     if ((cur != NULL) && (cur->errors == 0)) {
         for (; i < argc; i++) {
+#ifdef LIBXML_READER_ENABLED
+            if (stream) {
+                xsltProcessStream(cur, argv[i]);
+                continue;
+            }
+#endif
 	    doc = NULL;
             if (timing)
                 startTimer();
@@ -883,6 +1220,11 @@ main(int argc, char **argv)
         }
     }
 done:
+    if (archiveOutputs != NULL) {
+        if (xsltWriteArchive(archive, archiveOutputs) < 0)
+            errorno = 11;
+        xsltFreeMemoryOutputs(archiveOutputs);
+    }
     if (cur != NULL)
         xsltFreeStylesheet(cur);
     for (i = 0;i < nbstrparams;i++)